@@ -0,0 +1,230 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+/*
+ * Seeds the local cache from a freedb database dump.  The dump is a
+ * tar archive that is read from a file or from standard input, so a
+ * compressed dump can be piped through bzcat:
+ *
+ *     bzcat freedb-complete-20060201.tar.bz2 | cddb_import -D ~/.cddbslave
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <cddb/cddb.h>
+
+/* command-line option string */
+#define OPT_STRING ":b:CD:hj:m:qr"
+
+static int quiet = 0;           /* do not list rejected records */
+static int convert = 0;         /* convert record files, no dump */
+static int limit = 0;           /* maximum number of cached records */
+
+/* print usage message */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: cddb_import [OPTION] [DUMP]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Import the records of a freedb database dump (a tar archive) into\n");
+    fprintf(stderr, "the local cache.  Without DUMP, or if DUMP is -, the archive is\n");
+    fprintf(stderr, "read from standard input.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Available options:\n");
+    fprintf(stderr, "  -b <backend>     cache backend [dir|pack] (default = dir)\n");
+    fprintf(stderr, "  -C               copy the record files already in the cache directory\n");
+    fprintf(stderr, "                   into its packed data file instead of reading a dump\n");
+    fprintf(stderr, "  -D <cache dir>   directory for local cache (default = ~/.cddbslave)\n");
+    fprintf(stderr, "  -h               display this help and exit\n");
+    fprintf(stderr, "  -j <threads>     number of import threads (default = one per CPU)\n");
+    fprintf(stderr, "  -m <records>     limit the cache to this many records, the least recently\n");
+    fprintf(stderr, "                   used ones are removed after the import\n");
+    fprintf(stderr, "  -q               quiet, do not list rejected records\n");
+    fprintf(stderr, "  -r               replace records that are already cached\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Example:\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "\tbzcat freedb-complete-20060201.tar.bz2 | cddb_import -D ~/.cddbslave\n");
+}
+
+/* print error message and die */
+static void error_exit(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "error: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(EXIT_FAILURE);
+}
+
+/* list a rejected record */
+static void print_reject(const char *name, cddb_error_t errnum, void *data)
+{
+    if (!quiet) {
+        fprintf(stderr, "rejected %s: %s\n", name, cddb_error_str(errnum));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    cddb_conn_t *conn;
+    cddb_import_t *imp;
+    FILE *fp = stdin;
+    struct timeval start, end;
+    double secs;
+    unsigned long records;
+    int opt, rv, removed = 0;
+
+    conn = cddb_new();
+    if (!conn) {
+        error_exit("unable to create connection structure");
+    }
+    imp = cddb_import_new(conn);
+    if (!imp) {
+        error_exit("unable to create importer");
+    }
+
+    /* process options */
+    opterr = 0;
+    while ((opt = getopt(argc, argv, OPT_STRING)) != -1) {
+        switch (opt) {
+        case 'b':
+            if (strcmp(optarg, "dir") == 0) {
+                cddb_cache_set_backend(conn, CACHE_BACKEND_DIR);
+            } else if (strcmp(optarg, "pack") == 0) {
+                cddb_cache_set_backend(conn, CACHE_BACKEND_PACK);
+            } else {
+                error_exit("-b, invalid cache backend '%s'", optarg);
+            }
+            break;
+        case 'C':
+            convert = 1;
+            break;
+        case 'D':
+            cddb_cache_set_dir(conn, optarg);
+            break;
+        case 'h':
+            usage();
+            exit(EXIT_SUCCESS);
+        case 'j':
+            cddb_import_set_threads(imp, atoi(optarg));
+            break;
+        case 'm':
+            limit = atoi(optarg);
+            if (limit <= 0) {
+                error_exit("-m, invalid record count '%s'", optarg);
+            }
+            /* The limit is not applied while importing, the cache is
+               trimmed afterwards. */
+            cddb_cache_set_limit(conn, 0, limit);
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'r':
+            cddb_import_set_replace(imp, 1);
+            break;
+        case ':':
+            error_exit("missing value for option '-%c'", optopt);
+        default:
+            usage();
+            error_exit("unknown option '-%c'", optopt);
+        }
+    }
+    if (convert) {
+        if (optind < argc) {
+            usage();
+            error_exit("no dump expected with -C");
+        }
+        rv = cddb_cache_convert(conn);
+        if (rv == -1) {
+            error_exit("conversion failed: %s",
+                       cddb_error_str(cddb_errno(conn)));
+        }
+        printf("copied:   %d\n", rv);
+        cddb_import_destroy(imp);
+        cddb_destroy(conn);
+        libcddb_shutdown();
+        return EXIT_SUCCESS;
+    }
+    if (optind < argc - 1) {
+        usage();
+        error_exit("more than one dump specified");
+    }
+    if ((optind == argc - 1) && (strcmp(argv[optind], "-") != 0)) {
+        fp = fopen(argv[optind], "rb");
+        if (!fp) {
+            error_exit("cannot open '%s'", argv[optind]);
+        }
+    }
+
+    cddb_import_set_reject_cb(imp, print_reject, NULL);
+    gettimeofday(&start, NULL);
+    rv = cddb_import_tar(imp, fp);
+    gettimeofday(&end, NULL);
+    if (!rv) {
+        fprintf(stderr, "error: %s\n", cddb_error_str(cddb_errno(conn)));
+    } else if (limit) {
+        removed = cddb_cache_trim(conn);
+        if (removed == -1) {
+            fprintf(stderr, "error: %s\n", cddb_error_str(cddb_errno(conn)));
+            rv = 0;
+        }
+    }
+
+    /* report */
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    if (secs <= 0) {
+        secs = 1e-6;
+    }
+    records = cddb_import_get_count(imp, IMPORT_RECORDS);
+    printf("records:  %lu\n", records);
+    printf("added:    %lu\n", cddb_import_get_count(imp, IMPORT_ADDED));
+    printf("existing: %lu\n", cddb_import_get_count(imp, IMPORT_EXISTING));
+    printf("rejected: %lu\n", cddb_import_get_count(imp, IMPORT_REJECTED));
+    printf("failed:   %lu\n", cddb_import_get_count(imp, IMPORT_FAILED));
+    printf("ignored:  %lu\n", cddb_import_get_count(imp, IMPORT_IGNORED));
+    if (limit) {
+        printf("removed:  %d\n", removed);
+    }
+    printf("time:     %.2f s, %.0f records/s, %.1f MB/s\n", secs,
+           records / secs,
+           cddb_import_get_count(imp, IMPORT_BYTES) / secs / (1024 * 1024));
+
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    cddb_import_destroy(imp);
+    cddb_destroy(conn);
+    libcddb_shutdown();
+    return (rv ? EXIT_SUCCESS : EXIT_FAILURE);
+}
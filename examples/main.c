@@ -29,9 +29,9 @@
 
 #ifdef HAVE_LIBCDIO
 /* Allow -i <device> parameter */
-#define OPT_STRING ":c:D:e:hi:l:p:P:qs:t"
+#define OPT_STRING ":b:c:D:e:hi:l:Lp:P:qrs:t"
 #else
-#define OPT_STRING ":c:D:e:hl:p:P:qs:t"
+#define OPT_STRING ":b:c:D:e:hl:Lp:P:qrs:t"
 #endif
 
 /* other stuff */
@@ -64,6 +64,7 @@ static void usage(void)
     fprintf(stderr, "Usage: cddb_query [OPTION] COMMAND [ARG]\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Available options:\n");
+    fprintf(stderr, "  -b <backend>     local cache backend [dir|pack] (default = dir)\n");
     fprintf(stderr, "  -c <mode>        local cache mode [on|off|only] (default = on)\n");
     fprintf(stderr, "  -D <cache dir>   directory for local cache (default = ~/.cddbslave)\n");
     fprintf(stderr, "  -e <charset>     character set encoding (default = UTF-8, see iconv -l)\n");
@@ -73,9 +74,11 @@ static void usage(void)
 #endif
     fprintf(stderr, "  -l <level>       log level, one of debug, info, warning, error or\n");
     fprintf(stderr, "                   critical (default = warning)\n");
+    fprintf(stderr, "  -L               decode cached records lazily\n");
     fprintf(stderr, "  -p <port>        port of CDDB server (default = 888)\n");
     fprintf(stderr, "  -P <protocol>    server protocol [cddbp|http|proxy] (default = cddbp)\n");
     fprintf(stderr, "  -q               quiet, do not print any error or log messages\n");
+    fprintf(stderr, "  -r               parse records with regular expressions\n");
     fprintf(stderr, "  -s <server>      name of CDDB server (default = freedb.org)\n");
     fprintf(stderr, "  -t               use track times (in seconds) instead of frame offsets\n");
     fprintf(stderr, "\n");
@@ -281,6 +284,21 @@ static void parse_cmdline(int argc, char **argv, cddb_conn_t *conn)
             usage();
             exit(0);
             break;
+        case 'b':               /* local cache backend */
+            if (!*optarg) {
+                error_usage("-b, cache backend missing");
+            }
+            if (strcmp(optarg, "dir") == 0) {
+                /* Store every record in a file of its own (default). */
+                cddb_cache_set_backend(conn, CACHE_BACKEND_DIR);
+            } else if (strcmp(optarg, "pack") == 0) {
+                /* Store all records in a single memory-mapped data
+                   file. */
+                cddb_cache_set_backend(conn, CACHE_BACKEND_PACK);
+            } else {
+                error_usage("-b, invalid cache backend '%s'", optarg);
+            }
+            break;
         case 'c':               /* local cache settings */
             if (!*optarg) {
                 error_usage("-c, cache mode missing");
@@ -341,6 +359,9 @@ static void parse_cmdline(int argc, char **argv, cddb_conn_t *conn)
                 error_usage("-l, invalid log level '%s'", optarg);
             }
             break;
+        case 'L':               /* lazy decoding of cached records */
+            cddb_lazy_read_enable(conn);
+            break;
         case 'p':               /* server port */
             if (!*optarg || *optarg == '\0') {
                 error_usage("-p, server port missing");
@@ -361,6 +382,9 @@ static void parse_cmdline(int argc, char **argv, cddb_conn_t *conn)
             cddb_log_set_level(CDDB_LOG_NONE);
             quiet = 1;
             break;
+        case 'r':               /* regular expression parser */
+            libcddb_set_flags(CDDB_F_REGEX_PARSER);
+            break;
         case 's':               /* server name */
             if (!*optarg) {
                 /* server name missing */
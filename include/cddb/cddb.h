@@ -33,9 +33,11 @@
 #include <cddb/cddb_error.h>
 #include <cddb/cddb_track.h>
 #include <cddb/cddb_disc.h>
+#include <cddb/cddb_parser.h>
 #include <cddb/cddb_site.h>
 #include <cddb/cddb_conn.h>
 #include <cddb/cddb_cmd.h>
+#include <cddb/cddb_import.h>
 #include <cddb/cddb_log.h>
 
 
@@ -58,6 +60,10 @@ typedef enum {
     CDDB_F_NO_TRACK_ARTIST = BIT(1), /**< do not return the disc artist as the
                                        track artist (default), return NULL
                                        instead */
+    CDDB_F_REGEX_PARSER = BIT(2), /**< parse CDDB records and query results
+                                       with the regular expression engine
+                                       instead of the built-in line scanner
+                                       (default) */
 } cddb_flag_t;
 
 /**
@@ -89,6 +95,17 @@ void libcddb_set_flags(unsigned int flags);
  */
 void libcddb_reset_flags(unsigned int flags);
 
+/**
+ * Set for how long resolved server host names are remembered.  The
+ * cache is shared by all connections in the process, so repeated
+ * connects to the same server or proxy do not each need a DNS query.
+ * The default is 60 seconds.
+ *
+ * @param seconds Time-to-live of a cache entry in seconds, zero
+ *                disables the cache.
+ */
+void libcddb_set_dns_cache_ttl(int seconds);
+
 
 #ifdef __cplusplus
     }
@@ -0,0 +1,138 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#ifndef CDDB_ARENA_H
+#define CDDB_ARENA_H 1
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/* --- type definitions */
+
+
+/**
+ * A string arena.  Strings are carved out of a list of growing memory
+ * blocks and are all freed at once when the arena is destroyed.  The
+ * most recently allocated string can be extended in place, which is
+ * how multi-line record fields are built up.
+ */
+typedef struct cddb_arena_s cddb_arena_t;
+
+
+/* --- construction / destruction */
+
+
+/**
+ * Creates a new arena.  The first block is allocated together with
+ * the arena structure itself.
+ *
+ * @return The arena or NULL if memory allocation failed.
+ */
+cddb_arena_t *cddb_arena_new(void);
+
+/**
+ * Free the arena and all strings allocated from it.
+ *
+ * @param a The arena.
+ */
+void cddb_arena_destroy(cddb_arena_t *a);
+
+
+/* --- allocation --- */
+
+
+/**
+ * Allocate room for character data.  No alignment is guaranteed.  If
+ * not all of it is used, give back the rest with #cddb_arena_trim.
+ *
+ * @param a    The arena.
+ * @param size The number of bytes needed.
+ * @return The memory or NULL if memory allocation failed.
+ */
+char *cddb_arena_alloc(cddb_arena_t *a, int size);
+
+/**
+ * Shrink the most recent allocation to a string of the given length
+ * plus its terminating NUL.  Does nothing for older allocations.
+ *
+ * @param a   The arena.
+ * @param s   The string.
+ * @param len The length of the string.
+ */
+void cddb_arena_trim(cddb_arena_t *a, char *s, int len);
+
+/**
+ * Check whether a pointer lies within one of the arena's blocks.
+ *
+ * @param a The arena.
+ * @param p The pointer.
+ * @return TRUE if the memory belongs to the arena, FALSE otherwise.
+ */
+int cddb_arena_owns(const cddb_arena_t *a, const void *p);
+
+
+/* --- string fields --- */
+
+/*
+ * The functions below manage a string field that may live in an
+ * arena or on the heap.  With a NULL arena they fall back to plain
+ * malloc() and free(), so callers do not need two code paths.
+ */
+
+/**
+ * Free a string field and set it to NULL.  Heap strings are freed,
+ * arena strings are only given back if they were the last
+ * allocation.
+ *
+ * @param a The arena or NULL.
+ * @param s The string field.
+ */
+void cddb_arena_str_free(cddb_arena_t *a, char **s);
+
+/**
+ * Replace a string field with a copy of another string.
+ *
+ * @param a   The arena or NULL.
+ * @param s   The string field.
+ * @param src The new value, or NULL to clear the field.
+ */
+void cddb_arena_str_set(cddb_arena_t *a, char **s, const char *src);
+
+/**
+ * Append a number of characters to a string field.  The source does
+ * not need to be NUL terminated.  If the field is the most recent
+ * arena allocation it is extended in place.
+ *
+ * @param a   The arena or NULL.
+ * @param s   The string field.
+ * @param src The characters to append.
+ * @param len The number of characters.
+ */
+void cddb_arena_str_append(cddb_arena_t *a, char **s, const char *src, int len);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif /* CDDB_ARENA_H */
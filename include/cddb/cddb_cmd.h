@@ -78,6 +78,26 @@
  */
 int cddb_read(cddb_conn_t *c, cddb_disc_t *disc);
 
+/**
+ * Retrieve a number of disc records in one go.  Discs found in the
+ * local cache are read from there.  For the others, when using
+ * CDDBP, the read commands are sent back to back without waiting for
+ * the previous response, which saves a round trip to the server per
+ * disc.  Over HTTP the discs are read one after the other.
+ *
+ * Every disc should satisfy the requirements of #cddb_read.  If some
+ * discs could not be read, the error number is set to the error of
+ * the last one that failed.
+ *
+ * @param c    The CDDB connection structure.
+ * @param discs An array of non-null CDDB disc structures.
+ * @param n    The number of discs in the array.
+ * @param rcs  An array of n integers that receives the result of
+ *             #cddb_read for each disc, or NULL.
+ * @return The number of discs read successfully or -1 on error.
+ */
+int cddb_read_many(cddb_conn_t *c, cddb_disc_t *discs[], int n, int *rcs);
+
 /**
  * Query the CDDB database for a list of possible disc matches.  This
  * function requires that the disc ID and disc length of the provided
@@ -178,6 +198,118 @@ int cddb_write(cddb_conn_t *c, cddb_disc_t *disc);
 int cddb_sites(cddb_conn_t *c);
 
 
+/* --- asynchronous commands --- */
+
+
+/**
+ * Kind of socket readiness an asynchronous command is waiting for.
+ */
+typedef enum {
+    CDDB_IO_NONE = 0,           /**< nothing, the command has finished */
+    CDDB_IO_READ = 1,           /**< wait until the socket is readable */
+    CDDB_IO_WRITE = 2           /**< wait until the socket is writable */
+} cddb_io_t;
+
+/**
+ * Start retrieving a disc record without blocking the calling thread.
+ * This is the asynchronous version of #cddb_read and has the same
+ * requirements on the disc structure.
+ *
+ * When the record is found in the local cache the command finishes
+ * right away.  Otherwise the caller should wait on the file
+ * descriptor returned by #cddb_conn_fd for the readiness reported by
+ * #cddb_conn_wants and call #cddb_conn_process each time it is
+ * signalled, until #cddb_conn_process returns 1.  The outcome is then
+ * available through #cddb_conn_result and #cddb_errno.
+ *
+ * The server host name is resolved in a separate thread unless it is
+ * found in the DNS cache; without thread support it is resolved
+ * inside this function.  An event loop should also arm a timer for
+ * the time returned by #cddb_conn_time_left and call
+ * #cddb_conn_process when it expires, so that the command can time
+ * out.  The connection and disc structures should not be used for
+ * anything else while the command is running.
+ *
+ * @param c    The CDDB connection structure.
+ * @param disc A non-null CDDB disc structure.
+ * @return 1 if the command is running or already finished
+ *         successfully, 0 if it failed right away.
+ */
+int cddb_read_start(cddb_conn_t *c, cddb_disc_t *disc);
+
+/**
+ * Start querying the CDDB database without blocking the calling
+ * thread.  This is the asynchronous version of #cddb_query and has
+ * the same requirements on the disc structure.  See #cddb_read_start
+ * for how to drive the command to completion.  Once finished,
+ * #cddb_conn_result returns the number of matches (or -1) and other
+ * matches can be retrieved with #cddb_query_next.
+ *
+ * @param c    The CDDB connection structure.
+ * @param disc A non-null CDDB disc structure.
+ * @return 1 if the command is running or already finished
+ *         successfully, 0 if it failed right away.
+ */
+int cddb_query_start(cddb_conn_t *c, cddb_disc_t *disc);
+
+/**
+ * Returns the socket used by the running asynchronous command, for
+ * registering with the event loop of the caller.  While the server
+ * host name is being resolved, this is a descriptor that becomes
+ * readable when the look-up has finished.  The descriptor can change
+ * while the command is running, so it should be fetched again after
+ * each call to #cddb_conn_process.
+ *
+ * @param c The CDDB connection structure.
+ * @return The descriptor or -1 if not connected.
+ */
+int cddb_conn_fd(cddb_conn_t *c);
+
+/**
+ * Returns the socket readiness the running asynchronous command is
+ * waiting for.
+ *
+ * @param c The CDDB connection structure.
+ */
+cddb_io_t cddb_conn_wants(cddb_conn_t *c);
+
+/**
+ * Returns the number of milliseconds after which the running
+ * asynchronous command times out, for arming a timer in the event
+ * loop of the caller.  When the timer expires, #cddb_conn_process
+ * should be called even if the descriptor is not ready.  The time
+ * covers the host name look-up (see #cddb_set_timeout_ms) while the
+ * name is being resolved, and the whole command if a total time out
+ * has been set (see #cddb_set_total_timeout_ms).
+ *
+ * @param c The CDDB connection structure.
+ * @return The number of milliseconds left, 0 if the time is up or -1
+ *         if no time out applies.
+ */
+int cddb_conn_time_left(cddb_conn_t *c);
+
+/**
+ * Advance the running asynchronous command after the socket became
+ * ready or the time returned by #cddb_conn_time_left ran out.  This
+ * function does not block; if not enough data is available yet it
+ * returns and should be called again later.
+ *
+ * @param c The CDDB connection structure.
+ * @return 1 if the command has finished, 0 if it is waiting for more
+ *         I/O.
+ */
+int cddb_conn_process(cddb_conn_t *c);
+
+/**
+ * Returns the result of the last finished asynchronous command.  This
+ * is the same value the blocking version of the command would have
+ * returned.
+ *
+ * @param c The CDDB connection structure.
+ */
+int cddb_conn_result(cddb_conn_t *c);
+
+
 #ifdef __cplusplus
     }
 #endif
@@ -60,6 +60,32 @@ int cddb_get_response_code(cddb_conn_t *c, char **msg);
  */
 int cddb_send_cmd(cddb_conn_t *c, int cmd, ...);
 
+/**
+ * Parse one complete line of a CDDB record.  This is used instead of
+ * #cddb_parser_feed when the lines are already split, as they are
+ * when read from the network or the local cache.
+ *
+ * @param p    The parser.
+ * @param line The NUL-terminated line, without its line terminator.
+ * @param len  The length of the line.
+ * @param eq   The offset of the first '=' in the line, len if there
+ *             is none, or -1 if it is not known.
+ * @return TRUE if the line was accepted, FALSE if the record is
+ *         invalid (see #cddb_parser_errno).
+ */
+int cddb_parser_line(cddb_parser_t *p, char *line, int len, int eq);
+
+/**
+ * Let the parser only index the genre and extended data fields of a
+ * record instead of decoding them.  The lines given to
+ * #cddb_parser_line must then lie within the buffer of the lazy
+ * record.
+ *
+ * @param p  The parser.
+ * @param lz The lazy record.
+ */
+void cddb_parser_set_lazy(cddb_parser_t *p, cddb_lazy_t *lz);
+
 
 #ifdef __cplusplus
     }
@@ -43,6 +43,13 @@ typedef enum {
                                      access */
 } cddb_cache_mode_t;
 
+typedef enum {
+    CACHE_BACKEND_DIR = 0,      /**< one file per record, in a directory per
+                                     category (the default) */
+    CACHE_BACKEND_PACK          /**< all records in one data file with a
+                                     separate index file */
+} cddb_cache_backend_t;
+
 /**
  * Forward declaration of opaque structure used for character set
  * conversions.
@@ -196,6 +203,53 @@ unsigned int cddb_get_timeout(const cddb_conn_t *c);
  */
 void cddb_set_timeout(cddb_conn_t *c, unsigned int t);
 
+/**
+ * Get the network time out value (in milliseconds).
+ *
+ * @see cddb_set_timeout_ms
+ *
+ * @param c The connection structure.
+ * @return The current time out in milliseconds.
+ */
+unsigned int cddb_get_timeout_ms(const cddb_conn_t *c);
+
+/**
+ * Set the network time out value (in milliseconds).  This is the
+ * maximum time a single network operation, e.g. connecting or reading
+ * one line of a response, may take.  The default is 10 seconds.
+ *
+ * @see cddb_get_timeout_ms
+ *
+ * @param c  The connection structure.
+ * @param ms The new time out in milliseconds.
+ */
+void cddb_set_timeout_ms(cddb_conn_t *c, unsigned int ms);
+
+/**
+ * Get the total time out value of a command (in milliseconds).
+ *
+ * @see cddb_set_total_timeout_ms
+ *
+ * @param c The connection structure.
+ * @return The current total time out in milliseconds, zero if there
+ *         is none.
+ */
+unsigned int cddb_get_total_timeout_ms(const cddb_conn_t *c);
+
+/**
+ * Set the total time out value of a command (in milliseconds).  A
+ * command, e.g. #cddb_read, will fail once it has been running this
+ * long, including the time spent on looking up the server, connecting
+ * and the handshake.  By default there is no limit.
+ *
+ * @see cddb_get_total_timeout_ms
+ *
+ * @param c  The connection structure.
+ * @param ms The new total time out in milliseconds or zero to only
+ *           use the time out of the individual network operations.
+ */
+void cddb_set_total_timeout_ms(cddb_conn_t *c, unsigned int ms);
+
 /**
  * Get the URL path for querying a CDDB server through HTTP.
  *
@@ -509,6 +563,228 @@ const char *cddb_cache_get_dir(const cddb_conn_t *c);
  */
 int cddb_cache_set_dir(cddb_conn_t *c, const char *dir);
 
+/**
+ * Returns the way records are stored in the cache directory.
+ *
+ * @see cddb_cache_set_backend
+ *
+ * @param c The connection structure.
+ */
+cddb_cache_backend_t cddb_cache_get_backend(const cddb_conn_t *c);
+
+/**
+ * Change the way records are stored in the cache directory.  By
+ * default every record is a file of its own, in a directory per
+ * category (CACHE_BACKEND_DIR).  This is the layout other CDDB clients
+ * use, but with millions of records it wastes inodes and makes
+ * looking up and backing up records slow.  The packed backend
+ * (CACHE_BACKEND_PACK) appends all records to a single data file in
+ * the cache directory and keeps a sorted index of them in another
+ * one.  Both are memory-mapped, so reading a record does not have to
+ * open a file.  Records in the other layout are not seen, see
+ * #cddb_cache_convert.
+ *
+ * @see cddb_cache_get_backend
+ *
+ * @param c       The connection structure.
+ * @param backend The layout to use.
+ */
+void cddb_cache_set_backend(cddb_conn_t *c, cddb_cache_backend_t backend);
+
+/**
+ * Copy all records stored one file per record in the cache directory
+ * into the packed data file of that directory.  Records that are
+ * already there are skipped, so an interrupted conversion can be
+ * continued.  The files are not removed.
+ *
+ * @see cddb_cache_set_backend
+ *
+ * @param c The connection structure.
+ * @return The number of records copied, or -1 on error.
+ */
+int cddb_cache_convert(cddb_conn_t *c);
+
+/**
+ * Change the number of local cache query results that are remembered
+ * in memory.  A query for a disc that was recently found in the local
+ * cache is then answered without looking at the cache directory.
+ * When more discs are queried, the least recently used result is
+ * forgotten.  The default size is 256, a size of 0 disables this
+ * memory cache.  All results remembered so far are forgotten.
+ *
+ * @param c    The connection structure.
+ * @param size The maximum number of query results to remember.
+ * @return True on success, false if memory allocation failed.
+ */
+int cddb_cache_set_query_size(cddb_conn_t *c, unsigned int size);
+
+/**
+ * Also remember for some time that a disc was not found in the local
+ * cache.  Querying such a disc again then goes to the server without
+ * looking at the cache directory first.  Records written to the cache
+ * by this connection replace such a result immediately, records
+ * added by somebody else are only noticed when it expires.  By
+ * default only discs that were found are remembered.
+ *
+ * @param c       The connection structure.
+ * @param seconds Number of seconds to remember that a disc was not
+ *                found, 0 to not remember it.
+ */
+void cddb_cache_set_query_negative_ttl(cddb_conn_t *c, int seconds);
+
+/**
+ * Keep the discs read from the local cache in memory.  Reading such a
+ * disc again then copies it from memory instead of parsing its record
+ * again.  When adding a disc would use more memory than allowed, the
+ * least recently read discs are dropped.  Records written to the
+ * local cache by this connection, for example by #cddb_write, replace
+ * the disc kept in memory.  A disc that is read lazily (see
+ * #cddb_lazy_read_enable) is decoded completely when it is kept.
+ * This is disabled by default.
+ *
+ * @param c     The connection structure.
+ * @param bytes The memory the discs may use, 0 to disable this memory
+ *              cache.
+ * @return True on success, false if memory allocation failed.
+ */
+int cddb_cache_set_disc_memory(cddb_conn_t *c, unsigned long bytes);
+
+/**
+ * Limit the size of the local cache.  When a record written to the
+ * cache takes it over the limit, a few of the least recently used
+ * records are removed, so the cache shrinks back gradually while new
+ * records come in.  Reading records never removes any, it only marks
+ * them as used.  The first record read or written with a limit set
+ * has the cache directory scanned in a separate thread, no records
+ * are removed until that is done.  Records are ordered on the last
+ * time they were read or written according to the access log kept
+ * in the cache directory, or on the times of their files.  Records
+ * added by other processes are only counted after the next scan, see
+ * #cddb_cache_trim.  The limit only applies to the directory backend,
+ * the packed store never gives back the space of removed records.
+ * By default the cache is not limited.
+ *
+ * @see cddb_cache_trim
+ *
+ * @param c       The connection structure.
+ * @param bytes   The maximum total size in bytes of the records, 0 for
+ *                no limit.
+ * @param entries The maximum number of records, 0 for no limit.
+ */
+void cddb_cache_set_limit(cddb_conn_t *c, unsigned long bytes,
+                          unsigned int entries);
+
+/**
+ * Scan the local cache and remove least recently used records until
+ * it is within the limit set with #cddb_cache_set_limit.  This can
+ * take a while for a large cache, a program can call it from a
+ * separate thread with its own connection, for example after adding
+ * many records with #cddb_import_tar.
+ *
+ * @param c The connection structure.
+ * @return The number of records removed, or -1 on error.
+ */
+int cddb_cache_trim(cddb_conn_t *c);
+
+/**
+ * Write the presence index of the local cache to a file in the cache
+ * directory.  The index records which disc IDs are cached in which
+ * categories, so that a lookup does not have to check every category
+ * directory.  Without the index file, every connection builds the
+ * index by scanning the cache directory the first time it is used.
+ * Once the file exists, it is loaded instead and all connections
+ * using the cache keep it up to date.  With the packed backend, its
+ * index file is rewritten to cover all records instead.
+ *
+ * @param c The connection structure.
+ * @return True on success, false otherwise.
+ */
+int cddb_cache_save_index(cddb_conn_t *c);
+
+/**
+ * Returns true if records read from the local cache are decoded
+ * lazily and false if they are decoded completely.
+ *
+ * @see cddb_lazy_read_enable
+ * @see cddb_lazy_read_disable
+ *
+ * @param c The connection structure.
+ * @return True or false.
+ */
+unsigned int cddb_is_lazy_read_enabled(const cddb_conn_t *c);
+
+/**
+ * Decode records read from the local cache lazily.  The genre and
+ * the extended disc and track data are then only located when the
+ * record is read.  They are decoded and converted to the user
+ * character set the first time they are retrieved with
+ * #cddb_disc_get_genre, #cddb_disc_get_ext_data or
+ * #cddb_track_get_ext_data.  The disc keeps a copy of the record
+ * until then.  Those functions then change the disc, so a lazily read
+ * disc must not be shared between threads until all of its fields
+ * have been retrieved once.  By default this option is disabled.
+ *
+ * @see cddb_is_lazy_read_enabled
+ * @see cddb_lazy_read_disable
+ *
+ * @param c The connection structure.
+ */
+void cddb_lazy_read_enable(cddb_conn_t *c);
+
+/**
+ * Decode records read from the local cache completely when they are
+ * read.  This is the default.
+ *
+ * @see cddb_is_lazy_read_enabled
+ * @see cddb_lazy_read_enable
+ *
+ * @param c The connection structure.
+ */
+void cddb_lazy_read_disable(cddb_conn_t *c);
+
+/**
+ * Returns true if records fetched from the server are locked against
+ * other connections sharing the local cache and false if they are
+ * not.
+ *
+ * @see cddb_cache_lock_enable
+ * @see cddb_cache_lock_disable
+ *
+ * @param c The connection structure.
+ * @return True or false.
+ */
+unsigned int cddb_is_cache_lock_enabled(const cddb_conn_t *c);
+
+/**
+ * Lock a record that is not in the local cache while it is fetched
+ * from the server by #cddb_read.  Other connections sharing the
+ * cache directory, also in other processes, that want to read the
+ * same disc wait for it and then read it from the cache instead of
+ * fetching it again.  The locks are advisory locks on the file .lock
+ * in the cache directory.  Connections of the same process only
+ * exclude each other on systems that have locks belonging to an open
+ * file, such as Linux.  Records are always written to a temporary
+ * file that is renamed into place when complete, so readers never
+ * see a partial record even without locking.  By default this option
+ * is disabled.
+ *
+ * @see cddb_is_cache_lock_enabled
+ * @see cddb_cache_lock_disable
+ *
+ * @param c The connection structure.
+ */
+void cddb_cache_lock_enable(cddb_conn_t *c);
+
+/**
+ * Do not lock records fetched from the server.  This is the default.
+ *
+ * @see cddb_is_cache_lock_enabled
+ * @see cddb_cache_lock_enable
+ *
+ * @param c The connection structure.
+ */
+void cddb_cache_lock_disable(cddb_conn_t *c);
+
 /**
  * Retrieve the first CDDB mirror site.
  *
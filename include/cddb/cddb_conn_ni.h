@@ -30,6 +30,13 @@
 #include "cddb_ni.h"
 #include "ll.h"
 
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+
 
 /* --- type definitions */
 
@@ -41,6 +48,8 @@ struct cddb_iconv_s
                                      converting from user to FreeDB format */
     iconv_t cd_from_freedb;     /**< character set conversion descriptor for
                                      converting from FreeDB to user format */
+    char *name;                 /**< name of the user character set, or NULL
+                                     if none has been set */
 };
 
 /** Actual definition of serach parameters structure. */
@@ -52,24 +61,101 @@ typedef struct cddb_search_params_s
                                      bit string) */
 } cddb_search_params_t;
 
+/** Actual definition of receive buffer structure. */
+typedef struct cddb_rbuf_s
+{
+    char *data;                 /**< the buffered data */
+    int size;                   /**< allocated size of the buffer, defaults
+                                     to 4096 (see DEFAULT_RECV_BUF_SIZE) */
+    int start;                  /**< offset of the first unread byte */
+    int end;                    /**< offset right after the last valid byte */
+    int saved_pos;              /**< offset of the character that was
+                                     overwritten to terminate the last line
+                                     handed out, or -1 if none */
+    char saved;                 /**< the overwritten character */
+} cddb_rbuf_t;
+
+/** Actual definition of send buffer structure. */
+typedef struct cddb_wbuf_s
+{
+    char *data;                 /**< the request being built */
+    int size;                   /**< allocated size of the buffer */
+    int len;                    /**< number of bytes waiting to be sent */
+} cddb_wbuf_t;
+
+/**
+ * A view on one line of input.  The string points straight into a
+ * receive buffer and is only valid until the next line is read from
+ * the same source.
+ */
+typedef struct cddb_line_s
+{
+    char *str;                  /**< the line without line terminator, but
+                                     NUL terminated */
+    int len;                    /**< length of the line */
+} cddb_line_t;
+
+/** Maximum number of addresses kept for a single host name. */
+#define CDDB_MAX_ADDRS 8
+
+/** List of socket addresses a host name resolved to. */
+typedef struct cddb_addrs_s
+{
+    int count;                  /**< number of valid addresses */
+    struct sockaddr_storage addr[CDDB_MAX_ADDRS];
+                                /**< the addresses, in resolver order */
+    socklen_t len[CDDB_MAX_ADDRS];
+                                /**< size of each address structure */
+} cddb_addrs_t;
+
+/** A host name look-up running in a separate thread. */
+typedef struct dns_job_s cddb_dns_job_t;
+
+/** State of an asynchronous command (see #cddb_conn_process). */
+typedef struct cddb_async_s
+{
+    int state;                  /**< current step of the command, one of the
+                                     ASYNC_* values */
+    int cmd;                    /**< the command being executed */
+    cddb_disc_t *disc;          /**< disc passed in by the caller, not owned */
+    char *offsets;              /**< track offset list of a pending query */
+    int result;                 /**< return value of the finished command,
+                                     same as for its blocking version */
+    int reused;                 /**< the request went out on a connection
+                                     that was already open */
+} cddb_async_t;
+
 /** Actual definition of connection structure. */
 struct cddb_conn_s 
 {
     unsigned int buf_size;      /**< maximum line/buffer size, defaults to 1024
                                      (see DEFAULT_BUF_SIZE) */
-    char *line;                 /**< last line read */
+    cddb_rbuf_t rbuf;           /**< receive buffer, filled with large reads
+                                     from the socket and drained line by line */
+    cddb_wbuf_t wbuf;           /**< send buffer, a request is built in here
+                                     and sent with a single system call */
 
     int is_connected;           /**< are we already connected to the server? */
-    struct sockaddr_in sa;      /**< the socket address structure for
-                                     connecting to the CDDB server */
+    cddb_addrs_t addrs;         /**< the addresses of the CDDB server (or
+                                     HTTP proxy) with the port filled in */
+    int addr_idx;               /**< index of the address connected to, or
+                                     -1; it is tried first next time */
+    cddb_dns_job_t *dns_job;    /**< running look-up of the server (or
+                                     proxy) host name, or NULL */
+    long long dns_end;          /**< time at which that look-up times out
+                                     (see #cddb_now_ms) */
     int socket;                 /**< the socket file descriptor */
     char *server_name;          /**< host name of the CDDB server, defaults
                                      to 'freedb.org' (see DEFAULT_SERVER) */
     int server_port;            /**< port of the CDDB server, defaults to 888 
                                      (see DEFAULT_PORT) */
-    int timeout;                /**< time out interval (in seconds) used during
-                                     network operations, defaults to 10 seconds
-                                     (see DEFAULT_TIMEOUT) */
+    int timeout;                /**< time out interval (in milliseconds) used
+                                     during network operations, defaults to
+                                     10 seconds (see DEFAULT_TIMEOUT) */
+    int total_timeout;          /**< maximum time (in milliseconds) a single
+                                     command may take, or 0 for no limit */
+    long long deadline;         /**< time at which the running command times
+                                     out (see #cddb_now_ms), or 0 */
 
     char *http_path_query;      /**< URL for querying the server through HTTP,
                                      defaults to /~cddb/cddb.cgi'
@@ -78,6 +164,12 @@ struct cddb_conn_s
                                      defaults to /~cddb/submit.cgi'
                                      (see DEFAULT_PATH_SUBMIT) */
     int is_http_enabled;        /**< use HTTP, disabled by default */
+    int http_keep_alive;        /**< the server agreed to keep the HTTP
+                                     connection open after the last
+                                     response */
+    int http_body;              /**< the receive buffer holds the complete
+                                     body of the last HTTP response, reading
+                                     stops at its end */
 
     int is_http_proxy_enabled;  /**< use HTTP through a proxy server,
                                      disabled by default */
@@ -94,8 +186,43 @@ struct cddb_conn_s
                                      enabled by default (CACHE_ON) */
     char *cache_dir;            /**< CDDB slave cache, defaults to 
                                      '~/.cddbslave' (see DEFAULT_CACHE) */
-    int cache_read;             /**< read data from cached file instead of
-                                     from the network */
+    cddb_cache_backend_t cache_backend; /**< layout of the cache directory,
+                                     CACHE_BACKEND_DIR by default */
+    cddb_pack_t *cache_pack;    /**< packed store of the cache directory,
+                                     opened when first needed */
+    int cache_put;              /**< cache_fp is a temporary file that is
+                                     added to the packed store when it is
+                                     closed */
+    char *cache_tmp;            /**< temporary file in the category directory
+                                     cache_fp writes to, renamed to the cache
+                                     entry when it is closed, or NULL */
+    char *cache_fn;             /**< file name of that cache entry */
+    unsigned int cache_put_discid; /**< disc ID of the record being written */
+    cddb_cat_t cache_put_cat;   /**< category of that record */
+    int cache_lock;             /**< lock records that are fetched from the
+                                     server against other connections
+                                     sharing the cache, disabled by default */
+    int cache_lock_fd;          /**< lock file of the cache directory, or -1
+                                     if it is not open */
+    cddb_index_t *cache_index;  /**< presence index of the cache directory,
+                                     created when first needed */
+    cddb_usage_t *cache_usage;  /**< usage table of the cache directory,
+                                     built when a record is first read or
+                                     written with a limit set */
+    unsigned long cache_max_bytes; /**< maximum total size of the cache
+                                     entries, 0 (no limit) by default */
+    unsigned int cache_max_entries; /**< maximum number of cache entries,
+                                     0 (no limit) by default */
+    cddb_qcache_t *query_cache; /**< recent local cache query results, or
+                                     NULL if they are not remembered */
+    int query_negative_ttl;     /**< number of seconds a disc that was not
+                                     found in the local cache is remembered,
+                                     0 (not at all) by default */
+    cddb_dcache_t *disc_cache;  /**< recently read discs, or NULL if they are
+                                     not kept in memory (the default) */
+    int lazy_read;              /**< decode the genre and extended data of
+                                     cached records only when they are
+                                     asked for, disabled by default */
 
     char *cname;                /**< name of the client program, 'libcddb' by
                                      default */
@@ -115,6 +242,9 @@ struct cddb_conn_s
     cddb_search_params_t srch;  /**< parameters for text search */
 
     cddb_iconv_t charset;       /**< character set conversion settings */
+
+    cddb_async_t async;         /**< state of the running asynchronous
+                                     command, if any */
 };
 
 
@@ -123,14 +253,101 @@ struct cddb_conn_s
 
 #define cddb_cache_file(c) (c)->cache_fp
 
+/**
+ * Get the presence index of the cache directory, creating it if
+ * needed.
+ *
+ * @return The index or NULL if the cache is disabled or memory
+ *         allocation failed.
+ */
+cddb_index_t *cddb_cache_index(cddb_conn_t *c);
+
+/**
+ * Get the packed store of the cache directory, opening it if needed.
+ *
+ * @return The store or NULL if the cache is disabled, does not use the
+ *         packed backend or memory allocation failed.
+ */
+cddb_pack_t *cddb_cache_pack(cddb_conn_t *c);
+
+/**
+ * Get the usage table of the cache directory, starting a scan of the
+ * directory in the background if needed.
+ *
+ * @return The table or NULL if the cache is disabled, has no limit,
+ *         does not use the directory backend or the table could not
+ *         be built.
+ */
+cddb_usage_t *cddb_cache_usage(cddb_conn_t *c);
+
+/**
+ * Lock a record of the cache directory, if locking is enabled, so
+ * that no other connection fetches it from the server at the same
+ * time.  Waits until a connection holding the lock releases it.
+ *
+ * @return TRUE if the lock is held, FALSE if locking is disabled or
+ *         the lock could not be taken.
+ */
+int cddb_cache_lock(cddb_conn_t *c, unsigned int discid, cddb_cat_t cat);
+
+/**
+ * Release a record locked with #cddb_cache_lock.
+ */
+void cddb_cache_unlock(cddb_conn_t *c, unsigned int discid, cddb_cat_t cat);
+
 
 /* --- connecting / disconnecting --- */
 
 
 int cddb_connect(cddb_conn_t *c);
 
+/**
+ * Start resolving the server address without blocking, followed by a
+ * non-blocking connect once the address is known.  The socket is
+ * ready for use once it becomes writable and #sock_connect_check
+ * succeeds.  No handshake is sent.
+ *
+ * @return Zero if connected immediately (or already connected), 1 if
+ *         the connect is in progress, 2 if the host name is still
+ *         being resolved (see #cddb_connect_resolved) or -1 on error.
+ */
+int cddb_connect_start(cddb_conn_t *c);
+
+/**
+ * Continue a connect started with #cddb_connect_start after the
+ * descriptor of the look-up (see #cddb_resolve_fd) became readable,
+ * or its time ran out.  This does not block.
+ *
+ * @return The same values as #cddb_connect_start.
+ */
+int cddb_connect_resolved(cddb_conn_t *c);
+
+/**
+ * Give up on the address a non-blocking connect is in progress to and
+ * start connecting to the next address of the server instead.
+ *
+ * @return 1 if the connect is in progress, zero if connected
+ *         immediately or -1 if there are no addresses left.
+ */
+int cddb_connect_next(cddb_conn_t *c);
+
+/**
+ * The three steps of the CDDBP handshake.  Each step checks one
+ * server response, already waiting in the receive buffer, and sends
+ * the next request.
+ */
+int cddb_handshake_banner(cddb_conn_t *c);
+int cddb_handshake_hello(cddb_conn_t *c);
+int cddb_handshake_proto(cddb_conn_t *c);
+
 void cddb_disconnect(cddb_conn_t *c);
 
+/**
+ * Mark the start of a new command.  This sets the deadline for the
+ * command as a whole if a total time out has been configured.
+ */
+void cddb_deadline_start(cddb_conn_t *c);
+
 
 /* --- miscellaneous --- */
 
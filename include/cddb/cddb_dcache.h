@@ -0,0 +1,110 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#ifndef CDDB_DCACHE_H
+#define CDDB_DCACHE_H 1
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/* --- type definitions */
+
+
+/**
+ * Memory cache of parsed discs, keyed on their category and disc ID.
+ * It holds private, fully decoded copies of the discs, whose
+ * estimated size stays within a byte budget.  When adding a disc
+ * would exceed it, the least recently used discs are dropped.  All
+ * functions lock the cache, so it can be shared between threads.
+ */
+typedef struct cddb_dcache_s cddb_dcache_t;
+
+
+/* --- construction / destruction */
+
+
+/**
+ * Creates a new disc cache.
+ *
+ * @param budget The maximum estimated size in bytes of all discs.
+ * @return The cache or NULL if memory allocation failed.
+ */
+cddb_dcache_t *cddb_dcache_new(unsigned long budget);
+
+/**
+ * Free the disc cache and all discs in it.
+ *
+ * @param dc The disc cache.
+ */
+void cddb_dcache_destroy(cddb_dcache_t *dc);
+
+
+/* --- lookup and update --- */
+
+
+/**
+ * Copy a cached disc into another disc, as if its record had been
+ * parsed into it.
+ *
+ * @param dc     The disc cache.
+ * @param cat    The category.
+ * @param discid The disc ID.
+ * @param disc   The disc to copy into.
+ * @return TRUE if the disc was found, FALSE otherwise.
+ */
+int cddb_dcache_get(cddb_dcache_t *dc, cddb_cat_t cat, unsigned int discid,
+                    cddb_disc_t *disc);
+
+/**
+ * Add a copy of a disc to the cache, replacing any disc with the
+ * same category and disc ID.  Pending fields of a lazily read disc
+ * are decoded first.
+ *
+ * @param dc   The disc cache.
+ * @param disc The disc.
+ */
+void cddb_dcache_put(cddb_dcache_t *dc, cddb_disc_t *disc);
+
+/**
+ * Drop a disc from the cache.
+ *
+ * @param dc     The disc cache.
+ * @param cat    The category.
+ * @param discid The disc ID.
+ */
+void cddb_dcache_forget(cddb_dcache_t *dc, cddb_cat_t cat,
+                        unsigned int discid);
+
+/**
+ * Drop all discs from the cache.
+ *
+ * @param dc The disc cache.
+ */
+void cddb_dcache_clear(cddb_dcache_t *dc);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif /* CDDB_DCACHE_H */
@@ -87,6 +87,17 @@ typedef struct cddb_disc_s cddb_disc_t;
  */
 cddb_disc_t *cddb_disc_new(void);
 
+/**
+ * Creates a new CDDB disc structure that allocates all strings of the
+ * disc and its tracks from a single growing memory block (an arena).
+ * Destroying the disc frees them all at once.  This saves many small
+ * allocations when large numbers of records are read.  Apart from
+ * that, the disc behaves like one created with #cddb_disc_new.
+ *
+ * @return The CDDB disc structure or NULL if memory allocation failed.
+ */
+cddb_disc_t *cddb_disc_new_arena(void);
+
 /**
  * Free all resources associated with the given CDDB disc structure.
  * The tracks will also be freed automatically.
@@ -238,6 +249,11 @@ void cddb_disc_set_category_str(cddb_disc_t *disc, const char *cat);
  * will be returned.  As opposed to the disc category, this field is
  * not limited to a predefined set.
  *
+ * For a disc read with lazy reading enabled (see
+ * #cddb_lazy_read_enable), the first call decodes the genre and
+ * stores it in the disc, despite the const parameter.  Two threads
+ * must then not call it for the same disc at the same time.
+ *
  * @param disc The CDDB disc structure.
  * @return The disc genre.
  */
@@ -378,6 +394,10 @@ void cddb_disc_append_artist(cddb_disc_t *disc, const char *artist);
  * Get the extended disc data.  If the disc is invalid or no extended
  * data is set then NULL will be returned.
  *
+ * Like #cddb_disc_get_genre, this decodes the data into the disc on
+ * the first call if the disc was read lazily, and is not thread-safe
+ * for such a disc.
+ *
  * @param disc The CDDB disc structure.
  * @return The extended data.
  */
@@ -76,6 +76,7 @@ typedef enum {
 
     CDDB_ERR_PROXY_AUTH,        /**< proxy authentication failed */
     CDDB_ERR_INVALID,           /**< invalid input parameter(s) */
+    CDDB_ERR_TIMEOUT,           /**< network operation timed out */
 
     /* --- terminator --- */
 
@@ -0,0 +1,179 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#ifndef CDDB_IMPORT_H
+#define CDDB_IMPORT_H 1
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+#include <stdio.h>
+
+#include "cddb/cddb_error.h"
+#include "cddb/cddb_conn.h"
+
+
+/* --- type and structure definitions */
+
+
+/**
+ * Imports the records of a freedb database dump into the local cache
+ * of a connection.  The dump is a tar archive with one file per
+ * record, named after the category and disc ID of the record (for
+ * example 'rock/920ef00b').  It is read as a stream, so a compressed
+ * dump can be piped through a decompressor.  The records are checked
+ * by a pool of threads with the record parser and written to the
+ * cache backend of the connection.  The presence index of the cache
+ * is updated along the way and saved when the import is done.
+ */
+typedef struct cddb_import_s cddb_import_t;
+
+/**
+ * The numbers kept by an importer, see #cddb_import_get_count.
+ */
+typedef enum {
+    IMPORT_RECORDS = 0,         /**< records found in the dump */
+    IMPORT_ADDED,               /**< records added to the cache */
+    IMPORT_EXISTING,            /**< records that were already cached and
+                                     have been skipped */
+    IMPORT_REJECTED,            /**< invalid records that have been
+                                     skipped */
+    IMPORT_FAILED,              /**< records that could not be written to
+                                     the cache */
+    IMPORT_IGNORED,             /**< other files in the dump */
+    IMPORT_BYTES,               /**< size of the records found */
+    IMPORT_LAST                 /**< number of counters */
+} cddb_import_count_t;
+
+/**
+ * Called for every record that is rejected.  The calls are
+ * serialized, the callback does not have to be thread-safe.
+ *
+ * @param name   The name of the record in the dump.
+ * @param errnum The reason the record was rejected.
+ * @param data   The data passed to #cddb_import_set_reject_cb.
+ */
+typedef void cddb_import_reject_cb(const char *name, cddb_error_t errnum,
+                                   void *data);
+
+
+/* --- construction / destruction */
+
+
+/**
+ * Creates a new importer for the local cache of a connection.  The
+ * cache directory and backend are those of the connection.  The
+ * connection should not be used by other threads while an import is
+ * running.
+ *
+ * @param c The connection structure.
+ * @return The importer or NULL if memory allocation failed.
+ */
+cddb_import_t *cddb_import_new(cddb_conn_t *c);
+
+/**
+ * Free all resources associated with the given importer.
+ *
+ * @param imp The importer.
+ */
+void cddb_import_destroy(cddb_import_t *imp);
+
+
+/* --- setters / getters --- */
+
+
+/**
+ * Set the number of threads that check and write records.  The
+ * dump itself is read by the calling thread.  By default there is
+ * one thread per processor, with 1 all work is done by the calling
+ * thread.
+ *
+ * @param imp     The importer.
+ * @param threads The number of threads.
+ */
+void cddb_import_set_threads(cddb_import_t *imp, int threads);
+
+/**
+ * Replace records that are already in the cache.  By default they
+ * are kept and the records in the dump are skipped.
+ *
+ * @param imp     The importer.
+ * @param replace True to replace cached records, false to keep them.
+ */
+void cddb_import_set_replace(cddb_import_t *imp, int replace);
+
+/**
+ * Set the function that is called for every rejected record.
+ *
+ * @param imp  The importer.
+ * @param cb   The callback or NULL.
+ * @param data Passed to the callback.
+ */
+void cddb_import_set_reject_cb(cddb_import_t *imp, cddb_import_reject_cb *cb,
+                               void *data);
+
+/**
+ * Get one of the numbers kept by the importer.  They add up over all
+ * imports done with it.
+ *
+ * @param imp   The importer.
+ * @param which The number to get.
+ * @return The number.
+ */
+unsigned long cddb_import_get_count(const cddb_import_t *imp,
+                                    cddb_import_count_t which);
+
+
+/* --- importing --- */
+
+
+/**
+ * Import a database dump.  Records that are not valid are rejected.
+ * A record is valid if the record parser accepts it and it has a
+ * disc title and at least one track.  The cache limit set with
+ * #cddb_cache_set_limit is not applied while importing, call
+ * #cddb_cache_trim afterwards for that.
+ *
+ * If the whole dump was read the function returns true, even if
+ * some records were rejected or could not be written, and the error
+ * code will be reset to #CDDB_ERR_OK.  Otherwise false is returned
+ * and one of the following error codes is set:
+ * - #CDDB_ERR_INVALID:
+ *     If the cache is disabled or the dump is not a tar archive.
+ * - #CDDB_ERR_UNEXPECTED_EOF:
+ *     If the dump could not be read or ends prematurely.
+ * - #CDDB_ERR_OUT_OF_MEMORY:
+ *     If memory allocation failed.
+ *
+ * @param imp The importer.
+ * @param fp  The dump, read up to its end.
+ * @return True if the whole dump was imported, false otherwise.
+ */
+int cddb_import_tar(cddb_import_t *imp, FILE *fp);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif /* CDDB_IMPORT_H */
@@ -0,0 +1,191 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#ifndef CDDB_INDEX_H
+#define CDDB_INDEX_H 1
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/* --- type definitions */
+
+
+/**
+ * Presence index of a local cache directory.  It knows for every
+ * disc ID in which categories the cache holds a record, so looking
+ * for a disc does not have to try every category directory.
+ *
+ * The index is built by scanning the category directories once, or
+ * loaded from the index file in the cache directory if there is one.
+ * A category directory that has been changed by somebody else since
+ * it was last scanned, as seen from its modification time, is scanned
+ * again.  This is checked at most once per INDEX_CHECK_INTERVAL
+ * seconds.
+ */
+typedef struct cddb_index_s cddb_index_t;
+
+/** Name of the index file in the cache directory. */
+#define INDEX_FILE ".index"
+
+/** Minimum number of seconds between two checks for changes made to
+    the cache directory by somebody else. */
+#define INDEX_CHECK_INTERVAL 1
+
+
+/* --- construction / destruction */
+
+
+/**
+ * Creates a new presence index for a cache directory.  The index
+ * file is loaded if it exists, the directory is only scanned when
+ * the index is first used.
+ *
+ * @param dir The cache directory.
+ * @return The index or NULL if memory allocation failed.
+ */
+cddb_index_t *cddb_index_new(const char *dir);
+
+/**
+ * Free the index.  If it was loaded from or saved to the index file
+ * and it has changed since, the index file is updated first.
+ *
+ * @param idx The index.
+ */
+void cddb_index_destroy(cddb_index_t *idx);
+
+
+/* --- lookup and update --- */
+
+
+/**
+ * Look up a disc ID.
+ *
+ * @param idx    The index.
+ * @param discid The disc ID.
+ * @return A bit mask of the categories in which the disc is cached,
+ *         BIT(category) for each of them, or -1 if the index is not
+ *         usable and the cache directory has to be checked instead.
+ */
+int cddb_index_lookup(cddb_index_t *idx, unsigned int discid);
+
+/**
+ * Take note of the state of a category directory right before a
+ * cache entry is created in it or removed from it.  The following
+ * #cddb_index_add or #cddb_index_remove then knows whether the
+ * directory was changed by somebody else as well, and only has it
+ * scanned again if it was.  Without this call, the directory is
+ * always scanned again on the next check.
+ *
+ * @param idx The index.
+ * @param cat The category.
+ */
+void cddb_index_prepare(cddb_index_t *idx, cddb_cat_t cat);
+
+/**
+ * Take note of a change made to a category directory that does not
+ * create or remove a cache entry, like creating a temporary file.
+ * Like #cddb_index_add and #cddb_index_remove, this only keeps the
+ * directory from being scanned again if #cddb_index_prepare was
+ * called right before the change and found nobody else changed it.
+ *
+ * @param idx The index.
+ * @param cat The category.
+ */
+void cddb_index_touch(cddb_index_t *idx, cddb_cat_t cat);
+
+/**
+ * Record that a cache entry has been created.
+ *
+ * @param idx    The index.
+ * @param discid The disc ID.
+ * @param cat    The category.
+ */
+void cddb_index_add(cddb_index_t *idx, unsigned int discid, cddb_cat_t cat);
+
+/**
+ * Record that a cache entry has been removed.
+ *
+ * @param idx    The index.
+ * @param discid The disc ID.
+ * @param cat    The category.
+ */
+void cddb_index_remove(cddb_index_t *idx, unsigned int discid, cddb_cat_t cat);
+
+/**
+ * Make the next lookup check the cache directory for changes made by
+ * somebody else, even if the last check was less than
+ * INDEX_CHECK_INTERVAL seconds ago.
+ *
+ * @param idx The index.
+ */
+void cddb_index_recheck(cddb_index_t *idx);
+
+/**
+ * Stop checking the cache directory for changes.  The index is
+ * brought up to date once and from then on only changes made through
+ * #cddb_index_add and #cddb_index_remove are taken into account.  Use
+ * this while adding many records, which would otherwise have every
+ * changed category directory scanned again and again.
+ *
+ * @param idx The index.
+ */
+void cddb_index_hold(cddb_index_t *idx);
+
+/**
+ * Check the cache directory for changes again, as before
+ * #cddb_index_hold.  Every category directory that changed while the
+ * index was held is scanned once, to also pick up the changes made by
+ * somebody else in the meantime.
+ *
+ * @param idx The index.
+ */
+void cddb_index_release(cddb_index_t *idx);
+
+/**
+ * Write the index to the index file in the cache directory.  From
+ * then on the index file is kept up to date.
+ *
+ * @param idx The index.
+ * @return TRUE on success, FALSE otherwise.
+ */
+int cddb_index_save(cddb_index_t *idx);
+
+/* --- miscellaneous --- */
+
+
+/**
+ * Check whether a file name is that of a cache entry, that is eight
+ * hexadecimal digits that are not all zero.
+ *
+ * @param name   The file name.
+ * @param discid Set to the disc ID if it is.
+ * @return TRUE if it is, FALSE otherwise.
+ */
+int cddb_index_entry_name(const char *name, unsigned int *discid);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif /* CDDB_INDEX_H */
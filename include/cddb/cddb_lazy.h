@@ -0,0 +1,155 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#ifndef CDDB_LAZY_H
+#define CDDB_LAZY_H 1
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/* --- type definitions */
+
+
+/**
+ * The raw text of a CDDB record whose genre and extended data fields
+ * have not been decoded yet.  The lines of the record are stored one
+ * after the other, each terminated by a NUL character.  The record
+ * is kept by the disc until all of its pending fields have been
+ * decoded.
+ */
+typedef struct cddb_lazy_s cddb_lazy_t;
+
+/**
+ * A range of record lines that still have to be decoded into a disc
+ * or track field.  An empty range means nothing is pending.
+ */
+typedef struct cddb_span_s
+{
+    int off;                    /**< offset of the first line */
+    int len;                    /**< number of bytes up to and including
+                                     the NUL of the last line, or 0 */
+} cddb_span_t;
+
+
+/* --- construction / destruction */
+
+
+/**
+ * Creates a new lazy record.  The record takes ownership of the
+ * buffer.
+ *
+ * @param buf     The raw record, lines separated by NUL characters.
+ * @param charset The user character set the fields have to be
+ *                converted to when decoded, or NULL.
+ * @return The record or NULL if memory allocation failed.
+ */
+cddb_lazy_t *cddb_lazy_new(char *buf, const char *charset);
+
+/**
+ * Free the lazy record and its buffer.
+ *
+ * @param lz The lazy record.
+ */
+void cddb_lazy_destroy(cddb_lazy_t *lz);
+
+
+/* --- indexing --- */
+
+
+/**
+ * Add a record line to the range of a pending field.
+ *
+ * @param lz      The lazy record.
+ * @param span    The range of the field.
+ * @param line    The line, which has to lie within the record buffer.
+ * @param len     The length of the line.
+ * @param restart Forget any lines seen before and start a new range.
+ */
+void cddb_lazy_mark(cddb_lazy_t *lz, cddb_span_t *span,
+                    const char *line, int len, int restart);
+
+/**
+ * Hand a lazy record over to the disc whose fields have been indexed
+ * in it.  The record is freed right away if no field is pending.
+ *
+ * @param disc The disc.
+ * @param lz   The lazy record.
+ */
+void cddb_lazy_attach(cddb_disc_t *disc, cddb_lazy_t *lz);
+
+/**
+ * Forget about a pending field, because it is being overwritten.
+ * The lazy record is freed when this was the last pending field.
+ *
+ * @param disc The disc the field belongs to.
+ * @param span The range of the field.
+ */
+void cddb_lazy_drop(cddb_disc_t *disc, cddb_span_t *span);
+
+/**
+ * Forget about all pending fields of a disc and its tracks and free
+ * the lazy record.
+ *
+ * @param disc The disc.
+ */
+void cddb_lazy_release(cddb_disc_t *disc);
+
+
+/* --- decoding --- */
+
+
+/**
+ * Decode the genre of a disc if it is still pending.
+ *
+ * @param disc The disc.
+ */
+void cddb_lazy_genre(cddb_disc_t *disc);
+
+/**
+ * Decode the extended data of a disc if it is still pending.
+ *
+ * @param disc The disc.
+ */
+void cddb_lazy_disc_ext(cddb_disc_t *disc);
+
+/**
+ * Decode the extended data of a track if it is still pending.
+ *
+ * @param track The track.
+ */
+void cddb_lazy_track_ext(cddb_track_t *track);
+
+/**
+ * Decode all pending fields of a disc and its tracks.  Afterwards the
+ * disc no longer refers to a lazy record.
+ *
+ * @param disc The disc.
+ */
+void cddb_lazy_all(cddb_disc_t *disc);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif /* CDDB_LAZY_H */
@@ -44,26 +44,181 @@
 #endif
 
 
+/* --- buffered line reading --- */
+
+
+/**
+ * Callback prototype for refilling a receive buffer.  The callback
+ * should append new data at the end of the valid data in the buffer
+ * without exceeding its size.
+ *
+ * @param c   The CDDB connection structure.
+ * @param rb  The receive buffer to fill.
+ * @param arg Callback specific argument.
+ * @return The number of bytes added, 0 on end-of-stream or -1 on
+ *         error.
+ */
+typedef int cddb_rbuf_fill_cb(cddb_conn_t *c, cddb_rbuf_t *rb, void *arg);
+
+/**
+ * Initialize an empty receive buffer of the given size.
+ *
+ * @param rb   The receive buffer.
+ * @param size The initial buffer size.
+ */
+void cddb_rbuf_init(cddb_rbuf_t *rb, int size);
+
+/**
+ * Make sure that the receive buffer can hold at least the specified
+ * number of bytes.  Buffered data is preserved.
+ *
+ * @param rb   The receive buffer.
+ * @param size The minimal buffer size.
+ * @return True if the buffer is big enough, false if memory allocation
+ *         failed.
+ */
+int cddb_rbuf_reserve(cddb_rbuf_t *rb, int size);
+
+/**
+ * Discard all data in the receive buffer.
+ *
+ * @param rb The receive buffer.
+ */
+void cddb_rbuf_reset(cddb_rbuf_t *rb);
+
+/**
+ * Hand out the next line from the receive buffer without copying it.
+ * The line feed (and any carriage return before it) is replaced by a
+ * terminating null in the buffer itself.  Lines longer than the
+ * connection buffer size are split up.  The returned view stays valid
+ * until the next call for the same buffer.
+ *
+ * @param c    The CDDB connection structure.
+ * @param rb   The receive buffer.
+ * @param fill Callback used to refill the buffer when no full line
+ *             is available.
+ * @param arg  Argument passed to the callback.
+ * @param line The line view to initialize.
+ * @return True if a line was read, false on end-of-stream or error.
+ */
+int cddb_rbuf_getline(cddb_conn_t *c, cddb_rbuf_t *rb,
+                      cddb_rbuf_fill_cb *fill, void *arg, cddb_line_t *line);
+
+/**
+ * Check whether the receive buffer holds a complete server response.
+ * A single-line response is complete once its line feed has arrived.
+ * A multi-line response is complete once the terminating line with a
+ * single dot has arrived.
+ *
+ * @param rb    The receive buffer.
+ * @param multi True if the response is terminated by a dot line.
+ * @return True if the response is complete, false otherwise.
+ */
+int cddb_rbuf_has_response(cddb_rbuf_t *rb, int multi);
+
+/**
+ * Check whether the receive buffer holds a complete HTTP response,
+ * i.e. the status line, all headers and a body that is framed by
+ * either a Content-Length header or chunked transfer encoding.  A
+ * body without framing is only complete when the server closes the
+ * connection, so false is returned for it.
+ *
+ * @param rb    The receive buffer.
+ * @return True if the response is complete, false otherwise.
+ */
+int cddb_rbuf_has_http_response(cddb_rbuf_t *rb);
+
+/**
+ * Check whether an HTTP header line has the given name.  The
+ * comparison is case insensitive.
+ *
+ * @param line The header line.
+ * @param name The header name in lower case, without colon.
+ * @return A pointer to the header value, or NULL if the header name
+ *         does not match.
+ */
+const char *cddb_http_header(const char *line, const char *name);
+
+/**
+ * Check whether a comma separated HTTP header value contains the
+ * given token.  Only whole elements of the list match, the comparison
+ * ignores case and the white space around them.
+ *
+ * @param value The header value, as returned by cddb_http_header.
+ * @param eol The end of the header value.
+ * @param token The token in lower case.
+ * @return True if the token was found, false otherwise.
+ */
+int cddb_http_has_token(const char *value, const char *eol,
+                        const char *token);
+
+
 /* --- socket-based work-alikes --- */
 
 
 /**
- * This function performs the same task as the standard fgets except
- * for the fact that it might time-out if the socket read takes too
- * long.  In case of a time out, errno will be set to ETIMEDOUT.
+ * Read the next line from the socket into the receive buffer of the
+ * connection and return a view on it.  This function might time-out
+ * if the socket read takes too long.  In case of a time out, errno
+ * will be set to ETIMEDOUT.
  *
- * @param s       The string buffer.
- * @param size    Size of the buffer.
  * @param c       The CDDB connection structure.
- * @return The string that was read or NULL on error or EOF when no
- *         characters were read.
+ * @param line    The line view to initialize.
+ * @return True if a line was read, false on error or end-of-stream
+ *         when no characters were read.
+ */
+int sock_getline(cddb_conn_t *c, cddb_line_t *line);
+
+/**
+ * Append whatever data is currently available on the socket to the
+ * receive buffer of the connection, without waiting.  The buffer is
+ * grown as needed so that a complete response can be collected
+ * before it is parsed.
+ *
+ * @param c   The CDDB connection structure.
+ * @param eof Will be set to true if the server closed the connection.
+ * @return The number of bytes added (possibly zero), or -1 on error.
+ */
+int sock_recv_avail(cddb_conn_t *c, int *eof);
+
+/**
+ * Wait until an HTTP response body of the given length is available
+ * in the receive buffer.  Afterwards the buffer holds exactly the
+ * body.
+ *
+ * @param c   The CDDB connection structure.
+ * @param len The length of the body (Content-Length).
+ * @return Zero on success, -1 on error, time out or if the body is
+ *         larger than MAX_HTTP_BODY_SIZE.
+ */
+int sock_read_body(cddb_conn_t *c, int len);
+
+/**
+ * Receive and decode an HTTP response body that uses chunked transfer
+ * encoding.  The body is decoded in place, afterwards the receive
+ * buffer holds exactly the decoded body.
+ *
+ * @param c   The CDDB connection structure.
+ * @return Zero on success, -1 on error, time out, invalid encoding or
+ *         if the body is larger than MAX_HTTP_BODY_SIZE.
  */
-char *sock_fgets(char *s, int size, cddb_conn_t *c);
+int sock_read_chunked(cddb_conn_t *c);
+
+/**
+ * Check whether an idle connection can still be used for sending a
+ * new request.
+ *
+ * @param c   The CDDB connection structure.
+ * @return False if the server closed the connection.
+ */
+int sock_check_idle(cddb_conn_t *c);
 
 /**
  * This function performs the same task as the standard fwrite except
  * for the fact that it might time-out if the socket write takes too
- * long.  In case of a time out, errno will be set to ETIMEDOUT.
+ * long.  In case of a time out, errno will be set to ETIMEDOUT.  Any
+ * data still in the send buffer is sent first, together with the
+ * given data if possible.
  *
  * @param ptr     Pointer to data record.
  * @param size    Size of data record.
@@ -74,56 +229,187 @@ char *sock_fgets(char *s, int size, cddb_conn_t *c);
 size_t sock_fwrite(const void *ptr, size_t size, size_t nmemb, cddb_conn_t *c);
 
 /**
- * This function performs the same task as the standard fprintf except
- * for the fact that it might time-out if the socket write takes too
- * long.  In case of a time out, errno will be set to ETIMEDOUT.
+ * Send the data in the send buffer of the connection.  This might
+ * time-out if the socket write takes too long, in which case errno
+ * will be set to ETIMEDOUT.
+ *
+ * @param c       The CDDB connection structure.
+ * @return Zero on success, -1 on failure.
+ */
+int sock_fflush(cddb_conn_t *c);
+
+/**
+ * This function performs the same task as the standard fprintf.  Like
+ * with a stdio stream the output is buffered, it is only sent by
+ * #sock_fflush or #sock_fwrite.  A single call can not produce more
+ * than the connection's buffer size in characters.
  *
  * @param c       The CDDB connection structure.
  * @param format  Pointer to data record.
- * @return The number of characters written.
+ * @return The number of characters written or -1 on error.
  */
 int sock_fprintf(cddb_conn_t *c, const char *format, ...);
 
 /**
- * This function performs the same task as the standard vfprintf
- * except for the fact that it might time-out if the socket write
- * takes too long.  In case of a time out, errno will be set to
- * ETIMEDOUT.
+ * This function performs the same task as the standard vfprintf.
+ * The output is buffered, see #sock_fprintf.
  *
  * @param c       The CDDB connection structure.
  * @param format  Pointer to data record.
  * @param ap      Variable argument list.
- * @return The number of characters written.
+ * @return The number of characters written or -1 on error.
  */
 int sock_vfprintf(cddb_conn_t *c, const char *format, va_list ap);
 
+/* --- time-outs --- */
+
+/**
+ * Returns the current time in milliseconds.  A monotonic clock is used
+ * when available, so the value only makes sense compared with other
+ * values returned by this function.
+ */
+long long cddb_now_ms(void);
+
+/**
+ * Returns the time (see #cddb_now_ms) at which a network operation
+ * that is started now should time out.  This is the connection's
+ * time out, unless the deadline of the running command is earlier.
+ *
+ * @param c The CDDB connection structure.
+ */
+long long cddb_timeout_end(cddb_conn_t *c);
+
+/**
+ * Returns the number of milliseconds a network operation that is
+ * started now may take (see #cddb_timeout_end).
+ *
+ * @param c The CDDB connection structure.
+ */
+int cddb_timeout_left(cddb_conn_t *c);
+
 /* --- time-out enabled work-alikes --- */
 
 /**
- * This function performs the same task as the standard gethostbyname
- * except for the fact that it might time-out if the query takes too
- * long.  In case of a time out, errno will be set to ETIMEDOUT.
+ * Resolve a host name to the list of its stream socket addresses, with
+ * the port filled in.  Unlike gethostbyname this does not use signals
+ * and can be called from several threads at once.  Results are kept
+ * in a process-wide cache for #libcddb_set_dns_cache_ttl seconds.
+ * In case of a time out, errno will be set to ETIMEDOUT.
+ *
+ * @param hostname The hostname that needs to be resolved.
+ * @param port     The port to store in the resolved addresses.
+ * @param addrs    Receives the resolved addresses.
+ * @param timeout  Number of milliseconds after which to time out.
+ * @return Zero on success, -1 if the name could not be resolved or
+ *         the query timed out.
+ */
+int timeout_getaddrinfo(const char *hostname, int port, cddb_addrs_t *addrs,
+                        int timeout);
+
+/**
+ * Start resolving a host name without blocking.  The result is taken
+ * from the DNS cache if possible, otherwise the look-up runs in a
+ * separate thread.  Without thread support the name is resolved
+ * right away.
  *
  * @param hostname The hostname that needs to be resolved.
- * @param timeout  Number of seconds after which to time out.
- * @return The host entity for given host name or NULL if not found or
- *         timed out (errno will be set).
+ * @param port     The port to store in the resolved addresses.
+ * @param addrs    Receives the resolved addresses if the name was
+ *                 resolved right away.
+ * @param job      Set to the running look-up, or NULL.
+ * @return Zero if the name was resolved right away, 1 if the look-up
+ *         is running or -1 if the name could not be resolved.
  */
-struct hostent *timeout_gethostbyname(const char *hostname, int timeout);
+int cddb_resolve_start(const char *hostname, int port, cddb_addrs_t *addrs,
+                       cddb_dns_job_t **job);
+
+/**
+ * Returns a file descriptor that becomes readable when a look-up
+ * started with #cddb_resolve_start has finished.
+ *
+ * @param job The running look-up.
+ */
+int cddb_resolve_fd(cddb_dns_job_t *job);
+
+/**
+ * Collect the result of a look-up started with #cddb_resolve_start.
+ * This does not block.  Once the look-up has finished, it is freed.
+ *
+ * @param job   The running look-up.
+ * @param port  The port to store in the resolved addresses.
+ * @param addrs Receives the resolved addresses.
+ * @return Zero on success, 1 if the look-up is still running or -1 if
+ *         the name could not be resolved.
+ */
+int cddb_resolve_finish(cddb_dns_job_t *job, int port, cddb_addrs_t *addrs);
+
+/**
+ * Abandon a look-up started with #cddb_resolve_start.  It is freed
+ * once its thread finishes.
+ *
+ * @param job The running look-up.
+ */
+void cddb_resolve_cancel(cddb_dns_job_t *job);
+
+/**
+ * Remove all entries from the DNS cache.
+ */
+void cddb_dns_cache_flush(void);
+
+
+/**
+ * Put the addresses of a host in the order they should be tried: the
+ * preferred address first, followed by the others alternating between
+ * address families (IPv6 and IPv4).
+ *
+ * @param addrs    The addresses to sort.
+ * @param pref     The preferred address, e.g. the one the last
+ *                 successful connect used.
+ * @param pref_len The size of the preferred address or zero if there
+ *                 is none.
+ */
+void cddb_addrs_sort(cddb_addrs_t *addrs, const struct sockaddr_storage *pref,
+                     socklen_t pref_len);
 
 /**
  * This function performs the same task as the standard connect except
- * for the fact that it might time-out if the connect takes too long.
- * In case of a time out, errno will be set to ETIMEDOUT.
- * 
+ * for the fact that it might time-out if the connect takes too long
+ * and that it races all addresses of a host.  The addresses are tried
+ * in order, each attempt started a short while after the previous one
+ * unless that one failed earlier, and the first to succeed is used.
+ * So a slow or unreachable address does not hold up the connect for
+ * the whole time-out period.  In case of a time out, errno will be set
+ * to ETIMEDOUT.
+ *
+ * @param addrs    The addresses to connect to.
+ * @param timeout  Number of milliseconds after which to time out.
+ * @param idx      Receives the index of the address connected to.
+ * @return The connected (non-blocking) socket or -1 on failure
+ *         (errno will be set).
+ */
+int timeout_connect(const cddb_addrs_t *addrs, int timeout, int *idx);
+
+/* --- non-blocking connect --- */
+
+/**
+ * Switch the socket to non-blocking mode and start connecting it.
+ *
  * @param sockfd   The socket.
  * @param addr     The address to connect to.
  * @param len      The size of the address structure.
- * @param timeout  Number of seconds after which to time out.
+ * @return Zero if the connection was established immediately, 1 if it
+ *         is still in progress or -1 on failure (errno will be set).
+ */
+int sock_connect_start(int sockfd, const struct sockaddr *addr, size_t len);
+
+/**
+ * Check the outcome of a connect started with #sock_connect_start,
+ * once the socket has become writable.
+ *
+ * @param sockfd   The socket.
  * @return Zero on success, -1 on failure (errno will be set).
  */
-int timeout_connect(int sockfd, const struct sockaddr *addr, size_t len, 
-                    int timeout);
+int sock_connect_check(int sockfd);
 
 
 #ifdef __cplusplus
@@ -54,8 +54,16 @@
 #endif
 #endif
 
+#include "cddb/cddb_scan.h"
 #include "cddb/cddb_regex.h"
 #include "cddb/cddb.h"
+#include "cddb/cddb_arena.h"
+#include "cddb/cddb_lazy.h"
+#include "cddb/cddb_index.h"
+#include "cddb/cddb_pack.h"
+#include "cddb/cddb_usage.h"
+#include "cddb/cddb_qcache.h"
+#include "cddb/cddb_dcache.h"
 #include "cddb/cddb_conn_ni.h"
 #include "cddb/cddb_net.h"
 #include "cddb/cddb_cmd_ni.h"
@@ -72,6 +80,9 @@
 #define CHR_DOT        '.'
 
 #define DEFAULT_BUF_SIZE 1024
+#define DEFAULT_RECV_BUF_SIZE 4096
+#define DEFAULT_LINE_TABLE_SIZE 64
+#define MAX_HTTP_BODY_SIZE (1024 * 1024)
 
 #define CLIENT_NAME    PACKAGE
 #define CLIENT_VERSION VERSION
@@ -84,7 +95,12 @@
 #define DEFAULT_PATH_QUERY  "/~cddb/cddb.cgi"
 #define DEFAULT_PATH_SUBMIT "/~cddb/submit.cgi"
 #define DEFAULT_CACHE       ".cddbslave"
+#define CACHE_LOCK_FILE     ".lock"
+#define CACHE_EVICT_BATCH   16
+#define DEFAULT_QUERY_CACHE_SIZE 256
 #define DEFAULT_PROXY_PORT  8080
+#define DEFAULT_DNS_CACHE_TTL 60
+#define MAX_DNS_CACHE_SIZE  16
 
 #define DEFAULT_PROTOCOL_VERSION 6
 #define SERVER_CHARSET           "UTF8"
@@ -105,6 +121,12 @@
 #define ASSERT_RANGE(num,lo,hi) \
             ASSERT((num>=lo)&&(num<=hi), CDDB_ERR_INVALID)
 
+#if defined( WIN32 )
+#define MKDIR(dir, mode)  mkdir(dir)
+#else
+#define MKDIR(dir, mode)  mkdir(dir, mode)
+#endif
+
 
 /* --- type definitions */
 
@@ -121,6 +143,8 @@ struct cddb_track_s
     struct cddb_track_s *prev;  /**< pointer to previous track, or NULL */
     struct cddb_track_s *next;  /**< pointer to next track, or NULL */
     struct cddb_disc_s *disc;   /**< disc of which this is a track */
+    cddb_span_t lazy_ext;       /**< record lines of the extended data if
+                                     they have not been decoded yet */
 };
 
 /** Actual definition of disc structure. */
@@ -138,6 +162,14 @@ struct cddb_disc_s
     int track_cnt;              /**< number of tracks on the disc */
     cddb_track_t *tracks;       /**< pointer to the first track */
     cddb_track_t *iterator;     /**< track iterator */
+    cddb_arena_t *arena;        /**< arena for the disc and track strings,
+                                     or NULL if they are allocated one by
+                                     one (see #cddb_disc_new_arena) */
+    cddb_lazy_t *lazy;          /**< raw record the fields below still have
+                                     to be decoded from, or NULL (see
+                                     #cddb_lazy_read_enable) */
+    cddb_span_t lazy_genre;     /**< record line of the genre */
+    cddb_span_t lazy_ext;       /**< record lines of the extended data */
 };
 
 
@@ -153,12 +185,25 @@ extern cddb_conn_t *cddb_search_conn;
 
 unsigned int libcddb_flags(void);
 
+/**
+ * Returns the number of seconds resolved host names are cached (see
+ * #libcddb_set_dns_cache_ttl).
+ */
+int libcddb_dns_cache_ttl(void);
+
 /**
  * Convert a string to a new character encoding according to the given
  * conversion descriptor.
  */
 int cddb_str_iconv(iconv_t cd, ICONV_CONST char *in, char **out);
 
+/**
+ * Convert a string field to a new character encoding and replace it
+ * with the result.  If an arena is given, the result is allocated
+ * from it.
+ */
+int cddb_str_iconv_field(iconv_t cd, cddb_arena_t *a, char **s);
+
 /**
  * Converts all disc and track strings to user character encoding.
  */
@@ -174,6 +219,62 @@ int cddb_track_iconv(iconv_t cd, cddb_track_t *track);
  */
 int cddb_site_iconv(iconv_t cd, cddb_site_t *site);
 
+/**
+ * Append a number of characters to a dynamically allocated string.
+ * The source does not need to be NUL terminated.  If the destination
+ * is NULL a new string is allocated.
+ */
+void cddb_str_append(char **dst, const char *src, int len);
+
+/**
+ * Look up a category by its name.  The name does not need to be NUL
+ * terminated.  Unknown names map to CDDB_CAT_MISC.
+ */
+cddb_cat_t cddb_category_n(const char *cat, int len);
+
+/**
+ * Append a number of characters to the disc title.  The source string
+ * does not need to be NUL terminated.
+ */
+void cddb_disc_append_title_n(cddb_disc_t *disc, const char *title, int len);
+
+/**
+ * Append a number of characters to the disc artist.
+ */
+void cddb_disc_append_artist_n(cddb_disc_t *disc, const char *artist, int len);
+
+/**
+ * Append a number of characters to the extended disc data.
+ */
+void cddb_disc_append_ext_data_n(cddb_disc_t *disc, const char *ext_data, int len);
+
+/**
+ * Set the disc genre from a string that is not necessarily NUL
+ * terminated.
+ */
+void cddb_disc_set_genre_n(cddb_disc_t *disc, const char *genre, int len);
+
+/**
+ * Set the disc category and genre from a string that is not
+ * necessarily NUL terminated.
+ */
+void cddb_disc_set_category_n(cddb_disc_t *disc, const char *cat, int len);
+
+/**
+ * Append a number of characters to the track title.
+ */
+void cddb_track_append_title_n(cddb_track_t *track, const char *title, int len);
+
+/**
+ * Append a number of characters to the track artist.
+ */
+void cddb_track_append_artist_n(cddb_track_t *track, const char *artist, int len);
+
+/**
+ * Append a number of characters to the extended track data.
+ */
+void cddb_track_append_ext_data_n(cddb_track_t *track, const char *ext_data, int len);
+
 /**
  * Base64 encode the source string and write it to the destination
  * buffer.  The destination buffer should be large enough (= 4/3 of
@@ -0,0 +1,182 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#ifndef CDDB_PACK_H
+#define CDDB_PACK_H 1
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/* --- type definitions */
+
+
+/**
+ * Packed cache store.  All records of a cache directory live in one
+ * data file, to which they are only ever appended.  A record that is
+ * written again is appended again, a removed record is marked with an
+ * empty one.  A separate index file lists the last version of every
+ * record in the part of the data file it covers, sorted on disc ID
+ * and category.  Both files are memory-mapped read-only.  Records
+ * appended after the index was written are found by scanning the end
+ * of the data file, which is checked for growth at most once per
+ * PACK_CHECK_INTERVAL seconds.
+ */
+typedef struct cddb_pack_s cddb_pack_t;
+
+/** Name of the data file in the cache directory. */
+#define PACK_DATA_FILE "records.pack"
+
+/** Name of the index file in the cache directory. */
+#define PACK_INDEX_FILE "records.pidx"
+
+/** Minimum number of seconds between two checks for records appended
+    by somebody else. */
+#define PACK_CHECK_INTERVAL 1
+
+/** Number of records not covered by the index above which the index
+    is rewritten when the store is closed. */
+#define PACK_TAIL_MAX 1024
+
+
+/* --- construction / destruction */
+
+
+/**
+ * Creates a new packed store for a cache directory.  The files are
+ * only opened when the store is first used and created when the first
+ * record is written.
+ *
+ * @param dir The cache directory.
+ * @return The store or NULL if memory allocation failed.
+ */
+cddb_pack_t *cddb_pack_new(const char *dir);
+
+/**
+ * Close the store.  If many records are not covered by the index, the
+ * index file is rewritten first.
+ *
+ * @param pack The store.
+ */
+void cddb_pack_destroy(cddb_pack_t *pack);
+
+
+/* --- lookup and update --- */
+
+
+/**
+ * Look up a disc ID.
+ *
+ * @param pack   The store.
+ * @param discid The disc ID.
+ * @return A bit mask of the categories that hold a record for the
+ *         disc, BIT(category) for each of them.
+ */
+int cddb_pack_lookup(cddb_pack_t *pack, unsigned int discid);
+
+/**
+ * Get a record.  The record is not terminated and only valid until
+ * the next call for this store.
+ *
+ * @param pack   The store.
+ * @param discid The disc ID.
+ * @param cat    The category.
+ * @param len    Set to the length of the record.
+ * @return The record or NULL if there is none.
+ */
+const char *cddb_pack_get(cddb_pack_t *pack, unsigned int discid,
+                          cddb_cat_t cat, int *len);
+
+/**
+ * Append a record, replacing any earlier one for the same disc ID
+ * and category.
+ *
+ * @param pack   The store.
+ * @param discid The disc ID.
+ * @param cat    The category.
+ * @param data   The record.
+ * @param len    The length of the record, not zero.
+ * @return TRUE on success, FALSE otherwise.
+ */
+int cddb_pack_put(cddb_pack_t *pack, unsigned int discid, cddb_cat_t cat,
+                  const char *data, int len);
+
+/**
+ * Append a record like #cddb_pack_put, without looking at the data
+ * file afterwards.  The store only finds the record once it checks
+ * the files again (see #cddb_pack_recheck).  Use this to add many
+ * records in a row.
+ *
+ * @param pack   The store.
+ * @param discid The disc ID.
+ * @param cat    The category.
+ * @param data   The record.
+ * @param len    The length of the record, not zero.
+ * @return TRUE on success, FALSE otherwise.
+ */
+int cddb_pack_add(cddb_pack_t *pack, unsigned int discid, cddb_cat_t cat,
+                  const char *data, int len);
+
+/**
+ * Remove a record.
+ *
+ * @param pack   The store.
+ * @param discid The disc ID.
+ * @param cat    The category.
+ * @return TRUE on success, FALSE otherwise.
+ */
+int cddb_pack_remove(cddb_pack_t *pack, unsigned int discid, cddb_cat_t cat);
+
+/**
+ * Make the next lookup check the files for changes made by somebody
+ * else, even if the last check was less than PACK_CHECK_INTERVAL
+ * seconds ago.
+ *
+ * @param pack The store.
+ */
+void cddb_pack_recheck(cddb_pack_t *pack);
+
+/**
+ * Write the index file, covering all records of the data file.
+ *
+ * @param pack The store.
+ * @return TRUE on success, FALSE otherwise.
+ */
+int cddb_pack_save_index(cddb_pack_t *pack);
+
+/**
+ * Copy all records of a cache directory with one file per record into
+ * the store, skipping the ones it already holds.  The index file is
+ * written afterwards.
+ *
+ * @param pack The store.
+ * @param dir  The cache directory.
+ * @return The number of records copied or -1 on error.
+ */
+int cddb_pack_convert(cddb_pack_t *pack, const char *dir);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif /* CDDB_PACK_H */
@@ -0,0 +1,120 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#ifndef CDDB_PARSER_H
+#define CDDB_PARSER_H 1
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+#include "cddb/cddb_error.h"
+#include "cddb/cddb_disc.h"
+
+
+/* --- type and structure definitions */
+
+
+/**
+ * An incremental CDDB record parser.  Data is pushed into it in
+ * chunks of any size, as they arrive from a socket or are read from
+ * a file, and the parser fills in a disc structure as it goes.  The
+ * parser keeps its state, including a partially received line,
+ * between calls.
+ */
+typedef struct cddb_parser_s cddb_parser_t;
+
+
+/* --- construction / destruction */
+
+
+/**
+ * Creates a new parser that will fill in the given disc.  The disc
+ * structure should exist for as long as the parser is in use.
+ *
+ * @param disc The disc structure to fill in.
+ * @return The parser or NULL if memory allocation failed.
+ */
+cddb_parser_t *cddb_parser_new(cddb_disc_t *disc);
+
+/**
+ * Free all resources associated with the given parser.  The disc
+ * structure is not destroyed.
+ *
+ * @param p The parser.
+ */
+void cddb_parser_destroy(cddb_parser_t *p);
+
+
+/* --- parsing --- */
+
+
+/**
+ * Push the next chunk of a CDDB record into the parser.  Lines may be
+ * split across chunks in any way.  Parsing stops after the line with
+ * the terminating dot; any data after it is not consumed, so the
+ * caller can hand it to whatever follows the record.
+ *
+ * No character set conversion is done, the strings in the disc
+ * structure are in the encoding of the record itself.
+ *
+ * @param p   The parser.
+ * @param buf The data.
+ * @param len The number of bytes in the buffer.
+ * @return The number of bytes consumed or -1 if the record is
+ *         invalid (see #cddb_parser_errno).
+ */
+int cddb_parser_feed(cddb_parser_t *p, const char *buf, int len);
+
+/**
+ * Signal the end of the input.  A last line without a line terminator
+ * is parsed now.  A record without a terminating dot, as found in the
+ * local cache, is complete when its input ends.
+ *
+ * @param p The parser.
+ * @return TRUE if a valid record was parsed, FALSE otherwise.
+ */
+int cddb_parser_finish(cddb_parser_t *p);
+
+/**
+ * Check whether the parser has seen the end of the record.
+ *
+ * @param p The parser.
+ * @return TRUE if the record is complete or parsing stopped because
+ *         of an error, FALSE if it needs more data.
+ */
+int cddb_parser_done(const cddb_parser_t *p);
+
+/**
+ * Get the error that stopped the parser.
+ *
+ * @param p The parser.
+ * @return CDDB_ERR_OK or the error code.
+ */
+cddb_error_t cddb_parser_errno(const cddb_parser_t *p);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif /* CDDB_PARSER_H */
@@ -0,0 +1,113 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#ifndef CDDB_QCACHE_H
+#define CDDB_QCACHE_H 1
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/* --- type definitions */
+
+
+/**
+ * Memory cache of local cache query results.  It remembers in which
+ * category a disc was found, keyed on its disc ID and track count,
+ * and optionally that a disc was not found.  When it is full, the
+ * least recently used result is dropped.  All functions lock the
+ * cache, so it can be shared between threads.
+ */
+typedef struct cddb_qcache_s cddb_qcache_t;
+
+
+/* --- construction / destruction */
+
+
+/**
+ * Creates a new query cache.
+ *
+ * @param size The maximum number of results to remember.
+ * @return The cache or NULL if the size is zero or memory allocation
+ *         failed.
+ */
+cddb_qcache_t *cddb_qcache_new(unsigned int size);
+
+/**
+ * Free the query cache.
+ *
+ * @param qc The query cache.
+ */
+void cddb_qcache_destroy(cddb_qcache_t *qc);
+
+
+/* --- lookup and update --- */
+
+
+/**
+ * Look up the query result of a disc.
+ *
+ * @param qc     The query cache.
+ * @param discid The disc ID.
+ * @param tracks The number of tracks.
+ * @param cat    Set to the category of the disc, or to
+ *               CDDB_CAT_INVALID if the disc was not found.
+ * @return TRUE if a result is known, FALSE otherwise.
+ */
+int cddb_qcache_lookup(cddb_qcache_t *qc, unsigned int discid, int tracks,
+                       cddb_cat_t *cat);
+
+/**
+ * Remember the query result of a disc.
+ *
+ * @param qc     The query cache.
+ * @param discid The disc ID.
+ * @param tracks The number of tracks.
+ * @param cat    The category of the disc, or CDDB_CAT_INVALID if it
+ *               was not found.
+ * @param ttl    Number of seconds the result stays valid, or 0 if it
+ *               does not expire.
+ */
+void cddb_qcache_store(cddb_qcache_t *qc, unsigned int discid, int tracks,
+                       cddb_cat_t cat, int ttl);
+
+/**
+ * Forget all query results.
+ *
+ * @param qc The query cache.
+ */
+void cddb_qcache_clear(cddb_qcache_t *qc);
+
+/**
+ * Forget all query results of a disc ID, whatever its track count.
+ *
+ * @param qc     The query cache.
+ * @param discid The disc ID.
+ */
+void cddb_qcache_forget(cddb_qcache_t *qc, unsigned int discid);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif /* CDDB_QCACHE_H */
@@ -35,6 +35,7 @@
 #endif
 #include <sys/types.h>          /* need for MacOS X */
 #include <regex.h>
+#include <cddb/cddb_scan.h>
 
 
 extern regex_t *REGEX_TRACK_FRAME_OFFSETS;
@@ -50,7 +51,6 @@ extern regex_t *REGEX_TRACK_EXT;
 extern regex_t *REGEX_PLAY_ORDER;
 extern regex_t *REGEX_QUERY_MATCH;
 extern regex_t *REGEX_SITE;
-extern regex_t *REGEX_TEXT_SEARCH;
 
 
 void cddb_regex_init(void);
@@ -65,6 +65,33 @@ double cddb_regex_get_float(const char *s, regmatch_t matches[], int idx);
 
 char *cddb_regex_get_string(const char *s, regmatch_t matches[], int idx);
 
+/**
+ * Match a CDDB record line against the regular expression for one
+ * kind of line and fill in its fields.  This is the regular expression
+ * counterpart of #cddb_scan_record_line, used when the
+ * CDDB_F_REGEX_PARSER flag is set.
+ *
+ * @param kind The kind of line to test for.
+ * @param line The line to match.
+ * @param f    Receives the fields of the line if it matches.
+ * @return TRUE if the line is of the requested kind, FALSE otherwise.
+ */
+int cddb_regex_record_line(cddb_line_kind_t kind, const char *line,
+                           cddb_field_t *f);
+
+/**
+ * Pointer to the start of a matched sub-expression inside the source
+ * string.  Use together with cddb_regex_len to access the match without
+ * copying it.
+ */
+#define cddb_regex_ptr(s, matches, idx) ((s) + (matches)[idx].rm_so)
+
+/**
+ * Length of a matched sub-expression.
+ */
+#define cddb_regex_len(matches, idx) \
+    ((int)((matches)[idx].rm_eo - (matches)[idx].rm_so))
+
 
 #ifdef __cplusplus
     }
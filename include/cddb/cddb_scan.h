@@ -0,0 +1,196 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#ifndef CDDB_SCAN_H
+#define CDDB_SCAN_H 1
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/**
+ * The different kinds of lines found in a CDDB record.
+ */
+typedef enum {
+    LINE_OTHER = 0,             /**< comment or unknown line */
+    LINE_TRACK_FRAME_OFFSETS,   /**< '# Track frame offsets:' */
+    LINE_TRACK_FRAME_OFFSET,    /**< '#  150' */
+    LINE_DISC_LENGTH,           /**< '# Disc length: 2330 seconds' */
+    LINE_DISC_REVISION,         /**< '# Revision: 1' */
+    LINE_DISC_TITLE,            /**< 'DTITLE=...' */
+    LINE_DISC_YEAR,             /**< 'DYEAR=...' */
+    LINE_DISC_GENRE,            /**< 'DGENRE=...' */
+    LINE_DISC_EXT,              /**< 'EXTD=...' */
+    LINE_TRACK_TITLE,           /**< 'TTITLEn=...' */
+    LINE_TRACK_EXT,             /**< 'EXTTn=...' */
+    LINE_PLAY_ORDER,            /**< 'PLAYORDER=...' */
+} cddb_line_kind_t;
+
+/**
+ * The fields of a single classified CDDB record line.  The string
+ * fields point into the line itself and are not NUL-terminated.
+ */
+typedef struct cddb_field_s
+{
+    cddb_line_kind_t kind;      /**< kind of line */
+    int num;                    /**< frame offset, length, revision, year
+                                     or track number */
+    const char *str;            /**< value after the '=', or the artist
+                                     if the value contains ' / ' */
+    int len;                    /**< length of str */
+    const char *title;          /**< title after the last ' / ', or NULL
+                                     if there is no separator */
+    int title_len;              /**< length of title */
+} cddb_field_t;
+
+/**
+ * The fields of a query result line, '<category> <discid> <title>'
+ * where the title is either 'artist / title' or just a title.  The
+ * string fields point into the line itself and are not NUL-terminated.
+ */
+typedef struct cddb_query_line_s
+{
+    const char *cat;            /**< category name */
+    int cat_len;                /**< length of the category name */
+    unsigned int discid;        /**< disc ID */
+    const char *artist;         /**< artist, or NULL if there is no
+                                     ' / ' separator */
+    int artist_len;             /**< length of artist */
+    const char *title;          /**< disc title */
+    int title_len;              /**< length of title */
+} cddb_query_line_t;
+
+/**
+ * One hit on a full text search result page.  The string fields
+ * point into the page line and are not NUL-terminated.
+ */
+typedef struct cddb_search_hit_s
+{
+    const char *cat;            /**< category name */
+    int cat_len;                /**< length of the category name */
+    unsigned int discid;        /**< disc ID */
+    const char *artist;         /**< artist, or NULL for a duplicate */
+    int artist_len;             /**< length of artist */
+    const char *title;          /**< title, or NULL for a duplicate */
+    int title_len;              /**< length of title */
+    int dup;                    /**< number of a duplicate of the previous
+                                     hit (same artist and title, other
+                                     disc ID), or 0 */
+} cddb_search_hit_t;
+
+/**
+ * Callback prototype for search hits.
+ *
+ * @param hit The hit.
+ * @param arg The callback argument.
+ * @return TRUE to continue scanning, FALSE to stop.
+ */
+typedef int cddb_search_hit_cb(const cddb_search_hit_t *hit, void *arg);
+
+/**
+ * A line found by #cddb_scan_lines.
+ */
+typedef struct cddb_line_ref_s
+{
+    int off;                    /**< offset of the line in the buffer */
+    int len;                    /**< length of the line without its line
+                                     terminator (LF or CR LF) */
+    int eq;                     /**< offset of the first '=' within the
+                                     line, or len if there is none */
+} cddb_line_ref_t;
+
+
+/**
+ * Split a buffer into lines and locate the first '=' of every line,
+ * which separates the keyword of a record line from its value.  The
+ * whole buffer is scanned in one pass, using SSE2 or AVX2 when the
+ * CPU supports them.  Only lines terminated by a line feed are
+ * returned, the caller has to deal with the rest of the buffer.
+ *
+ * @param buf   The buffer.
+ * @param len   The number of bytes in the buffer.
+ * @param lines The line table to fill in.
+ * @param max   The size of the line table, at least 1.
+ * @param used  Receives the offset just past the last line returned.
+ * @return The number of lines found.
+ */
+int cddb_scan_lines(const char *buf, int len, cddb_line_ref_t *lines,
+                    int max, int *used);
+
+/**
+ * Select the implementation used by #cddb_scan_lines.  This is only
+ * useful for testing and benchmarking, by default the fastest one
+ * the CPU supports is used.
+ *
+ * @param name 'avx2', 'sse2', 'scalar' or NULL for the fastest one.
+ * @return The name of the selected implementation or NULL if it is
+ *         not available.
+ */
+const char *cddb_scan_lines_use(const char *name);
+
+/**
+ * Classify one line of a CDDB record by its keyword prefix and split
+ * it into its fields in a single pass.  The result is the same as
+ * matching the line against the REGEX_* record expressions.
+ *
+ * @param line The line, without its line terminator.
+ * @param len  The length of the line.
+ * @param eq   The offset of the first '=' in the line, len if there
+ *             is none, or -1 if it is not known yet.
+ * @param f    Receives the kind and fields of the line.
+ * @return The kind of line.
+ */
+cddb_line_kind_t cddb_scan_record_line(const char *line, int len, int eq,
+                                       cddb_field_t *f);
+
+/**
+ * Split a query result line into its fields in a single pass.  The
+ * result is the same as matching the line against REGEX_QUERY_MATCH.
+ *
+ * @param line The NUL-terminated line.
+ * @param q    Receives the fields of the line.
+ * @return TRUE if the line is a valid query result, FALSE otherwise.
+ */
+int cddb_scan_query_line(const char *line, cddb_query_line_t *q);
+
+/**
+ * Find all search hits on one line of a full text search result page
+ * in a single forward scan.  A hit is an anchor that links to
+ * 'freedb_search_fmt.php?cat=...&id=...' and contains either
+ * 'artist / title', a title, or a duplicate number.  Hits are handed
+ * to the callback in the order they appear on the line.
+ *
+ * @param line The NUL-terminated line.
+ * @param cb   The callback called for every hit.
+ * @param arg  The callback argument.
+ * @return The number of hits found or -1 if the callback stopped the
+ *         scan.
+ */
+int cddb_scan_search_line(const char *line, cddb_search_hit_cb *cb,
+                          void *arg);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif /* CDDB_SCAN_H */
@@ -182,6 +182,10 @@ void cddb_track_append_artist(cddb_track_t *track, const char *artist);
  * Get the extended track data.  If no extended data is set for this
  * track then NULL will be returned.
  *
+ * If the disc of the track was read lazily, the first call decodes
+ * the data into the track, so it is not thread-safe for such a
+ * track.
+ *
  * @param track The CDDB track structure.
  * @return The extended data.
  */
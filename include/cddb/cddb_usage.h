@@ -0,0 +1,176 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#ifndef CDDB_USAGE_H
+#define CDDB_USAGE_H 1
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+
+/* --- type definitions */
+
+
+/**
+ * Name of the access log in the cache directory.
+ */
+#define USAGE_LOG_FILE ".usage"
+
+
+/**
+ * Usage table of a cache directory.  It knows the size of every
+ * cache entry and keeps the entries in least recently used order,
+ * so that the cache can be kept within a size limit.  The table is
+ * built by scanning the category directories, ordering the entries
+ * on the last time they were read or written according to the access
+ * log, or on the access or modification time of their files if that
+ * is later.  From then on, the entries read and written through the
+ * table move to the front and are appended to the access log, so
+ * that the order survives when the table is built again.
+ */
+typedef struct cddb_usage_s cddb_usage_t;
+
+
+/* --- construction / destruction */
+
+
+/**
+ * Creates a new usage table for a cache directory.  The table is
+ * empty until it is scanned.
+ *
+ * @param dir The cache directory.
+ * @return The table or NULL if memory allocation failed.
+ */
+cddb_usage_t *cddb_usage_new(const char *dir);
+
+/**
+ * Free the usage table.  A scan that is still running in the
+ * background is stopped and the access log is flushed.
+ *
+ * @param u The table.
+ */
+void cddb_usage_destroy(cddb_usage_t *u);
+
+
+/* --- lookup and update --- */
+
+
+/**
+ * Replace the contents of the table with what is found in the
+ * category directories.
+ *
+ * @param u The table.
+ * @return TRUE on success, FALSE if memory ran out or the system
+ *         cannot scan directories.
+ */
+int cddb_usage_scan(cddb_usage_t *u);
+
+/**
+ * Start replacing the contents of the table with what is found in
+ * the category directories in a separate thread.  Until that is done
+ * the entries that are read, written and removed are only recorded,
+ * and no entry is over the limit.  Without thread support, or if the
+ * thread cannot be created, the table is scanned right away.
+ *
+ * @param u The table.
+ * @return TRUE on success, FALSE if scanning right away failed.
+ */
+int cddb_usage_scan_start(cddb_usage_t *u);
+
+/**
+ * Check whether a scan started in the background has finished.  The
+ * recorded changes are applied when it has.
+ *
+ * @param u The table.
+ * @return TRUE if the table is ready, FALSE if it is still scanned.
+ */
+int cddb_usage_ready(cddb_usage_t *u);
+
+/**
+ * Record that a cache entry has been read.  It becomes the most
+ * recently used one.  Nothing happens if the entry is unknown.
+ *
+ * @param u      The table.
+ * @param discid The disc ID.
+ * @param cat    The category.
+ */
+void cddb_usage_touch(cddb_usage_t *u, unsigned int discid, cddb_cat_t cat);
+
+/**
+ * Record that a cache entry has been written.  It becomes the most
+ * recently used one.
+ *
+ * @param u      The table.
+ * @param discid The disc ID.
+ * @param cat    The category.
+ * @param size   The size of the entry in bytes.
+ */
+void cddb_usage_add(cddb_usage_t *u, unsigned int discid, cddb_cat_t cat,
+                    unsigned long size);
+
+/**
+ * Record that a cache entry has been removed.
+ *
+ * @param u      The table.
+ * @param discid The disc ID.
+ * @param cat    The category.
+ */
+void cddb_usage_remove(cddb_usage_t *u, unsigned int discid, cddb_cat_t cat);
+
+/**
+ * Get the least recently used cache entry.  The most recently used
+ * one is never returned, so a single entry that is larger than the
+ * limit by itself is kept.  Nothing is returned while the table is
+ * scanned in the background.
+ *
+ * @param u      The table.
+ * @param discid Set to the disc ID.
+ * @param cat    Set to the category.
+ * @return TRUE if there is such an entry, FALSE otherwise.
+ */
+int cddb_usage_oldest(cddb_usage_t *u, unsigned int *discid, cddb_cat_t *cat);
+
+/**
+ * Check whether the cache holds more than allowed.
+ *
+ * @param u         The table.
+ * @param max_bytes The maximum total size in bytes, 0 for no limit.
+ * @param max_count The maximum number of entries, 0 for no limit.
+ * @return TRUE if it does, FALSE otherwise or while the table is
+ *         scanned in the background.
+ */
+int cddb_usage_over(cddb_usage_t *u, unsigned long max_bytes,
+                    unsigned int max_count);
+
+/**
+ * Append the access log lines collected so far to the log file.
+ *
+ * @param u The table.
+ */
+void cddb_usage_flush(cddb_usage_t *u);
+
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif /* CDDB_USAGE_H */
@@ -34,6 +34,9 @@ static int initialized = 0;
 /** Library flags. */
 static unsigned int _flags = 0;
 
+/** Time-to-live of the DNS cache in seconds. */
+static int _dns_ttl = DEFAULT_DNS_CACHE_TTL;
+
 
 /* --- public functions */
 
@@ -57,6 +60,7 @@ void libcddb_shutdown(void)
     if (initialized) {
         cddb_regex_destroy();
         cddb_destroy(cddb_search_conn);
+        cddb_dns_cache_flush();
         initialized = 0;
     }
 }
@@ -75,3 +79,16 @@ void libcddb_reset_flags(unsigned int flags)
 {
     _flags &= ~flags;
 }
+
+int libcddb_dns_cache_ttl(void)
+{
+    return _dns_ttl;
+}
+
+void libcddb_set_dns_cache_ttl(int seconds)
+{
+    _dns_ttl = (seconds > 0) ? seconds : 0;
+    if (_dns_ttl == 0) {
+        cddb_dns_cache_flush();
+    }
+}
@@ -0,0 +1,216 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#include "cddb/cddb_ni.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/* --- type and structure definitions */
+
+
+/** Size of the first block of an arena. */
+#define ARENA_BLOCK_SIZE 2048
+
+/** Blocks stop doubling in size once they reach this size. */
+#define ARENA_BLOCK_MAX  65536
+
+/**
+ * A block of arena memory.  The data follows the block header.
+ */
+typedef struct cddb_arena_block_s
+{
+    struct cddb_arena_block_s *prev; /**< previous (older) block */
+    int size;                   /**< number of data bytes in the block */
+    int used;                   /**< number of data bytes handed out */
+} cddb_arena_block_t;
+
+#define BLOCK_DATA(b) ((char*)((b) + 1))
+
+/**
+ * Actual definition of the arena structure.  The first block is part
+ * of the same allocation and follows the arena structure.
+ */
+struct cddb_arena_s
+{
+    cddb_arena_block_t *block;  /**< block allocations are made from */
+    char *last;                 /**< most recent allocation, or NULL */
+    int next_size;              /**< size of the next block to allocate */
+};
+
+#define FIRST_BLOCK(a) ((cddb_arena_block_t*)((a) + 1))
+
+
+/* --- construction / destruction */
+
+
+cddb_arena_t *cddb_arena_new(void)
+{
+    cddb_arena_t *a;
+
+    a = (cddb_arena_t*)malloc(sizeof(cddb_arena_t) +
+                              sizeof(cddb_arena_block_t) + ARENA_BLOCK_SIZE);
+    if (a) {
+        a->block = FIRST_BLOCK(a);
+        a->block->prev = NULL;
+        a->block->size = ARENA_BLOCK_SIZE;
+        a->block->used = 0;
+        a->last = NULL;
+        a->next_size = ARENA_BLOCK_SIZE * 2;
+    }
+    return a;
+}
+
+void cddb_arena_destroy(cddb_arena_t *a)
+{
+    cddb_arena_block_t *b, *prev;
+
+    if (a) {
+        for (b = a->block; b != FIRST_BLOCK(a); b = prev) {
+            prev = b->prev;
+            free(b);
+        }
+        free(a);
+    }
+}
+
+
+/* --- allocation --- */
+
+
+char *cddb_arena_alloc(cddb_arena_t *a, int size)
+{
+    cddb_arena_block_t *b = a->block;
+    char *p;
+
+    if (b->size - b->used < size) {
+        /* start a new block, big enough for this allocation */
+        int bsize = a->next_size;
+
+        while (bsize < size) {
+            bsize *= 2;
+        }
+        b = (cddb_arena_block_t*)malloc(sizeof(cddb_arena_block_t) + bsize);
+        if (!b) {
+            return NULL;
+        }
+        b->prev = a->block;
+        b->size = bsize;
+        b->used = 0;
+        a->block = b;
+        if (a->next_size < ARENA_BLOCK_MAX) {
+            a->next_size *= 2;
+        }
+    }
+    p = BLOCK_DATA(b) + b->used;
+    b->used += size;
+    a->last = p;
+    return p;
+}
+
+void cddb_arena_trim(cddb_arena_t *a, char *s, int len)
+{
+    if (s && s == a->last) {
+        a->block->used = (s - BLOCK_DATA(a->block)) + len + 1;
+    }
+}
+
+int cddb_arena_owns(const cddb_arena_t *a, const void *p)
+{
+    const cddb_arena_block_t *b;
+    const char *c = (const char*)p;
+
+    for (b = a->block; b; b = b->prev) {
+        if ((c >= BLOCK_DATA(b)) && (c < BLOCK_DATA(b) + b->size)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+
+/* --- string fields --- */
+
+
+void cddb_arena_str_free(cddb_arena_t *a, char **s)
+{
+    if (*s) {
+        if (!a || !cddb_arena_owns(a, *s)) {
+            free(*s);
+        } else if (*s == a->last) {
+            /* give back the space of the last allocation */
+            a->block->used = *s - BLOCK_DATA(a->block);
+            a->last = NULL;
+        }
+        *s = NULL;
+    }
+}
+
+void cddb_arena_str_set(cddb_arena_t *a, char **s, const char *src)
+{
+    cddb_arena_str_free(a, s);
+    if (src) {
+        if (a) {
+            cddb_arena_str_append(a, s, src, strlen(src));
+        } else {
+            *s = strdup(src);
+        }
+    }
+}
+
+void cddb_arena_str_append(cddb_arena_t *a, char **s, const char *src, int len)
+{
+    cddb_arena_block_t *b;
+    int old_len = 0;
+    char *p;
+
+    if (!a) {
+        cddb_str_append(s, src, len);
+        return;
+    }
+    b = a->block;
+    if (*s && *s == a->last) {
+        /* the last allocation is exactly the string plus its NUL */
+        old_len = BLOCK_DATA(b) + b->used - *s - 1;
+        if (b->size - b->used >= len) {
+            /* extend in place */
+            memcpy(*s + old_len, src, len);
+            (*s)[old_len + len] = CHR_EOS;
+            b->used += len;
+            return;
+        }
+    } else if (*s) {
+        old_len = strlen(*s);
+    }
+    p = cddb_arena_alloc(a, old_len + len + 1);
+    if (p) {
+        if (old_len > 0) {
+            memcpy(p, *s, old_len);
+        }
+        memcpy(p + old_len, src, len);
+        p[old_len + len] = CHR_EOS;
+        if (*s && !cddb_arena_owns(a, *s)) {
+            free(*s);
+        }
+        *s = p;
+    }
+}
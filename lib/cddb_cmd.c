@@ -30,6 +30,11 @@
 #include "cddb/cddb_ni.h"
 #include "cddb/ll.h"
 
+/* after cddb_ni.h, which pulls in config.h */
+#ifdef HAVE_FCNTL_H
+#  include <fcntl.h>
+#endif
+
 
 static const char *CDDB_COMMANDS[CMD_LAST] = {
     "cddb hello %s %s %s %s",
@@ -45,20 +50,21 @@ static const char *CDDB_COMMANDS[CMD_LAST] = {
 
 #define WRITE_BUF_SIZE 4096
 
-
-/*
- * Small memory cache for querying local database.
- */
-#define QUERY_CACHE_SIZE 256
-static struct query_cache_entry {
-    unsigned int discid;
-    cddb_cat_t category;
-} query_cache[QUERY_CACHE_SIZE];
+/* maximum number of pipelined commands waiting for a response */
+#define MAX_PIPELINE_DEPTH 16
 
 
 /* --- prototypes --- */
 
 
+/**
+ * Read the next line from the server.  The view points
+ * into a receive buffer and is valid until the next line is read.
+ *
+ * @return TRUE if a line was read, FALSE if something goes wrong
+ */
+int cddb_next_line(cddb_conn_t *c, cddb_line_t *line);
+
 /**
  * @return the line read or NULL if something goes wrong
  */
@@ -71,19 +77,34 @@ int cddb_write_data(cddb_conn_t *c, char *buf, int size, cddb_disc_t *disc);
 
 int cddb_http_parse_response(cddb_conn_t *c);
 
-void cddb_http_parse_headers(cddb_conn_t *c);
+/**
+ * Parse the HTTP response headers.
+ *
+ * @return the value of the Content-Length header or -1 if not present
+ */
+int cddb_http_parse_headers(cddb_conn_t *c, int *chunked);
+
+int cddb_http_write_cmd(cddb_conn_t *c, cddb_cmd_t cmd, va_list args);
+
+int cddb_http_recv_headers(cddb_conn_t *c);
 
 int cddb_http_send_cmd(cddb_conn_t *c, cddb_cmd_t cmd, va_list args);
 
 int cddb_parse_record(cddb_conn_t *c, cddb_disc_t *disc);
 
+static void cddb_skip_data(cddb_conn_t *c);
+
+static int cddb_parse_cached_record(cddb_conn_t *c, cddb_disc_t *disc);
+
+static int cddb_parse_cached_data(cddb_conn_t *c, cddb_disc_t *disc,
+                                  char *buf, int size);
+
 static int cddb_parse_query_data(cddb_conn_t *c, cddb_disc_t *disc,
                                  const char *line);
 
 static int cddb_handle_response_list(cddb_conn_t *c, cddb_disc_t *disc);
 
-static int cddb_parse_search_data(cddb_conn_t *c, cddb_disc_t **disc,
-                                  char *line, regmatch_t *matches);
+static int cddb_add_search_hit(const cddb_search_hit_t *hit, void *arg);
 
 static void cddb_search_param_str(cddb_search_params_t *params,
                                   char *buf, int len);
@@ -102,11 +123,6 @@ int cddb_cache_query(cddb_conn_t *c, cddb_disc_t *disc);
 
 int cddb_cache_query_disc(cddb_conn_t *c, cddb_disc_t *disc);
 
-/**
- * Initialize the local query cache.
- */
-void cddb_cache_query_init(void);
-
 int cddb_cache_mkdir(cddb_conn_t *c, cddb_disc_t *disc);
 
 
@@ -135,11 +151,25 @@ char *cddb_cache_file_name(cddb_conn_t *c, cddb_disc_t *disc)
 
 int cddb_cache_exists(cddb_conn_t *c, cddb_disc_t *disc)
 {
-    int rv = FALSE;
+    int rv = FALSE, cats;
     char *fn = NULL;
     struct stat buf;
+    cddb_index_t *idx;
 
     cddb_log_debug("cddb_cache_exists()");
+    if (cddb_cache_pack(c)) {
+        cats = cddb_pack_lookup(c->cache_pack, disc->discid);
+        rv = (cats & BIT(disc->category)) != 0;
+        cddb_log_debug(rv ? "...in cache" : "...not in cache");
+        return rv;
+    }
+    /* ask the presence index first */
+    idx = cddb_cache_index(c);
+    if (idx && ((cats = cddb_index_lookup(idx, disc->discid)) != -1)) {
+        rv = (cats & BIT(disc->category)) != 0;
+        cddb_log_debug(rv ? "...in cache" : "...not in cache");
+        return rv;
+    }
     /* try to stat cache file */
     fn = cddb_cache_file_name(c, disc);
     if (fn) {
@@ -154,6 +184,173 @@ int cddb_cache_exists(cddb_conn_t *c, cddb_disc_t *disc)
     return rv;
 }
 
+/**
+ * Drop what the memory caches know about a disc whose cache entry has
+ * been written or removed.
+ */
+static void cddb_cache_forget_memory(cddb_conn_t *c, unsigned int discid,
+                                     cddb_cat_t cat)
+{
+    if (c->query_cache) {
+        cddb_qcache_forget(c->query_cache, discid);
+    }
+    if (c->disc_cache) {
+        cddb_dcache_forget(c->disc_cache, cat, discid);
+    }
+}
+
+/**
+ * Remove least recently used cache entries while the cache holds more
+ * than allowed.
+ *
+ * @param max The maximum number of entries to remove, 0 for as many
+ *            as needed.
+ * @return The number of entries removed.
+ */
+static int cddb_cache_evict(cddb_conn_t *c, cddb_usage_t *u, int max)
+{
+    cddb_index_t *idx = cddb_cache_index(c);
+    unsigned int discid;
+    cddb_cat_t cat;
+    char *fn;
+    int len, n = 0;
+
+    len = strlen(c->cache_dir) + 32;
+    fn = (char*)malloc(len);
+    if (!fn) {
+        cddb_errno_log_crit(c, CDDB_ERR_OUT_OF_MEMORY);
+        return 0;
+    }
+    while (((max == 0) || (n < max)) &&
+           cddb_usage_over(u, c->cache_max_bytes, c->cache_max_entries) &&
+           cddb_usage_oldest(u, &discid, &cat)) {
+        snprintf(fn, len, "%s/%s/%08x", c->cache_dir, CDDB_CATEGORY[cat],
+                 discid);
+        if (idx) {
+            cddb_index_prepare(idx, cat);
+        }
+        if ((unlink(fn) == -1) && (errno != ENOENT)) {
+            cddb_log_warn("cannot remove cache entry '%s'", fn);
+            break;
+        }
+        cddb_log_debug("...removed cache entry '%s'", fn);
+        cddb_usage_remove(u, discid, cat);
+        if (idx) {
+            cddb_index_remove(idx, discid, cat);
+        }
+        cddb_cache_forget_memory(c, discid, cat);
+        n++;
+    }
+    free(fn);
+    return n;
+}
+
+/**
+ * Count a cache entry that has just been written.  If that takes the
+ * cache over its limit, a few of the least recently used entries are
+ * removed.
+ */
+static void cddb_cache_account(cddb_conn_t *c)
+{
+    cddb_usage_t *u;
+    struct stat st;
+
+    u = cddb_cache_usage(c);
+    if (!u || (stat(c->cache_fn, &st) == -1)) {
+        return;
+    }
+    cddb_usage_add(u, c->cache_put_discid, c->cache_put_cat, st.st_size);
+    cddb_cache_evict(c, u, CACHE_EVICT_BATCH);
+}
+
+int cddb_cache_trim(cddb_conn_t *c)
+{
+    cddb_usage_t *u;
+    int n;
+
+    cddb_log_debug("cddb_cache_trim()");
+    if ((c->use_cache == CACHE_OFF) || !c->cache_dir ||
+        (c->cache_backend != CACHE_BACKEND_DIR) ||
+        (!c->cache_max_bytes && !c->cache_max_entries)) {
+        /* nothing to do */
+        cddb_errno_set(c, CDDB_ERR_OK);
+        return 0;
+    }
+    /* scan again, for entries added by somebody else, and wait for
+       it to finish */
+    cddb_usage_destroy(c->cache_usage);
+    c->cache_usage = u = cddb_usage_new(c->cache_dir);
+    if (!u) {
+        cddb_errno_log_crit(c, CDDB_ERR_OUT_OF_MEMORY);
+        return -1;
+    }
+    if (!cddb_usage_scan(u)) {
+        cddb_log_warn("cannot scan cache directory '%s'", c->cache_dir);
+        cddb_usage_destroy(u);
+        c->cache_usage = NULL;
+        cddb_errno_set(c, CDDB_ERR_UNKNOWN);
+        return -1;
+    }
+    n = cddb_cache_evict(c, u, 0);
+    cddb_errno_set(c, CDDB_ERR_OK);
+    return n;
+}
+
+/**
+ * Create a temporary file next to a cache entry and open it for
+ * writing.  It is renamed to the cache entry when it is closed, so
+ * that nobody ever sees an incomplete entry.
+ *
+ * @param fn The file name of the cache entry, kept by the connection.
+ */
+static int cddb_cache_create(cddb_conn_t *c, char *fn)
+{
+    cddb_index_t *idx = cddb_cache_index(c);
+    char *tmp;
+    int fd;
+
+    tmp = (char*)malloc(strlen(fn) + 16);
+    if (!tmp) {
+        cddb_errno_log_crit(c, CDDB_ERR_OUT_OF_MEMORY);
+        free(fn);
+        return FALSE;
+    }
+    if (idx) {
+        cddb_index_prepare(idx, c->cache_put_cat);
+    }
+#ifdef HAVE_MKSTEMP
+    sprintf(tmp, "%s.XXXXXX", fn);
+    fd = mkstemp(tmp);
+    if (fd != -1) {
+        /* mkstemp only allows the owner to read the file */
+        fchmod(fd, 0644);
+    }
+#else
+    sprintf(tmp, "%s.%d", fn, (int)getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd != -1) {
+        c->cache_fp = fdopen(fd, "w");
+        if (!c->cache_fp) {
+            close(fd);
+            unlink(tmp);
+        }
+    }
+    if (idx) {
+        /* the temporary file changed the category directory */
+        cddb_index_touch(idx, c->cache_put_cat);
+    }
+    if (!c->cache_fp) {
+        cddb_log_warn("cannot create cache entry '%s'", fn);
+        free(tmp);
+        free(fn);
+        return FALSE;
+    }
+    c->cache_tmp = tmp;
+    c->cache_fn = fn;
+    return TRUE;
+}
+
 int cddb_cache_open(cddb_conn_t *c, cddb_disc_t *disc, const char* mode)
 {
     int rv = FALSE;
@@ -162,9 +359,24 @@ int cddb_cache_open(cddb_conn_t *c, cddb_disc_t *disc, const char* mode)
     cddb_log_debug("cddb_cache_open()");
     /* close previous entry */
     cddb_cache_close(c);
+    c->cache_put_discid = disc->discid;
+    c->cache_put_cat = disc->category;
+    if (cddb_cache_pack(c)) {
+        /* a new record for the packed store is collected in a
+           temporary file, it is added when that is closed; records
+           are read from the store directly */
+        if (mode[0] == 'w') {
+            c->cache_fp = tmpfile();
+            c->cache_put = (c->cache_fp != NULL);
+        }
+        return (c->cache_fp != NULL);
+    }
     /* open new entry */
     fn = cddb_cache_file_name(c, disc);
     if (fn) {
+        if (mode[0] == 'w') {
+            return cddb_cache_create(c, fn);
+        }
         c->cache_fp = fopen(fn, mode);
         rv = (c->cache_fp != NULL);
     }
@@ -172,17 +384,138 @@ int cddb_cache_open(cddb_conn_t *c, cddb_disc_t *disc, const char* mode)
     return rv;
 }
 
+/**
+ * Add the record collected in the temporary cache file to the packed
+ * store.
+ */
+static void cddb_cache_put(cddb_conn_t *c)
+{
+    char *buf;
+    long size;
+
+    size = ftell(c->cache_fp);
+    if (size <= 0) {
+        return;
+    }
+    buf = (char*)malloc(size);
+    if (!buf) {
+        cddb_errno_log_crit(c, CDDB_ERR_OUT_OF_MEMORY);
+        return;
+    }
+    rewind(c->cache_fp);
+    if (fread(buf, sizeof(char), size, c->cache_fp) == (size_t)size) {
+        cddb_pack_put(c->cache_pack, c->cache_put_discid, c->cache_put_cat,
+                      buf, size);
+        cddb_cache_forget_memory(c, c->cache_put_discid, c->cache_put_cat);
+    }
+    free(buf);
+}
+
+/**
+ * Rename the temporary file that has been written to the cache entry,
+ * replacing the entry if it already exists.
+ */
+static void cddb_cache_commit(cddb_conn_t *c)
+{
+    cddb_index_t *idx = cddb_cache_index(c);
+
+    if (idx) {
+        cddb_index_prepare(idx, c->cache_put_cat);
+    }
+    if (rename(c->cache_tmp, c->cache_fn) == -1) {
+        cddb_log_warn("cannot create cache entry '%s'", c->cache_fn);
+        unlink(c->cache_tmp);
+        if (idx) {
+            cddb_index_touch(idx, c->cache_put_cat);
+        }
+        return;
+    }
+    if (idx) {
+        cddb_index_add(idx, c->cache_put_discid, c->cache_put_cat);
+    }
+    cddb_cache_forget_memory(c, c->cache_put_discid, c->cache_put_cat);
+    cddb_cache_account(c);
+}
+
+/**
+ * Close the cache entry.  A new entry that has been written is added
+ * to the cache if keep is TRUE and everything was written, otherwise
+ * it is thrown away.
+ */
+static void cddb_cache_finish(cddb_conn_t *c, int keep)
+{
+    cddb_index_t *idx;
+    int ok;
+
+    if (c->cache_fp == NULL) {
+        return;
+    }
+    cddb_log_debug("cddb_cache_close()");
+    ok = (fflush(c->cache_fp) == 0) && !ferror(c->cache_fp);
+    if (c->cache_put) {
+        if (keep && ok) {
+            cddb_cache_put(c);
+        }
+        c->cache_put = FALSE;
+    }
+    ok = (fclose(c->cache_fp) == 0) && ok;
+    c->cache_fp = NULL;
+    if (c->cache_tmp) {
+        if (keep && ok) {
+            cddb_cache_commit(c);
+        } else {
+            if (keep) {
+                cddb_log_warn("cannot write cache entry '%s'", c->cache_fn);
+            }
+            idx = cddb_cache_index(c);
+            if (idx) {
+                cddb_index_prepare(idx, c->cache_put_cat);
+            }
+            unlink(c->cache_tmp);
+            if (idx) {
+                cddb_index_touch(idx, c->cache_put_cat);
+            }
+        }
+        FREE_NOT_NULL(c->cache_tmp);
+        FREE_NOT_NULL(c->cache_fn);
+    }
+}
+
 void cddb_cache_close(cddb_conn_t *c)
 {
-    if (c->cache_fp != NULL) {
-        cddb_log_debug("cddb_cache_close()");
-        fclose(c->cache_fp);
-        c->cache_fp = NULL;
+    cddb_cache_finish(c, TRUE);
+}
+
+/**
+ * Read a record from the packed store.
+ */
+static int cddb_cache_read_pack(cddb_conn_t *c, cddb_disc_t *disc)
+{
+    const char *data;
+    char *buf;
+    int len;
+
+    data = cddb_pack_get(c->cache_pack, disc->discid, disc->category, &len);
+    if (!data) {
+        cddb_log_warn("cache entry not readable: %s/%08x",
+                      CDDB_CATEGORY[disc->category], disc->discid);
+        return FALSE;
+    }
+    /* the parser terminates lines in place, the mapping is read-only */
+    buf = (char*)malloc(len + 1);
+    if (!buf) {
+        cddb_errno_log_crit(c, CDDB_ERR_OUT_OF_MEMORY);
+        return FALSE;
     }
+    memcpy(buf, data, len);
+    buf[len] = CHR_EOS;
+    cddb_log_debug("...cached version found");
+    return cddb_parse_cached_data(c, disc, buf, len);
 }
 
 int cddb_cache_read(cddb_conn_t *c, cddb_disc_t *disc)
 {
+    cddb_usage_t *u;
     int rv;
 
     cddb_log_debug("cddb_cache_read()");
@@ -192,6 +525,17 @@ int cddb_cache_read(cddb_conn_t *c, cddb_disc_t *disc)
         return FALSE;
     }
 
+    /* parsed disc already in memory? */
+    if (c->disc_cache &&
+        cddb_dcache_get(c->disc_cache, disc->category, disc->discid, disc)) {
+        cddb_log_debug("...disc found in memory");
+        if ((u = cddb_cache_usage(c)) != NULL) {
+            cddb_usage_touch(u, disc->discid, disc->category);
+        }
+        cddb_errno_set(c, CDDB_ERR_OK);
+        return TRUE;
+    }
+
     /* check whether cached version exists */
     if (!cddb_cache_exists(c, disc)) {
         /* no cached version available */
@@ -199,46 +543,39 @@ int cddb_cache_read(cddb_conn_t *c, cddb_disc_t *disc)
         return FALSE;
     }
 
-    /* try to open cache file */
-    if (!cddb_cache_open(c, disc, "r")) {
-        /* cached version not readable */
-        char *fn = cddb_cache_file_name(c, disc);
-        cddb_log_warn("cache file not readable: %s", fn);
-        FREE_NOT_NULL(fn);
-        return FALSE;
-    }
-
-    /* parse CDDB record */
-    cddb_log_debug("...cached version found");
-    c->cache_read = TRUE;
-    rv = cddb_parse_record(c, disc);
-    c->cache_read = FALSE;
-
-    /* close cache entry */
-    cddb_cache_close(c);
+    if (cddb_cache_pack(c)) {
+        rv = cddb_cache_read_pack(c, disc);
+    } else {
+        /* try to open cache file */
+        if (!cddb_cache_open(c, disc, "r")) {
+            /* cached version not readable */
+            char *fn = cddb_cache_file_name(c, disc);
+            cddb_log_warn("cache file not readable: %s", fn);
+            FREE_NOT_NULL(fn);
+            return FALSE;
+        }
 
-    return rv;
-}
+        /* parse CDDB record */
+        cddb_log_debug("...cached version found");
+        rv = cddb_parse_cached_record(c, disc);
 
-void cddb_cache_query_init(void)
-{
-    static int query_cache_init = FALSE;
-    int i;
+        /* close cache entry */
+        cddb_cache_close(c);
+    }
 
-    if (!query_cache_init) {
-        for (i = 0; i < sizeof(QUERY_CACHE_SIZE); i++) {
-            query_cache[i].category = CDDB_CAT_INVALID;
-        }
-        query_cache_init = TRUE;
+    if (rv && c->disc_cache) {
+        cddb_dcache_put(c->disc_cache, disc);
+    }
+    if (rv && ((u = cddb_cache_usage(c)) != NULL)) {
+        cddb_usage_touch(u, disc->discid, disc->category);
     }
-}
 
-/* use upper 8 bits of disc ID as hash */
-#define cddb_cache_query_hash(disc) ((disc)->discid >> 24)
+    return rv;
+}
 
 int cddb_cache_query(cddb_conn_t *c, cddb_disc_t *disc)
 {
-    int hash;
+    cddb_cat_t cat;
 
     cddb_log_debug("cddb_cache_query()");
     if (c->use_cache == CACHE_OFF) {
@@ -247,16 +584,16 @@ int cddb_cache_query(cddb_conn_t *c, cddb_disc_t *disc)
         return FALSE;
     }
 
-    /* initialize memory cache */
-    cddb_cache_query_init();
-
-    /* calculate disc hash */
-    hash = cddb_cache_query_hash(disc);
-
-    /* data already in memory? */
-    if (query_cache[hash].discid == disc->discid) {
+    /* result already in memory? */
+    if (c->query_cache &&
+        cddb_qcache_lookup(c->query_cache, disc->discid, disc->track_cnt,
+                           &cat)) {
+        disc->category = cat;
+        if (cat == CDDB_CAT_INVALID) {
+            cddb_log_debug("...entry known to be missing");
+            return FALSE;
+        }
         cddb_log_debug("...entry found in memory");
-        disc->category = query_cache[hash].category;
         cddb_errno_set(c, CDDB_ERR_OK);
         return TRUE;
     }
@@ -267,32 +604,39 @@ int cddb_cache_query(cddb_conn_t *c, cddb_disc_t *disc)
 
 int cddb_cache_query_disc(cddb_conn_t *c, cddb_disc_t *disc)
 {
-    int cat, hash;
+    int cat, cats = -1;
+    cddb_index_t *idx;
 
     cddb_log_debug("cddb_cache_query_disc()");
+    /* one index lookup tells which categories hold the disc, without
+       it every category directory has to be checked */
+    if (cddb_cache_pack(c)) {
+        cats = cddb_pack_lookup(c->cache_pack, disc->discid);
+    } else if ((idx = cddb_cache_index(c)) != NULL) {
+        cats = cddb_index_lookup(idx, disc->discid);
+    }
     for (cat = CDDB_CAT_DATA; cat < CDDB_CAT_INVALID; cat++) {
         disc->category = cat;
-        if (cddb_cache_exists(c, disc)) {
+        if ((cats != -1) ? (cats & BIT(cat)) : cddb_cache_exists(c, disc)) {
             /* update memory cache */
-            hash = cddb_cache_query_hash(disc);
-            query_cache[hash].discid = disc->discid;
-            query_cache[hash].category = disc->category;
+            if (c->query_cache) {
+                cddb_qcache_store(c->query_cache, disc->discid,
+                                  disc->track_cnt, disc->category, 0);
+            }
             cddb_log_debug("...entry found in local db");
             cddb_errno_set(c, CDDB_ERR_OK);
             return TRUE;
         }
     }
     disc->category = CDDB_CAT_INVALID;
+    if (c->query_cache && (c->query_negative_ttl > 0)) {
+        cddb_qcache_store(c->query_cache, disc->discid, disc->track_cnt,
+                          CDDB_CAT_INVALID, c->query_negative_ttl);
+    }
     cddb_log_debug("...entry not found in local db");
     return FALSE;
 }
 
-#if defined( WIN32 )
-#define MKDIR(dir, mode)  mkdir(dir)
-#else
-#define MKDIR(dir, mode)  mkdir(dir, mode)
-#endif 
-
 int cddb_cache_mkdir(cddb_conn_t *c, cddb_disc_t *disc)
 {
     char *fn = NULL;
@@ -303,6 +647,10 @@ int cddb_cache_mkdir(cddb_conn_t *c, cddb_disc_t *disc)
         cddb_log_error("could not create cache directory: %s", c->cache_dir);
         return FALSE;
     }
+    if (cddb_cache_pack(c)) {
+        /* the packed store has no category directories */
+        return TRUE;
+    }
 
     /* create category dir */
     fn = (char*)malloc(c->buf_size);
@@ -329,7 +677,7 @@ int cddb_get_response_code(cddb_conn_t *c, char **msg)
     cddb_log_debug("cddb_get_response_code()");
     line = cddb_read_line(c);
     if (!line) {
-        if (cddb_errno(c) != CDDB_ERR_OK) {
+        if (cddb_errno(c) != CDDB_ERR_OK && cddb_errno(c) != CDDB_ERR_TIMEOUT) {
             cddb_errno_log_error(c, CDDB_ERR_UNEXPECTED_EOF);
         }
         return -1;
@@ -353,33 +701,34 @@ int cddb_get_response_code(cddb_conn_t *c, char **msg)
     return code;
 }
 
-char *cddb_read_line(cddb_conn_t *c)
+int cddb_next_line(cddb_conn_t *c, cddb_line_t *line)
 {
-    char *s;
+    int rv;
 
-    cddb_log_debug("cddb_read_line()");
-    /* read line, possibly returning NULL */
-    if (c->cache_read) {
-        s = fgets(c->line, c->buf_size, cddb_cache_file(c));
-    } else {
-        s = sock_fgets(c->line, c->buf_size, c);
+    cddb_log_debug("cddb_next_line()");
+    /* read line, possibly failing */
+    errno = 0;
+    rv = sock_getline(c, line);
+    if (!rv && errno == ETIMEDOUT) {
+        cddb_errno_log_error(c, CDDB_ERR_TIMEOUT);
     }
-
-    /* strip off any line-terminating characters */
-    if (s) {
-        s = s + strlen(s) - 1;
-        while ((s >= c->line) && 
-               ((*s == CHR_CR) || (*s == CHR_LF))) {
-            *s = CHR_EOS;
-            s--;
-        }
-    } else {
-        return NULL;
+    if (!rv) {
+        return FALSE;
     }
 
     cddb_errno_set(c, CDDB_ERR_OK);
-    cddb_log_debug("...[%c] line = '%s'", (c->cache_read ? 'C' : 'N'), c->line);
-    return c->line;
+    cddb_log_debug("...[N] line = '%s'", line->str);
+    return TRUE;
+}
+
+char *cddb_read_line(cddb_conn_t *c)
+{
+    cddb_line_t line;
+
+    if (!cddb_next_line(c, &line)) {
+        return NULL;
+    }
+    return line.str;
 }
 
 static void url_encode(char *s)
@@ -395,7 +744,7 @@ static void url_encode(char *s)
 int cddb_http_parse_response(cddb_conn_t *c)
 {
     char *line;
-    int code;
+    int code, major, minor;
 
     if ((line = cddb_read_line(c)) == NULL) {
         /* no HTTP response line */
@@ -403,11 +752,13 @@ int cddb_http_parse_response(cddb_conn_t *c)
         return FALSE;
     }
 
-    if (sscanf(line, "%*s %d %*s", &code) != 1) {
+    if (sscanf(line, "HTTP/%d.%d %d", &major, &minor, &code) != 3) {
         /* invalid */
         cddb_errno_log_error(c, CDDB_ERR_INVALID_RESPONSE);
         return FALSE;
     }
+    /* HTTP/1.1 connections are persistent unless stated otherwise */
+    c->http_keep_alive = (major > 1) || ((major == 1) && (minor >= 1));
 
     cddb_log_debug("...HTTP response code = %d", code);
     switch (code) {
@@ -428,14 +779,68 @@ int cddb_http_parse_response(cddb_conn_t *c)
     return TRUE;
 }
 
-void cddb_http_parse_headers(cddb_conn_t *c)
+int cddb_http_parse_headers(cddb_conn_t *c, int *chunked)
 {
+    const char *value, *eol;
     char *line;
+    int len = -1;
 
     cddb_log_debug("cddb_http_parse_headers()");
+    *chunked = FALSE;
     while (((line = cddb_read_line(c)) != NULL) &&
            (*line != CHR_EOS)) {
-        /* no-op */
+        if ((value = cddb_http_header(line, "content-length")) != NULL) {
+            len = atoi(value);
+        } else if ((value = cddb_http_header(line, "transfer-encoding")) != NULL) {
+            *chunked = cddb_http_has_token(value, value + strlen(value),
+                                           "chunked");
+        } else if ((value = cddb_http_header(line, "connection")) != NULL) {
+            eol = value + strlen(value);
+            if (cddb_http_has_token(value, eol, "close")) {
+                c->http_keep_alive = FALSE;
+            } else if (cddb_http_has_token(value, eol, "keep-alive")) {
+                c->http_keep_alive = TRUE;
+            }
+        }
+    }
+    return len;
+}
+
+/**
+ * Receive the body of an HTTP response.  If the body has a known
+ * length it is buffered completely, so the connection can be reused
+ * afterwards.
+ */
+static int cddb_http_recv_body(cddb_conn_t *c, int len, int chunked)
+{
+    int rv;
+
+    if (chunked) {
+        rv = sock_read_chunked(c);
+    } else if (len >= 0) {
+        rv = sock_read_body(c, len);
+    } else {
+        /* body ends when the server closes the connection */
+        c->http_keep_alive = FALSE;
+        return TRUE;
+    }
+    if (rv == -1) {
+        c->http_keep_alive = FALSE;
+        cddb_errno_log_error(c, CDDB_ERR_INVALID_RESPONSE);
+        return FALSE;
+    }
+    c->http_body = TRUE;
+    return TRUE;
+}
+
+/**
+ * Called when done with an HTTP response.  The connection is closed
+ * unless the server agreed to keep it open.
+ */
+static void cddb_http_done(cddb_conn_t *c)
+{
+    if (c->is_http_enabled && !c->http_keep_alive) {
+        cddb_disconnect(c);
     }
 }
 
@@ -448,9 +853,13 @@ static int cddb_add_proxy_auth(cddb_conn_t *c)
     return TRUE;
 }
 
-int cddb_http_send_cmd(cddb_conn_t *c, cddb_cmd_t cmd, va_list args)
+int cddb_http_write_cmd(cddb_conn_t *c, cddb_cmd_t cmd, va_list args)
 {
-    cddb_log_debug("cddb_http_send_cmd()");
+    cddb_log_debug("cddb_http_write_cmd()");
+    /* forget about the previous response on this connection */
+    cddb_rbuf_reset(&c->rbuf);
+    c->http_body = FALSE;
+    c->http_keep_alive = FALSE;
     switch (cmd) {
         case CMD_WRITE:
             /* entry submission (POST method) */
@@ -479,14 +888,14 @@ int cddb_http_send_cmd(cddb_conn_t *c, cddb_cmd_t cmd, va_list args)
                 sock_fprintf(c, "User-Email: %s@%s\r\n", c->user, c->hostname);
                 sock_fprintf(c, "Submit-Mode: submit\r\n");
                 sock_fprintf(c, "Content-Length: %d\r\n", size);
-                sock_fprintf(c, "Charset: UTF-8\r\n");
-                sock_fprintf(c, "\r\n");
+                sock_fprintf(c, "Charset: UTF-8\r\n\r\n");
+                /* the headers are sent along with the entry itself */
             }
             break;
         default:
             /* anything else */
             {
-                char *buf;
+                cddb_wbuf_t *wb = &c->wbuf;
                 int rv;
                 
                 if (c->is_http_proxy_enabled) {
@@ -498,40 +907,34 @@ int cddb_http_send_cmd(cddb_conn_t *c, cddb_cmd_t cmd, va_list args)
                     sock_fprintf(c, "GET %s?", c->http_path_query);
                 }
 
-                buf = (char*)malloc(c->buf_size);
-                rv = vsnprintf(buf, c->buf_size, CDDB_COMMANDS[cmd], args);
-                if (rv < 0 || rv >= c->buf_size) {
+                if (cmd != CMD_SEARCH) {
+                    sock_fprintf(c, "cmd=");
+                }
+                /* format the command straight into the request */
+                rv = wb->len;
+                if (sock_vfprintf(c, CDDB_COMMANDS[cmd], args) == -1) {
                     /* buffer is too small */
-                    cddb_errno_log_crit(c, CDDB_ERR_LINE_SIZE);
+                    wb->len = 0;
                     return FALSE;
                 }
-                url_encode(buf);
-                if (cmd == CMD_SEARCH) {
-                    sock_fprintf(c, "%s", buf);
-                } else {
-                    sock_fprintf(c, "cmd=%s&", buf);
-                    sock_fprintf(c, "hello=%s+%s+%s+%s&", 
+                url_encode(wb->data + rv);
+                if (cmd != CMD_SEARCH) {
+                    sock_fprintf(c, "&hello=%s+%s+%s+%s&", 
                                  c->user, c->hostname, c->cname, c->cversion);
                     sock_fprintf(c, "proto=%d", DEFAULT_PROTOCOL_VERSION);
                 }
-                free(buf);
-                sock_fprintf(c, " HTTP/1.0\r\n");
+                sock_fprintf(c, " HTTP/1.1\r\n");
 
+                /* insert host header */
+                sock_fprintf(c, "Host: %s:%d\r\n",
+                             c->server_name, c->server_port);
                 if (c->is_http_proxy_enabled) {
-                    /* insert host header */
-                    sock_fprintf(c, "Host: %s:%d\r\n",
-                                 c->server_name, c->server_port);
                     cddb_add_proxy_auth(c);
                 }
-                sock_fprintf(c, "\r\n");
-
-                /* parse HTTP response line */
-                if (!cddb_http_parse_response(c)) {
-                    return FALSE;
-                }
-
-                /* skip HTTP response headers */
-                cddb_http_parse_headers(c);
+                /* ask to keep the connection open for the next command */
+                sock_fprintf(c, "Connection: keep-alive\r\n\r\n");
+                /* a failed send shows up when reading the response */
+                sock_fflush(c);
             }
     }
 
@@ -539,76 +942,226 @@ int cddb_http_send_cmd(cddb_conn_t *c, cddb_cmd_t cmd, va_list args)
     return TRUE;
 }
 
-int cddb_send_cmd(cddb_conn_t *c, int cmd, ...)
+int cddb_http_recv_headers(cddb_conn_t *c)
 {
-    va_list args;
-    
-    cddb_log_debug("cddb_send_cmd()");
-    if (!CONNECTION_OK(c)) {
-        cddb_errno_log_error(c, CDDB_ERR_NOT_CONNECTED);
+    int len, chunked;
+
+    /* parse HTTP response line */
+    if (!cddb_http_parse_response(c)) {
         return FALSE;
     }
-    
-    va_start(args, cmd);
-    if (c->is_http_enabled) {
-        /* HTTP */
-        if (!cddb_http_send_cmd(c, cmd, args)) {
-            int errnum;
 
-            errnum = cddb_errno(c); /* save error number */
-            cddb_disconnect(c);
-            cddb_errno_set(c, errnum); /* restore error number */
-            return FALSE;
-        }
-    } else {
-        /* CDDBP */
-        sock_vfprintf(c, CDDB_COMMANDS[cmd], args);
-        sock_fprintf(c, "\n");
-    }
-    va_end(args);
+    /* parse HTTP response headers and buffer the body */
+    len = cddb_http_parse_headers(c, &chunked);
+    return cddb_http_recv_body(c, len, chunked);
+}
 
-    cddb_errno_set(c, CDDB_ERR_OK);
+/**
+ * Send an HTTP request and, except for submissions, receive the
+ * response headers.
+ */
+static int cddb_http_request(cddb_conn_t *c, cddb_cmd_t cmd, va_list args)
+{
+    if (!cddb_http_write_cmd(c, cmd, args)) {
+        return FALSE;
+    }
+    if (cmd != CMD_WRITE) {
+        /* submission response is only read after sending the entry */
+        return cddb_http_recv_headers(c);
+    }
     return TRUE;
 }
 
-#define STATE_START         0
-#define STATE_TRACK_OFFSETS 1
-#define STATE_DISC_LENGTH   2
-#define STATE_DISC_REVISION 3
-#define STATE_DISC_TITLE    4
-#define STATE_DISC_YEAR     5
-#define STATE_DISC_GENRE    6
-#define STATE_DISC_EXT      7
-#define STATE_TRACK_TITLE   8
-#define STATE_TRACK_EXT     9
-#define STATE_PLAY_ORDER    10
-#define STATE_END_DOT       11
-#define STATE_STOP          12
-
-#define MULTI_NONE          0
-#define MULTI_ARTIST        1
-#define MULTI_TITLE         2
-#define MULTI_EXT           3
-
-int cddb_parse_record(cddb_conn_t *c, cddb_disc_t *disc)
+int cddb_http_send_cmd(cddb_conn_t *c, cddb_cmd_t cmd, va_list args)
 {
-    char *line, *buf;
-    int state, multi_line = MULTI_NONE;
-#ifdef HAVE_REGEX_H
-    regmatch_t matches[6];
-#endif
-    cddb_track_t *track;
-    int cache_content;
-    int track_no = 0, old_no = -1;
+    va_list retry;
+    int reused, rv;
+
+    cddb_log_debug("cddb_http_send_cmd()");
+    reused = c->http_keep_alive;
+    va_copy(retry, args);
+    rv = cddb_http_request(c, cmd, args);
+    if (!rv && reused && (cddb_errno(c) == CDDB_ERR_UNEXPECTED_EOF)) {
+        /* the server closed the kept-alive connection before it got
+           our request, try once more on a new connection */
+        cddb_log_debug("...stale connection, retrying");
+        cddb_disconnect(c);
+        rv = cddb_connect(c) && cddb_http_request(c, cmd, retry);
+    }
+    va_end(retry);
+    return rv;
+}
+
+/**
+ * Add a CDDBP command to the send buffer without sending it yet.
+ */
+static int cddb_vqueue_cmd(cddb_conn_t *c, int cmd, va_list args)
+{
+    if (sock_vfprintf(c, CDDB_COMMANDS[cmd], args) == -1 ||
+        sock_fprintf(c, "\n") == -1) {
+        c->wbuf.len = 0;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * Send a command to the server.  If wait is false, the response line
+ * and headers of an HTTP request are not read.
+ */
+static int cddb_vsend_cmd(cddb_conn_t *c, int cmd, int wait, va_list args)
+{
+    if (!CONNECTION_OK(c)) {
+        cddb_errno_log_error(c, CDDB_ERR_NOT_CONNECTED);
+        return FALSE;
+    }
+    
+    if (c->is_http_enabled) {
+        /* HTTP */
+        int rv;
+
+        if (wait) {
+            rv = cddb_http_send_cmd(c, cmd, args);
+        } else {
+            rv = cddb_http_write_cmd(c, cmd, args);
+        }
+        if (!rv) {
+            int errnum;
+
+            errnum = cddb_errno(c); /* save error number */
+            cddb_disconnect(c);
+            cddb_errno_set(c, errnum); /* restore error number */
+            return FALSE;
+        }
+    } else {
+        /* CDDBP */
+        if (!cddb_vqueue_cmd(c, cmd, args)) {
+            return FALSE;
+        }
+        /* a failed send shows up when reading the response */
+        sock_fflush(c);
+    }
+
+    cddb_errno_set(c, CDDB_ERR_OK);
+    return TRUE;
+}
+
+int cddb_send_cmd(cddb_conn_t *c, int cmd, ...)
+{
+    va_list args;
+    int rv;
+    
+    cddb_log_debug("cddb_send_cmd()");
+    va_start(args, cmd);
+    rv = cddb_vsend_cmd(c, cmd, TRUE, args);
+    va_end(args);
+    return rv;
+}
+
+/**
+ * Send a command without waiting for any part of the response.
+ */
+static int cddb_send_cmd_nowait(cddb_conn_t *c, int cmd, ...)
+{
+    va_list args;
+    int rv;
+    
+    cddb_log_debug("cddb_send_cmd_nowait()");
+    va_start(args, cmd);
+    rv = cddb_vsend_cmd(c, cmd, FALSE, args);
+    va_end(args);
+    return rv;
+}
+
+/**
+ * Add a CDDBP command to the send buffer, see #sock_fflush.
+ */
+static int cddb_queue_cmd(cddb_conn_t *c, int cmd, ...)
+{
+    va_list args;
+    int rv;
+    
+    cddb_log_debug("cddb_queue_cmd()");
+    va_start(args, cmd);
+    rv = cddb_vqueue_cmd(c, cmd, args);
+    va_end(args);
+    return rv;
+}
+
+/**
+ * Drop a removed cache entry from the presence index and the memory
+ * caches.
+ */
+static void cddb_cache_forget(cddb_conn_t *c, cddb_disc_t *disc)
+{
+    cddb_index_t *idx = cddb_cache_index(c);
+
+    if (idx) {
+        cddb_index_remove(idx, disc->discid, disc->category);
+    }
+    if (c->cache_usage) {
+        cddb_usage_remove(c->cache_usage, disc->discid, disc->category);
+    }
+    cddb_cache_forget_memory(c, disc->discid, disc->category);
+}
+
+/**
+ * Throw away the cache entry that is being written, it is incomplete.
+ */
+static void cddb_cache_discard(cddb_conn_t *c)
+{
+    cddb_cache_finish(c, FALSE);
+}
+
+/**
+ * Remove a cache entry that could not be parsed.
+ */
+static void cddb_cache_remove_invalid(cddb_conn_t *c, cddb_disc_t *disc)
+{
+    cddb_index_t *idx;
+    char *fn;
+
+    if (cddb_cache_pack(c)) {
+        cddb_log_warn("removing invalid cache entry %s/%08x",
+                      CDDB_CATEGORY[disc->category], disc->discid);
+        cddb_pack_remove(c->cache_pack, disc->discid, disc->category);
+        cddb_cache_forget(c, disc);
+        return;
+    }
+    fn = cddb_cache_file_name(c, disc);
+    if (fn) {
+        cddb_log_warn("removing invalid cache entry '%s'", fn);
+        idx = cddb_cache_index(c);
+        if (idx) {
+            cddb_index_prepare(idx, disc->category);
+        }
+        unlink(fn);
+        cddb_cache_forget(c, disc);
+    }
+    FREE_NOT_NULL(fn);
+}
+
+int cddb_parse_record(cddb_conn_t *c, cddb_disc_t *disc)
+{
+    cddb_line_t lv;
+    cddb_parser_t *p;
+    int cache_content, rv = TRUE;
 
     cddb_log_debug("cddb_parse_record()");
+    p = cddb_parser_new(disc);
+    if (!p) {
+        cddb_errno_log_crit(c, CDDB_ERR_OUT_OF_MEMORY);
+        /* the next response follows the record */
+        cddb_skip_data(c);
+        return FALSE;
+    }
     /* 
      * Do we need to cache the processed content ?  We cache if:
      *   1. caching is allowed (CACHE_ON or CACHE_ONLY) 
      * and
      *   2. a cached version does not yet exist
      */
-    cache_content = !c->cache_read && (c->use_cache != CACHE_OFF) && 
+    cache_content = (c->use_cache != CACHE_OFF) && 
                     !cddb_cache_exists(c, disc);
     if (cache_content) {
         /* create cache directory structure */
@@ -618,278 +1171,174 @@ int cddb_parse_record(cddb_conn_t *c, cddb_disc_t *disc)
     }
     cddb_log_debug("...cache_content: %s", (cache_content ? "yes" : "no"));
 
-    state = STATE_START;
-    while ((line = cddb_read_line(c)) != NULL) {
+    while (!cddb_parser_done(p) && (rv = cddb_next_line(c, &lv))) {
 
         if (cache_content) {
-            fprintf(cddb_cache_file(c), "%s\n", line);
+            fwrite(lv.str, sizeof(char), lv.len, cddb_cache_file(c));
+            fputc(CHR_LF, cddb_cache_file(c));
         }
 
-        switch (state) {
-            case STATE_START:
-                cddb_log_debug("...state: START");
-                if (regexec(REGEX_TRACK_FRAME_OFFSETS, line, 0, NULL, 0) == 0) {
-                    /* expect a list of track frame offsets now */
-                    state = STATE_TRACK_OFFSETS;
-                }
-                break;
-            case STATE_TRACK_OFFSETS:
-                cddb_log_debug("...state: TRACK OFFSETS");
-                if (regexec(REGEX_TRACK_FRAME_OFFSET, line, 2, matches, 0) == 0) {
-                    track = cddb_disc_get_track(disc, track_no);
-                    if (!track) {
-                        /* no such track present in disc structure yet */
-                        track = cddb_track_new();
-                        /* XXX: insert at track_no pos?? */
-                        cddb_disc_add_track(disc, track);
-                    }
-                    track->frame_offset = cddb_regex_get_int(line, matches, 1);
-                    track_no++;
-                    break;
-                } else {
-                    /* expect disc length now */
-                    state = STATE_DISC_LENGTH;
-                }
-            case STATE_DISC_LENGTH:
-                cddb_log_debug("...state: DISC LENGTH");
-                if (regexec(REGEX_DISC_LENGTH, line, 2, matches, 0) == 0) {
-                    disc->length = cddb_regex_get_int(line, matches, 1);
-                    /* expect disc revision now */
-                    state = STATE_DISC_REVISION;
-                }            
-                break;
-            case STATE_DISC_REVISION:
-                cddb_log_debug("...state: DISC REVISION");
-                if (regexec(REGEX_DISC_REVISION, line, 2, matches, 0) == 0) {
-                    disc->revision = cddb_regex_get_int(line, matches, 1);
-                    /* expect disc title now */
-                    state = STATE_DISC_TITLE;
-                }            
-                break;
-            case STATE_DISC_TITLE:
-                cddb_log_debug("...state: DISC TITLE");
-                if (regexec(REGEX_DISC_TITLE, line, 5, matches, 0) == 0) {
-                    /* XXX: more error detection possible! */
-                    if (multi_line == MULTI_NONE) {
-                        /* start parsing title or artist, delete current
-                           track and artist in case this disc structure is
-                           being reused from a previous read */
-                        cddb_disc_set_artist(disc, NULL);
-                        cddb_disc_set_title(disc, NULL);
-                    }
-                    if (matches[2].rm_so != -1) {
-                        /* both artist and title of disc are specified */
-                        buf = cddb_regex_get_string(line, matches, 2);
-                        cddb_disc_append_artist(disc, buf);
-                        free(buf);
-                        buf = cddb_regex_get_string(line, matches, 3);
-                        cddb_disc_append_title(disc, buf);
-                        free(buf);
-                        /* we should only get title continuations now */
-                        multi_line = MULTI_TITLE;
-                    } else {
-                        /* only title or artist of disc on this line */
-                        if (multi_line != MULTI_TITLE) {
-                            /* this line is part of the artist name */
-                            buf = cddb_regex_get_string(line, matches, 4);
-                            cddb_disc_append_artist(disc, buf);
-                            free(buf);
-                            /* next line might be continuation of artist name */
-                            multi_line = MULTI_ARTIST;
-                        } else {
-                            /* this line is part of the title */
-                            buf = cddb_regex_get_string(line, matches, 4);
-                            cddb_disc_append_title(disc, buf);
-                            free(buf);
-                        }
-                    }
-                    break;
-                }
-                if (multi_line == MULTI_NONE) {
-                    /* not yet parsing multi-line DTITLE */
-                    /* might be comment line, just skip it */
-                    break;
-                }
-                /* if format was not 'artist / title' we assume that
-                   the title and artist name are equal (see specs) */
-                if (disc->artist != NULL && disc->title == NULL) {
-                    cddb_disc_set_title(disc, disc->artist);
-                }
-                multi_line = MULTI_NONE;
-                /* fall through to end multi-line disc title */
-            case STATE_DISC_YEAR:
-                cddb_log_debug("...state: DISC YEAR");
-                if (regexec(REGEX_DISC_YEAR, line, 2, matches, 0) == 0) {
-                    disc->year = cddb_regex_get_int(line, matches, 1);
-                    /* expect disc genre now */
-                    state = STATE_DISC_GENRE;
-                    break;
-                }
-                /* fall through because disc year is optional */
-            case STATE_DISC_GENRE:
-                cddb_log_debug("...state: DISC GENRE");
-                if (regexec(REGEX_DISC_GENRE, line, 2, matches, 0) == 0) {
-                    buf = cddb_regex_get_string(line, matches, 1);
-                    cddb_disc_set_genre(disc, buf);
-                    free(buf);
-                    /* expect track title now */
-                    state = STATE_TRACK_TITLE;
-                    break;
-                }
-                /* fall through because disc genre is optional */
-            case STATE_TRACK_TITLE:
-                cddb_log_debug("...state: TRACK TITLE");
-                if (regexec(REGEX_TRACK_TITLE, line, 6, matches, 0) == 0) {
-                    state = STATE_TRACK_TITLE;
-                    track_no = cddb_regex_get_int(line, matches, 1);
-                    track = cddb_disc_get_track(disc, track_no);
-                    if (track == NULL) {
-                        cddb_errno_log_error(c, CDDB_ERR_TRACK_NOT_FOUND);
-                        return FALSE;
-                    }
-                    if (track_no != old_no) {
-                        old_no = track_no;
-                        /* reset multi-line flag, expect artist first */
-                        multi_line = MULTI_ARTIST;
-                        /* delete current title and artist in case this
-                           track structure is being reused from a previous
-                           read */
-                        cddb_track_set_artist(track, NULL);
-                        cddb_track_set_title(track, NULL);
-                    }
-                    if (matches[3].rm_so == -1) {
-                        /* only title or artist of track on this line */
-                        if (multi_line != MULTI_TITLE) {
-                            /* this line might be part of the artist,
-                               but if we don't encounter a ' / ' it's the title,
-                               so we use the title space for now and fix it later
-                               if needed (see below) */
-                            buf = cddb_regex_get_string(line, matches, 5);
-                            cddb_track_append_title(track, buf);
-                            free(buf);
-                        } else {
-                            /* this line is part of the title */
-                            buf = cddb_regex_get_string(line, matches, 5);
-                            cddb_track_append_title(track, buf);
-                            free(buf);
-                        }
-                    } else {
-                        /* we might have put the artist in the title space,
-                           fix this now (see artist) */
-                        track->artist = track->title;
-                        track->title = NULL;
-                        /* both artist and title of track are specified */
-                        buf = cddb_regex_get_string(line, matches, 3);
-                        cddb_track_append_artist(track, buf);
-                        free(buf);
-                        buf = cddb_regex_get_string(line, matches, 4);
-                        cddb_track_append_title(track, buf);
-                        free(buf);
-                        /* we should only get title continuations now */
-                        multi_line = MULTI_TITLE;
-                    }
-                    /* valid track title, process next line */
-                    break;
-                }
-                multi_line = MULTI_NONE;
-                old_no = -1;
-                /* fall through, we might have reached end of track titles */
-            case STATE_DISC_EXT:
-                cddb_log_debug("...state: DISC EXT");
-                if (regexec(REGEX_DISC_EXT, line, 2, matches, 0) == 0) {
-                    state = STATE_DISC_EXT;
-                    if (multi_line == MULTI_NONE) {
-                        /* start parsing extended disc data, delete
-                           current data in case this disc structure is
-                           being reused from a previous read */
-                        cddb_disc_set_ext_data(disc, NULL);
-                        multi_line = MULTI_EXT;
-                    }
-                    buf = cddb_regex_get_string(line, matches, 1);
-                    if (*buf) {
-                        cddb_disc_append_ext_data(disc, buf);
-                    }
-                    free(buf);
-                    break;
-                }
-                multi_line = MULTI_NONE;
-                /* fall through, reached end of multi-line extended disc data */
-            case STATE_TRACK_EXT:
-                cddb_log_debug("...state: TRACK EXT");
-                if (regexec(REGEX_TRACK_EXT, line, 3, matches, 0) == 0) {
-                    state = STATE_TRACK_EXT;
-                    track_no = cddb_regex_get_int(line, matches, 1);
-                    track = cddb_disc_get_track(disc, track_no);
-                    if (track == NULL) {
-                        cddb_errno_log_error(c, CDDB_ERR_TRACK_NOT_FOUND);
-                        return FALSE;
-                    }
-                    if (track_no != old_no) {
-                        old_no = track_no;
-                        /* start parsing extended track data for a new
-                           track, delete current data in case this
-                           track structure is being reused from a
-                           previous read */
-                        cddb_track_set_ext_data(track, NULL);
-                    }
-                    buf = cddb_regex_get_string(line, matches, 2);
-                    if (*buf) {
-                        cddb_track_append_ext_data(track, buf);
-                    }
-                    free(buf);
-                    break;
-                }
-                /* fall through, reached end of extended track data? */
-            case STATE_PLAY_ORDER:
-                cddb_log_debug("...state: PLAY ORDER");
-                if (regexec(REGEX_PLAY_ORDER, line, 2, matches, 0) == 0) {
-                    /* expect nothing more */
-                    state = STATE_END_DOT;
-                    break;
-                }
-                /* fall through, reached end? */
-            case STATE_END_DOT:
-                cddb_log_debug("...state: STOP");
-                if (*line == CHR_DOT) {
-                    /* server response ends with a dot, so end of parsing */
-                    state = STATE_STOP;
-                    break;
-                }
-            default:
-                /* unexpected line */
-                cddb_log_error("unexpected line = '%s'", line);
-        }
-        /* break if we have to stop parsing */
-        if (state == STATE_STOP) {
-            break;
+        if (!cddb_parser_line(p, lv.str, lv.len, -1)) {
+            /* invalid record, do not keep a partial cache entry */
+            cddb_errno_log_error(c, cddb_parser_errno(p));
+            if (cache_content) {
+                cddb_cache_discard(c);
+            }
+            cddb_parser_destroy(p);
+            /* parsing stopped before the terminating dot, skip the rest
+               of the record so that the next response can be read */
+            cddb_skip_data(c);
+            return FALSE;
         }
     }
 
-    /* change state to STOP if end of stream reached */
-    if (line == NULL) {
-        state = STATE_STOP;
+    if (!cddb_parser_done(p)) {
+        /* the connection ended before the terminating dot, do not
+           keep a partial cache entry */
+        if (cache_content) {
+            cddb_cache_discard(c);
+        }
+        cddb_parser_destroy(p);
+        if (cddb_errno(c) != CDDB_ERR_TIMEOUT) {
+            cddb_errno_log_error(c, CDDB_ERR_UNEXPECTED_EOF);
+        }
+        /* the rest of the record might still arrive, it must not be
+           taken for the next response */
+        cddb_disconnect(c);
+        return FALSE;
     }
 
+    rv = cddb_parser_finish(p);
+    cddb_parser_destroy(p);
+
     if (cache_content) {
         cddb_cache_close(c);
     }
 
-    if (state != STATE_STOP) {
-        /* something wrong with the CDDB entry (either the network
-           response or the cached version) */
-        if (c->cache_read) {
-            /* we're reading from the cache, remove the invalid entry */
-            char *fn = cddb_cache_file_name(c, disc);
-            if (fn) {
-                cddb_log_warn("removing invalid cache entry '%s'", fn);
-                unlink(fn);
+    if (!rv) {
+        /* something wrong with the CDDB entry */
+        cddb_errno_log_error(c, CDDB_ERR_INVALID_RESPONSE);
+        return FALSE;
+    }
+
+    if (!cddb_disc_iconv(c->charset->cd_from_freedb, disc)) {
+        cddb_errno_log_error(c, CDDB_ERR_ICONV_FAIL);
+        return FALSE;
+    }
+
+    cddb_errno_set(c, CDDB_ERR_OK);
+    return TRUE;
+}
+
+/**
+ * Parse the cached CDDB record that has been opened for reading.  The
+ * whole record is loaded into memory first.
+ */
+static int cddb_parse_cached_record(cddb_conn_t *c, cddb_disc_t *disc)
+{
+    FILE *fp = cddb_cache_file(c);
+    struct stat st;
+    char *buf;
+    int size;
+
+    cddb_log_debug("cddb_parse_cached_record()");
+    if (fstat(fileno(fp), &st) == -1) {
+        cddb_errno_log_error(c, CDDB_ERR_INVALID_RESPONSE);
+        return FALSE;
+    }
+    buf = (char*)malloc(st.st_size + 1);
+    if (!buf) {
+        cddb_errno_log_crit(c, CDDB_ERR_OUT_OF_MEMORY);
+        return FALSE;
+    }
+    size = fread(buf, sizeof(char), st.st_size, fp);
+    buf[size] = CHR_EOS;
+    return cddb_parse_cached_data(c, disc, buf, size);
+}
+
+/**
+ * Parse a cached CDDB record that has been loaded into memory, the
+ * buffer is terminated after the record and becomes owned by this
+ * function.  The record is split into lines in one go.  With lazy
+ * reading the record is then kept with the disc: its genre and
+ * extended data lines are only indexed; they are decoded and
+ * converted to the user character set by the getters that return
+ * them (see #cddb_lazy_read_enable).
+ */
+static int cddb_parse_cached_data(cddb_conn_t *c, cddb_disc_t *disc,
+                                  char *buf, int size)
+{
+    cddb_line_ref_t lines[DEFAULT_LINE_TABLE_SIZE];
+    cddb_parser_t *p;
+    cddb_lazy_t *lz = NULL;
+    char *line;
+    int pos, n, i, used, rv = TRUE;
+
+    p = cddb_parser_new(disc);
+    if (p && c->lazy_read) {
+        /* decode what is left of a previous read, that record is
+           about to be replaced */
+        cddb_lazy_all(disc);
+        lz = cddb_lazy_new(buf, c->charset->name);
+        if (lz) {
+            cddb_parser_set_lazy(p, lz);
+        }
+    }
+    if (!p || (c->lazy_read && !lz)) {
+        free(buf);
+        cddb_parser_destroy(p);
+        cddb_errno_log_crit(c, CDDB_ERR_OUT_OF_MEMORY);
+        return FALSE;
+    }
+
+    /* split the record into lines and terminate them in place */
+    for (pos = 0; rv && (pos < size) && !cddb_parser_done(p); pos += used) {
+        n = cddb_scan_lines(buf + pos, size - pos, lines,
+                            DEFAULT_LINE_TABLE_SIZE, &used);
+        if (n == 0) {
+            /* last line is not terminated */
+            lines[0].off = 0;
+            lines[0].len = size - pos;
+            lines[0].eq = -1;
+            while ((lines[0].len > 0) &&
+                   (buf[pos + lines[0].len - 1] == CHR_CR)) {
+                lines[0].len--;
             }
-            FREE_NOT_NULL(fn);
+            n = 1;
+            used = size - pos;
         }
+        for (i = 0; rv && (i < n) && !cddb_parser_done(p); i++) {
+            line = buf + pos + lines[i].off;
+            line[lines[i].len] = CHR_EOS;
+            cddb_log_debug("...[C] line = '%s'", line);
+            rv = cddb_parser_line(p, line, lines[i].len, lines[i].eq);
+        }
+    }
+
+    if (!rv) {
+        /* invalid record */
+        cddb_errno_log_error(c, cddb_parser_errno(p));
+    } else if (!cddb_parser_finish(p)) {
+        cddb_cache_remove_invalid(c, disc);
         cddb_errno_log_error(c, CDDB_ERR_INVALID_RESPONSE);
+        rv = FALSE;
+    }
+    cddb_parser_destroy(p);
+
+    if (lz) {
+        /* the disc only keeps the record if some field is pending */
+        cddb_lazy_attach(disc, lz);
+        if (!rv) {
+            cddb_lazy_release(disc);
+        }
+    } else {
+        free(buf);
+    }
+    if (!rv) {
         return FALSE;
     }
 
+    /* convert the fields that have been decoded already */
     if (!cddb_disc_iconv(c->charset->cd_from_freedb, disc)) {
         cddb_errno_log_error(c, CDDB_ERR_ICONV_FAIL);
         return FALSE;
@@ -903,97 +1352,320 @@ int cddb_parse_record(cddb_conn_t *c, cddb_disc_t *disc)
 /* --- server commands --- */
 
 
-int cddb_read(cddb_conn_t *c, cddb_disc_t *disc)
+/**
+ * Check the preconditions of a read command and try to answer it
+ * from the local cache.
+ *
+ * @return TRUE if the command has been handled, the command result is
+ *         then stored in rc; FALSE if the server has to be contacted.
+ */
+static int cddb_read_local(cddb_conn_t *c, cddb_disc_t *disc, int *rc)
 {
-    char *msg;
-    int code, rc;
-
-    cddb_log_debug("cddb_read()");
     /* check whether we have enough info to execute the command */
     if ((disc->category == CDDB_CAT_INVALID) || (disc->discid == 0)) {
         cddb_errno_log_error(c, CDDB_ERR_DATA_MISSING);
-        return FALSE;
+        *rc = FALSE;
+        return TRUE;
     }
 
     if (cddb_cache_read(c, disc)) {
         /* cached version found */
+        *rc = TRUE;
         return TRUE;
     } else if (c->use_cache == CACHE_ONLY) {
         /* no network access allowed */
         cddb_errno_set(c, CDDB_ERR_DISC_NOT_FOUND);
+        *rc = FALSE;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * Skip the remaining lines of a multi-line server response, up to
+ * and including the terminating dot.
+ */
+static void cddb_skip_data(cddb_conn_t *c)
+{
+    char *line;
+    int errnum;
+
+    errnum = cddb_errno(c);     /* save error number */
+    while (((line = cddb_read_line(c)) != NULL) && (*line != CHR_DOT)) {
+        /* no-op */
+    }
+    cddb_errno_set(c, errnum);  /* restore error number */
+}
+
+/**
+ * Check the response to a read command and parse the CDDB record
+ * that follows it.
+ */
+static int cddb_read_response(cddb_conn_t *c, cddb_disc_t *disc)
+{
+    char *msg;
+    int code, rc;
+
+    switch (code = cddb_get_response_code(c, &msg)) {
+        case  -1:
+            return FALSE;
+        case 210:                   /* OK, CDDB database entry follows */
+            break;
+        case 401:                   /* specified CDDB entry not found */
+            cddb_errno_set(c, CDDB_ERR_DISC_NOT_FOUND);
+            return FALSE;
+        case 402:                   /* server error */
+        case 403:                   /* database entry is corrupt */
+            cddb_errno_log_error(c, CDDB_ERR_SERVER_ERROR);
+            return FALSE;
+        case 409:                   /* no handshake */
+        case 530:                   /* server error, server timeout */
+            cddb_disconnect(c);
+            cddb_errno_log_error(c, CDDB_ERR_NOT_CONNECTED);
+            return FALSE;
+        default:
+            cddb_errno_log_error(c, CDDB_ERR_UNKNOWN);
+            return FALSE;
+    }
+
+    /* parse CDDB record, up to the terminating dot even if it is
+       invalid */
+    rc = cddb_parse_record(c, disc);
+
+    /* close connection unless HTTP keep-alive is in effect */
+    cddb_http_done(c);
+
+    return rc;
+}
+
+/**
+ * Check again whether a record has been added to the local cache,
+ * after waiting for the lock of a connection that was fetching it.
+ */
+static int cddb_cache_reread(cddb_conn_t *c, cddb_disc_t *disc)
+{
+    cddb_index_t *idx;
+
+    if (cddb_cache_pack(c)) {
+        cddb_pack_recheck(c->cache_pack);
+    } else if ((idx = cddb_cache_index(c)) != NULL) {
+        cddb_index_recheck(idx);
+    }
+    return cddb_cache_read(c, disc);
+}
+
+/**
+ * Fetch a record from the server.
+ */
+static int cddb_read_remote(cddb_conn_t *c, cddb_disc_t *disc)
+{
+    if (!cddb_connect(c)) {
+        /* connection not OK */
         return FALSE;
     }
 
-    if (!cddb_connect(c)) {
-        /* connection not OK */
-        return FALSE;
+    /* send read command and check response */
+    if (!cddb_send_cmd(c, CMD_READ, CDDB_CATEGORY[disc->category], disc->discid)) {
+        return FALSE;
+    }
+    return cddb_read_response(c, disc);
+}
+
+int cddb_read(cddb_conn_t *c, cddb_disc_t *disc)
+{
+    int rc, locked;
+
+    cddb_log_debug("cddb_read()");
+    cddb_deadline_start(c);
+    if (cddb_read_local(c, disc, &rc)) {
+        return rc;
+    }
+
+    /* only one of the connections sharing the cache fetches the
+       record, the others wait for it and read it from the cache */
+    locked = FALSE;
+    if (c->cache_lock && (c->use_cache != CACHE_OFF)) {
+        /* the lock file lives in the cache directory */
+        locked = cddb_cache_mkdir(c, disc) &&
+                 cddb_cache_lock(c, disc->discid, disc->category);
+    }
+    if (locked && cddb_cache_reread(c, disc)) {
+        rc = TRUE;
+    } else {
+        rc = cddb_read_remote(c, disc);
+    }
+    if (locked) {
+        cddb_cache_unlock(c, disc->discid, disc->category);
+    }
+    return rc;
+}
+
+int cddb_read_many(cddb_conn_t *c, cddb_disc_t *discs[], int n, int *rcs)
+{
+    int *pending, cnt = 0, sent, done, count = 0, errnum = CDDB_ERR_OK;
+    int i, rc;
+
+    cddb_log_debug("cddb_read_many()");
+    if (n <= 0) {
+        /* nothing to read */
+        cddb_errno_set(c, CDDB_ERR_OK);
+        return 0;
+    }
+    cddb_deadline_start(c);
+    /* look up discs in the local cache first */
+    pending = (int*)malloc(n * sizeof(int));
+    if (!pending) {
+        cddb_errno_log_error(c, CDDB_ERR_OUT_OF_MEMORY);
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        if (cddb_read_local(c, discs[i], &rc)) {
+            if (rc) {
+                count++;
+            } else {
+                errnum = cddb_errno(c);
+            }
+            if (rcs) {
+                rcs[i] = rc;
+            }
+        } else {
+            pending[cnt++] = i;
+        }
+    }
+    cddb_log_debug("...%d of %d discs not cached", cnt, n);
+
+    if (c->is_http_enabled) {
+        /* no pipelining over HTTP, one request at a time, all within
+           the deadline of the whole batch */
+        for (i = 0; i < cnt; i++) {
+            rc = cddb_read_remote(c, discs[pending[i]]);
+            if (rc) {
+                count++;
+            } else {
+                errnum = cddb_errno(c);
+            }
+            if (rcs) {
+                rcs[pending[i]] = rc;
+            }
+        }
+        free(pending);
+        cddb_errno_set(c, errnum);
+        return count;
+    }
+
+    /* CDDBP: keep up to MAX_PIPELINE_DEPTH commands in flight, the
+       server answers them in the order they were sent */
+    sent = done = 0;
+    if ((cnt > 0) && !cddb_connect(c)) {
+        errnum = cddb_errno(c);
+        for (i = 0; rcs && (i < cnt); i++) {
+            rcs[pending[i]] = FALSE;
+        }
+        cnt = 0;
     }
+    while (done < cnt) {
+        while ((sent < cnt) && (sent - done < MAX_PIPELINE_DEPTH)) {
+            cddb_disc_t *disc = discs[pending[sent]];
 
-    /* send read command and check response */
-    if (!cddb_send_cmd(c, CMD_READ, CDDB_CATEGORY[disc->category], disc->discid)) {
-        return FALSE;
-    }
-    switch (code = cddb_get_response_code(c, &msg)) {
-        case  -1:
-            return FALSE;
-        case 210:                   /* OK, CDDB database entry follows */
+            if (!cddb_queue_cmd(c, CMD_READ, CDDB_CATEGORY[disc->category],
+                                disc->discid)) {
+                break;
+            }
+            sent++;
+        }
+        /* send all new commands in one go, a failure shows up when
+           reading the responses */
+        if (c->wbuf.len > 0) {
+            sock_fflush(c);
+        }
+        if (sent == done) {
+            /* nothing in flight, could not send */
             break;
-        case 401:                   /* specified CDDB entry not found */
-            cddb_errno_set(c, CDDB_ERR_DISC_NOT_FOUND);
-            return FALSE;
-        case 402:                   /* server error */
-        case 403:                   /* database entry is corrupt */
-            cddb_errno_log_error(c, CDDB_ERR_SERVER_ERROR);
-            return FALSE;
-        case 409:                   /* no handshake */
-        case 530:                   /* server error, server timeout */
-            cddb_disconnect(c);
-            cddb_errno_log_error(c, CDDB_ERR_NOT_CONNECTED);
-            return FALSE;
-        default:
-            cddb_errno_log_error(c, CDDB_ERR_UNKNOWN);
-            return FALSE;
+        }
+        rc = cddb_read_response(c, discs[pending[done]]);
+        if (rc) {
+            count++;
+        } else {
+            errnum = cddb_errno(c);
+        }
+        if (rcs) {
+            rcs[pending[done]] = rc;
+        }
+        done++;
+        if (!CONNECTION_OK(c)) {
+            /* the server hung up, remaining responses are lost */
+            break;
+        }
+    }
+    if (done < cnt) {
+        /* connection lost, the remaining discs could not be read */
+        cddb_errno_log_error(c, CDDB_ERR_NOT_CONNECTED);
+        errnum = CDDB_ERR_NOT_CONNECTED;
+        for (; rcs && (done < cnt); done++) {
+            rcs[pending[done]] = FALSE;
+        }
     }
+    free(pending);
+    cddb_errno_set(c, errnum);
+    return count;
+}
 
-    /* parse CDDB record */
-    rc = cddb_parse_record(c, disc);
+/**
+ * Split a query result line with REGEX_QUERY_MATCH, the regular
+ * expression counterpart of #cddb_scan_query_line.
+ */
+static int cddb_regex_query_line(const char *line, cddb_query_line_t *q)
+{
+    regmatch_t matches[7];
 
-    /* close connection if using HTTP */
-    if (c->is_http_enabled) {
-        cddb_disconnect(c);
+    if (regexec(REGEX_QUERY_MATCH, line, 7, matches, 0) == REG_NOMATCH) {
+        return FALSE;
     }
-
-    return rc;
+    q->cat = cddb_regex_ptr(line, matches, 1);
+    q->cat_len = cddb_regex_len(matches, 1);
+    q->discid = cddb_regex_get_hex(line, matches, 2);
+    if (matches[4].rm_so != -1) {
+        q->artist = cddb_regex_ptr(line, matches, 4);
+        q->artist_len = cddb_regex_len(matches, 4);
+        q->title = cddb_regex_ptr(line, matches, 5);
+        q->title_len = cddb_regex_len(matches, 5);
+    } else {
+        q->artist = NULL;
+        q->artist_len = 0;
+        q->title = cddb_regex_ptr(line, matches, 6);
+        q->title_len = cddb_regex_len(matches, 6);
+    }
+    return TRUE;
 }
 
 static int cddb_parse_query_data(cddb_conn_t *c, cddb_disc_t *disc,
                                  const char *line)
 {
-    char *aux;
-    regmatch_t matches[7];
+    cddb_query_line_t q;
+    int rv;
 
-    if (regexec(REGEX_QUERY_MATCH, line, 7, matches, 0) == REG_NOMATCH) {
+    if (libcddb_flags() & CDDB_F_REGEX_PARSER) {
+        rv = cddb_regex_query_line(line, &q);
+    } else {
+        rv = cddb_scan_query_line(line, &q);
+    }
+    if (!rv) {
         /* invalid repsponse */
         cddb_errno_log_error(c, CDDB_ERR_INVALID_RESPONSE);
         return FALSE;
     }
     /* extract category */
-    aux = cddb_regex_get_string(line, matches, 1);
-    cddb_disc_set_category_str(disc, aux);
-    free(aux);                  /* free temporary buffer */
+    cddb_disc_set_category_n(disc, q.cat, q.cat_len);
     /* extract disc ID */
-    aux = cddb_regex_get_string(line, matches, 2);
-    disc->discid = strtoll(aux, NULL, 16);
-    free(aux);                  /* free temporary buffer */
+    disc->discid = q.discid;
     /* extract artist and title */
-    if (matches[4].rm_so != -1) {
+    if (q.artist != NULL) {
         /* both artist and title of disc are specified */
-        disc->artist = cddb_regex_get_string(line, matches, 4);
-        disc->title = cddb_regex_get_string(line, matches, 5);
-    } else {
-        /* only title of disc is specified */
-        disc->title = cddb_regex_get_string(line, matches, 6);
-    }        
+        cddb_disc_set_artist(disc, NULL);
+        cddb_disc_append_artist_n(disc, q.artist, q.artist_len);
+    }
+    cddb_disc_set_title(disc, NULL);
+    cddb_disc_append_title_n(disc, q.title, q.title_len);
 
     if (!cddb_disc_iconv(c->charset->cd_from_freedb, disc)) {
         cddb_errno_log_error(c, CDDB_ERR_ICONV_FAIL);
@@ -1065,22 +1737,23 @@ static int cddb_handle_response_list(cddb_conn_t *c, cddb_disc_t *disc)
             return -1;
     }
 
-    /* close connection if using HTTP */
-    if (c->is_http_enabled) {
-        cddb_disconnect(c);
-    }
+    /* close connection unless HTTP keep-alive is in effect */
+    cddb_http_done(c);
 
     cddb_log_debug("...number of matches: %d", count);
     cddb_errno_set(c, CDDB_ERR_OK);
     return count;
 }
 
-int cddb_query(cddb_conn_t *c, cddb_disc_t *disc)
+/**
+ * Check the preconditions of a query command and try to answer it
+ * from the local cache.
+ *
+ * @return TRUE if the command has been handled, the command result is
+ *         then stored in rc; FALSE if the server has to be contacted.
+ */
+static int cddb_query_local(cddb_conn_t *c, cddb_disc_t *disc, int *rc)
 {
-    char *buf, offset[32];
-    cddb_track_t *track;
-
-    cddb_log_debug("cddb_query()");
     /* clear previous query result set */
     list_flush(c->query_data);
     
@@ -1093,17 +1766,32 @@ int cddb_query(cddb_conn_t *c, cddb_disc_t *disc)
     cddb_log_debug("...disc->track_cnt = %d", disc->track_cnt);
     if ((disc->discid == 0) || (disc->length == 0) || (disc->track_cnt == 0)) {
         cddb_errno_log_error(c, CDDB_ERR_DATA_MISSING);
-        return -1;
+        *rc = -1;
+        return TRUE;
     }
 
     if (cddb_cache_query(c, disc)) {
         /* cached version found */
+        *rc = TRUE;
         return TRUE;
     } else if (c->use_cache == CACHE_ONLY) {
         /* no network access allowed */
         cddb_errno_set(c, CDDB_ERR_DISC_NOT_FOUND);
-        return FALSE;
+        *rc = FALSE;
+        return TRUE;
     }
+    return FALSE;
+}
+
+/**
+ * Build the list of track frame offsets sent along with a query.
+ *
+ * @return A newly allocated string or NULL on error.
+ */
+static char *cddb_query_offsets(cddb_conn_t *c, cddb_disc_t *disc)
+{
+    char *buf, offset[32];
+    cddb_track_t *track;
 
     buf = (char*)malloc(c->buf_size);
     /* check track offsets and generate offset list */
@@ -1114,17 +1802,34 @@ int cddb_query(cddb_conn_t *c, cddb_disc_t *disc)
         if (track->frame_offset == -1) {
             cddb_errno_log_error(c, CDDB_ERR_DATA_MISSING);
             free(buf);
-            return -1;
+            return NULL;
         }
         snprintf(offset, sizeof(offset), "%d ", track->frame_offset);
         if (strlen(buf) + strlen(offset) >= c->buf_size) {
             /* buffer is too small */
             cddb_errno_log_crit(c, CDDB_ERR_LINE_SIZE);
             free(buf);
-            return -1;
+            return NULL;
         }
         strcat(buf, offset);
     }
+    return buf;
+}
+
+int cddb_query(cddb_conn_t *c, cddb_disc_t *disc)
+{
+    char *buf;
+    int rc;
+
+    cddb_log_debug("cddb_query()");
+    cddb_deadline_start(c);
+    if (cddb_query_local(c, disc, &rc)) {
+        return rc;
+    }
+
+    if ((buf = cddb_query_offsets(c, disc)) == NULL) {
+        return -1;
+    }
 
     if (!cddb_connect(c)) {
         /* connection not OK */
@@ -1162,6 +1867,7 @@ int cddb_query_next(cddb_conn_t *c, cddb_disc_t *disc)
 int cddb_album(cddb_conn_t *c, cddb_disc_t *disc)
 {
     cddb_log_debug("cddb_album()");
+    cddb_deadline_start(c);
     /* clear previous query result set */
     list_flush(c->query_data);
     
@@ -1197,51 +1903,45 @@ int cddb_album_next(cddb_conn_t *c, cddb_disc_t *disc)
   return cddb_query_next(c, disc);
 }
 
-static int cddb_parse_search_data(cddb_conn_t *c, cddb_disc_t **disc,
-                                  char *line, regmatch_t *matches)
+/**
+ * State kept while the hits on a search result page are collected.
+ */
+typedef struct cddb_search_state_s
 {
-    regmatch_t pre_matches[11];
-    char *buf;
+    cddb_conn_t *c;             /**< connection with the result list */
+    cddb_disc_t *last;          /**< the previous hit, or NULL */
+} cddb_search_state_t;
+
+/**
+ * Add a search hit to the query result list.
+ */
+static int cddb_add_search_hit(const cddb_search_hit_t *hit, void *arg)
+{
+    cddb_search_state_t *state = (cddb_search_state_t*)arg;
+    cddb_disc_t *disc;
 
-    /* HACK: because of greedy matching of POSIX regular expressions
-       we first need to check whether the prefix remainder also
-       contains a valid match. */
-    buf = cddb_regex_get_string(line, matches, 1);
-    if (regexec(REGEX_TEXT_SEARCH, buf, 11, pre_matches, 0) == 0) {
-        cddb_parse_search_data(c, disc, buf, pre_matches);
-    }
-    free(buf);
     /* clone so that duplicate matches get correct artist and title */
-    if (*disc) {
-        *disc = cddb_disc_clone(*disc);
+    if (state->last) {
+        disc = cddb_disc_clone(state->last);
     } else {
-        *disc = cddb_disc_new();
+        disc = cddb_disc_new();
     }
-    if (*disc == NULL) {
-        cddb_errno_log_error(c, CDDB_ERR_OUT_OF_MEMORY);
+    if (disc == NULL) {
+        cddb_errno_log_error(state->c, CDDB_ERR_OUT_OF_MEMORY);
         return FALSE;
     }
     /* fill in the results in the new disc */
-    buf = cddb_regex_get_string(line, matches, 2);
-    cddb_disc_set_category_str(*disc, buf);
-    free(buf);
-    cddb_disc_set_discid(*disc, cddb_regex_get_hex(line, matches, 3));
-    if (matches[6].rm_so != -1) {
-        buf = cddb_regex_get_string(line, matches, 6);
-        cddb_disc_set_artist(*disc, buf);
-        free(buf);
-        buf = cddb_regex_get_string(line, matches, 7);
-        cddb_disc_set_title(*disc, buf);
-        free(buf);
-    } else if (matches[8].rm_so != -1) {
-        buf = cddb_regex_get_string(line, matches, 8);
-        cddb_disc_set_artist(*disc, buf);
-        cddb_disc_set_title(*disc, buf);
-        free(buf);
-    } else if (matches[10].rm_so != -1) {
-        /* nothing to do, values should be correct because of cloning */
-    }
-    list_append(c->query_data, *disc);
+    cddb_disc_set_category_n(disc, hit->cat, hit->cat_len);
+    cddb_disc_set_discid(disc, hit->discid);
+    if (hit->title) {
+        cddb_disc_set_artist(disc, NULL);
+        cddb_disc_append_artist_n(disc, hit->artist, hit->artist_len);
+        cddb_disc_set_title(disc, NULL);
+        cddb_disc_append_title_n(disc, hit->title, hit->title_len);
+    }
+    /* else a duplicate, artist and title are correct because of cloning */
+    list_append(state->c->query_data, disc);
+    state->last = disc;
     return TRUE;
 }
 
@@ -1290,17 +1990,19 @@ static void cddb_search_param_str(cddb_search_params_t *params,
 
 int cddb_search(cddb_conn_t *c, cddb_disc_t *disc, const char *str)
 {
-    regmatch_t matches[11];
     char *line;
     int count;
-    cddb_disc_t *aux = NULL;
+    cddb_search_state_t state;
     char paramstr[1024];        /* big enough! */
 
     /* NOTE: For server access this function uses the special
              'cddb_search_conn' connection structure. */
     cddb_log_debug("cddb_search()");
-    /* copy proxy parameters */
+    /* copy proxy parameters and time outs */
     cddb_clone_proxy(cddb_search_conn, c);
+    cddb_search_conn->timeout = c->timeout;
+    cddb_search_conn->total_timeout = c->total_timeout;
+    cddb_deadline_start(cddb_search_conn);
     /* clear previous query result set */
     list_flush(c->query_data);
     
@@ -1321,12 +2023,11 @@ int cddb_search(cddb_conn_t *c, cddb_disc_t *disc, const char *str)
     }
 
     /* parse HTML response page */
+    state.c = c;
+    state.last = NULL;
     while ((line = cddb_read_line(cddb_search_conn)) != NULL) {
-        if (regexec(REGEX_TEXT_SEARCH, line, 11, matches, 0) == 0) {
-            /* process matching result line */
-            if (!cddb_parse_search_data(c, &aux, line, matches)) {
-                return -1;
-            }
+        if (cddb_scan_search_line(line, cddb_add_search_hit, &state) == -1) {
+            return -1;
         }
     }
     /* return first disc in result set */
@@ -1335,8 +2036,8 @@ int cddb_search(cddb_conn_t *c, cddb_disc_t *disc, const char *str)
         cddb_disc_copy(disc, 
                        (cddb_disc_t *)element_data(list_first(c->query_data)));
     }
-    /* close connection */
-    cddb_disconnect(cddb_search_conn);
+    /* close connection unless HTTP keep-alive is in effect */
+    cddb_http_done(cddb_search_conn);
 
     cddb_log_debug("...number of matches: %d", count);
     cddb_errno_set(c, CDDB_ERR_OK);
@@ -1434,6 +2135,7 @@ int cddb_write(cddb_conn_t *c, cddb_disc_t *disc)
     char buf[WRITE_BUF_SIZE];
 
     cddb_log_debug("cddb_write()");
+    cddb_deadline_start(c);
     /* check whether the default e-mail address has been changed, the
        freedb spec requires this */
     if (strcmp(c->user, DEFAULT_USER) == 0 ||
@@ -1459,7 +2161,9 @@ int cddb_write(cddb_conn_t *c, cddb_disc_t *disc)
         }
     }
 
-    /* convert to FreeDB character set */
+    /* convert to FreeDB character set, all fields have to be decoded
+       for that */
+    cddb_lazy_all(disc);
     if (!cddb_disc_iconv(c->charset->cd_to_freedb, disc)) {
         cddb_errno_log_error(c, CDDB_ERR_ICONV_FAIL);
         return FALSE;
@@ -1475,9 +2179,10 @@ int cddb_write(cddb_conn_t *c, cddb_disc_t *disc)
         if (cddb_cache_mkdir(c, disc)) {
             /* open file, possibly overwriting it */
             cddb_log_debug("...caching data");
-            cddb_cache_open(c, disc, "w");
-            fwrite(buf, sizeof(char), size, cddb_cache_file(c));
-            cddb_cache_close(c);
+            if (cddb_cache_open(c, disc, "w")) {
+                fwrite(buf, sizeof(char), size, cddb_cache_file(c));
+                cddb_cache_close(c);
+            }
         }
     }
 
@@ -1486,6 +2191,11 @@ int cddb_write(cddb_conn_t *c, cddb_disc_t *disc)
         cddb_errno_set(c, CDDB_ERR_OK);
         return TRUE;
     }
+
+    if (c->is_http_enabled) {
+        /* submissions use HTTP/1.0, do not reuse a kept-alive connection */
+        cddb_disconnect(c);
+    }
     
     if (!cddb_connect(c)) {
         /* connection not OK */
@@ -1522,8 +2232,10 @@ int cddb_write(cddb_conn_t *c, cddb_disc_t *disc)
     cddb_log_debug("...sending data");
     sock_fwrite(buf, sizeof(char), size, c);
     if (c->is_http_enabled) {
+        int chunked;
+
         /* skip HTTP response headers */
-        cddb_http_parse_headers(c);
+        cddb_http_parse_headers(c, &chunked);
     } else {
         /* send terminating marker */
         sock_fprintf(c, ".\n");
@@ -1567,6 +2279,7 @@ int cddb_sites(cddb_conn_t *c)
     cddb_site_t *site;
 
     cddb_log_debug("cddb_sites()");
+    cddb_deadline_start(c);
     /* clear previous sites result set */
     list_flush(c->sites_data);
 
@@ -1619,10 +2332,323 @@ int cddb_sites(cddb_conn_t *c)
         }
     }
 
-    /* close connection if using HTTP */
+    /* close connection unless HTTP keep-alive is in effect */
+    cddb_http_done(c);
+
+    return TRUE;
+}
+
+
+/* --- asynchronous commands --- */
+
+
+#define ASYNC_IDLE          0
+#define ASYNC_CONNECT       1
+#define ASYNC_BANNER        2
+#define ASYNC_HELLO         3
+#define ASYNC_PROTO         4
+#define ASYNC_RESPONSE      5
+#define ASYNC_DONE          6
+#define ASYNC_RESOLVE       7
+
+/**
+ * Finish the running asynchronous command with the given result.
+ */
+static int cddb_async_finish(cddb_conn_t *c, int result)
+{
+    FREE_NOT_NULL(c->async.offsets);
+    c->async.result = result;
+    c->async.state = ASYNC_DONE;
+    return TRUE;
+}
+
+/**
+ * Abort the running asynchronous command.  The connection is closed
+ * because it is in an unknown protocol state, the error number is
+ * preserved.
+ */
+static int cddb_async_fail(cddb_conn_t *c)
+{
+    int errnum;
+
+    errnum = cddb_errno(c);     /* save error number */
+    cddb_disconnect(c);
+    cddb_errno_set(c, errnum);  /* restore error number */
+    return cddb_async_finish(c, (c->async.cmd == CMD_QUERY) ? -1 : FALSE);
+}
+
+/**
+ * Send the actual command and start waiting for its response.
+ */
+static int cddb_async_send(cddb_conn_t *c)
+{
+    cddb_disc_t *disc = c->async.disc;
+    int rv;
+
+    if (c->async.cmd == CMD_READ) {
+        rv = cddb_send_cmd_nowait(c, CMD_READ, CDDB_CATEGORY[disc->category],
+                                  disc->discid);
+    } else {
+        rv = cddb_send_cmd_nowait(c, CMD_QUERY, disc->discid, disc->track_cnt,
+                                  c->async.offsets, disc->length);
+    }
+    if (!rv) {
+        return cddb_async_fail(c);
+    }
+    c->async.state = ASYNC_RESPONSE;
+    return FALSE;
+}
+
+/**
+ * The connection has been set up, either start the CDDBP handshake
+ * or send the HTTP request.
+ */
+static int cddb_async_connected(cddb_conn_t *c)
+{
     if (c->is_http_enabled) {
+        return cddb_async_send(c);
+    }
+    /* wait for the sign-on banner */
+    c->async.state = ASYNC_BANNER;
+    return FALSE;
+}
+
+/**
+ * Parse the complete response that was collected in the receive
+ * buffer and finish the command.
+ */
+static int cddb_async_response(cddb_conn_t *c)
+{
+    if (c->is_http_enabled && !cddb_http_recv_headers(c)) {
+        return cddb_async_fail(c);
+    }
+    if (c->async.cmd == CMD_READ) {
+        return cddb_async_finish(c, cddb_read_response(c, c->async.disc));
+    }
+    return cddb_async_finish(c, cddb_handle_response_list(c, c->async.disc));
+}
+
+/**
+ * Move on according to the outcome of #cddb_connect_start or
+ * #cddb_connect_resolved.
+ *
+ * @param connected Was the connection already open?
+ */
+static int cddb_async_connecting(cddb_conn_t *c, int rv, int connected)
+{
+    switch (rv) {
+        case -1:
+            return cddb_async_fail(c);
+        case 1:
+            /* wait for the connect to complete */
+            c->async.state = ASYNC_CONNECT;
+            return FALSE;
+        case 2:
+            /* wait for the host name look-up */
+            c->async.state = ASYNC_RESOLVE;
+            return FALSE;
+    }
+    if (connected && !c->is_http_enabled) {
+        /* handshake was done earlier */
+        return cddb_async_send(c);
+    }
+    return cddb_async_connected(c);
+}
+
+/**
+ * Set up the connection for the command, reusing an open one if
+ * possible.
+ */
+static int cddb_async_connect(cddb_conn_t *c)
+{
+    int connected, rv;
+
+    connected = CONNECTION_OK(c);
+    rv = cddb_connect_start(c);
+    /* a kept-alive HTTP connection might have been dropped by
+       cddb_connect_start */
+    c->async.reused = connected && CONNECTION_OK(c) && (rv == 0);
+    return cddb_async_connecting(c, rv, connected);
+}
+
+/**
+ * Common part of starting an asynchronous read or query.
+ */
+static int cddb_async_start(cddb_conn_t *c, int cmd, cddb_disc_t *disc)
+{
+    if ((c->async.state != ASYNC_IDLE) && (c->async.state != ASYNC_DONE)) {
+        /* abandon the previous command, connection is out of sync */
         cddb_disconnect(c);
     }
+    c->async.cmd = cmd;
+    c->async.disc = disc;
+    cddb_deadline_start(c);
+    cddb_async_connect(c);
+    return (c->async.state != ASYNC_DONE) ||
+           (c->async.result > 0);
+}
 
-    return TRUE;
+int cddb_read_start(cddb_conn_t *c, cddb_disc_t *disc)
+{
+    int rc;
+
+    cddb_log_debug("cddb_read_start()");
+    if (cddb_read_local(c, disc, &rc)) {
+        cddb_async_finish(c, rc);
+        return rc;
+    }
+    return cddb_async_start(c, CMD_READ, disc);
+}
+
+int cddb_query_start(cddb_conn_t *c, cddb_disc_t *disc)
+{
+    int rc;
+
+    cddb_log_debug("cddb_query_start()");
+    if (cddb_query_local(c, disc, &rc)) {
+        cddb_async_finish(c, rc);
+        return (rc != -1);
+    }
+    FREE_NOT_NULL(c->async.offsets);
+    if ((c->async.offsets = cddb_query_offsets(c, disc)) == NULL) {
+        cddb_async_finish(c, -1);
+        return FALSE;
+    }
+    return cddb_async_start(c, CMD_QUERY, disc);
+}
+
+int cddb_conn_fd(cddb_conn_t *c)
+{
+    if ((c->async.state == ASYNC_RESOLVE) && c->dns_job) {
+        return cddb_resolve_fd(c->dns_job);
+    }
+    return c->socket;
+}
+
+cddb_io_t cddb_conn_wants(cddb_conn_t *c)
+{
+    switch (c->async.state) {
+        case ASYNC_CONNECT:
+            return CDDB_IO_WRITE;
+        case ASYNC_RESOLVE:
+        case ASYNC_BANNER:
+        case ASYNC_HELLO:
+        case ASYNC_PROTO:
+        case ASYNC_RESPONSE:
+            return CDDB_IO_READ;
+        default:
+            return CDDB_IO_NONE;
+    }
+}
+
+int cddb_conn_time_left(cddb_conn_t *c)
+{
+    long long end, left;
+
+    switch (c->async.state) {
+        case ASYNC_IDLE:
+        case ASYNC_DONE:
+            return -1;
+    }
+    /* the look-up time-out already takes the deadline into account */
+    end = (c->dns_job ? c->dns_end : c->deadline);
+    if (!end) {
+        return -1;
+    }
+    left = end - cddb_now_ms();
+    return (left > 0) ? (int)left : 0;
+}
+
+int cddb_conn_result(cddb_conn_t *c)
+{
+    return c->async.result;
+}
+
+int cddb_conn_process(cddb_conn_t *c)
+{
+    cddb_rbuf_t *rb = &c->rbuf;
+    int eof, multi;
+
+    cddb_log_debug("cddb_conn_process()");
+    switch (c->async.state) {
+        case ASYNC_IDLE:
+        case ASYNC_DONE:
+            return TRUE;
+    }
+    if (c->deadline && cddb_now_ms() >= c->deadline) {
+        /* the command has used up its time */
+        cddb_errno_log_error(c, CDDB_ERR_TIMEOUT);
+        return cddb_async_fail(c);
+    }
+    switch (c->async.state) {
+        case ASYNC_RESOLVE:
+            return cddb_async_connecting(c, cddb_connect_resolved(c), FALSE);
+        case ASYNC_CONNECT:
+            if (sock_connect_check(c->socket) == -1) {
+                /* try the other addresses of the server */
+                switch (cddb_connect_next(c)) {
+                    case -1:
+                        return cddb_async_fail(c);
+                    case 1:
+                        return FALSE;
+                }
+            }
+            return cddb_async_connected(c);
+    }
+
+    /* collect the server response before handing it to the parsers,
+       which will then never have to wait for data */
+    if (sock_recv_avail(c, &eof) == -1) {
+        cddb_errno_log_error(c, CDDB_ERR_NOT_CONNECTED);
+        return cddb_async_fail(c);
+    }
+    if (eof && (rb->start == rb->end) && c->async.reused) {
+        /* the server closed the kept-alive connection before it got
+           our request, try once more on a new connection */
+        cddb_log_debug("...stale connection, retrying");
+        cddb_disconnect(c);
+        return cddb_async_connect(c);
+    }
+    if (!eof) {
+        if (!cddb_rbuf_has_response(rb, FALSE)) {
+            return FALSE;
+        }
+        if (c->async.state == ASYNC_RESPONSE) {
+            if (c->is_http_enabled) {
+                /* wait for the complete body, unless it is delimited
+                   by the server closing the connection */
+                return cddb_rbuf_has_http_response(rb) ?
+                    cddb_async_response(c) : FALSE;
+            }
+            /* 21x responses are followed by data up to a dot line */
+            multi = (rb->data[rb->start] == '2') &&
+                    (rb->data[rb->start + 1] == '1');
+            if (multi && !cddb_rbuf_has_response(rb, TRUE)) {
+                return FALSE;
+            }
+        }
+    }
+
+    switch (c->async.state) {
+        case ASYNC_BANNER:
+            if (!cddb_handshake_banner(c)) {
+                return cddb_async_fail(c);
+            }
+            c->async.state = ASYNC_HELLO;
+            break;
+        case ASYNC_HELLO:
+            if (!cddb_handshake_hello(c)) {
+                return cddb_async_fail(c);
+            }
+            c->async.state = ASYNC_PROTO;
+            break;
+        case ASYNC_PROTO:
+            if (!cddb_handshake_proto(c)) {
+                return cddb_async_fail(c);
+            }
+            return cddb_async_send(c);
+        case ASYNC_RESPONSE:
+            return cddb_async_response(c);
+    }
+    return FALSE;
 }
@@ -21,6 +21,8 @@
 
 #include "cddb/cddb_ni.h"
 
+#include <errno.h>
+
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>
 #endif
@@ -45,6 +47,10 @@
 #include <unistd.h>
 #endif
 
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
 
 /* --- prototypes --- */
 
@@ -61,6 +67,11 @@ static void cddb_set_http_proxy_auth(cddb_conn_t *c,
                                      const char *username,
                                      const char *password);
 
+/**
+ * Close the lock file of the cache directory.
+ */
+static void cddb_cache_close_lock(cddb_conn_t *c);
+
 
 /* --- construction / destruction --- */
 
@@ -74,22 +85,32 @@ cddb_conn_t *cddb_new(void)
     c = (cddb_conn_t*)malloc(sizeof(cddb_conn_t));
     if (c) {
         c->buf_size = DEFAULT_BUF_SIZE;
-        c->line = (char*)malloc(c->buf_size);
+        cddb_rbuf_init(&c->rbuf, DEFAULT_RECV_BUF_SIZE);
+        c->wbuf.data = NULL;
+        c->wbuf.size = 0;
+        c->wbuf.len = 0;
 
         c->cname = strdup(CLIENT_NAME);
         c->cversion = strdup(CLIENT_VERSION);
 
         c->is_connected = FALSE;
         c->socket = -1;
+        c->addrs.count = 0;
+        c->addr_idx = -1;
+        c->dns_job = NULL;
         c->cache_fp = NULL;
         c->server_name = strdup(DEFAULT_SERVER);
         c->server_port = DEFAULT_PORT;
-        c->timeout = DEFAULT_TIMEOUT;
+        c->timeout = DEFAULT_TIMEOUT * 1000;
+        c->total_timeout = 0;
+        c->deadline = 0;
 
         c->http_path_query = strdup(DEFAULT_PATH_QUERY);
         c->http_path_submit = strdup(DEFAULT_PATH_SUBMIT);
 
         c->is_http_enabled = FALSE;
+        c->http_keep_alive = FALSE;
+        c->http_body = FALSE;
         c->is_http_proxy_enabled = FALSE;
         c->http_proxy_server = NULL;
         c->http_proxy_server_port = DEFAULT_PROXY_PORT;
@@ -102,7 +123,21 @@ cddb_conn_t *cddb_new(void)
         s = getenv("HOME");
         c->cache_dir = (char*)malloc(strlen(s) + 1 + sizeof(DEFAULT_CACHE) + 1);
         sprintf(c->cache_dir, "%s/%s", s, DEFAULT_CACHE);
-        c->cache_read = FALSE;
+        c->cache_backend = CACHE_BACKEND_DIR;
+        c->cache_pack = NULL;
+        c->cache_put = FALSE;
+        c->cache_tmp = NULL;
+        c->cache_fn = NULL;
+        c->cache_lock = FALSE;
+        c->cache_lock_fd = -1;
+        c->cache_index = NULL;
+        c->cache_usage = NULL;
+        c->cache_max_bytes = 0;
+        c->cache_max_entries = 0;
+        c->query_cache = cddb_qcache_new(DEFAULT_QUERY_CACHE_SIZE);
+        c->query_negative_ttl = 0;
+        c->disc_cache = NULL;
+        c->lazy_read = FALSE;
 
         /* use anonymous@localhost */
         c->user = strdup(DEFAULT_USER);
@@ -117,9 +152,14 @@ cddb_conn_t *cddb_new(void)
         c->charset = malloc(sizeof(struct cddb_iconv_s));
         c->charset->cd_to_freedb = NULL;
         c->charset->cd_from_freedb = NULL;
+        c->charset->name = NULL;
 
         c->srch.fields = SEARCH_ARTIST | SEARCH_TITLE;
         c->srch.cats = SEARCH_ALL;
+
+        c->async.state = 0;
+        c->async.disc = NULL;
+        c->async.offsets = NULL;
     } else {
         cddb_log_crit(cddb_error_str(CDDB_ERR_OUT_OF_MEMORY));
     }
@@ -138,6 +178,7 @@ static void cddb_close_iconv(cddb_conn_t *c)
             iconv_close(c->charset->cd_from_freedb);
         }
 #endif /* HAVE_ICONV_H */
+        FREE_NOT_NULL(c->charset->name);
     }
 }
 
@@ -145,7 +186,8 @@ void cddb_destroy(cddb_conn_t *c)
 {
     if (c) {
         cddb_disconnect(c);
-        FREE_NOT_NULL(c->line);
+        FREE_NOT_NULL(c->rbuf.data);
+        FREE_NOT_NULL(c->wbuf.data);
         FREE_NOT_NULL(c->cname);
         FREE_NOT_NULL(c->cversion);
         FREE_NOT_NULL(c->server_name);
@@ -154,9 +196,16 @@ void cddb_destroy(cddb_conn_t *c)
         FREE_NOT_NULL(c->http_proxy_server);
         FREE_NOT_NULL(c->http_proxy_username);
         FREE_NOT_NULL(c->http_proxy_password);
+        cddb_index_destroy(c->cache_index);
+        cddb_usage_destroy(c->cache_usage);
+        cddb_pack_destroy(c->cache_pack);
+        cddb_qcache_destroy(c->query_cache);
+        cddb_dcache_destroy(c->disc_cache);
+        cddb_cache_close_lock(c);
         FREE_NOT_NULL(c->cache_dir);
         FREE_NOT_NULL(c->user);
         FREE_NOT_NULL(c->hostname);
+        FREE_NOT_NULL(c->async.offsets);
         list_destroy(c->query_data);
         list_destroy(c->sites_data);
         cddb_close_iconv(c);
@@ -187,6 +236,12 @@ int cddb_set_charset(cddb_conn_t *c, const char *charset)
         cddb_errno_set(c, CDDB_ERR_INVALID_CHARSET);
         return FALSE;
     }
+    /* remembered for records that are decoded later on */
+    c->charset->name = strdup(charset);
+    if (c->disc_cache) {
+        /* the cached discs have been converted to the old one */
+        cddb_dcache_clear(c->disc_cache);
+    }
     cddb_errno_set(c, CDDB_ERR_OK);
     return TRUE;
 #else
@@ -197,9 +252,9 @@ int cddb_set_charset(cddb_conn_t *c, const char *charset)
 
 void cddb_set_buf_size(cddb_conn_t *c, unsigned int size)
 {
-    FREE_NOT_NULL(c->line);
     c->buf_size = size;
-    c->line = (char*)malloc(c->buf_size);
+    /* the receive buffer should be able to hold at least one line */
+    cddb_rbuf_reserve(&c->rbuf, size + 1);
 }
 
 cddb_error_t cddb_set_site(cddb_conn_t *c, const cddb_site_t *site)
@@ -265,15 +320,44 @@ void cddb_set_server_port(cddb_conn_t *c, int port)
 unsigned int cddb_get_timeout(const cddb_conn_t *c)
 {
     if (c) {
-        return c->timeout;
+        /* round up, a sub-second time out should not show up as 0 */
+        return (c->timeout + 999) / 1000;
     }
     return 0;
 }
 
 void cddb_set_timeout(cddb_conn_t *c, unsigned int t)
+{
+    cddb_set_timeout_ms(c, t * 1000);
+}
+
+unsigned int cddb_get_timeout_ms(const cddb_conn_t *c)
+{
+    if (c) {
+        return c->timeout;
+    }
+    return 0;
+}
+
+void cddb_set_timeout_ms(cddb_conn_t *c, unsigned int ms)
 {
     if (c) {
-        c->timeout = t;
+        c->timeout = ms;
+    }
+}
+
+unsigned int cddb_get_total_timeout_ms(const cddb_conn_t *c)
+{
+    if (c) {
+        return c->total_timeout;
+    }
+    return 0;
+}
+
+void cddb_set_total_timeout_ms(cddb_conn_t *c, unsigned int ms)
+{
+    if (c) {
+        c->total_timeout = ms;
     }
 }
 
@@ -540,12 +624,41 @@ const char *cddb_cache_get_dir(const cddb_conn_t *c)
     return NULL;
 }
 
+static void cddb_cache_close_lock(cddb_conn_t *c)
+{
+    if (c->cache_lock_fd != -1) {
+        close(c->cache_lock_fd);
+        c->cache_lock_fd = -1;
+    }
+}
+
+/**
+ * Forget everything known about the contents of the cache directory.
+ */
+static void cddb_cache_reset(cddb_conn_t *c)
+{
+    cddb_cache_close_lock(c);
+    cddb_index_destroy(c->cache_index);
+    c->cache_index = NULL;
+    cddb_usage_destroy(c->cache_usage);
+    c->cache_usage = NULL;
+    cddb_pack_destroy(c->cache_pack);
+    c->cache_pack = NULL;
+    if (c->query_cache) {
+        cddb_qcache_clear(c->query_cache);
+    }
+    if (c->disc_cache) {
+        cddb_dcache_clear(c->disc_cache);
+    }
+}
+
 int cddb_cache_set_dir(cddb_conn_t *c, const char *dir)
 {
     char *home;
 
     cddb_log_debug("cddb_cache_set_dir()");
     if (dir) {
+        cddb_cache_reset(c);
         FREE_NOT_NULL(c->cache_dir);
         if (dir[0] == '~') {
             /* expand ~ to $HOME */
@@ -561,6 +674,277 @@ int cddb_cache_set_dir(cddb_conn_t *c, const char *dir)
     return TRUE;
 }
 
+cddb_cache_backend_t cddb_cache_get_backend(const cddb_conn_t *c)
+{
+    return c->cache_backend;
+}
+
+void cddb_cache_set_backend(cddb_conn_t *c, cddb_cache_backend_t backend)
+{
+    cddb_log_debug("cddb_cache_set_backend()");
+    if (backend != c->cache_backend) {
+        cddb_cache_reset(c);
+        c->cache_backend = backend;
+    }
+}
+
+int cddb_cache_convert(cddb_conn_t *c)
+{
+    cddb_pack_t *pack;
+    int rv;
+
+    cddb_log_debug("cddb_cache_convert()");
+    pack = (c->cache_dir ? cddb_pack_new(c->cache_dir) : NULL);
+    if (!pack) {
+        cddb_errno_log_error(c, CDDB_ERR_OUT_OF_MEMORY);
+        return -1;
+    }
+    rv = cddb_pack_convert(pack, c->cache_dir);
+    cddb_pack_destroy(pack);
+    if (rv == -1) {
+        cddb_errno_set(c, CDDB_ERR_UNKNOWN);
+    } else {
+        cddb_errno_set(c, CDDB_ERR_OK);
+    }
+    return rv;
+}
+
+cddb_pack_t *cddb_cache_pack(cddb_conn_t *c)
+{
+    if ((c->use_cache == CACHE_OFF) || !c->cache_dir ||
+        (c->cache_backend != CACHE_BACKEND_PACK)) {
+        return NULL;
+    }
+    if (!c->cache_pack) {
+        c->cache_pack = cddb_pack_new(c->cache_dir);
+    }
+    return c->cache_pack;
+}
+
+cddb_index_t *cddb_cache_index(cddb_conn_t *c)
+{
+    if ((c->use_cache == CACHE_OFF) || !c->cache_dir ||
+        (c->cache_backend != CACHE_BACKEND_DIR)) {
+        return NULL;
+    }
+    if (!c->cache_index) {
+        c->cache_index = cddb_index_new(c->cache_dir);
+    }
+    return c->cache_index;
+}
+
+cddb_usage_t *cddb_cache_usage(cddb_conn_t *c)
+{
+    if ((c->use_cache == CACHE_OFF) || !c->cache_dir ||
+        (c->cache_backend != CACHE_BACKEND_DIR) ||
+        (!c->cache_max_bytes && !c->cache_max_entries)) {
+        return NULL;
+    }
+    if (!c->cache_usage) {
+        c->cache_usage = cddb_usage_new(c->cache_dir);
+        /* scanned in the background, nothing is removed until then */
+        if (c->cache_usage && !cddb_usage_scan_start(c->cache_usage)) {
+            cddb_log_warn("cannot scan cache directory '%s'", c->cache_dir);
+            cddb_usage_destroy(c->cache_usage);
+            c->cache_usage = NULL;
+        }
+    }
+    return c->cache_usage;
+}
+
+#ifdef HAVE_FCNTL_H
+/**
+ * Byte of the lock file that stands for a record.  The disc ID is cut
+ * to 27 bits to keep the offset positive with a 32-bit off_t, discs
+ * that only differ in the top bits share a lock.
+ */
+#define LOCK_OFFSET(discid, cat) \
+    ((off_t)((discid) & 0x07ffffff) * 16 + (cat))
+
+/**
+ * Set or clear a lock on one byte of the lock file.  Locks that
+ * belong to the open file are used where available, so that
+ * connections of the same process exclude each other too.  Otherwise
+ * the lock belongs to the process.
+ */
+static int cddb_cache_lock_byte(cddb_conn_t *c, off_t off, int type)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = off;
+    fl.l_len = 1;
+#ifdef F_OFD_SETLKW
+    if (fcntl(c->cache_lock_fd, (type == F_UNLCK ? F_OFD_SETLK : F_OFD_SETLKW),
+              &fl) == 0) {
+        return TRUE;
+    }
+    if (errno != EINVAL) {
+        return FALSE;
+    }
+#endif
+    return (fcntl(c->cache_lock_fd, (type == F_UNLCK ? F_SETLK : F_SETLKW),
+                  &fl) == 0);
+}
+#endif /* HAVE_FCNTL_H */
+
+int cddb_cache_lock(cddb_conn_t *c, unsigned int discid, cddb_cat_t cat)
+{
+#ifdef HAVE_FCNTL_H
+    char *fn;
+
+    if (!c->cache_lock || (c->use_cache == CACHE_OFF) || !c->cache_dir) {
+        return FALSE;
+    }
+    if (c->cache_lock_fd == -1) {
+        fn = (char*)malloc(strlen(c->cache_dir) + 1 +
+                           sizeof(CACHE_LOCK_FILE));
+        if (!fn) {
+            cddb_errno_log_crit(c, CDDB_ERR_OUT_OF_MEMORY);
+            return FALSE;
+        }
+        sprintf(fn, "%s/%s", c->cache_dir, CACHE_LOCK_FILE);
+        c->cache_lock_fd = open(fn, O_RDWR | O_CREAT, 0644);
+        if (c->cache_lock_fd == -1) {
+            cddb_log_warn("cannot open cache lock file '%s'", fn);
+        }
+        free(fn);
+        if (c->cache_lock_fd == -1) {
+            return FALSE;
+        }
+    }
+    if (!cddb_cache_lock_byte(c, LOCK_OFFSET(discid, cat), F_WRLCK)) {
+        cddb_log_warn("cannot lock cache entry %s/%08x",
+                      CDDB_CATEGORY[cat], discid);
+        return FALSE;
+    }
+    return TRUE;
+#else
+    return FALSE;
+#endif /* HAVE_FCNTL_H */
+}
+
+void cddb_cache_unlock(cddb_conn_t *c, unsigned int discid, cddb_cat_t cat)
+{
+#ifdef HAVE_FCNTL_H
+    if (c->cache_lock_fd != -1) {
+        cddb_cache_lock_byte(c, LOCK_OFFSET(discid, cat), F_UNLCK);
+    }
+#endif /* HAVE_FCNTL_H */
+}
+
+int cddb_cache_set_query_size(cddb_conn_t *c, unsigned int size)
+{
+    cddb_log_debug("cddb_cache_set_query_size()");
+    cddb_qcache_destroy(c->query_cache);
+    c->query_cache = NULL;
+    if (size > 0) {
+        c->query_cache = cddb_qcache_new(size);
+        if (!c->query_cache) {
+            cddb_errno_log_error(c, CDDB_ERR_OUT_OF_MEMORY);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+void cddb_cache_set_query_negative_ttl(cddb_conn_t *c, int seconds)
+{
+    c->query_negative_ttl = (seconds > 0 ? seconds : 0);
+}
+
+int cddb_cache_set_disc_memory(cddb_conn_t *c, unsigned long bytes)
+{
+    cddb_log_debug("cddb_cache_set_disc_memory()");
+    cddb_dcache_destroy(c->disc_cache);
+    c->disc_cache = NULL;
+    if (bytes > 0) {
+        c->disc_cache = cddb_dcache_new(bytes);
+        if (!c->disc_cache) {
+            cddb_errno_log_error(c, CDDB_ERR_OUT_OF_MEMORY);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+void cddb_cache_set_limit(cddb_conn_t *c, unsigned long bytes,
+                          unsigned int entries)
+{
+    cddb_log_debug("cddb_cache_set_limit()");
+    c->cache_max_bytes = bytes;
+    c->cache_max_entries = entries;
+    if (!bytes && !entries) {
+        cddb_usage_destroy(c->cache_usage);
+        c->cache_usage = NULL;
+    }
+}
+
+int cddb_cache_save_index(cddb_conn_t *c)
+{
+    cddb_index_t *idx;
+
+    cddb_log_debug("cddb_cache_save_index()");
+    if (cddb_cache_pack(c)) {
+        if (!cddb_pack_save_index(c->cache_pack)) {
+            cddb_errno_set(c, CDDB_ERR_UNKNOWN);
+            return FALSE;
+        }
+        cddb_errno_set(c, CDDB_ERR_OK);
+        return TRUE;
+    }
+    idx = cddb_cache_index(c);
+    if (!idx || !cddb_index_save(idx)) {
+        cddb_errno_set(c, CDDB_ERR_UNKNOWN);
+        return FALSE;
+    }
+    cddb_errno_set(c, CDDB_ERR_OK);
+    return TRUE;
+}
+
+unsigned int cddb_is_lazy_read_enabled(const cddb_conn_t *c)
+{
+    if (c) {
+        return c->lazy_read;
+    }
+    return FALSE;
+}
+
+void cddb_lazy_read_enable(cddb_conn_t *c)
+{
+    c->lazy_read = TRUE;
+    cddb_errno_set(c, CDDB_ERR_OK);
+}
+
+void cddb_lazy_read_disable(cddb_conn_t *c)
+{
+    c->lazy_read = FALSE;
+    cddb_errno_set(c, CDDB_ERR_OK);
+}
+
+unsigned int cddb_is_cache_lock_enabled(const cddb_conn_t *c)
+{
+    if (c) {
+        return c->cache_lock;
+    }
+    return FALSE;
+}
+
+void cddb_cache_lock_enable(cddb_conn_t *c)
+{
+    c->cache_lock = TRUE;
+    cddb_errno_set(c, CDDB_ERR_OK);
+}
+
+void cddb_cache_lock_disable(cddb_conn_t *c)
+{
+    c->cache_lock = FALSE;
+    cddb_cache_close_lock(c);
+    cddb_errno_set(c, CDDB_ERR_OK);
+}
+
 const cddb_site_t *cddb_first_site(cddb_conn_t *c)
 {
     elem_t *e;
@@ -596,12 +980,12 @@ void cddb_search_set_categories(cddb_conn_t *c, unsigned int cats)
 /* --- connecting / disconnecting --- */
 
 
-static int cddb_handshake(cddb_conn_t *c)
+int cddb_handshake_banner(cddb_conn_t *c)
 {
     char *msg;
     int code;
 
-    cddb_log_debug("cddb_handshake()");
+    cddb_log_debug("cddb_handshake_banner()");
     /* check sign-on banner */
     switch (code = cddb_get_response_code(c, &msg)) {
         case  -1:
@@ -616,10 +1000,17 @@ static int cddb_handshake(cddb_conn_t *c)
             return FALSE;
     }
 
-    /* send hello and check response */
-    if (!cddb_send_cmd(c, CMD_HELLO, c->user, c->hostname, c->cname, c->cversion)) {
-        return FALSE;
-    }
+    /* send hello */
+    return cddb_send_cmd(c, CMD_HELLO, c->user, c->hostname, c->cname, c->cversion);
+}
+
+int cddb_handshake_hello(cddb_conn_t *c)
+{
+    char *msg;
+    int code;
+
+    cddb_log_debug("cddb_handshake_hello()");
+    /* check hello response */
     switch (code = cddb_get_response_code(c, &msg)) {
         case  -1:
             return FALSE;
@@ -632,9 +1023,16 @@ static int cddb_handshake(cddb_conn_t *c)
     }
 
     /* set protocol level */
-    if (!cddb_send_cmd(c, CMD_PROTO, DEFAULT_PROTOCOL_VERSION)) {
-        return FALSE;
-    }
+    return cddb_send_cmd(c, CMD_PROTO, DEFAULT_PROTOCOL_VERSION);
+}
+
+int cddb_handshake_proto(cddb_conn_t *c)
+{
+    char *msg;
+    int code;
+
+    cddb_log_debug("cddb_handshake_proto()");
+    /* check protocol level response */
     switch (code = cddb_get_response_code(c, &msg)) {
         case  -1:
             return FALSE;
@@ -651,44 +1049,98 @@ static int cddb_handshake(cddb_conn_t *c)
     return TRUE;
 }
 
+static int cddb_handshake(cddb_conn_t *c)
+{
+    cddb_log_debug("cddb_handshake()");
+    return cddb_handshake_banner(c) &&
+           cddb_handshake_hello(c) &&
+           cddb_handshake_proto(c);
+}
+
+/**
+ * Get the host name to connect to: that of the HTTP proxy if one is
+ * used, that of the CDDB server otherwise.
+ *
+ * @param port Set to the port to connect to.
+ */
+static const char *cddb_connect_host(cddb_conn_t *c, int *port)
+{
+    if (c->is_http_proxy_enabled) {
+        /* use HTTP proxy server name */
+        *port = c->http_proxy_server_port;
+        return c->http_proxy_server;
+    }
+    /* use CDDB server name */
+    *port = c->server_port;
+    return c->server_name;
+}
+
+/**
+ * Use the addresses the host name of the server (or proxy) resolved
+ * to.  The address that was connected to last time is put first in
+ * the list.
+ */
+static void cddb_connect_use(cddb_conn_t *c, const cddb_addrs_t *addrs)
+{
+    struct sockaddr_storage pref;
+    socklen_t pref_len = 0;
+
+    if (c->addr_idx >= 0 && c->addr_idx < c->addrs.count) {
+        pref = c->addrs.addr[c->addr_idx];
+        pref_len = c->addrs.len[c->addr_idx];
+    }
+    c->addr_idx = -1;
+    c->addrs = *addrs;
+    cddb_addrs_sort(&c->addrs, &pref, pref_len);
+}
+
+/**
+ * Resolve the host name of the server (or proxy).
+ */
+static int cddb_connect_resolve(cddb_conn_t *c)
+{
+    cddb_addrs_t addrs;
+    const char *host;
+    int port;
+
+    if (c->deadline && cddb_now_ms() >= c->deadline) {
+        /* no time left for the command */
+        cddb_errno_log_error(c, CDDB_ERR_TIMEOUT);
+        return FALSE;
+    }
+
+    /* resolve host name */
+    host = cddb_connect_host(c, &port);
+    if (timeout_getaddrinfo(host, port, &addrs, cddb_timeout_left(c)) == -1) {
+        cddb_errno_log_error(c, CDDB_ERR_UNKNOWN_HOST_NAME);
+        return FALSE;
+    }
+    cddb_connect_use(c, &addrs);
+    return TRUE;
+}
+
 int cddb_connect(cddb_conn_t *c)
 {
-    int rv = TRUE;
+    int idx;
 
     cddb_log_debug("cddb_connect()");
+    if (CONNECTION_OK(c) && c->is_http_enabled && !sock_check_idle(c)) {
+        /* kept-alive HTTP connection was closed by the server */
+        cddb_log_debug("...reconnecting");
+        cddb_disconnect(c);
+    }
     if (!CONNECTION_OK(c)) {
-        struct hostent *he;
-
-        /* resolve host name */
-        if (c->is_http_proxy_enabled) {
-            /* use HTTP proxy server name */
-            he = timeout_gethostbyname(c->http_proxy_server, c->timeout);
-            c->sa.sin_port = htons(c->http_proxy_server_port);
-        } else {
-            /* use CDDB server name */
-            he = timeout_gethostbyname(c->server_name, c->timeout);
-            c->sa.sin_port = htons(c->server_port);
-        }
-        if (he == NULL) {
-            cddb_errno_log_error(c, CDDB_ERR_UNKNOWN_HOST_NAME);
+        if (!cddb_connect_resolve(c)) {
             return FALSE;
         }
-        /* initialize socket address */
-        c->sa.sin_family = AF_INET;
-        c->sa.sin_addr = *((struct in_addr*)he->h_addr);
-        memset(&(c->sa.sin_zero), 0, sizeof(c->sa.sin_zero));
 
-        if ((c->socket  = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-            cddb_errno_log_error(c, CDDB_ERR_CONNECT);
-            return FALSE;
-        }
-
-        rv =  timeout_connect(c->socket, (struct sockaddr*)&(c->sa), 
-                              sizeof(struct sockaddr), c->timeout);
-        if (rv == -1) {
-            cddb_errno_log_error(c, CDDB_ERR_CONNECT);
+        c->socket = timeout_connect(&c->addrs, cddb_timeout_left(c), &idx);
+        if (c->socket == -1) {
+            cddb_errno_log_error(c, (errno == ETIMEDOUT) ? CDDB_ERR_TIMEOUT :
+                                                           CDDB_ERR_CONNECT);
             return FALSE;
         } 
+        c->addr_idx = idx;
 
         if (!c->is_http_enabled) {
             /* send handshake message to CDDB server (CDDBP only) */
@@ -700,6 +1152,125 @@ int cddb_connect(cddb_conn_t *c)
     return TRUE;
 }
 
+/**
+ * Start a non-blocking connect to the addresses of the server,
+ * beginning with the one at the given index.
+ */
+static int cddb_connect_addr(cddb_conn_t *c, int idx)
+{
+    int rv = -1;
+
+    for (; rv == -1 && idx < c->addrs.count; idx++) {
+        c->socket = socket(c->addrs.addr[idx].ss_family, SOCK_STREAM, 0);
+        if (c->socket == -1) {
+            continue;
+        }
+        rv = sock_connect_start(c->socket,
+                                (struct sockaddr*)&c->addrs.addr[idx],
+                                c->addrs.len[idx]);
+        if (rv == -1) {
+            close(c->socket);
+            c->socket = -1;
+        } else {
+            c->addr_idx = idx;
+        }
+    }
+    if (rv == -1) {
+        cddb_errno_log_error(c, CDDB_ERR_CONNECT);
+    } else {
+        cddb_errno_set(c, CDDB_ERR_OK);
+    }
+    return rv;
+}
+
+int cddb_connect_start(cddb_conn_t *c)
+{
+    cddb_addrs_t addrs;
+    const char *host;
+    int port, rv;
+
+    cddb_log_debug("cddb_connect_start()");
+    if (CONNECTION_OK(c) && c->is_http_enabled && !sock_check_idle(c)) {
+        /* kept-alive HTTP connection was closed by the server */
+        cddb_log_debug("...reconnecting");
+        cddb_disconnect(c);
+    }
+    if (c->dns_job) {
+        /* still resolving */
+        return 2;
+    }
+    if (!CONNECTION_OK(c)) {
+        if (c->deadline && cddb_now_ms() >= c->deadline) {
+            /* no time left for the command */
+            cddb_errno_log_error(c, CDDB_ERR_TIMEOUT);
+            return -1;
+        }
+        host = cddb_connect_host(c, &port);
+        rv = cddb_resolve_start(host, port, &addrs, &c->dns_job);
+        if (rv == 1) {
+            c->dns_end = cddb_timeout_end(c);
+            cddb_errno_set(c, CDDB_ERR_OK);
+            return 2;
+        }
+        if (rv == -1) {
+            cddb_errno_log_error(c, CDDB_ERR_UNKNOWN_HOST_NAME);
+            return -1;
+        }
+        cddb_connect_use(c, &addrs);
+        return cddb_connect_addr(c, 0);
+    }
+
+    cddb_errno_set(c, CDDB_ERR_OK);
+    return 0;
+}
+
+int cddb_connect_resolved(cddb_conn_t *c)
+{
+    cddb_addrs_t addrs;
+    int port, rv;
+
+    cddb_log_debug("cddb_connect_resolved()");
+    if (!c->dns_job) {
+        return cddb_connect_start(c);
+    }
+    cddb_connect_host(c, &port);
+    rv = cddb_resolve_finish(c->dns_job, port, &addrs);
+    if (rv == 1) {
+        if (cddb_now_ms() < c->dns_end) {
+            return 2;
+        }
+        /* leave the look-up to finish on its own */
+        cddb_resolve_cancel(c->dns_job);
+        rv = -1;
+    }
+    c->dns_job = NULL;
+    if (rv == -1) {
+        cddb_errno_log_error(c, CDDB_ERR_UNKNOWN_HOST_NAME);
+        return -1;
+    }
+    cddb_connect_use(c, &addrs);
+    return cddb_connect_addr(c, 0);
+}
+
+int cddb_connect_next(cddb_conn_t *c)
+{
+    int idx = c->addr_idx;
+
+    cddb_log_debug("cddb_connect_next()");
+    cddb_disconnect(c);
+    c->addr_idx = -1;
+    if (idx < 0) {
+        cddb_errno_log_error(c, CDDB_ERR_CONNECT);
+        return -1;
+    }
+    return cddb_connect_addr(c, idx + 1);
+}
+
+void cddb_deadline_start(cddb_conn_t *c)
+{
+    c->deadline = c->total_timeout ? cddb_now_ms() + c->total_timeout : 0;
+}
+
 void cddb_disconnect(cddb_conn_t *c)
 {
     cddb_log_debug("cddb_disconnect()");
@@ -707,6 +1278,15 @@ void cddb_disconnect(cddb_conn_t *c)
         close(c->socket);
         c->socket = -1;
     }
+    if (c->dns_job) {
+        cddb_resolve_cancel(c->dns_job);
+        c->dns_job = NULL;
+    }
+    /* drop any data still buffered for the old connection */
+    cddb_rbuf_reset(&c->rbuf);
+    c->wbuf.len = 0;
+    c->http_keep_alive = FALSE;
+    c->http_body = FALSE;
     cddb_errno_set(c, CDDB_ERR_OK);
 }
 
@@ -0,0 +1,318 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#include "cddb/cddb_ni.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+
+
+/* --- type and structure definitions */
+
+
+/* Initial number of hash buckets, a power of two. */
+#define DC_INITIAL_BUCKETS 256
+
+/**
+ * One cached disc.
+ */
+typedef struct dcache_entry_s
+{
+    cddb_disc_t *disc;          /**< private copy of the disc */
+    unsigned long size;         /**< estimated size of the copy */
+    struct dcache_entry_s *chain; /**< next entry in the same bucket */
+    struct dcache_entry_s *prev;  /**< more recently used entry */
+    struct dcache_entry_s *next;  /**< less recently used entry */
+} dcache_entry_t;
+
+/**
+ * Actual definition of the disc cache structure.
+ */
+struct cddb_dcache_s
+{
+    dcache_entry_t **buckets;   /**< hash chains */
+    unsigned int mask;          /**< number of buckets minus one */
+    unsigned int count;         /**< number of cached discs */
+    unsigned long size;         /**< estimated size of all cached discs */
+    unsigned long budget;       /**< maximum size of all cached discs */
+    dcache_entry_t *head;       /**< most recently used entry */
+    dcache_entry_t *tail;       /**< least recently used entry */
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t lock;       /**< serializes all access */
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+#define DC_LOCK(dc) pthread_mutex_lock(&(dc)->lock)
+#define DC_UNLOCK(dc) pthread_mutex_unlock(&(dc)->lock)
+#else
+#define DC_LOCK(dc)
+#define DC_UNLOCK(dc)
+#endif
+
+#define DC_BUCKET(dc, cat, discid) \
+    ((dc)->buckets + (((((discid) ^ (cat)) * 0x9e3779b1u) >> 16) & (dc)->mask))
+
+#define DC_STRLEN(s) ((s) ? strlen(s) + 1 : 0)
+
+
+/* --- private functions --- */
+
+
+/**
+ * Estimate the memory used by a disc and its tracks.
+ */
+static unsigned long cddb_dcache_disc_size(const cddb_disc_t *disc)
+{
+    const cddb_track_t *track;
+    unsigned long size;
+
+    size = sizeof(dcache_entry_t) + sizeof(cddb_disc_t) +
+        DC_STRLEN(disc->genre) + DC_STRLEN(disc->title) +
+        DC_STRLEN(disc->artist) + DC_STRLEN(disc->ext_data);
+    for (track = disc->tracks; track; track = track->next) {
+        size += sizeof(cddb_track_t) + DC_STRLEN(track->title) +
+            DC_STRLEN(track->artist) + DC_STRLEN(track->ext_data);
+    }
+    return size;
+}
+
+/**
+ * Find the link pointing to the entry of a disc.
+ *
+ * @return The link, which points to NULL if the disc is not cached.
+ */
+static dcache_entry_t **cddb_dcache_find(cddb_dcache_t *dc, cddb_cat_t cat,
+                                         unsigned int discid)
+{
+    dcache_entry_t **p;
+
+    for (p = DC_BUCKET(dc, cat, discid); *p; p = &(*p)->chain) {
+        if (((*p)->disc->discid == discid) && ((*p)->disc->category == cat)) {
+            break;
+        }
+    }
+    return p;
+}
+
+static void cddb_dcache_unlink(cddb_dcache_t *dc, dcache_entry_t *e)
+{
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        dc->head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        dc->tail = e->prev;
+    }
+}
+
+static void cddb_dcache_push(cddb_dcache_t *dc, dcache_entry_t *e)
+{
+    e->prev = NULL;
+    e->next = dc->head;
+    if (dc->head) {
+        dc->head->prev = e;
+    } else {
+        dc->tail = e;
+    }
+    dc->head = e;
+}
+
+/**
+ * Drop the entry a link points to.
+ */
+static void cddb_dcache_drop(cddb_dcache_t *dc, dcache_entry_t **p)
+{
+    dcache_entry_t *e = *p;
+
+    *p = e->chain;
+    cddb_dcache_unlink(dc, e);
+    dc->count--;
+    dc->size -= e->size;
+    cddb_disc_destroy(e->disc);
+    free(e);
+}
+
+/**
+ * Double the number of buckets.  Nothing happens if memory
+ * allocation fails, the chains just get longer.
+ */
+static void cddb_dcache_grow(cddb_dcache_t *dc)
+{
+    dcache_entry_t **old = dc->buckets, *e, *next, **p;
+    unsigned int n = dc->mask + 1, i;
+
+    dc->buckets = (dcache_entry_t**)calloc(n * 2, sizeof(dcache_entry_t*));
+    if (!dc->buckets) {
+        dc->buckets = old;
+        return;
+    }
+    dc->mask = n * 2 - 1;
+    for (i = 0; i < n; i++) {
+        for (e = old[i]; e; e = next) {
+            next = e->chain;
+            p = DC_BUCKET(dc, e->disc->category, e->disc->discid);
+            e->chain = *p;
+            *p = e;
+        }
+    }
+    free(old);
+}
+
+
+/* --- construction / destruction */
+
+
+cddb_dcache_t *cddb_dcache_new(unsigned long budget)
+{
+    cddb_dcache_t *dc;
+
+    dc = (cddb_dcache_t*)calloc(1, sizeof(cddb_dcache_t));
+    if (dc) {
+        dc->buckets = (dcache_entry_t**)calloc(DC_INITIAL_BUCKETS,
+                                               sizeof(dcache_entry_t*));
+        if (!dc->buckets) {
+            free(dc);
+            return NULL;
+        }
+        dc->mask = DC_INITIAL_BUCKETS - 1;
+        dc->count = 0;
+        dc->size = 0;
+        dc->budget = budget;
+        dc->head = dc->tail = NULL;
+#ifdef HAVE_PTHREAD
+        pthread_mutex_init(&dc->lock, NULL);
+#endif
+    }
+    return dc;
+}
+
+void cddb_dcache_destroy(cddb_dcache_t *dc)
+{
+    if (dc) {
+        cddb_dcache_clear(dc);
+#ifdef HAVE_PTHREAD
+        pthread_mutex_destroy(&dc->lock);
+#endif
+        free(dc->buckets);
+        free(dc);
+    }
+}
+
+
+/* --- lookup and update --- */
+
+
+int cddb_dcache_get(cddb_dcache_t *dc, cddb_cat_t cat, unsigned int discid,
+                    cddb_disc_t *disc)
+{
+    dcache_entry_t *e;
+
+    DC_LOCK(dc);
+    e = *cddb_dcache_find(dc, cat, discid);
+    if (e) {
+        if (dc->head != e) {
+            cddb_dcache_unlink(dc, e);
+            cddb_dcache_push(dc, e);
+        }
+        /* throw away what is left of a previous read, that record
+           is about to be replaced */
+        cddb_lazy_release(disc);
+        cddb_disc_copy(disc, e->disc);
+    }
+    DC_UNLOCK(dc);
+    return (e != NULL);
+}
+
+void cddb_dcache_put(cddb_dcache_t *dc, cddb_disc_t *disc)
+{
+    dcache_entry_t *e, **p;
+    unsigned long size;
+
+    e = (dcache_entry_t*)malloc(sizeof(dcache_entry_t));
+    if (!e) {
+        return;
+    }
+    /* cloning decodes the pending fields, the copy has none */
+    e->disc = cddb_disc_clone(disc);
+    if (!e->disc) {
+        free(e);
+        return;
+    }
+    size = e->size = cddb_dcache_disc_size(e->disc);
+    DC_LOCK(dc);
+    p = cddb_dcache_find(dc, disc->category, disc->discid);
+    if (*p) {
+        cddb_dcache_drop(dc, p);
+    }
+    if (size <= dc->budget) {
+        while (dc->size + size > dc->budget) {
+            /* evict the least recently used discs */
+            cddb_dcache_drop(dc, cddb_dcache_find(dc, dc->tail->disc->category,
+                                                  dc->tail->disc->discid));
+        }
+        p = DC_BUCKET(dc, disc->category, disc->discid);
+        e->chain = *p;
+        *p = e;
+        cddb_dcache_push(dc, e);
+        dc->count++;
+        dc->size += size;
+        if (dc->count > dc->mask) {
+            cddb_dcache_grow(dc);
+        }
+        e = NULL;
+    }
+    DC_UNLOCK(dc);
+    if (e) {
+        /* larger than the whole budget */
+        cddb_disc_destroy(e->disc);
+        free(e);
+    }
+}
+
+void cddb_dcache_forget(cddb_dcache_t *dc, cddb_cat_t cat,
+                        unsigned int discid)
+{
+    dcache_entry_t **p;
+
+    DC_LOCK(dc);
+    p = cddb_dcache_find(dc, cat, discid);
+    if (*p) {
+        cddb_dcache_drop(dc, p);
+    }
+    DC_UNLOCK(dc);
+}
+
+void cddb_dcache_clear(cddb_dcache_t *dc)
+{
+    DC_LOCK(dc);
+    while (dc->tail) {
+        cddb_dcache_drop(dc, cddb_dcache_find(dc, dc->tail->disc->category,
+                                              dc->tail->disc->discid));
+    }
+    DC_UNLOCK(dc);
+}
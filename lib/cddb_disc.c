@@ -36,46 +36,83 @@ const char *CDDB_CATEGORY[CDDB_CAT_LAST] = {
 };
 
 
+/**
+ * The categories that start with a given lower case letter, at most
+ * two per letter, ended by CDDB_CAT_LAST.
+ */
+static const cddb_cat_t CATEGORY_BY_LETTER[26][3] = {
+    /* a */ { CDDB_CAT_LAST },
+    /* b */ { CDDB_CAT_BLUES, CDDB_CAT_LAST },
+    /* c */ { CDDB_CAT_COUNTRY, CDDB_CAT_CLASSICAL, CDDB_CAT_LAST },
+    /* d */ { CDDB_CAT_DATA, CDDB_CAT_LAST },
+    /* e */ { CDDB_CAT_LAST },
+    /* f */ { CDDB_CAT_FOLK, CDDB_CAT_LAST },
+    /* g */ { CDDB_CAT_LAST },
+    /* h */ { CDDB_CAT_LAST },
+    /* i */ { CDDB_CAT_INVALID, CDDB_CAT_LAST },
+    /* j */ { CDDB_CAT_JAZZ, CDDB_CAT_LAST },
+    /* k */ { CDDB_CAT_LAST },
+    /* l */ { CDDB_CAT_LAST },
+    /* m */ { CDDB_CAT_MISC, CDDB_CAT_LAST },
+    /* n */ { CDDB_CAT_NEWAGE, CDDB_CAT_LAST },
+    /* o */ { CDDB_CAT_LAST },
+    /* p */ { CDDB_CAT_LAST },
+    /* q */ { CDDB_CAT_LAST },
+    /* r */ { CDDB_CAT_ROCK, CDDB_CAT_REGGAE, CDDB_CAT_LAST },
+    /* s */ { CDDB_CAT_SOUNDTRACK, CDDB_CAT_LAST },
+    /* t */ { CDDB_CAT_LAST },
+    /* u */ { CDDB_CAT_LAST },
+    /* v */ { CDDB_CAT_LAST },
+    /* w */ { CDDB_CAT_LAST },
+    /* x */ { CDDB_CAT_LAST },
+    /* y */ { CDDB_CAT_LAST },
+    /* z */ { CDDB_CAT_LAST },
+};
+
+
 /* --- private functions */
 
 
+cddb_cat_t cddb_category_n(const char *cat, int len)
+{
+    const cddb_cat_t *i;
+
+    if ((len > 0) && (cat[0] >= 'a') && (cat[0] <= 'z')) {
+        for (i = CATEGORY_BY_LETTER[cat[0] - 'a']; *i != CDDB_CAT_LAST; i++) {
+            if ((strncmp(cat, CDDB_CATEGORY[*i], len) == 0) &&
+                (CDDB_CATEGORY[*i][len] == '\0')) {
+                return *i;
+            }
+        }
+    }
+    return CDDB_CAT_MISC;
+}
+
+
 int cddb_disc_iconv(iconv_t cd, cddb_disc_t *disc)
 { 
-    char *result;
     cddb_track_t *track;
 
     if (!cd) {
         return TRUE;            /* no user character set defined */
     }
     if (disc->genre) {
-        if (cddb_str_iconv(cd, disc->genre, &result)) {
-            free(disc->genre);
-            disc->genre = result;
-        } else {
+        if (!cddb_str_iconv_field(cd, disc->arena, &disc->genre)) {
             return FALSE;
         }
     }
     if (disc->title) {
-        if (cddb_str_iconv(cd, disc->title, &result)) {
-            free(disc->title);
-            disc->title = result;
-        } else {
+        if (!cddb_str_iconv_field(cd, disc->arena, &disc->title)) {
             return FALSE;
         }
     }
     if (disc->artist) {
-        if (cddb_str_iconv(cd, disc->artist, &result)) {
-            free(disc->artist);
-            disc->artist = result;
-        } else {
+        if (!cddb_str_iconv_field(cd, disc->arena, &disc->artist)) {
             return FALSE;
         }
     }
     if (disc->ext_data) {
-        if (cddb_str_iconv(cd, disc->ext_data, &result)) {
-            free(disc->ext_data);
-            disc->ext_data = result;
-        } else {
+        if (!cddb_str_iconv_field(cd, disc->arena, &disc->ext_data)) {
             return FALSE;
         }
     }
@@ -107,21 +144,39 @@ cddb_disc_t *cddb_disc_new(void)
     return disc;
 }
 
+cddb_disc_t *cddb_disc_new_arena(void)
+{
+    cddb_disc_t *disc;
+
+    disc = cddb_disc_new();
+    if (disc) {
+        disc->arena = cddb_arena_new();
+        if (!disc->arena) {
+            cddb_log_crit(cddb_error_str(CDDB_ERR_OUT_OF_MEMORY));
+            free(disc);
+            return NULL;
+        }
+    }
+    return disc;
+}
+
 void cddb_disc_destroy(cddb_disc_t *disc)
 {
     cddb_track_t *track, *next;
 
     if (disc) {
-        FREE_NOT_NULL(disc->genre);
-        FREE_NOT_NULL(disc->title);
-        FREE_NOT_NULL(disc->artist);
-        FREE_NOT_NULL(disc->ext_data);
+        cddb_arena_str_free(disc->arena, &disc->genre);
+        cddb_arena_str_free(disc->arena, &disc->title);
+        cddb_arena_str_free(disc->arena, &disc->artist);
+        cddb_arena_str_free(disc->arena, &disc->ext_data);
         track = disc->tracks;
         while (track) {
             next = track->next;
             cddb_track_destroy(track);
             track = next;
         }
+        cddb_lazy_destroy(disc->lazy);
+        cddb_arena_destroy(disc->arena);
         free(disc);
     }
 }
@@ -132,16 +187,18 @@ cddb_disc_t *cddb_disc_clone(const cddb_disc_t *disc)
     cddb_track_t *track;
 
     cddb_log_debug("cddb_disc_clone()");
-    clone = cddb_disc_new();
+    /* the clone does not share the raw record */
+    cddb_lazy_all((cddb_disc_t*)disc);
+    clone = (disc->arena ? cddb_disc_new_arena() : cddb_disc_new());
     clone->discid = disc->discid;
     clone->category = disc->category;
     clone->year = disc->year;
-    clone->genre = (disc->genre ? strdup(disc->genre) : NULL);
-    clone->title = (disc->title ? strdup(disc->title) : NULL);
-    clone->artist = (disc->artist ? strdup(disc->artist) : NULL);
+    cddb_arena_str_set(clone->arena, &clone->genre, disc->genre);
+    cddb_arena_str_set(clone->arena, &clone->title, disc->title);
+    cddb_arena_str_set(clone->arena, &clone->artist, disc->artist);
     clone->length = disc->length;
     clone->revision = disc->revision;
-    clone->ext_data = (disc->ext_data ? strdup(disc->ext_data) : NULL);
+    cddb_arena_str_set(clone->arena, &clone->ext_data, disc->ext_data);
     /* clone the tracks */
     track = disc->tracks;
     while (track) {
@@ -251,17 +308,13 @@ const char *cddb_disc_get_category_str(cddb_disc_t *disc)
 
 void cddb_disc_set_category_str(cddb_disc_t *disc, const char *cat)
 {
-    int i;
+    cddb_disc_set_category_n(disc, cat, strlen(cat));
+}
 
-    FREE_NOT_NULL(disc->genre);
-    disc->genre = strdup(cat);
-    disc->category = CDDB_CAT_MISC;
-    for (i = 0; i < CDDB_CAT_LAST; i++) {
-        if (strcmp(cat, CDDB_CATEGORY[i]) == 0) {
-            disc->category = i;
-            return;
-        }
-    }
+void cddb_disc_set_category_n(cddb_disc_t *disc, const char *cat, int len)
+{
+    cddb_disc_set_genre_n(disc, cat, len);
+    disc->category = cddb_category_n(cat, len);
 }
 
 const char *cddb_disc_get_genre(const cddb_disc_t *disc)
@@ -269,6 +322,7 @@ const char *cddb_disc_get_genre(const cddb_disc_t *disc)
     const char *genre = NULL;
 
     if (disc) {
+        cddb_lazy_genre((cddb_disc_t*)disc);
         genre = disc->genre;
     }
     RETURN_STR_OR_EMPTY(genre);
@@ -277,8 +331,17 @@ const char *cddb_disc_get_genre(const cddb_disc_t *disc)
 void cddb_disc_set_genre(cddb_disc_t *disc, const char *genre)
 {
     if (disc) {
-        FREE_NOT_NULL(disc->genre);
-        disc->genre = strdup(genre);
+        cddb_lazy_drop(disc, &disc->lazy_genre);
+        cddb_arena_str_set(disc->arena, &disc->genre, genre);
+    }
+}
+
+void cddb_disc_set_genre_n(cddb_disc_t *disc, const char *genre, int len)
+{
+    if (disc) {
+        cddb_lazy_drop(disc, &disc->lazy_genre);
+        cddb_arena_str_free(disc->arena, &disc->genre);
+        cddb_arena_str_append(disc->arena, &disc->genre, genre, len);
     }
 }
 
@@ -348,26 +411,21 @@ const char *cddb_disc_get_title(const cddb_disc_t *disc)
 void cddb_disc_set_title(cddb_disc_t *disc, const char *title)
 {
     if (disc) {
-        FREE_NOT_NULL(disc->title);
-        if (title) {
-            disc->title = strdup(title);
-        }
+        cddb_arena_str_set(disc->arena, &disc->title, title);
     }
 }
 
 void cddb_disc_append_title(cddb_disc_t *disc, const char *title)
 {
-    int old_len = 0, len;
+    if (disc && title) {
+        cddb_disc_append_title_n(disc, title, strlen(title));
+    }
+}
 
+void cddb_disc_append_title_n(cddb_disc_t *disc, const char *title, int len)
+{
     if (disc && title) {
-        /* only append if there is something to append */
-        if (disc->title) {
-            old_len = strlen(disc->title);
-        }
-        len = strlen(title);
-        disc->title = realloc(disc->title, old_len+len+1);
-        strcpy(disc->title+old_len, title);
-        disc->title[old_len+len] = '\0';
+        cddb_arena_str_append(disc->arena, &disc->title, title, len);
     }
 }
 
@@ -384,26 +442,21 @@ const char *cddb_disc_get_artist(const cddb_disc_t *disc)
 void cddb_disc_set_artist(cddb_disc_t *disc, const char *artist)
 {
     if (disc) {
-        FREE_NOT_NULL(disc->artist);
-        if (artist) {
-            disc->artist = strdup(artist);
-        }
+        cddb_arena_str_set(disc->arena, &disc->artist, artist);
     }
 }
 
 void cddb_disc_append_artist(cddb_disc_t *disc, const char *artist)
 {
-    int old_len = 0, len;
+    if (disc && artist) {
+        cddb_disc_append_artist_n(disc, artist, strlen(artist));
+    }
+}
 
+void cddb_disc_append_artist_n(cddb_disc_t *disc, const char *artist, int len)
+{
     if (disc && artist) {
-        /* only append if there is something to append */
-        if (disc->artist) {
-            old_len = strlen(disc->artist);
-        }
-        len = strlen(artist);
-        disc->artist = realloc(disc->artist, old_len+len+1);
-        strcpy(disc->artist+old_len, artist);
-        disc->artist[old_len+len] = '\0';
+        cddb_arena_str_append(disc->arena, &disc->artist, artist, len);
     }
 }
 
@@ -412,6 +465,7 @@ const char *cddb_disc_get_ext_data(const cddb_disc_t *disc)
     const char *ext_data = NULL;
 
     if (disc) {
+        cddb_lazy_disc_ext((cddb_disc_t*)disc);
         ext_data = disc->ext_data;
     }
     RETURN_STR_OR_EMPTY(ext_data);
@@ -420,26 +474,23 @@ const char *cddb_disc_get_ext_data(const cddb_disc_t *disc)
 void cddb_disc_set_ext_data(cddb_disc_t *disc, const char *ext_data)
 {
     if (disc) {
-        FREE_NOT_NULL(disc->ext_data);
-        if (ext_data) {
-            disc->ext_data = strdup(ext_data);
-        }
+        cddb_lazy_drop(disc, &disc->lazy_ext);
+        cddb_arena_str_set(disc->arena, &disc->ext_data, ext_data);
     }
 }
 
 void cddb_disc_append_ext_data(cddb_disc_t *disc, const char *ext_data)
 {
-    int old_len = 0, len;
+    if (disc && ext_data) {
+        cddb_disc_append_ext_data_n(disc, ext_data, strlen(ext_data));
+    }
+}
 
+void cddb_disc_append_ext_data_n(cddb_disc_t *disc, const char *ext_data, int len)
+{
     if (disc && ext_data) {
-        /* only append if there is something to append */
-        if (disc->ext_data) {
-            old_len = strlen(disc->ext_data);
-        }
-        len = strlen(ext_data);
-        disc->ext_data = realloc(disc->ext_data, old_len+len+1);
-        strcpy(disc->ext_data+old_len, ext_data);
-        disc->ext_data[old_len+len] = '\0';
+        cddb_lazy_disc_ext(disc);
+        cddb_arena_str_append(disc->arena, &disc->ext_data, ext_data, len);
     }
 }
 
@@ -452,6 +503,7 @@ void cddb_disc_copy(cddb_disc_t *dst, cddb_disc_t *src)
     cddb_track_t *src_track, *dst_track;
 
     cddb_log_debug("cddb_disc_copy()");
+    cddb_lazy_all(src);
     if (src->discid != 0) {
         dst->discid = src->discid;
     }
@@ -462,16 +514,14 @@ void cddb_disc_copy(cddb_disc_t *dst, cddb_disc_t *src)
         dst->year = src->year;
     }
     if (src->genre != NULL) {
-        FREE_NOT_NULL(dst->genre);
-        dst->genre = strdup(src->genre);
+        cddb_lazy_drop(dst, &dst->lazy_genre);
+        cddb_arena_str_set(dst->arena, &dst->genre, src->genre);
     }
     if (src->title != NULL) {
-        FREE_NOT_NULL(dst->title);
-        dst->title = strdup(src->title);
+        cddb_arena_str_set(dst->arena, &dst->title, src->title);
     }
     if (src->artist) {
-        FREE_NOT_NULL(dst->artist);
-        dst->artist = strdup(src->artist);
+        cddb_arena_str_set(dst->arena, &dst->artist, src->artist);
     }
     if (src->length != 0) {
         dst->length = src->length;
@@ -480,8 +530,8 @@ void cddb_disc_copy(cddb_disc_t *dst, cddb_disc_t *src)
         dst->revision = src->revision;
     }
     if (src->ext_data != NULL) {
-        FREE_NOT_NULL(dst->ext_data);
-        dst->ext_data = strdup(src->ext_data);
+        cddb_lazy_drop(dst, &dst->lazy_ext);
+        cddb_arena_str_set(dst->arena, &dst->ext_data, src->ext_data);
     }
     /* copy the tracks */
     src_track = src->tracks;
@@ -536,6 +586,7 @@ void cddb_disc_print(cddb_disc_t *disc)
     cddb_track_t *track;
     int cnt;
 
+    cddb_lazy_all(disc);
     printf("Disc ID: %08x\n", disc->discid);
     printf("CDDB category: %s (%d)\n", CDDB_CATEGORY[disc->category], disc->category);
     printf("Music genre: '%s'\n", STR_OR_NULL(disc->genre));
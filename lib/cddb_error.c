@@ -71,7 +71,9 @@ static const char* err_str[CDDB_ERR_LAST] = {
     /* CDDB_ERR_PROXY_AUTH */
     "proxy authentication failed",
     /* CDDB_ERR_INVALID */
-    "invalid input parameter"
+    "invalid input parameter",
+    /* CDDB_ERR_TIMEOUT */
+    "operation timed out"
 
     /** CDDB_ERR_LAST */
 };
@@ -0,0 +1,917 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#include "cddb/cddb_ni.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_FCNTL_H
+#  include <fcntl.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+
+
+/* --- type and structure definitions */
+
+
+/* Size of a tar header and the unit of the archive. */
+#define TAR_BLOCK 512
+
+/* Padding after the data of an entry. */
+#define TAR_PAD(size) ((TAR_BLOCK - (size) % TAR_BLOCK) % TAR_BLOCK)
+
+/* Maximum number of records and bytes in a batch that is handed to a
+   worker thread. */
+#define IMPORT_BATCH_RECORDS 64
+#define IMPORT_BATCH_BYTES (256 * 1024)
+
+/* Larger files in the dump are rejected. */
+#define MAX_IMPORT_RECORD_SIZE MAX_HTTP_BODY_SIZE
+
+/**
+ * Header of an entry in a tar archive, POSIX ustar format.
+ */
+typedef struct tar_header_s
+{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+} tar_header_t;
+
+/**
+ * A record in a batch.
+ */
+typedef struct import_record_s
+{
+    unsigned int discid;        /**< the disc ID */
+    cddb_cat_t cat;             /**< the category */
+    int off;                    /**< offset of the record in the buffer */
+    int len;                    /**< length of the record */
+    cddb_error_t status;        /**< CDDB_ERR_OK if it is valid, the reason
+                                     it was rejected otherwise */
+} import_record_t;
+
+/**
+ * Records that are checked and written by one worker in one go.
+ */
+typedef struct import_batch_s
+{
+    struct import_batch_s *next; /**< next batch in the queue */
+    char *buf;                  /**< the records, one after the other */
+    int size;                   /**< allocated size of the buffer */
+    int len;                    /**< bytes in use */
+    int count;                  /**< number of records */
+    import_record_t recs[IMPORT_BATCH_RECORDS];
+} import_batch_t;
+
+/**
+ * Actual definition of the importer structure.
+ */
+struct cddb_import_s
+{
+    cddb_conn_t *conn;          /**< connection whose cache is filled */
+    int threads;                /**< number of worker threads */
+    int replace;                /**< replace records that are cached */
+    cddb_import_reject_cb *reject_cb; /**< called for rejected records */
+    void *reject_data;          /**< passed to reject_cb */
+    unsigned long counts[IMPORT_LAST]; /**< see cddb_import_count_t */
+
+    /* state of a running import */
+    cddb_index_t *index;        /**< presence index of the cache, or NULL */
+    cddb_pack_t *pack;          /**< packed store, or NULL */
+    unsigned int dirs;          /**< BIT(category) for every category
+                                     directory known to exist */
+    import_batch_t *queue;      /**< batches waiting for a worker */
+    import_batch_t *queue_tail; /**< last batch of the queue */
+    int queued;                 /**< number of batches in the queue */
+    int max_queued;             /**< limit on the number of batches queued */
+    import_batch_t *spare;      /**< batches that can be reused */
+    int done;                   /**< the whole dump has been queued */
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t queue_lock; /**< protects the queue and spare batches */
+    pthread_cond_t work;        /**< signalled when a batch is queued */
+    pthread_cond_t room;        /**< signalled when a batch is taken */
+    pthread_mutex_t store_lock; /**< protects the cache backend, the index,
+                                     the counts and the reject callback */
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+#define QUEUE_LOCK(imp) pthread_mutex_lock(&(imp)->queue_lock)
+#define QUEUE_UNLOCK(imp) pthread_mutex_unlock(&(imp)->queue_lock)
+#define STORE_LOCK(imp) pthread_mutex_lock(&(imp)->store_lock)
+#define STORE_UNLOCK(imp) pthread_mutex_unlock(&(imp)->store_lock)
+#else
+#define QUEUE_LOCK(imp)
+#define QUEUE_UNLOCK(imp)
+#define STORE_LOCK(imp)
+#define STORE_UNLOCK(imp)
+#endif
+
+
+/* --- private functions --- */
+
+
+/**
+ * Parse an octal number of a tar header.  Large numbers are stored
+ * in base 256 with the top bit of the first byte set.
+ */
+static long long tar_number(const char *p, int len)
+{
+    long long n = 0;
+    int i = 0;
+
+    if ((unsigned char)p[0] & 0x80) {
+        n = (unsigned char)p[0] & 0x3f;
+        for (i = 1; i < len; i++) {
+            n = (n << 8) | (unsigned char)p[i];
+        }
+        return n;
+    }
+    while ((i < len) && (p[i] == CHR_SPACE)) {
+        i++;
+    }
+    for (; (i < len) && (p[i] >= '0') && (p[i] <= '7'); i++) {
+        n = n * 8 + (p[i] - '0');
+    }
+    return n;
+}
+
+/**
+ * Check the checksum of a tar header, the sum of all its bytes with
+ * the checksum field taken as spaces.
+ */
+static int tar_header_valid(const tar_header_t *h)
+{
+    const unsigned char *p = (const unsigned char*)h;
+    long sum = 0;
+    int i;
+
+    for (i = 0; i < TAR_BLOCK; i++) {
+        if ((i >= 148) && (i < 156)) {
+            sum += CHR_SPACE;
+        } else {
+            sum += p[i];
+        }
+    }
+    return (sum == tar_number(h->chksum, sizeof(h->chksum)));
+}
+
+/**
+ * Check whether a block consists of zeros only, two of those end an
+ * archive.
+ */
+static int tar_block_empty(const char *p)
+{
+    int i;
+
+    for (i = 0; i < TAR_BLOCK; i++) {
+        if (p[i]) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * Check whether the name of an entry in the dump is that of a
+ * record, that is a category directory and a disc ID.
+ */
+static int import_record_name(const char *name, cddb_cat_t *cat,
+                              unsigned int *discid)
+{
+    const char *file, *dir;
+    int len;
+
+    file = strrchr(name, '/');
+    if (!file || !cddb_index_entry_name(file + 1, discid)) {
+        return FALSE;
+    }
+    for (dir = file; (dir > name) && (dir[-1] != '/'); dir--) {
+        /* no-op */
+    }
+    len = file - dir;
+    *cat = cddb_category_n(dir, len);
+    return ((strncmp(CDDB_CATEGORY[*cat], dir, len) == 0) &&
+            (CDDB_CATEGORY[*cat][len] == CHR_EOS));
+}
+
+/**
+ * Check a record with the record parser.
+ */
+static cddb_error_t import_check(const char *data, int len)
+{
+    cddb_disc_t *disc;
+    cddb_parser_t *p;
+    cddb_error_t rv = CDDB_ERR_OK;
+
+    disc = cddb_disc_new();
+    p = (disc ? cddb_parser_new(disc) : NULL);
+    if (!p) {
+        cddb_disc_destroy(disc);
+        return CDDB_ERR_OUT_OF_MEMORY;
+    }
+    if ((cddb_parser_feed(p, data, len) == -1) || !cddb_parser_finish(p)) {
+        rv = cddb_parser_errno(p);
+        if (rv == CDDB_ERR_OK) {
+            rv = CDDB_ERR_INVALID_RESPONSE;
+        }
+    } else if (!disc->title || !disc->tracks) {
+        rv = CDDB_ERR_DATA_MISSING;
+    }
+    cddb_parser_destroy(p);
+    cddb_disc_destroy(disc);
+    return rv;
+}
+
+/**
+ * Build the name of the cache file of a record, followed by a suffix.
+ */
+static char *import_file_name(cddb_import_t *imp, const import_record_t *r,
+                              const char *suffix)
+{
+    char *fn;
+    int len;
+
+    /* +11 for two slashes, disc ID and terminating zero */
+    len = strlen(imp->conn->cache_dir) + strlen(CDDB_CATEGORY[r->cat]) +
+          strlen(suffix) + 11;
+    fn = (char*)malloc(len);
+    if (fn) {
+        snprintf(fn, len, "%s/%s/%08x%s", imp->conn->cache_dir,
+                 CDDB_CATEGORY[r->cat], r->discid, suffix);
+    }
+    return fn;
+}
+
+/**
+ * Check whether the cache already holds a record.
+ */
+static int import_exists(cddb_import_t *imp, const import_record_t *r)
+{
+    struct stat buf;
+    char *fn;
+    int cats, rv;
+
+    if (imp->pack) {
+        return (cddb_pack_lookup(imp->pack, r->discid) & BIT(r->cat)) != 0;
+    }
+    if (imp->index && ((cats = cddb_index_lookup(imp->index, r->discid)) != -1)) {
+        return (cats & BIT(r->cat)) != 0;
+    }
+    fn = import_file_name(imp, r, "");
+    rv = (fn && (stat(fn, &buf) == 0));
+    FREE_NOT_NULL(fn);
+    return rv;
+}
+
+/**
+ * Create the category directory of a record, if that has not been
+ * done yet.
+ */
+static int import_mkdir(cddb_import_t *imp, cddb_cat_t cat)
+{
+    char *fn;
+    int rv = TRUE;
+
+    if (imp->dirs & BIT(cat)) {
+        return TRUE;
+    }
+    fn = (char*)malloc(strlen(imp->conn->cache_dir) +
+                       strlen(CDDB_CATEGORY[cat]) + 2);
+    if (!fn) {
+        return FALSE;
+    }
+    sprintf(fn, "%s/%s", imp->conn->cache_dir, CDDB_CATEGORY[cat]);
+    if ((MKDIR(fn, 0755) == -1) && (errno != EEXIST)) {
+        cddb_log_error("could not create category directory: %s", fn);
+        rv = FALSE;
+    } else {
+        imp->dirs |= BIT(cat);
+    }
+    free(fn);
+    return rv;
+}
+
+/**
+ * Write a record to its own file in the cache directory.  It is
+ * written to a temporary file first, that is renamed into place.
+ */
+static int import_write_file(cddb_import_t *imp, const import_record_t *r,
+                             const char *data)
+{
+    char *fn, *tmp;
+    int fd, pos, n, rv = FALSE;
+
+    fn = import_file_name(imp, r, "");
+#ifdef HAVE_MKSTEMP
+    tmp = import_file_name(imp, r, ".XXXXXX");
+#else
+    tmp = import_file_name(imp, r, ".import");
+#endif
+    if (!fn || !tmp) {
+        FREE_NOT_NULL(fn);
+        FREE_NOT_NULL(tmp);
+        return FALSE;
+    }
+#ifdef HAVE_MKSTEMP
+    fd = mkstemp(tmp);
+    if (fd != -1) {
+        fchmod(fd, 0644);
+    }
+#else
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd != -1) {
+        for (pos = 0; pos < r->len; pos += n) {
+            n = write(fd, data + pos, r->len - pos);
+            if ((n == -1) && (errno == EINTR)) {
+                n = 0;
+            } else if (n <= 0) {
+                break;
+            }
+        }
+        rv = (pos == r->len);
+        rv = (close(fd) == 0) && rv;
+        if (!rv || (rename(tmp, fn) == -1)) {
+            unlink(tmp);
+            rv = FALSE;
+        }
+    }
+    if (!rv) {
+        cddb_log_warn("cannot create cache entry '%s'", fn);
+    }
+    free(tmp);
+    free(fn);
+    return rv;
+}
+
+/**
+ * Report a rejected record.
+ */
+static void import_reject(cddb_import_t *imp, const import_record_t *r)
+{
+    char name[32];
+
+    cddb_log_debug("...rejected %s/%08x: %s", CDDB_CATEGORY[r->cat],
+                   r->discid, cddb_error_str(r->status));
+    imp->counts[IMPORT_REJECTED]++;
+    if (imp->reject_cb) {
+        snprintf(name, sizeof(name), "%s/%08x", CDDB_CATEGORY[r->cat],
+                 r->discid);
+        imp->reject_cb(name, r->status, imp->reject_data);
+    }
+}
+
+/**
+ * Check the records of a batch and add the valid ones to the cache.
+ * The cache backend and the index are only touched with the store
+ * lock held, files in the cache directory are written without it.
+ */
+static void import_batch(cddb_import_t *imp, import_batch_t *b)
+{
+    import_record_t *r;
+    int i;
+
+    /* skip the records that are cached already */
+    if (!imp->replace) {
+        STORE_LOCK(imp);
+        for (i = 0; i < b->count; i++) {
+            r = b->recs + i;
+            if (import_exists(imp, r)) {
+                r->status = CDDB_ERR_LAST;
+                imp->counts[IMPORT_EXISTING]++;
+            }
+        }
+        STORE_UNLOCK(imp);
+    }
+
+    for (i = 0; i < b->count; i++) {
+        r = b->recs + i;
+        if (r->status == CDDB_ERR_OK) {
+            r->status = import_check(b->buf + r->off, r->len);
+        }
+        if ((r->status == CDDB_ERR_OK) && !imp->pack &&
+            !import_write_file(imp, r, b->buf + r->off)) {
+            r->status = CDDB_ERR_UNKNOWN;
+        }
+    }
+
+    STORE_LOCK(imp);
+    for (i = 0; i < b->count; i++) {
+        r = b->recs + i;
+        if ((r->status == CDDB_ERR_OK) && imp->pack &&
+            !cddb_pack_add(imp->pack, r->discid, r->cat,
+                           b->buf + r->off, r->len)) {
+            r->status = CDDB_ERR_UNKNOWN;
+        }
+        switch (r->status) {
+            case CDDB_ERR_OK:
+                if (imp->index) {
+                    cddb_index_add(imp->index, r->discid, r->cat);
+                }
+                imp->counts[IMPORT_ADDED]++;
+                break;
+            case CDDB_ERR_LAST:
+                /* already counted */
+                break;
+            case CDDB_ERR_UNKNOWN:
+                imp->counts[IMPORT_FAILED]++;
+                break;
+            default:
+                import_reject(imp, r);
+        }
+    }
+    if (imp->pack) {
+        /* let the next lookup see the records just added */
+        cddb_pack_recheck(imp->pack);
+    }
+    STORE_UNLOCK(imp);
+}
+
+/**
+ * Get an empty batch.
+ */
+static import_batch_t *import_batch_get(cddb_import_t *imp)
+{
+    import_batch_t *b;
+
+    QUEUE_LOCK(imp);
+    b = imp->spare;
+    if (b) {
+        imp->spare = b->next;
+    }
+    QUEUE_UNLOCK(imp);
+    if (!b) {
+        b = (import_batch_t*)calloc(1, sizeof(import_batch_t));
+        if (!b) {
+            return NULL;
+        }
+    }
+    b->next = NULL;
+    b->len = 0;
+    b->count = 0;
+    return b;
+}
+
+/**
+ * Return a batch that has been processed.
+ */
+static void import_batch_put(cddb_import_t *imp, import_batch_t *b)
+{
+    QUEUE_LOCK(imp);
+    b->next = imp->spare;
+    imp->spare = b;
+    QUEUE_UNLOCK(imp);
+}
+
+#ifdef HAVE_PTHREAD
+
+/**
+ * Hand a full batch to the workers, waiting while the queue is full.
+ */
+static void import_queue(cddb_import_t *imp, import_batch_t *b)
+{
+    QUEUE_LOCK(imp);
+    while (imp->queued >= imp->max_queued) {
+        pthread_cond_wait(&imp->room, &imp->queue_lock);
+    }
+    if (imp->queue_tail) {
+        imp->queue_tail->next = b;
+    } else {
+        imp->queue = b;
+    }
+    imp->queue_tail = b;
+    imp->queued++;
+    pthread_cond_signal(&imp->work);
+    QUEUE_UNLOCK(imp);
+}
+
+/**
+ * Worker thread, processes batches until the dump is done.
+ */
+static void *import_worker(void *arg)
+{
+    cddb_import_t *imp = (cddb_import_t*)arg;
+    import_batch_t *b;
+
+    for (;;) {
+        QUEUE_LOCK(imp);
+        while (!imp->queue && !imp->done) {
+            pthread_cond_wait(&imp->work, &imp->queue_lock);
+        }
+        b = imp->queue;
+        if (b) {
+            imp->queue = b->next;
+            if (!imp->queue) {
+                imp->queue_tail = NULL;
+            }
+            imp->queued--;
+            pthread_cond_signal(&imp->room);
+        }
+        QUEUE_UNLOCK(imp);
+        if (!b) {
+            /* queue empty and done */
+            return NULL;
+        }
+        import_batch(imp, b);
+        import_batch_put(imp, b);
+    }
+}
+
+#endif /* HAVE_PTHREAD */
+
+/**
+ * Read exactly len bytes of the dump, or discard them if buf is NULL.
+ */
+static int import_read(FILE *fp, char *buf, long long len)
+{
+    char skip[TAR_BLOCK * 8];
+    size_t n;
+
+    if (buf) {
+        return (fread(buf, 1, len, fp) == (size_t)len);
+    }
+    while (len > 0) {
+        n = (len < (long long)sizeof(skip)) ? (size_t)len : sizeof(skip);
+        if (fread(skip, 1, n, fp) != n) {
+            return FALSE;
+        }
+        len -= n;
+    }
+    return TRUE;
+}
+
+/**
+ * Read the data of a record into a batch.
+ */
+static int import_add(cddb_import_t *imp, import_batch_t *b, FILE *fp,
+                      cddb_cat_t cat, unsigned int discid, int len)
+{
+    import_record_t *r;
+    char *buf;
+    int size;
+
+    if (b->len + len > b->size) {
+        size = b->size ? b->size : IMPORT_BATCH_BYTES;
+        while (size < b->len + len) {
+            size *= 2;
+        }
+        buf = (char*)realloc(b->buf, size);
+        if (!buf) {
+            cddb_errno_log_crit(imp->conn, CDDB_ERR_OUT_OF_MEMORY);
+            return FALSE;
+        }
+        b->buf = buf;
+        b->size = size;
+    }
+    if (!import_read(fp, b->buf + b->len, len)) {
+        cddb_errno_set(imp->conn, CDDB_ERR_UNEXPECTED_EOF);
+        return FALSE;
+    }
+    r = b->recs + b->count++;
+    r->discid = discid;
+    r->cat = cat;
+    r->off = b->len;
+    r->len = len;
+    r->status = CDDB_ERR_OK;
+    b->len += len;
+    return TRUE;
+}
+
+/**
+ * Read the dump and hand its records to the workers, or process them
+ * in this thread if there are none.
+ */
+static int import_stream(cddb_import_t *imp, FILE *fp, int workers)
+{
+    tar_header_t h;
+    import_batch_t *b = NULL;
+    char name[1024];
+    int longname = FALSE;
+    long long size;
+    unsigned int discid;
+    cddb_cat_t cat;
+    import_record_t rejected;
+
+    for (;;) {
+        if (!b && !(b = import_batch_get(imp))) {
+            cddb_errno_log_crit(imp->conn, CDDB_ERR_OUT_OF_MEMORY);
+            return FALSE;
+        }
+        if (fread(&h, 1, TAR_BLOCK, fp) != TAR_BLOCK) {
+            cddb_errno_set(imp->conn, CDDB_ERR_UNEXPECTED_EOF);
+            break;
+        }
+        if (tar_block_empty((const char*)&h)) {
+            /* end of archive */
+            cddb_errno_set(imp->conn, CDDB_ERR_OK);
+            break;
+        }
+        if (!tar_header_valid(&h)) {
+            cddb_log_error("dump is not a valid tar archive");
+            cddb_errno_set(imp->conn, CDDB_ERR_INVALID);
+            break;
+        }
+        size = tar_number(h.size, sizeof(h.size));
+        if (h.typeflag == 'L') {
+            /* GNU long name of the next entry */
+            if (size >= (long long)sizeof(name)) {
+                cddb_errno_set(imp->conn, CDDB_ERR_INVALID);
+                break;
+            }
+            if (!import_read(fp, name, size) ||
+                !import_read(fp, NULL, TAR_PAD(size))) {
+                cddb_errno_set(imp->conn, CDDB_ERR_UNEXPECTED_EOF);
+                break;
+            }
+            name[size] = CHR_EOS;
+            longname = TRUE;
+            continue;
+        }
+        if (!longname) {
+            if (h.prefix[0] && (strncmp(h.magic, "ustar", 5) == 0)) {
+                snprintf(name, sizeof(name), "%.*s/%.*s",
+                         (int)sizeof(h.prefix), h.prefix,
+                         (int)sizeof(h.name), h.name);
+            } else {
+                snprintf(name, sizeof(name), "%.*s",
+                         (int)sizeof(h.name), h.name);
+            }
+        }
+        longname = FALSE;
+        if (((h.typeflag != '0') && (h.typeflag != CHR_EOS)) ||
+            !import_record_name(name, &cat, &discid)) {
+            /* directory or some other file */
+            if ((h.typeflag == '0') || (h.typeflag == CHR_EOS)) {
+                imp->counts[IMPORT_IGNORED]++;
+            }
+        } else if (size > MAX_IMPORT_RECORD_SIZE) {
+            imp->counts[IMPORT_RECORDS]++;
+            imp->counts[IMPORT_BYTES] += size;
+            rejected.discid = discid;
+            rejected.cat = cat;
+            rejected.status = CDDB_ERR_LINE_SIZE;
+            STORE_LOCK(imp);
+            import_reject(imp, &rejected);
+            STORE_UNLOCK(imp);
+        } else {
+            imp->counts[IMPORT_RECORDS]++;
+            imp->counts[IMPORT_BYTES] += size;
+            if (!imp->pack) {
+                import_mkdir(imp, cat);
+            }
+            if (!import_add(imp, b, fp, cat, discid, size)) {
+                break;
+            }
+            if (!import_read(fp, NULL, TAR_PAD(size))) {
+                cddb_errno_set(imp->conn, CDDB_ERR_UNEXPECTED_EOF);
+                break;
+            }
+            if ((b->count == IMPORT_BATCH_RECORDS) ||
+                (b->len >= IMPORT_BATCH_BYTES)) {
+#ifdef HAVE_PTHREAD
+                if (workers > 0) {
+                    import_queue(imp, b);
+                    b = NULL;
+                    continue;
+                }
+#endif
+                import_batch(imp, b);
+                b->len = 0;
+                b->count = 0;
+            }
+            continue;
+        }
+        if (!import_read(fp, NULL, size + TAR_PAD(size))) {
+            cddb_errno_set(imp->conn, CDDB_ERR_UNEXPECTED_EOF);
+            break;
+        }
+    }
+    if (b) {
+        /* what is left is imported even if the dump is damaged */
+        if (b->count > 0) {
+            import_batch(imp, b);
+        }
+        import_batch_put(imp, b);
+    }
+    return (cddb_errno(imp->conn) == CDDB_ERR_OK);
+}
+
+
+/* --- construction / destruction --- */
+
+
+cddb_import_t *cddb_import_new(cddb_conn_t *c)
+{
+    cddb_import_t *imp;
+
+    imp = (cddb_import_t*)calloc(1, sizeof(cddb_import_t));
+    if (imp) {
+        imp->conn = c;
+        imp->threads = 1;
+#if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+        imp->threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (imp->threads < 1) {
+            imp->threads = 1;
+        }
+#endif
+        imp->replace = FALSE;
+        imp->reject_cb = NULL;
+        imp->spare = NULL;
+#ifdef HAVE_PTHREAD
+        pthread_mutex_init(&imp->queue_lock, NULL);
+        pthread_mutex_init(&imp->store_lock, NULL);
+        pthread_cond_init(&imp->work, NULL);
+        pthread_cond_init(&imp->room, NULL);
+#endif
+    }
+    return imp;
+}
+
+void cddb_import_destroy(cddb_import_t *imp)
+{
+    import_batch_t *b;
+
+    if (imp) {
+        while ((b = imp->spare) != NULL) {
+            imp->spare = b->next;
+            FREE_NOT_NULL(b->buf);
+            free(b);
+        }
+#ifdef HAVE_PTHREAD
+        pthread_mutex_destroy(&imp->queue_lock);
+        pthread_mutex_destroy(&imp->store_lock);
+        pthread_cond_destroy(&imp->work);
+        pthread_cond_destroy(&imp->room);
+#endif
+        free(imp);
+    }
+}
+
+
+/* --- setters / getters --- */
+
+
+void cddb_import_set_threads(cddb_import_t *imp, int threads)
+{
+    imp->threads = (threads > 1 ? threads : 1);
+}
+
+void cddb_import_set_replace(cddb_import_t *imp, int replace)
+{
+    imp->replace = replace;
+}
+
+void cddb_import_set_reject_cb(cddb_import_t *imp, cddb_import_reject_cb *cb,
+                               void *data)
+{
+    imp->reject_cb = cb;
+    imp->reject_data = data;
+}
+
+unsigned long cddb_import_get_count(const cddb_import_t *imp,
+                                    cddb_import_count_t which)
+{
+    if ((unsigned int)which >= IMPORT_LAST) {
+        return 0;
+    }
+    return imp->counts[which];
+}
+
+
+/* --- importing --- */
+
+
+int cddb_import_tar(cddb_import_t *imp, FILE *fp)
+{
+    cddb_conn_t *c = imp->conn;
+    int workers = 0, rv;
+#ifdef HAVE_PTHREAD
+    pthread_t *tids = NULL;
+    cddb_line_ref_t line;
+    int i;
+#endif
+
+    cddb_log_debug("cddb_import_tar()");
+    if ((c->use_cache == CACHE_OFF) || !c->cache_dir) {
+        cddb_errno_log_error(c, CDDB_ERR_INVALID);
+        return FALSE;
+    }
+    if ((MKDIR(c->cache_dir, 0755) == -1) && (errno != EEXIST)) {
+        cddb_log_error("could not create cache directory: %s", c->cache_dir);
+        cddb_errno_set(c, CDDB_ERR_INVALID);
+        return FALSE;
+    }
+    imp->pack = cddb_cache_pack(c);
+    imp->index = cddb_cache_index(c);
+    if (imp->index) {
+        /* the workers keep changing the category directories, they
+           would be scanned over and over again */
+        cddb_index_hold(imp->index);
+    }
+    imp->dirs = 0;
+    imp->queue = imp->queue_tail = NULL;
+    imp->queued = 0;
+    imp->done = FALSE;
+
+#ifdef HAVE_PTHREAD
+    if (imp->threads > 1) {
+        /* the parser picks its line scanner on first use, do that here
+           instead of in all workers at the same time */
+        cddb_scan_lines("", 0, &line, 1, &rv);
+        tids = (pthread_t*)malloc(imp->threads * sizeof(pthread_t));
+        for (i = 0; tids && (i < imp->threads); i++) {
+            if (pthread_create(tids + i, NULL, import_worker, imp) != 0) {
+                break;
+            }
+            workers++;
+        }
+        if (workers < imp->threads) {
+            cddb_log_warn("started only %d of %d import threads", workers,
+                          imp->threads);
+        }
+    }
+    /* enough batches to keep every worker busy */
+    imp->max_queued = 2 * workers;
+#endif
+
+    rv = import_stream(imp, fp, workers);
+
+#ifdef HAVE_PTHREAD
+    QUEUE_LOCK(imp);
+    imp->done = TRUE;
+    pthread_cond_broadcast(&imp->work);
+    QUEUE_UNLOCK(imp);
+    for (i = 0; i < workers; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    FREE_NOT_NULL(tids);
+#endif
+
+    if (imp->index) {
+        cddb_index_release(imp->index);
+    }
+    /* the index is written even if the dump was damaged, it covers
+       the records that were added */
+    if (imp->counts[IMPORT_ADDED] > 0) {
+        if (imp->pack) {
+            cddb_pack_save_index(imp->pack);
+        } else if (imp->index) {
+            cddb_index_save(imp->index);
+        }
+    }
+    /* remembered query results may be outdated */
+    if (c->query_cache) {
+        cddb_qcache_clear(c->query_cache);
+    }
+    if (c->disc_cache) {
+        cddb_dcache_clear(c->disc_cache);
+    }
+    /* the usage table does not know the new records, it is built
+       again when needed */
+    cddb_usage_destroy(c->cache_usage);
+    c->cache_usage = NULL;
+    return rv;
+}
@@ -0,0 +1,609 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#include "cddb/cddb_ni.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+#ifdef HAVE_DIRENT_H
+#  include <dirent.h>
+#endif
+
+
+/* --- type and structure definitions */
+
+
+/* First line of the index file. */
+#define INDEX_MAGIC "libcddb cache index 1\n"
+
+/* Initial number of slots in the hash table, a power of two. */
+#define INDEX_INITIAL_SIZE 1024
+
+/**
+ * One slot of the hash table.  A disc ID of 0 marks an unused slot,
+ * such discs are never cached.
+ */
+typedef struct index_entry_s
+{
+    unsigned int discid;        /**< the disc ID */
+    unsigned int cats;          /**< categories that hold a record for it */
+} index_entry_t;
+
+/**
+ * What the index knows about a category directory.
+ */
+typedef struct index_stamp_s
+{
+    long sec;                   /**< modification time of the directory, 0
+                                     if it does not exist or -1 if it has
+                                     not been scanned yet */
+    long nsec;                  /**< nanoseconds of the modification time,
+                                     if the system has them */
+    int racy;                   /**< the directory was scanned in the same
+                                     second as it was last changed, a change
+                                     made later in that second might not
+                                     show in its modification time */
+} index_stamp_t;
+
+/**
+ * Actual definition of the index structure.
+ */
+struct cddb_index_s
+{
+    char *dir;                  /**< the cache directory */
+    index_entry_t *slots;       /**< hash table, open addressing */
+    unsigned int size;          /**< number of slots, a power of two */
+    unsigned int count;         /**< number of slots in use */
+    index_stamp_t stamps[CDDB_CAT_INVALID]; /**< state of every category
+                                               directory */
+    time_t checked;             /**< last time the category directories were
+                                     checked for changes, or 0 */
+    int usable;                 /**< FALSE when memory ran out or the system
+                                     cannot scan directories */
+    int persist;                /**< keep the index file up to date */
+    int dirty;                  /**< changed since loaded or saved */
+    int held;                   /**< the category directories are not
+                                     checked for changes, see
+                                     cddb_index_hold */
+    int current[CDDB_CAT_INVALID]; /**< the category directory had not
+                                        changed since its stamp was taken
+                                        right before this index changed
+                                        it, see cddb_index_prepare */
+};
+
+
+/* --- private functions --- */
+
+
+/**
+ * Create the name of a file in the cache directory.
+ *
+ * @return The name, to be freed by the caller, or NULL.
+ */
+static char *cddb_index_path(cddb_index_t *idx, const char *name)
+{
+    char *fn;
+    int len;
+
+    len = strlen(idx->dir) + strlen(name) + 2;
+    fn = (char*)malloc(len);
+    if (fn) {
+        snprintf(fn, len, "%s/%s", idx->dir, name);
+    }
+    return fn;
+}
+
+/**
+ * Get the current state of a category directory.
+ */
+static void cddb_index_stat(cddb_index_t *idx, cddb_cat_t cat,
+                            index_stamp_t *stamp)
+{
+    struct stat st;
+    char *fn;
+
+    stamp->sec = 0;
+    stamp->nsec = 0;
+    stamp->racy = FALSE;
+    fn = cddb_index_path(idx, CDDB_CATEGORY[cat]);
+    if (fn && (stat(fn, &st) == 0)) {
+        stamp->sec = (long)st.st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+        stamp->nsec = st.st_mtim.tv_nsec;
+#endif
+    }
+    FREE_NOT_NULL(fn);
+}
+
+static unsigned int cddb_index_hash(unsigned int discid)
+{
+    /* the low bits of a disc ID are the track count, mix them up */
+    discid *= 0x9e3779b1;
+    return discid ^ (discid >> 16);
+}
+
+/**
+ * Double the size of the hash table.  Discs that are no longer cached
+ * in any category are dropped.
+ *
+ * @return FALSE if memory allocation failed.
+ */
+static int cddb_index_grow(cddb_index_t *idx)
+{
+    index_entry_t *old = idx->slots, *e;
+    unsigned int size = idx->size, i, h;
+
+    idx->slots = (index_entry_t*)calloc(size * 2, sizeof(index_entry_t));
+    if (!idx->slots) {
+        idx->slots = old;
+        return FALSE;
+    }
+    idx->size = size * 2;
+    idx->count = 0;
+    for (i = 0; i < size; i++) {
+        if (old[i].discid && old[i].cats) {
+            h = cddb_index_hash(old[i].discid);
+            for (e = idx->slots + (h & (idx->size - 1)); e->discid;
+                 e = idx->slots + (++h & (idx->size - 1))) {
+                /* find a free slot */
+            }
+            *e = old[i];
+            idx->count++;
+        }
+    }
+    free(old);
+    return TRUE;
+}
+
+/**
+ * Find the slot of a disc ID.
+ *
+ * @param insert Create the slot if the disc ID is not present yet.
+ * @return The slot or NULL if it was not found or could not be
+ *         created.
+ */
+static index_entry_t *cddb_index_find(cddb_index_t *idx, unsigned int discid,
+                                      int insert)
+{
+    index_entry_t *e;
+    unsigned int h;
+
+    if (discid == 0) {
+        return NULL;
+    }
+    h = cddb_index_hash(discid);
+    for (e = idx->slots + (h & (idx->size - 1)); e->discid;
+         e = idx->slots + (++h & (idx->size - 1))) {
+        if (e->discid == discid) {
+            return e;
+        }
+    }
+    if (!insert) {
+        return NULL;
+    }
+    if ((idx->count + 1) * 2 > idx->size) {
+        /* keep the table at most half full */
+        if (!cddb_index_grow(idx)) {
+            idx->usable = FALSE;
+            return NULL;
+        }
+        return cddb_index_find(idx, discid, TRUE);
+    }
+    e->discid = discid;
+    e->cats = 0;
+    idx->count++;
+    return e;
+}
+
+/**
+ * Scan a category directory and replace what the index knows about
+ * that category.
+ */
+static void cddb_index_scan(cddb_index_t *idx, cddb_cat_t cat,
+                            const index_stamp_t *stamp)
+{
+#ifdef HAVE_DIRENT_H
+    DIR *dir;
+    struct dirent *d;
+    index_entry_t *e;
+    unsigned int i, discid;
+    char *fn;
+
+    cddb_log_debug("cddb_index_scan()");
+    for (i = 0; i < idx->size; i++) {
+        idx->slots[i].cats &= ~BIT(cat);
+    }
+    fn = cddb_index_path(idx, CDDB_CATEGORY[cat]);
+    dir = (fn ? opendir(fn) : NULL);
+    FREE_NOT_NULL(fn);
+    if (dir) {
+        while ((d = readdir(dir)) != NULL) {
+            if (!cddb_index_entry_name(d->d_name, &discid)) {
+                /* not a cache entry */
+                continue;
+            }
+            e = cddb_index_find(idx, discid, TRUE);
+            if (!e) {
+                /* out of memory, the index is no longer usable */
+                break;
+            }
+            e->cats |= BIT(cat);
+        }
+        closedir(dir);
+    }
+    idx->stamps[cat] = *stamp;
+    idx->stamps[cat].racy = (stamp->sec >= (long)time(NULL) - 1);
+    idx->dirty = TRUE;
+#else
+    idx->usable = FALSE;
+#endif /* HAVE_DIRENT_H */
+}
+
+/**
+ * Scan the category directories that have changed since they were
+ * last scanned.
+ */
+static void cddb_index_check(cddb_index_t *idx)
+{
+    index_stamp_t stamp;
+    time_t now = time(NULL);
+    int cat;
+
+    if (idx->held ||
+        (idx->checked && (now - idx->checked < INDEX_CHECK_INTERVAL))) {
+        return;
+    }
+    idx->checked = now;
+    for (cat = CDDB_CAT_DATA; idx->usable && (cat < CDDB_CAT_INVALID); cat++) {
+        cddb_index_stat(idx, cat, &stamp);
+        if ((stamp.sec != idx->stamps[cat].sec) ||
+            (stamp.nsec != idx->stamps[cat].nsec) || idx->stamps[cat].racy) {
+            cddb_log_debug("...category '%s' changed", CDDB_CATEGORY[cat]);
+            cddb_index_scan(idx, cat, &stamp);
+        }
+    }
+}
+
+/**
+ * Load the index file.
+ *
+ * @return FALSE if there is no index file or it is invalid.
+ */
+static int cddb_index_load(cddb_index_t *idx)
+{
+    index_entry_t *e;
+    unsigned int discid, cats;
+    char line[64], name[32], *fn, *end;
+    long sec, nsec;
+    FILE *fp;
+    int cat, rv = TRUE;
+
+    fn = cddb_index_path(idx, INDEX_FILE);
+    fp = (fn ? fopen(fn, "r") : NULL);
+    FREE_NOT_NULL(fn);
+    if (!fp) {
+        return FALSE;
+    }
+    cddb_log_debug("cddb_index_load()");
+    /* the file will be updated, even if it is invalid */
+    idx->persist = TRUE;
+    if (!fgets(line, sizeof(line), fp) || (strcmp(line, INDEX_MAGIC) != 0)) {
+        rv = FALSE;
+    }
+    /* '<category> <seconds> <nanoseconds>' for every category */
+    for (cat = CDDB_CAT_DATA; rv && (cat < CDDB_CAT_INVALID); cat++) {
+        if (!fgets(line, sizeof(line), fp) ||
+            (sscanf(line, "%31s %ld %ld", name, &sec, &nsec) != 3) ||
+            (strcmp(name, CDDB_CATEGORY[cat]) != 0)) {
+            rv = FALSE;
+        } else {
+            idx->stamps[cat].sec = sec;
+            idx->stamps[cat].nsec = nsec;
+        }
+    }
+    /* '<discid> <categories>' for every disc */
+    while (rv && fgets(line, sizeof(line), fp)) {
+        discid = strtoul(line, &end, 16);
+        cats = strtoul(end, &end, 16);
+        if ((*end != CHR_LF) || !(e = cddb_index_find(idx, discid, TRUE))) {
+            rv = FALSE;
+        } else {
+            e->cats = cats;
+        }
+    }
+    fclose(fp);
+    if (!rv) {
+        /* start from scratch */
+        cddb_log_warn("ignoring invalid cache index in '%s'", idx->dir);
+        memset(idx->slots, 0, idx->size * sizeof(index_entry_t));
+        idx->count = 0;
+        for (cat = CDDB_CAT_DATA; cat < CDDB_CAT_INVALID; cat++) {
+            idx->stamps[cat].sec = -1;
+        }
+        idx->usable = TRUE;
+    }
+    idx->dirty = !rv;
+    return rv;
+}
+
+
+/* --- construction / destruction */
+
+
+cddb_index_t *cddb_index_new(const char *dir)
+{
+    cddb_index_t *idx;
+    int cat;
+
+    idx = (cddb_index_t*)calloc(1, sizeof(cddb_index_t));
+    if (idx) {
+        idx->dir = strdup(dir);
+        idx->size = INDEX_INITIAL_SIZE;
+        idx->slots = (index_entry_t*)calloc(idx->size, sizeof(index_entry_t));
+        if (!idx->dir || !idx->slots) {
+            FREE_NOT_NULL(idx->dir);
+            FREE_NOT_NULL(idx->slots);
+            free(idx);
+            return NULL;
+        }
+        idx->count = 0;
+        for (cat = CDDB_CAT_DATA; cat < CDDB_CAT_INVALID; cat++) {
+            idx->stamps[cat].sec = -1;
+        }
+        idx->checked = 0;
+#ifdef HAVE_DIRENT_H
+        idx->usable = TRUE;
+#else
+        idx->usable = FALSE;
+#endif
+        idx->persist = FALSE;
+        idx->dirty = FALSE;
+        idx->held = FALSE;
+        for (cat = CDDB_CAT_DATA; cat < CDDB_CAT_INVALID; cat++) {
+            idx->current[cat] = FALSE;
+        }
+        cddb_index_load(idx);
+    }
+    return idx;
+}
+
+void cddb_index_destroy(cddb_index_t *idx)
+{
+    if (idx) {
+        if (idx->persist && idx->dirty) {
+            cddb_index_save(idx);
+        }
+        FREE_NOT_NULL(idx->dir);
+        FREE_NOT_NULL(idx->slots);
+        free(idx);
+    }
+}
+
+
+/* --- lookup and update --- */
+
+
+int cddb_index_lookup(cddb_index_t *idx, unsigned int discid)
+{
+    index_entry_t *e;
+
+    if (!idx->usable) {
+        return -1;
+    }
+    cddb_index_check(idx);
+    if (!idx->usable) {
+        return -1;
+    }
+    e = cddb_index_find(idx, discid, FALSE);
+    return (e ? (int)e->cats : 0);
+}
+
+void cddb_index_prepare(cddb_index_t *idx, cddb_cat_t cat)
+{
+    index_stamp_t stamp;
+
+    if (!idx->usable || idx->held) {
+        return;
+    }
+    cddb_index_check(idx);
+    cddb_index_stat(idx, cat, &stamp);
+    idx->current[cat] = ((stamp.sec == idx->stamps[cat].sec) &&
+                         (stamp.nsec == idx->stamps[cat].nsec) &&
+                         !idx->stamps[cat].racy);
+}
+
+void cddb_index_touch(cddb_index_t *idx, cddb_cat_t cat)
+{
+    index_stamp_t stamp;
+
+    idx->dirty = TRUE;
+    if (idx->held || !idx->current[cat]) {
+        /* scanned again when released or on the next check */
+        return;
+    }
+    idx->current[cat] = FALSE;
+    cddb_index_stat(idx, cat, &stamp);
+    idx->stamps[cat].sec = stamp.sec;
+    idx->stamps[cat].nsec = stamp.nsec;
+}
+
+void cddb_index_add(cddb_index_t *idx, unsigned int discid, cddb_cat_t cat)
+{
+    index_entry_t *e;
+
+    if (!idx->usable) {
+        return;
+    }
+    cddb_index_check(idx);
+    e = cddb_index_find(idx, discid, TRUE);
+    if (e) {
+        e->cats |= BIT(cat);
+        cddb_index_touch(idx, cat);
+    }
+}
+
+void cddb_index_remove(cddb_index_t *idx, unsigned int discid, cddb_cat_t cat)
+{
+    index_entry_t *e;
+
+    if (!idx->usable) {
+        return;
+    }
+    cddb_index_check(idx);
+    e = cddb_index_find(idx, discid, FALSE);
+    if (e) {
+        e->cats &= ~BIT(cat);
+    }
+    cddb_index_touch(idx, cat);
+}
+
+void cddb_index_recheck(cddb_index_t *idx)
+{
+    idx->checked = 0;
+}
+
+void cddb_index_hold(cddb_index_t *idx)
+{
+    if (idx->usable) {
+        cddb_index_check(idx);
+    }
+    idx->held = TRUE;
+}
+
+void cddb_index_release(cddb_index_t *idx)
+{
+    if (!idx->held) {
+        return;
+    }
+    idx->held = FALSE;
+    /* somebody else may have changed the same directories, scan every
+       one that changed once */
+    idx->checked = 0;
+    if (idx->usable) {
+        cddb_index_check(idx);
+    }
+}
+
+int cddb_index_save(cddb_index_t *idx)
+{
+    char *fn, *tmp;
+    FILE *fp;
+    unsigned int i;
+    int cat, len, rv;
+#ifdef HAVE_MKSTEMP
+    int fd;
+#endif
+
+    cddb_log_debug("cddb_index_save()");
+    if (!idx->usable) {
+        return FALSE;
+    }
+    cddb_index_check(idx);
+    fn = cddb_index_path(idx, INDEX_FILE);
+    if (!fn) {
+        return FALSE;
+    }
+    /* write a temporary file and move it into place, readers never see
+       a partial index */
+    len = strlen(fn) + 16;
+    tmp = (char*)malloc(len);
+    if (!tmp) {
+        free(fn);
+        return FALSE;
+    }
+#ifdef HAVE_MKSTEMP
+    snprintf(tmp, len, "%s.XXXXXX", fn);
+    fd = mkstemp(tmp);
+    fp = NULL;
+    if (fd != -1) {
+        /* mkstemp only allows the owner to read the file */
+        fchmod(fd, 0644);
+        fp = fdopen(fd, "w");
+        if (!fp) {
+            close(fd);
+            unlink(tmp);
+        }
+    }
+#else
+    snprintf(tmp, len, "%s.%d", fn, (int)getpid());
+    fp = fopen(tmp, "w");
+#endif
+    if (!fp) {
+        cddb_log_error("cannot write cache index '%s'", tmp);
+        free(tmp);
+        free(fn);
+        return FALSE;
+    }
+    fputs(INDEX_MAGIC, fp);
+    for (cat = CDDB_CAT_DATA; cat < CDDB_CAT_INVALID; cat++) {
+        /* have a racy directory scanned again by whoever loads this */
+        fprintf(fp, "%s %ld %ld\n", CDDB_CATEGORY[cat],
+                idx->stamps[cat].racy ? -1 : idx->stamps[cat].sec,
+                idx->stamps[cat].nsec);
+    }
+    for (i = 0; i < idx->size; i++) {
+        if (idx->slots[i].discid && idx->slots[i].cats) {
+            fprintf(fp, "%08x %x\n", idx->slots[i].discid,
+                    idx->slots[i].cats);
+        }
+    }
+    rv = !ferror(fp);
+    rv = (fclose(fp) == 0) && rv && (rename(tmp, fn) == 0);
+    if (!rv) {
+        cddb_log_error("cannot write cache index '%s'", fn);
+        unlink(tmp);
+    } else {
+        idx->persist = TRUE;
+        idx->dirty = FALSE;
+    }
+    free(tmp);
+    free(fn);
+    return rv;
+}
+
+
+/* --- miscellaneous --- */
+
+
+int cddb_index_entry_name(const char *name, unsigned int *discid)
+{
+    int i;
+
+    for (i = 0; name[i]; i++) {
+        if ((i == 8) || !isxdigit((unsigned char)name[i])) {
+            return FALSE;
+        }
+    }
+    if (i != 8) {
+        return FALSE;
+    }
+    /* disc ID 0 is not valid, it marks unused slots of the index */
+    *discid = strtoul(name, NULL, 16);
+    return (*discid != 0);
+}
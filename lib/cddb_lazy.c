@@ -0,0 +1,244 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#include "cddb/cddb_ni.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/* --- type and structure definitions */
+
+
+/**
+ * Actual definition of the lazy record structure.
+ */
+struct cddb_lazy_s
+{
+    char *buf;                  /**< the raw record */
+    int pending;                /**< number of fields not decoded yet */
+    char *charset;              /**< user character set, or NULL */
+    iconv_t cd;                 /**< conversion descriptor, opened when
+                                     the first field is decoded */
+};
+
+
+/* --- construction / destruction */
+
+
+cddb_lazy_t *cddb_lazy_new(char *buf, const char *charset)
+{
+    cddb_lazy_t *lz;
+
+    lz = (cddb_lazy_t*)calloc(1, sizeof(cddb_lazy_t));
+    if (lz) {
+        if (charset) {
+            lz->charset = strdup(charset);
+            if (!lz->charset) {
+                free(lz);
+                return NULL;
+            }
+        }
+        lz->buf = buf;
+        lz->pending = 0;
+        lz->cd = NULL;
+    }
+    return lz;
+}
+
+void cddb_lazy_destroy(cddb_lazy_t *lz)
+{
+    if (lz) {
+#ifdef HAVE_ICONV_H
+        if (lz->cd) {
+            iconv_close(lz->cd);
+        }
+#endif /* HAVE_ICONV_H */
+        FREE_NOT_NULL(lz->charset);
+        FREE_NOT_NULL(lz->buf);
+        free(lz);
+    }
+}
+
+
+/* --- indexing --- */
+
+
+void cddb_lazy_mark(cddb_lazy_t *lz, cddb_span_t *span,
+                    const char *line, int len, int restart)
+{
+    int off = line - lz->buf;
+
+    if (span->len == 0) {
+        /* new pending field */
+        lz->pending++;
+        restart = TRUE;
+    }
+    if (restart) {
+        span->off = off;
+    }
+    span->len = off + len + 1 - span->off;
+}
+
+void cddb_lazy_attach(cddb_disc_t *disc, cddb_lazy_t *lz)
+{
+    if (lz->pending > 0) {
+        disc->lazy = lz;
+    } else {
+        cddb_lazy_destroy(lz);
+    }
+}
+
+void cddb_lazy_drop(cddb_disc_t *disc, cddb_span_t *span)
+{
+    if (disc && disc->lazy && (span->len > 0)) {
+        span->len = 0;
+        disc->lazy->pending--;
+        if (disc->lazy->pending == 0) {
+            /* nothing left to decode */
+            cddb_lazy_destroy(disc->lazy);
+            disc->lazy = NULL;
+        }
+    }
+}
+
+void cddb_lazy_release(cddb_disc_t *disc)
+{
+    cddb_track_t *track;
+
+    disc->lazy_genre.len = 0;
+    disc->lazy_ext.len = 0;
+    for (track = disc->tracks; track; track = track->next) {
+        track->lazy_ext.len = 0;
+    }
+    cddb_lazy_destroy(disc->lazy);
+    disc->lazy = NULL;
+}
+
+
+/* --- decoding --- */
+
+
+/**
+ * Open the conversion descriptor to the user character set the first
+ * time it is needed.
+ *
+ * @return The descriptor or NULL if no conversion is needed.
+ */
+static iconv_t cddb_lazy_iconv(cddb_lazy_t *lz)
+{
+#ifdef HAVE_ICONV_H
+    if (lz->charset && !lz->cd) {
+        lz->cd = iconv_open(lz->charset, SERVER_CHARSET);
+        if (lz->cd == (iconv_t)-1) {
+            cddb_log_error("cannot convert to character set '%s'",
+                           lz->charset);
+            lz->cd = NULL;
+            FREE_NOT_NULL(lz->charset);
+        }
+    }
+#endif /* HAVE_ICONV_H */
+    return lz->cd;
+}
+
+/**
+ * Decode a pending field.  The values of all lines of the given kind
+ * within the range of the field are concatenated, other lines are
+ * skipped just like the parser did, and the result is converted to
+ * the user character set.
+ *
+ * @param disc The disc the field belongs to.
+ * @param span The range of the field.
+ * @param kind The kind of record line that holds the field.
+ * @param s    The field.
+ */
+static void cddb_lazy_decode(cddb_disc_t *disc, cddb_span_t *span,
+                             cddb_line_kind_t kind, char **s)
+{
+    cddb_lazy_t *lz = disc->lazy;
+    cddb_field_t f;
+    const char *line, *end;
+    iconv_t cd;
+    int len;
+
+    cddb_log_debug("cddb_lazy_decode()");
+    line = lz->buf + span->off;
+    end = line + span->len;
+    cddb_arena_str_free(disc->arena, s);
+    for (; line < end; line += len + 1) {
+        len = strlen(line);
+        if (cddb_scan_record_line(line, len, -1, &f) != kind) {
+            continue;
+        }
+        /* an empty genre is still a genre, empty lines of extended
+           data add nothing */
+        if ((f.len > 0) || (kind == LINE_DISC_GENRE)) {
+            cddb_arena_str_append(disc->arena, s, f.str, f.len);
+        }
+    }
+    cd = cddb_lazy_iconv(lz);
+    if (*s && cd && !cddb_str_iconv_field(cd, disc->arena, s)) {
+        cddb_log_warn("cannot convert field '%s', keeping it unconverted",
+                      *s);
+    }
+    /* this also frees the record if it was the last field */
+    cddb_lazy_drop(disc, span);
+}
+
+void cddb_lazy_genre(cddb_disc_t *disc)
+{
+    if (disc->lazy && (disc->lazy_genre.len > 0)) {
+        cddb_lazy_decode(disc, &disc->lazy_genre, LINE_DISC_GENRE,
+                         &disc->genre);
+    }
+}
+
+void cddb_lazy_disc_ext(cddb_disc_t *disc)
+{
+    if (disc->lazy && (disc->lazy_ext.len > 0)) {
+        cddb_lazy_decode(disc, &disc->lazy_ext, LINE_DISC_EXT,
+                         &disc->ext_data);
+    }
+}
+
+void cddb_lazy_track_ext(cddb_track_t *track)
+{
+    cddb_disc_t *disc = track->disc;
+
+    if (disc && disc->lazy && (track->lazy_ext.len > 0)) {
+        cddb_lazy_decode(disc, &track->lazy_ext, LINE_TRACK_EXT,
+                         &track->ext_data);
+    }
+}
+
+void cddb_lazy_all(cddb_disc_t *disc)
+{
+    cddb_track_t *track;
+
+    if (disc->lazy) {
+        cddb_log_debug("cddb_lazy_all()");
+        cddb_lazy_genre(disc);
+        cddb_lazy_disc_ext(disc);
+        for (track = disc->tracks; disc->lazy && track; track = track->next) {
+            cddb_lazy_track_ext(track);
+        }
+    }
+}
@@ -0,0 +1,290 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#include "cddb/cddb_ni.h"
+
+#include <string.h>
+
+/* The vector versions need GCC style target attributes and run-time
+   CPU detection. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  ifdef HAVE_EMMINTRIN_H
+#    include <emmintrin.h>
+#    define SCAN_SSE2 1
+#  endif
+#  if defined(HAVE_IMMINTRIN_H) && ((__GNUC__ >= 5) || defined(__clang__))
+#    include <immintrin.h>
+#    define SCAN_AVX2 1
+#  endif
+#endif
+
+/* The helpers have to be inlined into the vector versions, calling
+   code compiled for plain SSE with the upper halves of the AVX
+   registers in use is very slow. */
+#ifdef __GNUC__
+#  define SCAN_INLINE static inline __attribute__((always_inline))
+#else
+#  define SCAN_INLINE static inline
+#endif
+
+
+/* --- type and structure definitions */
+
+
+/**
+ * State of a line scan, shared by all implementations.
+ */
+typedef struct scan_state_s
+{
+    const char *buf;            /**< the buffer being scanned */
+    cddb_line_ref_t *lines;     /**< the line table */
+    int max;                    /**< size of the line table */
+    int n;                      /**< number of lines found so far */
+    int start;                  /**< offset of the current line */
+    int eq;                     /**< offset of the first '=' in the current
+                                     line, relative to its start, or -1 */
+} scan_state_t;
+
+typedef int scan_lines_fn(const char *buf, int len, cddb_line_ref_t *lines,
+                          int max, int *used);
+
+/**
+ * A line scanner implementation.
+ */
+typedef struct scanner_s
+{
+    const char *name;           /**< name of the implementation */
+    scan_lines_fn *fn;          /**< the scanner */
+    int (*usable)(void);        /**< does the CPU support it? */
+} scanner_t;
+
+/** The implementation in use, picked on first use. */
+static scan_lines_fn *scan_lines = NULL;
+
+
+/* --- common helpers --- */
+
+
+/**
+ * Handle a line feed or '=' found at the given offset.
+ *
+ * @return FALSE when the line table is full.
+ */
+SCAN_INLINE int scan_mark(scan_state_t *s, int pos)
+{
+    cddb_line_ref_t *l;
+    int len;
+
+    if (s->buf[pos] != CHR_LF) {
+        /* only the first '=' of a line counts */
+        if (s->eq < 0) {
+            s->eq = pos - s->start;
+        }
+        return TRUE;
+    }
+    len = pos - s->start;
+    while ((len > 0) && (s->buf[s->start + len - 1] == CHR_CR)) {
+        len--;
+    }
+    l = s->lines + s->n++;
+    l->off = s->start;
+    l->len = len;
+    l->eq = ((s->eq >= 0) && (s->eq < len)) ? s->eq : len;
+    s->start = pos + 1;
+    s->eq = -1;
+    return (s->n < s->max);
+}
+
+#if defined(SCAN_SSE2) || defined(SCAN_AVX2)
+/**
+ * Handle all line feeds and '=' characters flagged in a bit mask
+ * computed for the block at the given offset.
+ *
+ * @return FALSE when the line table is full.
+ */
+SCAN_INLINE int scan_mask(scan_state_t *s, int base, unsigned int mask)
+{
+    while (mask) {
+        if (!scan_mark(s, base + __builtin_ctz(mask))) {
+            return FALSE;
+        }
+        mask &= mask - 1;
+    }
+    return TRUE;
+}
+#endif
+
+/**
+ * Scan the bytes from pos up to len one at a time.
+ */
+SCAN_INLINE int scan_bytes(scan_state_t *s, int pos, int len)
+{
+    for (; pos < len; pos++) {
+        if ((s->buf[pos] == CHR_LF) || (s->buf[pos] == '=')) {
+            if (!scan_mark(s, pos)) {
+                break;
+            }
+        }
+    }
+    return s->n;
+}
+
+SCAN_INLINE void scan_init(scan_state_t *s, const char *buf,
+                      cddb_line_ref_t *lines, int max)
+{
+    s->buf = buf;
+    s->lines = lines;
+    s->max = max;
+    s->n = 0;
+    s->start = 0;
+    s->eq = -1;
+}
+
+
+/* --- implementations --- */
+
+
+static int scan_lines_scalar(const char *buf, int len, cddb_line_ref_t *lines,
+                             int max, int *used)
+{
+    scan_state_t s;
+
+    scan_init(&s, buf, lines, max);
+    scan_bytes(&s, 0, len);
+    *used = s.start;
+    return s.n;
+}
+
+static int usable_always(void)
+{
+    return TRUE;
+}
+
+#ifdef SCAN_SSE2
+__attribute__((target("sse2")))
+static int scan_lines_sse2(const char *buf, int len, cddb_line_ref_t *lines,
+                           int max, int *used)
+{
+    const __m128i lf = _mm_set1_epi8(CHR_LF);
+    const __m128i eq = _mm_set1_epi8('=');
+    __m128i v;
+    unsigned int mask;
+    scan_state_t s;
+    int pos;
+
+    scan_init(&s, buf, lines, max);
+    for (pos = 0; pos + 16 <= len; pos += 16) {
+        v = _mm_loadu_si128((const __m128i*)(buf + pos));
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lf),
+                                              _mm_cmpeq_epi8(v, eq)));
+        if (mask && !scan_mask(&s, pos, mask)) {
+            break;
+        }
+    }
+    if (s.n < max) {
+        scan_bytes(&s, pos, len);
+    }
+    *used = s.start;
+    return s.n;
+}
+
+static int usable_sse2(void)
+{
+    return __builtin_cpu_supports("sse2");
+}
+#endif /* SCAN_SSE2 */
+
+#ifdef SCAN_AVX2
+__attribute__((target("avx2")))
+static int scan_lines_avx2(const char *buf, int len, cddb_line_ref_t *lines,
+                           int max, int *used)
+{
+    const __m256i lf = _mm256_set1_epi8(CHR_LF);
+    const __m256i eq = _mm256_set1_epi8('=');
+    __m256i v;
+    unsigned int mask;
+    scan_state_t s;
+    int pos;
+
+    scan_init(&s, buf, lines, max);
+    for (pos = 0; pos + 32 <= len; pos += 32) {
+        v = _mm256_loadu_si256((const __m256i*)(buf + pos));
+        mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, lf),
+                                                    _mm256_cmpeq_epi8(v, eq)));
+        if (mask && !scan_mask(&s, pos, mask)) {
+            break;
+        }
+    }
+    if (s.n < max) {
+        scan_bytes(&s, pos, len);
+    }
+    *used = s.start;
+    return s.n;
+}
+
+static int usable_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+#endif /* SCAN_AVX2 */
+
+/**
+ * The available implementations, best one first.
+ */
+static const scanner_t SCANNERS[] = {
+#ifdef SCAN_AVX2
+    { "avx2",   scan_lines_avx2,   usable_avx2 },
+#endif
+#ifdef SCAN_SSE2
+    { "sse2",   scan_lines_sse2,   usable_sse2 },
+#endif
+    { "scalar", scan_lines_scalar, usable_always },
+    { NULL,     NULL,              NULL }
+};
+
+
+/* --- public functions --- */
+
+
+const char *cddb_scan_lines_use(const char *name)
+{
+    int i;
+
+    for (i = 0; SCANNERS[i].name; i++) {
+        if ((!name || (strcmp(name, SCANNERS[i].name) == 0)) &&
+            SCANNERS[i].usable()) {
+            scan_lines = SCANNERS[i].fn;
+            cddb_log_debug("...line scanner: %s", SCANNERS[i].name);
+            return SCANNERS[i].name;
+        }
+    }
+    return NULL;
+}
+
+int cddb_scan_lines(const char *buf, int len, cddb_line_ref_t *lines,
+                    int max, int *used)
+{
+    if (!scan_lines) {
+        /* pick the best implementation this CPU supports */
+        cddb_scan_lines_use(NULL);
+    }
+    return scan_lines(buf, len, lines, max, used);
+}
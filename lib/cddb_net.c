@@ -21,6 +21,7 @@
 
 #include "cddb/cddb_ni.h"
 
+#include <ctype.h>
 #include <errno.h>
 
 #ifdef HAVE_FCNTL_H
@@ -31,8 +32,17 @@
 #include <netdb.h>
 #endif
 
-#include <setjmp.h>
-#include <signal.h>
+#ifdef HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
 
 #ifdef HAVE_STRING_H
 #include <string.h>
@@ -57,6 +67,10 @@
 #include <sys/socket.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>
 #endif
@@ -65,12 +79,57 @@
 /* Utility functions */
 
 
+#ifdef MSG_NOSIGNAL
+/* do not get killed by SIGPIPE when the server closed the connection */
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+
+long long cddb_now_ms(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == 0) {
+        return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    }
+#endif
+    {
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    }
+}
+
+long long cddb_timeout_end(cddb_conn_t *c)
+{
+    long long end;
+
+    end = cddb_now_ms() + c->timeout;
+    if (c->deadline && c->deadline < end) {
+        /* the command as a whole has less time left */
+        end = c->deadline;
+    }
+    return end;
+}
+
+int cddb_timeout_left(cddb_conn_t *c)
+{
+    long long left;
+
+    left = cddb_timeout_end(c) - cddb_now_ms();
+    return (left > 0) ? (int)left : 0;
+}
+
 /**
  * Checks whether bytes can be read/written from/to the socket within
  * the specified time out period.
  *
  * @param sock     The socket to read from.
- * @param timeout  Number of seconds after which to time out.
+ * @param timeout  Number of milliseconds after which to time out.
  * @param to_write TRUE if we have to check for writing, FALSE for
  *                 reading.
  * @return TRUE if reading/writing is possible, FALSE otherwise.
@@ -83,8 +142,8 @@ static int sock_ready(int sock, int timeout, int to_write)
 
     //cddb_log_debug("sock_ready()");
     /* set up select time out */
-    tv.tv_sec = timeout;
-    tv.tv_usec = 0;
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
     /* set up file descriptor set */
     FD_ZERO(&fds);
     FD_SET(sock, &fds);
@@ -106,92 +165,572 @@ static int sock_ready(int sock, int timeout, int to_write)
 #define sock_can_write(s,t) sock_ready(s, t, TRUE)
 
 
-/* Socket-based work-alikes */
+/* Buffered line reading */
 
 
-char *sock_fgets(char *s, int size, cddb_conn_t *c)
+void cddb_rbuf_init(cddb_rbuf_t *rb, int size)
 {
-    int rv;
-    time_t now, end, timeout;
-    char *p = s;
-
-    cddb_log_debug("sock_fgets()");
-    timeout = c->timeout;
-    end = time(NULL) + timeout;
-    size--;                      /* save one for terminating null */
-    while (size) {
-        now = time(NULL);
-        timeout = end - now;
-        if (timeout <= 0) {
-            errno = ETIMEDOUT;
-            return NULL;        /* time out */
+    rb->data = (char*)malloc(size);
+    rb->size = rb->data ? size : 0;
+    rb->start = rb->end = 0;
+    rb->saved_pos = -1;
+}
+
+int cddb_rbuf_reserve(cddb_rbuf_t *rb, int size)
+{
+    char *data;
+
+    if (rb->size < size) {
+        data = (char*)realloc(rb->data, size);
+        if (!data) {
+            return FALSE;
         }
-        /* can we read from the socket? */
-        if (!sock_can_read(c->socket, timeout)) {
-            /* error or time out */
-            return NULL;
+        rb->data = data;
+        rb->size = size;
+    }
+    return TRUE;
+}
+
+void cddb_rbuf_reset(cddb_rbuf_t *rb)
+{
+    rb->start = rb->end = 0;
+    rb->saved_pos = -1;
+}
+
+/**
+ * Put back the character that was overwritten to terminate the last
+ * line handed out.
+ */
+static void cddb_rbuf_restore(cddb_rbuf_t *rb)
+{
+    if (rb->saved_pos != -1) {
+        rb->data[rb->saved_pos] = rb->saved;
+        rb->saved_pos = -1;
+    }
+}
+
+/**
+ * Terminate the line starting at the current buffer position at the
+ * given offset and advance past it.
+ */
+static void cddb_rbuf_cut(cddb_rbuf_t *rb, int eol, int next,
+                          cddb_line_t *line)
+{
+    if (eol == next && eol < rb->end) {
+        /* terminator overwrites the first character of the next line */
+        rb->saved = rb->data[eol];
+        rb->saved_pos = eol;
+    }
+    rb->data[eol] = CHR_EOS;
+    line->str = rb->data + rb->start;
+    line->len = eol - rb->start;
+    rb->start = next;
+    /* strip off any line-terminating characters */
+    while ((line->len > 0) &&
+           ((line->str[line->len - 1] == CHR_CR) ||
+            (line->str[line->len - 1] == CHR_LF))) {
+        line->str[--line->len] = CHR_EOS;
+    }
+}
+
+int cddb_rbuf_getline(cddb_conn_t *c, cddb_rbuf_t *rb,
+                      cddb_rbuf_fill_cb *fill, void *arg, cddb_line_t *line)
+{
+    int max, scan, rv;
+    char *lf;
+
+    cddb_rbuf_restore(rb);
+    max = c->buf_size - 1;
+    if (!cddb_rbuf_reserve(rb, max + 1)) {
+        return FALSE;
+    }
+    scan = rb->start;
+    while (TRUE) {
+        /* look for the end of the line in the buffered data */
+        lf = memchr(rb->data + scan, CHR_LF, rb->end - scan);
+        if (lf && (lf - rb->data) - rb->start < max) {
+            cddb_rbuf_cut(rb, lf - rb->data, lf - rb->data + 1, line);
+            return TRUE;
         }
-        /* read one byte */
-        rv = recv(c->socket, p, 1, 0);
-        if (rv == -1) {
-            /* recv() error */
+        if ((rb->end - rb->start) >= max && rb->start + max < rb->size) {
+            /* line too long, hand it out in pieces */
+            cddb_rbuf_cut(rb, rb->start + max, rb->start + max, line);
+            return TRUE;
+        }
+        /* move remaining data to the front to make room */
+        if (rb->start > 0) {
+            memmove(rb->data, rb->data + rb->start, rb->end - rb->start);
+            rb->end -= rb->start;
+            rb->start = 0;
+        }
+        scan = rb->end;
+        if (rb->end - rb->start >= max) {
+            continue;           /* long line, can be cut now */
+        }
+        rv = fill(c, rb, arg);
+        if (rv <= 0) {
+            if (rv == 0 && rb->end > rb->start) {
+                /* end-of-stream, return last unterminated line */
+                cddb_rbuf_cut(rb, rb->end, rb->end, line);
+                return TRUE;
+            }
+            return FALSE;
+        }
+    }
+}
+
+
+int cddb_rbuf_has_response(cddb_rbuf_t *rb, int multi)
+{
+    char *p, *end, *lf;
+
+    cddb_rbuf_restore(rb);
+    p = rb->data + rb->start;
+    end = rb->data + rb->end;
+    /* status line */
+    lf = memchr(p, CHR_LF, end - p);
+    if (!lf || !multi) {
+        return (lf != NULL);
+    }
+    /* look for the terminating dot */
+    for (p = lf + 1; (lf = memchr(p, CHR_LF, end - p)) != NULL; p = lf + 1) {
+        if ((*p == CHR_DOT) &&
+            ((p + 1 == lf) || ((p + 2 == lf) && (p[1] == CHR_CR)))) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+const char *cddb_http_header(const char *line, const char *name)
+{
+    while (*name) {
+        if (tolower((unsigned char)*line) != *name) {
             return NULL;
-        } else if (rv == 0) {
-            /* EOS reached */
-            break;
-        } else if (*p == CHR_LF) {
-            /* EOL reached, stop reading */
+        }
+        line++;
+        name++;
+    }
+    if (*line != ':') {
+        return NULL;
+    }
+    line++;
+    while (*line == CHR_SPACE || *line == '\t') {
+        line++;
+    }
+    return line;
+}
+
+int cddb_http_has_token(const char *value, const char *eol,
+                        const char *token)
+{
+    const char *p, *q, *next;
+    int len = strlen(token), i;
+
+    for (p = value; p < eol; p = next) {
+        /* one element of the comma separated list, without the white
+           space around it */
+        q = memchr(p, ',', eol - p);
+        if (!q) {
+            q = eol;
+        }
+        next = q + 1;
+        while ((p < q) && isspace((unsigned char)*p)) {
             p++;
+        }
+        while ((q > p) && isspace((unsigned char)q[-1])) {
+            q--;
+        }
+        if (q - p != len) {
+            continue;
+        }
+        for (i = 0; i < len && tolower((unsigned char)p[i]) == token[i]; i++) {
+            /* compare */
+        }
+        if (i == len) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+int cddb_rbuf_has_http_response(cddb_rbuf_t *rb)
+{
+    const char *p, *end, *lf, *v;
+    char *endp;
+    long len = -1, size;
+    int chunked = FALSE;
+
+    cddb_rbuf_restore(rb);
+    p = rb->data + rb->start;
+    end = rb->data + rb->end;
+    /* status line and headers, up to the empty line */
+    while (TRUE) {
+        if ((lf = memchr(p, CHR_LF, end - p)) == NULL) {
+            return FALSE;
+        }
+        if ((p == lf) || ((p + 1 == lf) && (*p == CHR_CR))) {
+            p = lf + 1;
             break;
         }
-        p++;
-        size--;
+        if ((v = cddb_http_header(p, "content-length")) != NULL) {
+            len = strtol(v, NULL, 10);
+        } else if ((v = cddb_http_header(p, "transfer-encoding")) != NULL) {
+            chunked = cddb_http_has_token(v, lf, "chunked");
+        }
+        p = lf + 1;
+    }
+    if (chunked) {
+        while (TRUE) {
+            if ((lf = memchr(p, CHR_LF, end - p)) == NULL) {
+                return FALSE;
+            }
+            errno = 0;
+            size = strtol(p, &endp, 16);
+            if ((endp == p) || (size < 0) || (errno == ERANGE)) {
+                /* malformed, let the parser report it */
+                return TRUE;
+            }
+            p = lf + 1;
+            if (size == 0) {
+                break;
+            }
+            if (end - p < size) {
+                return FALSE;
+            }
+            p += size;
+            if ((lf = memchr(p, CHR_LF, end - p)) == NULL) {
+                return FALSE;
+            }
+            p = lf + 1;
+        }
+        /* optional trailers, up to the empty line */
+        while ((lf = memchr(p, CHR_LF, end - p)) != NULL) {
+            if ((p == lf) || ((p + 1 == lf) && (*p == CHR_CR))) {
+                return TRUE;
+            }
+            p = lf + 1;
+        }
+        return FALSE;
     }
-    if (p == s) {
+    if (len >= 0) {
+        return (end - p >= len);
+    }
+    /* body is delimited by the end of the connection */
+    return FALSE;
+}
+
+
+/* Socket-based work-alikes */
+
+
+/**
+ * Refill the receive buffer of the connection with as much data as is
+ * currently available on the socket, waiting at most until the
+ * specified end time.
+ */
+static int sock_fill(cddb_conn_t *c, cddb_rbuf_t *rb, void *arg)
+{
+    long long end = *(long long*)arg;
+    long long timeout;
+    int rv;
+
+    if (c->http_body) {
+        /* complete HTTP response body is buffered, nothing more to read */
+        return 0;
+    }
+    timeout = end - cddb_now_ms();
+    if (timeout <= 0) {
+        errno = ETIMEDOUT;
+        return -1;              /* time out */
+    }
+    /* can we read from the socket? */
+    if (!sock_can_read(c->socket, (int)timeout)) {
+        /* error or time out */
+        return -1;
+    }
+    /* read as much as fits into the buffer */
+    rv = recv(c->socket, rb->data + rb->end, rb->size - rb->end, 0);
+    if (rv > 0) {
+        rb->end += rv;
+    }
+    return rv;
+}
+
+int sock_getline(cddb_conn_t *c, cddb_line_t *line)
+{
+    long long end;
+
+    cddb_log_debug("sock_getline()");
+    end = cddb_timeout_end(c);
+    if (!cddb_rbuf_getline(c, &c->rbuf, sock_fill, &end, line)) {
         cddb_log_debug("...read = Empty");
-        return NULL;
+        return FALSE;
     }
-    *p = CHR_EOS;
-    cddb_log_debug("...read = '%s'", s);
-    return s;
+    cddb_log_debug("...read = '%s'", line->str);
+    return TRUE;
 }
 
-size_t sock_fwrite(const void *ptr, size_t size, size_t nmemb, cddb_conn_t *c)
+int sock_recv_avail(cddb_conn_t *c, int *eof)
+{
+    cddb_rbuf_t *rb = &c->rbuf;
+    int rv, total = 0;
+
+    cddb_log_debug("sock_recv_avail()");
+    *eof = FALSE;
+    cddb_rbuf_restore(rb);
+    while (TRUE) {
+        if (rb->end == rb->size) {
+            /* make room, the response is collected as a whole */
+            if (rb->start > 0) {
+                memmove(rb->data, rb->data + rb->start, rb->end - rb->start);
+                rb->end -= rb->start;
+                rb->start = 0;
+            } else if (!cddb_rbuf_reserve(rb, rb->size * 2)) {
+                cddb_errno_log_error(c, CDDB_ERR_OUT_OF_MEMORY);
+                return -1;
+            }
+        }
+        rv = recv(c->socket, rb->data + rb->end, rb->size - rb->end, 0);
+        if (rv > 0) {
+            rb->end += rv;
+            total += rv;
+        } else if (rv == 0) {
+            *eof = TRUE;
+            break;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+    cddb_log_debug("...received = %d bytes", total);
+    return total;
+}
+
+/**
+ * Receive more data at the end of the receive buffer without moving
+ * what is already in there, growing the buffer when it is full.
+ */
+static int sock_fill_more(cddb_conn_t *c, long long *end)
+{
+    cddb_rbuf_t *rb = &c->rbuf;
+
+    if (rb->end == rb->size) {
+        if ((rb->size >= 2 * MAX_HTTP_BODY_SIZE) ||
+            !cddb_rbuf_reserve(rb, rb->size * 2)) {
+            return -1;
+        }
+    }
+    return sock_fill(c, rb, end);
+}
+
+int sock_read_body(cddb_conn_t *c, int len)
+{
+    cddb_rbuf_t *rb = &c->rbuf;
+    long long end;
+
+    cddb_log_debug("sock_read_body()");
+    if (len > MAX_HTTP_BODY_SIZE) {
+        return -1;
+    }
+    cddb_rbuf_restore(rb);
+    if (rb->start > 0) {
+        memmove(rb->data, rb->data + rb->start, rb->end - rb->start);
+        rb->end -= rb->start;
+        rb->start = 0;
+    }
+    /* room for the body and a terminator */
+    if (!cddb_rbuf_reserve(rb, len + 1)) {
+        return -1;
+    }
+    end = cddb_timeout_end(c);
+    while (rb->end < len) {
+        if (sock_fill(c, rb, &end) <= 0) {
+            return -1;
+        }
+    }
+    /* ignore anything the server sent after the body */
+    rb->end = len;
+    return 0;
+}
+
+/**
+ * Find the next line feed at or after the given buffer offset,
+ * receiving more data if needed.
+ *
+ * @return Offset of the line feed or -1 on error.
+ */
+static int sock_find_lf(cddb_conn_t *c, int pos, long long *end)
+{
+    cddb_rbuf_t *rb = &c->rbuf;
+    char *lf;
+
+    while ((lf = memchr(rb->data + pos, CHR_LF, rb->end - pos)) == NULL) {
+        if (sock_fill_more(c, end) <= 0) {
+            return -1;
+        }
+    }
+    return lf - rb->data;
+}
+
+int sock_read_chunked(cddb_conn_t *c)
+{
+    cddb_rbuf_t *rb = &c->rbuf;
+    int dst, pos, lf;
+    long size;
+    char *endp;
+    long long end;
+
+    cddb_log_debug("sock_read_chunked()");
+    cddb_rbuf_restore(rb);
+    end = cddb_timeout_end(c);
+    /* chunk data is moved down over the chunk headers, the decoded
+       body ends up in front of the data still to be decoded */
+    dst = pos = rb->start;
+    while (TRUE) {
+        /* chunk size line */
+        if ((lf = sock_find_lf(c, pos, &end)) == -1) {
+            return -1;
+        }
+        errno = 0;
+        size = strtol(rb->data + pos, &endp, 16);
+        if ((endp == rb->data + pos) || (size < 0) || (errno == ERANGE) ||
+            (size > MAX_HTTP_BODY_SIZE - (dst - rb->start))) {
+            return -1;
+        }
+        pos = lf + 1;
+        if (size == 0) {
+            break;
+        }
+        /* chunk data */
+        while (rb->end - pos < size) {
+            if (sock_fill_more(c, &end) <= 0) {
+                return -1;
+            }
+        }
+        memmove(rb->data + dst, rb->data + pos, size);
+        dst += size;
+        pos += size;
+        /* line feed after the chunk data */
+        if ((lf = sock_find_lf(c, pos, &end)) == -1) {
+            return -1;
+        }
+        pos = lf + 1;
+    }
+    /* skip optional trailers, up to the empty line */
+    while (TRUE) {
+        if ((lf = sock_find_lf(c, pos, &end)) == -1) {
+            return -1;
+        }
+        if ((lf == pos) || ((lf == pos + 1) && (rb->data[pos] == CHR_CR))) {
+            break;
+        }
+        pos = lf + 1;
+    }
+    /* headers take up space, so there is always room for a terminator */
+    rb->end = dst;
+    return 0;
+}
+
+int sock_check_idle(cddb_conn_t *c)
 {
-    size_t total_size, to_send;
-    time_t now, end, timeout;
+    /* an idle connection should not have anything to read, if it has
+       the server either closed it or sent something unexpected */
+    return !sock_can_read(c->socket, 0);
+}
+
+/**
+ * Send the contents of the send buffer followed by the given data,
+ * gathered into as few system calls as possible.
+ *
+ * @return The number of bytes of data sent, not counting the buffered
+ *         bytes, or -1 if the buffer itself could not be sent.
+ */
+static int sock_send(cddb_conn_t *c, const char *data, int len)
+{
+    cddb_wbuf_t *wb = &c->wbuf;
+    const char *p = wb->data;
+    int left = wb->len, total = len;
+    long long end, timeout;
     int rv;
-    const char *p = (const char *)ptr;
+#ifdef HAVE_SENDMSG
+    struct msghdr msg;
+    struct iovec iov[2];
+#endif
 
-    cddb_log_debug("sock_fwrite()");
-    total_size = size * nmemb;
-    to_send = total_size;
-    timeout = c->timeout;
-    end = time(NULL) + timeout;
-    while (to_send) {
-        now = time(NULL);
-        timeout = end - now;
+    end = cddb_timeout_end(c);
+    while (left + len > 0) {
+        timeout = end - cddb_now_ms();
         if (timeout <= 0) {
             /* time out */
             errno = ETIMEDOUT;
             break;
         }
         /* can we write to the socket? */
-        if (!sock_can_write(c->socket, timeout)) {
+        if (!sock_can_write(c->socket, (int)timeout)) {
             /* error or time out */
             break;
         }
-        /* try sending data */
-        rv = send(c->socket, p, to_send, 0);
-        if (rv == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
-            /* error */
-            break;
+#ifdef HAVE_SENDMSG
+        if (left > 0 && len > 0) {
+            /* buffered request and data in one go */
+            memset(&msg, 0, sizeof(msg));
+            iov[0].iov_base = (void*)p;
+            iov[0].iov_len = left;
+            iov[1].iov_base = (void*)data;
+            iov[1].iov_len = len;
+            msg.msg_iov = iov;
+            msg.msg_iovlen = 2;
+            rv = sendmsg(c->socket, &msg, SEND_FLAGS);
+        } else
+#endif
+        if (left > 0) {
+            rv = send(c->socket, p, left, SEND_FLAGS);
         } else {
-            to_send -= rv;
+            rv = send(c->socket, data, len, SEND_FLAGS);
+        }
+        if (rv == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                /* error */
+                break;
+            }
+            continue;
+        }
+        if (rv <= left) {
             p += rv;
+            left -= rv;
+        } else {
+            data += rv - left;
+            len -= rv - left;
+            left = 0;
         }
     }
-    return (total_size - to_send) / size;
+    if (left > 0) {
+        /* keep what could not be sent at the start of the buffer */
+        memmove(wb->data, p, left);
+        wb->len = left;
+        return -1;
+    }
+    wb->len = 0;
+    return total - len;
+}
+
+size_t sock_fwrite(const void *ptr, size_t size, size_t nmemb, cddb_conn_t *c)
+{
+    size_t total_size;
+    int rv;
+
+    cddb_log_debug("sock_fwrite()");
+    total_size = size * nmemb;
+    rv = sock_send(c, (const char*)ptr, total_size);
+    return (rv > 0) ? rv / size : 0;
+}
+
+int sock_fflush(cddb_conn_t *c)
+{
+    cddb_log_debug("sock_fflush()");
+    return (sock_send(c, NULL, 0) == -1) ? -1 : 0;
 }
 
 int sock_fprintf(cddb_conn_t *c, const char *format, ...)
@@ -208,134 +747,706 @@ int sock_fprintf(cddb_conn_t *c, const char *format, ...)
 
 int sock_vfprintf(cddb_conn_t *c, const char *format, va_list ap)
 {
+    cddb_wbuf_t *wb = &c->wbuf;
     char *buf;
     int rv;
    
     cddb_log_debug("sock_vfprintf()");
-    buf = (char*)malloc(c->buf_size);
+    /* make room for a line of maximum length */
+    if (wb->size - wb->len < c->buf_size) {
+        buf = (char*)realloc(wb->data, wb->len + c->buf_size);
+        if (!buf) {
+            cddb_errno_log_error(c, CDDB_ERR_OUT_OF_MEMORY);
+            return -1;
+        }
+        wb->data = buf;
+        wb->size = wb->len + c->buf_size;
+    }
+    buf = wb->data + wb->len;
     rv = vsnprintf(buf, c->buf_size, format, ap);
-    cddb_log_debug("...buf = '%s'", buf);
     if (rv < 0 || rv >= c->buf_size) {
         /* buffer too small */
         cddb_errno_log_crit(c, CDDB_ERR_LINE_SIZE);
-        free(buf);
         return -1;
     }
-    rv = sock_fwrite(buf, sizeof(char), rv, c);
-    free(buf);
+    cddb_log_debug("...buf = '%s'", buf);
+    wb->len += rv;
     return rv;
 }
 
 /* Time-out enabled work-alikes */
 
-#ifdef HAVE_ALARM
-/* time-out jump buffer */
-static jmp_buf timeout_expired;
-
-/* time-out signal handler */
-static void alarm_handler(int signum)
+/**
+ * Switch a socket to non-blocking mode.
+ *
+ * @return Zero on success, -1 on failure.
+ */
+static int sock_set_nonblocking(int sockfd)
 {
-    longjmp(timeout_expired, 1);
+#ifdef BEOS
+    int on = 1;
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_NONBLOCK, &on, sizeof(on)) == -1) {
+        /* error while trying to set socket to non-blocking */
+        return -1;
+    }
+#elif defined WIN32
+    unsigned long arg = 1;
+
+    if (ioctlsocket(sockfd, FIONBIO, &arg))
+        return -1;
+#else
+    int flags;
+
+    flags = fcntl(sockfd, F_GETFL, 0);
+    flags |= O_NONBLOCK;        /* add non-blocking flag */
+    if (fcntl(sockfd, F_SETFL, flags) == -1) {
+        return -1;
+    }
+#endif /* BEOS */
+    return 0;
 }
+
+/* --- host name resolution --- */
+
+/** One resolved host name in the DNS cache. */
+typedef struct dns_entry_s
+{
+    char *hostname;             /**< the host name that was resolved */
+    long long expires;          /**< time at which the entry goes stale
+                                     (see #cddb_now_ms) */
+    cddb_addrs_t addrs;         /**< resolved addresses, port set to zero */
+} dns_entry_t;
+
+/** Process-wide cache of resolved host names. */
+static list_t *dns_cache = NULL;
+
+#ifdef HAVE_PTHREAD
+/* serializes access to the cache and to pending look-ups */
+static pthread_mutex_t dns_lock = PTHREAD_MUTEX_INITIALIZER;
+#define DNS_LOCK() pthread_mutex_lock(&dns_lock)
+#define DNS_UNLOCK() pthread_mutex_unlock(&dns_lock)
+#else
+#define DNS_LOCK()
+#define DNS_UNLOCK()
 #endif
 
-struct hostent *timeout_gethostbyname(const char *hostname, int timeout)
+static void dns_entry_destroy(void *data)
 {
-#ifdef HAVE_ALARM
-    struct hostent *he = NULL;
-    struct sigaction action;
-    struct sigaction old;
+    dns_entry_t *entry = (dns_entry_t*)data;
 
-    /* no signal before setjmp */
-    alarm(0);
+    free(entry->hostname);
+    free(entry);
+}
+
+/**
+ * Look up a host name in the cache.  Must be called with the DNS lock
+ * held.
+ *
+ * @return TRUE if a fresh entry was found and copied into addrs.
+ */
+static int dns_cache_get(const char *hostname, cddb_addrs_t *addrs)
+{
+    elem_t *elem;
+    dns_entry_t *entry;
+    long long now;
+
+    if (!dns_cache || libcddb_dns_cache_ttl() <= 0) {
+        return FALSE;
+    }
+    now = cddb_now_ms();
+    for (elem = list_first(dns_cache); elem; elem = list_next(dns_cache)) {
+        entry = (dns_entry_t*)element_data(elem);
+        if (entry->expires > now && strcmp(entry->hostname, hostname) == 0) {
+            *addrs = entry->addrs;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
 
-    /* register signal handler */
-    memset(&action, 0, sizeof(action));
-    action.sa_handler = alarm_handler;
-    sigaction(SIGALRM, &action, &old);
+/**
+ * Store a resolved host name in the cache, replacing an older entry
+ * for the same name or, when the cache is full, the entry that will
+ * expire first.  Must be called with the DNS lock held.
+ */
+static void dns_cache_put(const char *hostname, const cddb_addrs_t *addrs)
+{
+    elem_t *elem;
+    dns_entry_t *entry, *victim = NULL;
+    char *name;
 
-    /* save stack state */
-    if (!setjmp(timeout_expired)) {
-        alarm(timeout);         /* set time-out alarm */
-        he = gethostbyname(hostname); /* execute DNS query */
-        alarm(0);               /* reset alarm timer */
+    if (libcddb_dns_cache_ttl() <= 0) {
+        return;
+    }
+    if (!dns_cache && (dns_cache = list_new(dns_entry_destroy)) == NULL) {
+        return;
+    }
+    for (elem = list_first(dns_cache); elem; elem = list_next(dns_cache)) {
+        entry = (dns_entry_t*)element_data(elem);
+        if (strcmp(entry->hostname, hostname) == 0) {
+            victim = entry;
+            break;
+        }
+        if (!victim || entry->expires < victim->expires) {
+            victim = entry;
+        }
+    }
+    if (victim && (strcmp(victim->hostname, hostname) == 0 ||
+                   list_size(dns_cache) >= MAX_DNS_CACHE_SIZE)) {
+        entry = victim;
+        if (strcmp(entry->hostname, hostname) != 0) {
+            if ((name = strdup(hostname)) == NULL) {
+                return;
+            }
+            free(entry->hostname);
+            entry->hostname = name;
+        }
     } else {
-        errno = ETIMEDOUT;
+        entry = (dns_entry_t*)malloc(sizeof(dns_entry_t));
+        if (!entry) {
+            return;
+        }
+        if ((entry->hostname = strdup(hostname)) == NULL ||
+            !list_append(dns_cache, entry)) {
+            dns_entry_destroy(entry);
+            return;
+        }
     }
-    sigaction(SIGALRM, &old, NULL); /* restore previous signal handler */
+    entry->expires = cddb_now_ms() + libcddb_dns_cache_ttl() * 1000LL;
+    entry->addrs = *addrs;
+}
 
-    return he;
-#else
-    return gethostbyname(hostname); /* execute DNS query directly */
+void cddb_dns_cache_flush(void)
+{
+    DNS_LOCK();
+    if (dns_cache) {
+        list_destroy(dns_cache);
+        dns_cache = NULL;
+    }
+    DNS_UNLOCK();
+}
+
+/**
+ * Store the port in every address of the list.
+ */
+static void dns_set_port(cddb_addrs_t *addrs, int port)
+{
+    int i;
+
+    for (i = 0; i < addrs->count; i++) {
+        switch (addrs->addr[i].ss_family) {
+        case AF_INET:
+            ((struct sockaddr_in*)&addrs->addr[i])->sin_port = htons(port);
+            break;
+#ifdef AF_INET6
+        case AF_INET6:
+            ((struct sockaddr_in6*)&addrs->addr[i])->sin6_port = htons(port);
+            break;
 #endif
+        }
+    }
 }
 
-int timeout_connect(int sockfd, const struct sockaddr *addr, 
-                    size_t len, int timeout)
+#ifdef HAVE_GETADDRINFO
+
+/**
+ * Resolve a host name with getaddrinfo and copy the results.
+ *
+ * @return Zero on success or a getaddrinfo error code.
+ */
+static int dns_resolve(const char *hostname, cddb_addrs_t *addrs)
 {
-    int got_error = 0;
+    struct addrinfo hints, *res, *ai;
+    int rv;
 
-    /* set socket to non-blocking */
-#ifdef BEOS
-    int on = 1;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+#ifdef AI_ADDRCONFIG
+    hints.ai_flags = AI_ADDRCONFIG;
+#endif
+    addrs->count = 0;
+    if ((rv = getaddrinfo(hostname, NULL, &hints, &res)) != 0) {
+        return rv;
+    }
+    for (ai = res; ai && addrs->count < CDDB_MAX_ADDRS; ai = ai->ai_next) {
+        if (ai->ai_addrlen > sizeof(struct sockaddr_storage)) {
+            continue;
+        }
+        memcpy(&addrs->addr[addrs->count], ai->ai_addr, ai->ai_addrlen);
+        addrs->len[addrs->count] = ai->ai_addrlen;
+        addrs->count++;
+    }
+    freeaddrinfo(res);
+    return (addrs->count > 0) ? 0 : EAI_NONAME;
+}
 
-    if (setsockopt(sockfd, SOL_SOCKET, SO_NONBLOCK, &on, sizeof(on)) == -1) {
-        /* error while trying to set socket to non-blocking */
+#else
+
+/* gethostbyname is not reentrant, callers must hold the DNS lock */
+static int dns_resolve(const char *hostname, cddb_addrs_t *addrs)
+{
+    struct hostent *he;
+    struct sockaddr_in *sin;
+    int i;
+
+    addrs->count = 0;
+    if ((he = gethostbyname(hostname)) == NULL || he->h_addrtype != AF_INET) {
         return -1;
     }
-#elif defined WIN32
-    unsigned long arg = 1;
+    for (i = 0; he->h_addr_list[i] && i < CDDB_MAX_ADDRS; i++) {
+        sin = (struct sockaddr_in*)&addrs->addr[i];
+        memset(sin, 0, sizeof(struct sockaddr_storage));
+        sin->sin_family = AF_INET;
+        memcpy(&sin->sin_addr, he->h_addr_list[i], sizeof(sin->sin_addr));
+        addrs->len[i] = sizeof(struct sockaddr_in);
+        addrs->count++;
+    }
+    return (addrs->count > 0) ? 0 : -1;
+}
 
-    if (ioctlsocket(sockfd, FIONBIO, &arg))
+#endif /* HAVE_GETADDRINFO */
+
+#if defined(HAVE_PTHREAD) && defined(HAVE_GETADDRINFO)
+
+/**
+ * A look-up running in its own thread.  The structure is shared by the
+ * waiting caller and the resolver thread; whichever of the two is done
+ * with it last frees it.  This way a caller that timed out can return
+ * straight away and leave the thread to finish on its own.
+ */
+struct dns_job_s
+{
+    char *hostname;             /**< the host name to resolve */
+    cddb_addrs_t addrs;         /**< the look-up result */
+    int rv;                     /**< getaddrinfo return value */
+    int done;                   /**< has the look-up finished? */
+    int refs;                   /**< number of users of this structure */
+    pthread_cond_t cond;        /**< signalled when the look-up finishes */
+    int fds[2];                 /**< pipe that becomes readable when the
+                                     look-up finishes, or -1 */
+};
+
+typedef struct dns_job_s dns_job_t;
+
+/* drops a reference, must be called with the DNS lock held */
+static int dns_job_release(dns_job_t *job)
+{
+    if (--job->refs > 0) {
+        return FALSE;
+    }
+    if (job->fds[0] != -1) {
+        close(job->fds[0]);
+        close(job->fds[1]);
+    }
+    pthread_cond_destroy(&job->cond);
+    free(job->hostname);
+    free(job);
+    return TRUE;
+}
+
+static void *dns_job_run(void *arg)
+{
+    dns_job_t *job = (dns_job_t*)arg;
+    cddb_addrs_t addrs;
+    int rv;
+
+    rv = dns_resolve(job->hostname, &addrs);
+    DNS_LOCK();
+    job->addrs = addrs;
+    job->rv = rv;
+    job->done = TRUE;
+    pthread_cond_signal(&job->cond);
+    if (job->fds[1] != -1) {
+        /* wake up the event loop of the caller */
+        rv = write(job->fds[1], "", 1);
+    }
+    dns_job_release(job);
+    DNS_UNLOCK();
+    return NULL;
+}
+
+/**
+ * Start a look-up in its own thread, optionally with a pipe to signal
+ * its completion.
+ *
+ * @return The look-up, with one reference left for the caller, or NULL
+ *         if it could not be started.
+ */
+static dns_job_t *dns_job_start(const char *hostname, int notify)
+{
+    dns_job_t *job;
+    pthread_t thread;
+
+    job = (dns_job_t*)calloc(1, sizeof(dns_job_t));
+    if (!job) {
+        return NULL;
+    }
+    if ((job->hostname = strdup(hostname)) == NULL) {
+        free(job);
+        return NULL;
+    }
+    job->fds[0] = job->fds[1] = -1;
+    if (notify && (pipe(job->fds) == -1)) {
+        free(job->hostname);
+        free(job);
+        return NULL;
+    }
+    pthread_cond_init(&job->cond, NULL);
+    job->refs = 2;
+    if (pthread_create(&thread, NULL, dns_job_run, job) != 0) {
+        job->refs = 1;
+        DNS_LOCK();
+        dns_job_release(job);
+        DNS_UNLOCK();
+        return NULL;
+    }
+    pthread_detach(thread);
+    return job;
+}
+
+/**
+ * Run the look-up in a separate thread so that we can stop waiting
+ * for it after the time-out.  getaddrinfo itself cannot be
+ * interrupted, an abandoned thread simply runs to completion.
+ */
+static int dns_resolve_timeout(const char *hostname, cddb_addrs_t *addrs,
+                               int timeout)
+{
+    dns_job_t *job;
+    struct timeval now;
+    struct timespec deadline;
+    int rv = 0, timed_out;
+
+    if (timeout <= 0) {
+        return dns_resolve(hostname, addrs);
+    }
+    job = dns_job_start(hostname, FALSE);
+    if (!job) {
+        return dns_resolve(hostname, addrs);
+    }
+
+    /* condition variables wait until a wall clock time */
+    gettimeofday(&now, NULL);
+    deadline.tv_sec = now.tv_sec + timeout / 1000;
+    deadline.tv_nsec = (now.tv_usec + (timeout % 1000) * 1000L) * 1000;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    DNS_LOCK();
+    while (!job->done && rv == 0) {
+        rv = pthread_cond_timedwait(&job->cond, &dns_lock, &deadline);
+    }
+    timed_out = !job->done;
+    if (!timed_out) {
+        *addrs = job->addrs;
+        rv = job->rv;
+    }
+    dns_job_release(job);
+    DNS_UNLOCK();
+    if (timed_out) {
+        errno = ETIMEDOUT;
         return -1;
-#else
-    int flags;
+    }
+    return rv;
+}
 
-    flags = fcntl(sockfd, F_GETFL, 0);
-    flags |= O_NONBLOCK;        /* add non-blocking flag */
-    if (fcntl(sockfd, F_SETFL, flags) == -1) {
+int cddb_resolve_start(const char *hostname, int port, cddb_addrs_t *addrs,
+                       cddb_dns_job_t **job)
+{
+    int found;
+
+    *job = NULL;
+    DNS_LOCK();
+    found = dns_cache_get(hostname, addrs);
+    DNS_UNLOCK();
+    if (found) {
+        dns_set_port(addrs, port);
+        return 0;
+    }
+    *job = dns_job_start(hostname, TRUE);
+    if (*job) {
+        return 1;
+    }
+    /* no thread, look it up right here */
+    return timeout_getaddrinfo(hostname, port, addrs, 0);
+}
+
+int cddb_resolve_fd(cddb_dns_job_t *job)
+{
+    return job->fds[0];
+}
+
+int cddb_resolve_finish(cddb_dns_job_t *job, int port, cddb_addrs_t *addrs)
+{
+    int rv;
+
+    DNS_LOCK();
+    if (!job->done) {
+        DNS_UNLOCK();
+        return 1;
+    }
+    rv = job->rv;
+    if (rv == 0) {
+        *addrs = job->addrs;
+        dns_cache_put(job->hostname, addrs);
+    }
+    dns_job_release(job);
+    DNS_UNLOCK();
+    if (rv != 0) {
+        addrs->count = 0;
         return -1;
     }
-#endif /* BEOS */
+    dns_set_port(addrs, port);
+    return 0;
+}
 
-    /* try connecting */
-    if (connect(sockfd, addr, len) == -1) {
-        /* check whether we can continue */
-        if (errno == EINPROGRESS) {
-            int rv;
-            fd_set wfds;
-            struct timeval tv;
-            size_t l;
-
-            /* set up select time out */
-            tv.tv_sec = timeout;
-            tv.tv_usec = 0;
-
-            /* set up file descriptor set */
-            FD_ZERO(&wfds);
-            FD_SET(sockfd, &wfds);
-
-            /* wait for connect to finish */
-            rv = select(sockfd + 1, NULL, &wfds, NULL, &tv);
-            switch (rv) {
-            case 0:             /* time out */
-                errno = ETIMEDOUT;
-            case -1:            /* select error */
-                got_error = -1;
-            default:
-                /* we got connected, check error condition */
-                l = sizeof(rv);
-                getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &rv, &l);
-                if (rv) {
-                    /* something went wrong, simulate normal connect behaviour */
-                    errno = rv;
-                    got_error = -1;
+void cddb_resolve_cancel(cddb_dns_job_t *job)
+{
+    /* the thread runs to completion and frees the look-up */
+    DNS_LOCK();
+    dns_job_release(job);
+    DNS_UNLOCK();
+}
+
+#else
+
+static int dns_resolve_timeout(const char *hostname, cddb_addrs_t *addrs,
+                               int timeout)
+{
+    int rv;
+
+    DNS_LOCK();
+    rv = dns_resolve(hostname, addrs);
+    DNS_UNLOCK();
+    return rv;
+}
+
+int cddb_resolve_start(const char *hostname, int port, cddb_addrs_t *addrs,
+                       cddb_dns_job_t **job)
+{
+    /* no threads, the look-up blocks */
+    *job = NULL;
+    return timeout_getaddrinfo(hostname, port, addrs, 0);
+}
+
+int cddb_resolve_fd(cddb_dns_job_t *job)
+{
+    return -1;
+}
+
+int cddb_resolve_finish(cddb_dns_job_t *job, int port, cddb_addrs_t *addrs)
+{
+    return -1;
+}
+
+void cddb_resolve_cancel(cddb_dns_job_t *job)
+{
+}
+
+#endif /* HAVE_PTHREAD && HAVE_GETADDRINFO */
+
+int timeout_getaddrinfo(const char *hostname, int port, cddb_addrs_t *addrs,
+                        int timeout)
+{
+    int found;
+
+    DNS_LOCK();
+    found = dns_cache_get(hostname, addrs);
+    DNS_UNLOCK();
+    if (!found) {
+        if (dns_resolve_timeout(hostname, addrs, timeout) != 0) {
+            addrs->count = 0;
+            return -1;
+        }
+        DNS_LOCK();
+        dns_cache_put(hostname, addrs);
+        DNS_UNLOCK();
+    }
+    dns_set_port(addrs, port);
+    return 0;
+}
+
+/* Concurrent connect */
+
+/** Milliseconds between two connection attempts (RFC 8305). */
+#define CONNECT_ATTEMPT_DELAY 250
+
+void cddb_addrs_sort(cddb_addrs_t *addrs, const struct sockaddr_storage *pref,
+                     socklen_t pref_len)
+{
+    cddb_addrs_t sorted;
+    int used[CDDB_MAX_ADDRS];
+    int i, family;
+
+    memset(used, 0, sizeof(used));
+    sorted.count = 0;
+    /* the address that worked last time goes first */
+    for (i = 0; pref_len > 0 && i < addrs->count; i++) {
+        if (addrs->len[i] == pref_len &&
+            memcmp(&addrs->addr[i], pref, pref_len) == 0) {
+            sorted.addr[0] = addrs->addr[i];
+            sorted.len[0] = addrs->len[i];
+            sorted.count = 1;
+            used[i] = TRUE;
+            break;
+        }
+    }
+    /* then alternate between address families, keeping the resolver
+       order within each family */
+    while (sorted.count < addrs->count) {
+        family = sorted.count ? sorted.addr[sorted.count - 1].ss_family :
+                                AF_UNSPEC;
+        /* first unused address of another family, if any */
+        for (i = 0; i < addrs->count; i++) {
+            if (!used[i] && addrs->addr[i].ss_family != family) {
+                break;
+            }
+        }
+        if (i == addrs->count) {
+            for (i = 0; used[i]; i++) ;
+        }
+        sorted.addr[sorted.count] = addrs->addr[i];
+        sorted.len[sorted.count] = addrs->len[i];
+        sorted.count++;
+        used[i] = TRUE;
+    }
+    *addrs = sorted;
+}
+
+int timeout_connect(const cddb_addrs_t *addrs, int timeout, int *idx)
+{
+    int fds[CDDB_MAX_ADDRS];
+    int next = 0, active = 0, sock = -1, err = ECONNREFUSED;
+    int i, rv, maxfd;
+    long long now, deadline, next_start;
+    fd_set wfds;
+    struct timeval tv;
+
+    for (i = 0; i < CDDB_MAX_ADDRS; i++) {
+        fds[i] = -1;
+    }
+    now = cddb_now_ms();
+    deadline = now + timeout;
+    next_start = now;
+    while (sock == -1) {
+        now = cddb_now_ms();
+        if (next < addrs->count && (active == 0 || now >= next_start)) {
+            /* start connecting to the next address */
+            fds[next] = socket(addrs->addr[next].ss_family, SOCK_STREAM, 0);
+            rv = (fds[next] == -1) ? -1 :
+                 sock_connect_start(fds[next],
+                                    (const struct sockaddr*)&addrs->addr[next],
+                                    addrs->len[next]);
+            if (rv == 0) {
+                sock = next;
+            } else if (rv == 1) {
+                active++;
+            } else {
+                err = errno;
+                if (fds[next] != -1) {
+                    close(fds[next]);
+                    fds[next] = -1;
                 }
             }
+            next++;
+            next_start = now + CONNECT_ATTEMPT_DELAY;
+            continue;
         }
-    } else {
-        /* connect failed */
-        got_error = -1;
+        if (active == 0) {
+            /* all addresses failed */
+            break;
+        }
+        if (now >= deadline) {
+            err = ETIMEDOUT;
+            break;
+        }
+        /* wait for an attempt to finish or for the next one to start */
+        if (next < addrs->count && next_start < deadline) {
+            rv = (int)(next_start - now);
+        } else {
+            rv = (int)(deadline - now);
+        }
+        tv.tv_sec = rv / 1000;
+        tv.tv_usec = (rv % 1000) * 1000;
+        FD_ZERO(&wfds);
+        maxfd = -1;
+        for (i = 0; i < next; i++) {
+            if (fds[i] != -1) {
+                FD_SET(fds[i], &wfds);
+                if (fds[i] > maxfd) {
+                    maxfd = fds[i];
+                }
+            }
+        }
+        rv = select(maxfd + 1, NULL, &wfds, NULL, &tv);
+        if (rv == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            err = errno;
+            break;
+        }
+        for (i = 0; i < next && sock == -1 && rv > 0; i++) {
+            if (fds[i] == -1 || !FD_ISSET(fds[i], &wfds)) {
+                continue;
+            }
+            if (sock_connect_check(fds[i]) == 0) {
+                sock = i;
+            } else {
+                /* this one failed, do not wait to start the next one */
+                err = errno;
+                close(fds[i]);
+                fds[i] = -1;
+                active--;
+                next_start = now;
+            }
+        }
+    }
+
+    /* close the attempts that lost the race */
+    for (i = 0; i < next; i++) {
+        if (fds[i] != -1 && i != sock) {
+            close(fds[i]);
+        }
+    }
+    if (sock == -1) {
+        errno = err;
+        return -1;
+    }
+    *idx = sock;
+    return fds[sock];
+}
+
+/* Non-blocking connect */
+
+int sock_connect_start(int sockfd, const struct sockaddr *addr, size_t len)
+{
+    if (sock_set_nonblocking(sockfd) == -1) {
+        return -1;
+    }
+    if (connect(sockfd, addr, len) == -1) {
+        if (errno == EINPROGRESS || errno == EWOULDBLOCK) {
+            return 1;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+int sock_connect_check(int sockfd)
+{
+    int rv = 0;
+    socklen_t l = sizeof(rv);
+
+    if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, (void*)&rv, &l) == -1) {
+        return -1;
+    }
+    if (rv) {
+        errno = rv;
+        return -1;
     }
-    return got_error;
+    return 0;
 }
@@ -0,0 +1,824 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#include "cddb/cddb_ni.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_FCNTL_H
+#  include <fcntl.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+#ifdef HAVE_DIRENT_H
+#  include <dirent.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
+
+
+/* --- type and structure definitions */
+
+
+/* First bytes of the data and index files. */
+#define PACK_DATA_MAGIC  "cddb-pack\n\0"
+#define PACK_INDEX_MAGIC "cddb-pidx\n\0"
+
+/* Stored in native byte order, files from a machine with another byte
+   order are rejected. */
+#define PACK_ORDER 0x01020304
+
+/* Initial number of slots in the hash table of unindexed records. */
+#define PACK_TAIL_INITIAL_SIZE 64
+
+/**
+ * Start of the data and index files.
+ */
+typedef struct pack_header_s
+{
+    char magic[12];             /**< PACK_DATA_MAGIC or PACK_INDEX_MAGIC */
+    unsigned int order;         /**< PACK_ORDER */
+} pack_header_t;
+
+/**
+ * Start of the index file.
+ */
+typedef struct pack_index_header_s
+{
+    pack_header_t h;            /**< magic and byte order */
+    unsigned int count;         /**< number of entries that follow */
+    unsigned int spare;         /**< zero */
+    unsigned long long covered; /**< size of the data file that has been
+                                     indexed */
+} pack_index_header_t;
+
+/**
+ * Precedes every record in the data file.
+ */
+typedef struct pack_record_s
+{
+    unsigned int discid;        /**< the disc ID */
+    unsigned int cat;           /**< the category */
+    unsigned int len;           /**< length of the record, 0 if it has
+                                     been removed */
+} pack_record_t;
+
+/**
+ * Where the last version of a record is, in the index file as well as
+ * in the hash table of records that have not been indexed yet.
+ */
+typedef struct pack_entry_s
+{
+    unsigned int discid;        /**< the disc ID, 0 marks an unused slot */
+    unsigned int cat;           /**< the category */
+    unsigned int len;           /**< length of the record, 0 if it has
+                                     been removed */
+    unsigned int spare;         /**< zero */
+    unsigned long long off;     /**< offset of the record in the data file */
+} pack_entry_t;
+
+/**
+ * A read-only file mapping.
+ */
+typedef struct pack_map_s
+{
+    char *addr;                 /**< start of the mapping, or NULL */
+    size_t len;                 /**< length of the mapping */
+} pack_map_t;
+
+/**
+ * Actual definition of the packed store structure.
+ */
+struct cddb_pack_s
+{
+    char *data_fn;              /**< name of the data file */
+    char *index_fn;             /**< name of the index file */
+    int fd;                     /**< data file opened for reading, or -1 */
+    int wfd;                    /**< data file opened for appending, or -1 */
+    pack_map_t data;            /**< mapping of the data file */
+    unsigned long long scanned; /**< end of the last complete record in the
+                                     data file that has been seen */
+    int broken;                 /**< the data file is invalid */
+    pack_map_t index;           /**< mapping of the index file */
+    dev_t index_dev;            /**< device of the last index file seen */
+    ino_t index_ino;            /**< inode of the last index file seen */
+    const pack_entry_t *entries; /**< sorted index entries */
+    unsigned int count;         /**< number of index entries */
+    pack_entry_t *tail;         /**< hash table of the records after the
+                                     part covered by the index */
+    unsigned int tail_size;     /**< number of slots, a power of two */
+    unsigned int tail_count;    /**< number of slots in use */
+    time_t checked;             /**< last time the files were checked for
+                                     changes, or 0 */
+};
+
+
+/* --- private functions --- */
+
+
+static char *cddb_pack_path(const char *dir, const char *name)
+{
+    char *fn;
+    int len;
+
+    len = strlen(dir) + strlen(name) + 2;
+    fn = (char*)malloc(len);
+    if (fn) {
+        snprintf(fn, len, "%s/%s", dir, name);
+    }
+    return fn;
+}
+
+/**
+ * Map the first bytes of a file.
+ *
+ * @return FALSE if the file could not be mapped.
+ */
+static int cddb_pack_map(pack_map_t *m, int fd, size_t len)
+{
+#ifdef HAVE_MMAP
+    void *addr;
+
+    addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        return FALSE;
+    }
+    m->addr = (char*)addr;
+#else
+    size_t pos = 0;
+    ssize_t n;
+
+    /* no mmap, read the file into memory */
+    m->addr = (char*)malloc(len);
+    if (!m->addr || (lseek(fd, 0, SEEK_SET) == -1)) {
+        FREE_NOT_NULL(m->addr);
+        return FALSE;
+    }
+    while (pos < len) {
+        n = read(fd, m->addr + pos, len - pos);
+        if (n <= 0) {
+            FREE_NOT_NULL(m->addr);
+            return FALSE;
+        }
+        pos += n;
+    }
+#endif
+    m->len = len;
+    return TRUE;
+}
+
+static void cddb_pack_unmap(pack_map_t *m)
+{
+    if (m->addr) {
+#ifdef HAVE_MMAP
+        munmap(m->addr, m->len);
+#else
+        free(m->addr);
+#endif
+        m->addr = NULL;
+    }
+    m->len = 0;
+}
+
+#define PACK_HASH(discid, cat) (((discid) ^ ((cat) << 27)) * 0x9e3779b1u)
+
+/**
+ * Find the slot of a record in the hash table of unindexed records.
+ *
+ * @param insert Create the slot if the record is not present yet.
+ * @return The slot or NULL if it was not found or could not be
+ *         created.
+ */
+static pack_entry_t *cddb_pack_tail_find(cddb_pack_t *pack,
+                                         unsigned int discid,
+                                         unsigned int cat, int insert)
+{
+    pack_entry_t *e, *old;
+    unsigned int h, i, size;
+
+    if (!pack->tail) {
+        return NULL;
+    }
+    h = PACK_HASH(discid, cat);
+    for (e = pack->tail + (h & (pack->tail_size - 1)); e->discid;
+         e = pack->tail + (++h & (pack->tail_size - 1))) {
+        if ((e->discid == discid) && (e->cat == cat)) {
+            return e;
+        }
+    }
+    if (!insert) {
+        return NULL;
+    }
+    if ((pack->tail_count + 1) * 2 > pack->tail_size) {
+        /* keep the table at most half full */
+        old = pack->tail;
+        size = pack->tail_size;
+        pack->tail = (pack_entry_t*)calloc(size * 2, sizeof(pack_entry_t));
+        if (!pack->tail) {
+            pack->tail = old;
+            return NULL;
+        }
+        pack->tail_size = size * 2;
+        for (i = 0; i < size; i++) {
+            if (old[i].discid) {
+                h = PACK_HASH(old[i].discid, old[i].cat);
+                for (e = pack->tail + (h & (pack->tail_size - 1)); e->discid;
+                     e = pack->tail + (++h & (pack->tail_size - 1))) {
+                    /* find a free slot */
+                }
+                *e = old[i];
+            }
+        }
+        free(old);
+        return cddb_pack_tail_find(pack, discid, cat, TRUE);
+    }
+    e->discid = discid;
+    e->cat = cat;
+    pack->tail_count++;
+    return e;
+}
+
+static int cddb_pack_entry_cmp(const void *a, const void *b)
+{
+    const pack_entry_t *x = (const pack_entry_t*)a;
+    const pack_entry_t *y = (const pack_entry_t*)b;
+
+    if (x->discid != y->discid) {
+        return (x->discid < y->discid ? -1 : 1);
+    }
+    return (x->cat < y->cat ? -1 : (x->cat > y->cat));
+}
+
+/**
+ * Find the last version of a record.
+ *
+ * @return The entry, or NULL if the store never held the record.
+ */
+static const pack_entry_t *cddb_pack_find(cddb_pack_t *pack,
+                                          unsigned int discid,
+                                          unsigned int cat)
+{
+    pack_entry_t key;
+    const pack_entry_t *e;
+
+    e = cddb_pack_tail_find(pack, discid, cat, FALSE);
+    if (!e && pack->count) {
+        key.discid = discid;
+        key.cat = cat;
+        e = (const pack_entry_t*)bsearch(&key, pack->entries, pack->count,
+                                         sizeof(pack_entry_t),
+                                         cddb_pack_entry_cmp);
+    }
+    return e;
+}
+
+/**
+ * Scan the records that have been appended to the data file since it
+ * was last scanned.
+ */
+static void cddb_pack_scan(cddb_pack_t *pack)
+{
+    unsigned long long pos = pack->scanned;
+    pack_record_t rec;
+    pack_entry_t *e;
+
+    if (pos < sizeof(pack_header_t)) {
+        pos = sizeof(pack_header_t);
+    }
+    while (pos + sizeof(pack_record_t) <= pack->data.len) {
+        memcpy(&rec, pack->data.addr + pos, sizeof(pack_record_t));
+        if (rec.len > pack->data.len - pos - sizeof(pack_record_t)) {
+            /* still being written */
+            break;
+        }
+        if ((rec.discid == 0) || (rec.cat >= CDDB_CAT_INVALID)) {
+            cddb_log_warn("invalid record in packed cache '%s' at %llu",
+                          pack->data_fn, pos);
+            pack->broken = TRUE;
+            break;
+        }
+        e = cddb_pack_tail_find(pack, rec.discid, rec.cat, TRUE);
+        if (!e) {
+            break;
+        }
+        e->len = rec.len;
+        e->off = pos + sizeof(pack_record_t);
+        pos += sizeof(pack_record_t) + rec.len;
+    }
+    pack->scanned = pos;
+}
+
+/**
+ * Map the index file again if it has been replaced.
+ */
+static void cddb_pack_check_index(cddb_pack_t *pack)
+{
+    pack_index_header_t hdr;
+    pack_map_t m;
+    struct stat st;
+    int fd;
+
+    if ((stat(pack->index_fn, &st) == -1) ||
+        ((st.st_dev == pack->index_dev) && (st.st_ino == pack->index_ino))) {
+        /* no index or still the same one */
+        return;
+    }
+    fd = open(pack->index_fn, O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    /* do not look at an invalid one again */
+    pack->index_dev = st.st_dev;
+    pack->index_ino = st.st_ino;
+    m.addr = NULL;
+    if ((fstat(fd, &st) == -1) || (st.st_size < sizeof(hdr)) ||
+        !cddb_pack_map(&m, fd, st.st_size)) {
+        close(fd);
+        return;
+    }
+    close(fd);
+    memcpy(&hdr, m.addr, sizeof(hdr));
+    if ((memcmp(hdr.h.magic, PACK_INDEX_MAGIC, sizeof(hdr.h.magic)) != 0) ||
+        (hdr.h.order != PACK_ORDER) ||
+        (hdr.count > (m.len - sizeof(hdr)) / sizeof(pack_entry_t))) {
+        cddb_log_warn("ignoring invalid packed cache index '%s'",
+                      pack->index_fn);
+        cddb_pack_unmap(&m);
+        return;
+    }
+    cddb_pack_unmap(&pack->index);
+    pack->index = m;
+    pack->entries = (const pack_entry_t*)(m.addr + sizeof(hdr));
+    pack->count = hdr.count;
+    /* forget the records found after the part covered by the old
+       index, they are scanned again from the end of the new one */
+    memset(pack->tail, 0, pack->tail_size * sizeof(pack_entry_t));
+    pack->tail_count = 0;
+    pack->scanned = hdr.covered;
+    pack->broken = FALSE;
+}
+
+/**
+ * Map the data file again if it has grown, and scan the new records.
+ */
+static void cddb_pack_check_data(cddb_pack_t *pack)
+{
+    pack_header_t hdr;
+    struct stat st;
+
+    if (pack->fd == -1) {
+        pack->fd = open(pack->data_fn, O_RDONLY);
+        if (pack->fd == -1) {
+            return;
+        }
+    }
+    if ((fstat(pack->fd, &st) == 0) && (st.st_size > pack->data.len)) {
+        /* it has grown */
+        cddb_pack_unmap(&pack->data);
+        if ((st.st_size < sizeof(hdr)) ||
+            !cddb_pack_map(&pack->data, pack->fd, st.st_size)) {
+            return;
+        }
+        memcpy(&hdr, pack->data.addr, sizeof(hdr));
+        if ((memcmp(hdr.magic, PACK_DATA_MAGIC, sizeof(hdr.magic)) != 0) ||
+            (hdr.order != PACK_ORDER)) {
+            cddb_log_warn("ignoring invalid packed cache '%s'",
+                          pack->data_fn);
+            cddb_pack_unmap(&pack->data);
+            pack->broken = TRUE;
+            return;
+        }
+    }
+    if (pack->data.addr && !pack->broken) {
+        cddb_pack_scan(pack);
+    }
+}
+
+/**
+ * Check the files for changes made by somebody else.
+ *
+ * @param force Check even if the last check was less than
+ *              PACK_CHECK_INTERVAL seconds ago.
+ */
+static void cddb_pack_check(cddb_pack_t *pack, int force)
+{
+    time_t now = time(NULL);
+
+    if (!force && pack->checked &&
+        (now - pack->checked < PACK_CHECK_INTERVAL)) {
+        return;
+    }
+    pack->checked = now;
+    cddb_pack_check_index(pack);
+    cddb_pack_check_data(pack);
+}
+
+/**
+ * Create the data file if it does not exist yet.  The header is
+ * written to a temporary file that is then linked into place, so that
+ * nobody sees a data file without one.
+ */
+static int cddb_pack_create(cddb_pack_t *pack)
+{
+    pack_header_t hdr;
+    char *tmp;
+    int fd, len, rv;
+
+    len = strlen(pack->data_fn) + 16;
+    tmp = (char*)malloc(len);
+    if (!tmp) {
+        return FALSE;
+    }
+#ifdef HAVE_MKSTEMP
+    snprintf(tmp, len, "%s.XXXXXX", pack->data_fn);
+    fd = mkstemp(tmp);
+    if (fd != -1) {
+        /* mkstemp only allows the owner to read the file */
+        fchmod(fd, 0644);
+    }
+#else
+    snprintf(tmp, len, "%s.%d", pack->data_fn, (int)getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd == -1) {
+        free(tmp);
+        return FALSE;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PACK_DATA_MAGIC, sizeof(hdr.magic));
+    hdr.order = PACK_ORDER;
+    rv = (write(fd, &hdr, sizeof(hdr)) == sizeof(hdr));
+    rv &= (close(fd) == 0);
+    if (rv && (link(tmp, pack->data_fn) == -1) && (errno != EEXIST)) {
+        rv = FALSE;
+    }
+    unlink(tmp);
+    free(tmp);
+    return rv;
+}
+
+/**
+ * Append a record to the data file, without scanning it.
+ */
+static int cddb_pack_append(cddb_pack_t *pack, unsigned int discid,
+                            cddb_cat_t cat, const char *data, int len)
+{
+    pack_record_t rec;
+    char *buf;
+    ssize_t n;
+    off_t start = -1;
+    int pos, size;
+
+    if (discid == 0) {
+        /* the scan would take it for a damaged data file */
+        cddb_log_warn("not adding record with disc ID 0 to packed cache");
+        return FALSE;
+    }
+    if (pack->wfd == -1) {
+        pack->wfd = open(pack->data_fn, O_WRONLY | O_APPEND);
+        if ((pack->wfd == -1) && (errno == ENOENT) &&
+            cddb_pack_create(pack)) {
+            pack->wfd = open(pack->data_fn, O_WRONLY | O_APPEND);
+        }
+        if (pack->wfd == -1) {
+            cddb_log_error("cannot write packed cache '%s'", pack->data_fn);
+            return FALSE;
+        }
+    }
+    /* one write, so that records appended by others do not end up in
+       the middle */
+    size = sizeof(rec) + len;
+    buf = (char*)malloc(size);
+    if (!buf) {
+        return FALSE;
+    }
+    rec.discid = discid;
+    rec.cat = cat;
+    rec.len = len;
+    memcpy(buf, &rec, sizeof(rec));
+    memcpy(buf + sizeof(rec), data, len);
+    for (pos = 0; pos < size; pos += n) {
+        n = write(pack->wfd, buf + pos, size - pos);
+        if (n <= 0) {
+            cddb_log_error("cannot write packed cache '%s'", pack->data_fn);
+            break;
+        }
+        if (pos == 0) {
+            /* where the record starts, others may append too */
+            start = lseek(pack->wfd, 0, SEEK_CUR) - n;
+        }
+    }
+    free(buf);
+    if ((pos > 0) && (pos < size)) {
+        /* cut off the partial record, everything appended after it
+           would be out of step */
+        if ((start < 0) || (ftruncate(pack->wfd, start) == -1)) {
+            cddb_log_error("packed cache '%s' is damaged", pack->data_fn);
+            pack->broken = TRUE;
+        }
+    }
+    return (pos == size);
+}
+
+
+/* --- construction / destruction */
+
+
+cddb_pack_t *cddb_pack_new(const char *dir)
+{
+    cddb_pack_t *pack;
+
+    pack = (cddb_pack_t*)calloc(1, sizeof(cddb_pack_t));
+    if (pack) {
+        pack->data_fn = cddb_pack_path(dir, PACK_DATA_FILE);
+        pack->index_fn = cddb_pack_path(dir, PACK_INDEX_FILE);
+        pack->tail_size = PACK_TAIL_INITIAL_SIZE;
+        pack->tail = (pack_entry_t*)calloc(pack->tail_size,
+                                           sizeof(pack_entry_t));
+        if (!pack->data_fn || !pack->index_fn || !pack->tail) {
+            FREE_NOT_NULL(pack->data_fn);
+            FREE_NOT_NULL(pack->index_fn);
+            FREE_NOT_NULL(pack->tail);
+            free(pack);
+            return NULL;
+        }
+        pack->fd = -1;
+        pack->wfd = -1;
+        pack->scanned = 0;
+        pack->count = 0;
+        pack->tail_count = 0;
+        pack->checked = 0;
+    }
+    return pack;
+}
+
+void cddb_pack_destroy(cddb_pack_t *pack)
+{
+    if (pack) {
+        if (pack->tail_count >= PACK_TAIL_MAX) {
+            /* spare the next user a long scan */
+            cddb_pack_save_index(pack);
+        }
+        cddb_pack_unmap(&pack->data);
+        cddb_pack_unmap(&pack->index);
+        if (pack->fd != -1) {
+            close(pack->fd);
+        }
+        if (pack->wfd != -1) {
+            close(pack->wfd);
+        }
+        free(pack->data_fn);
+        free(pack->index_fn);
+        free(pack->tail);
+        free(pack);
+    }
+}
+
+
+/* --- lookup and update --- */
+
+
+int cddb_pack_lookup(cddb_pack_t *pack, unsigned int discid)
+{
+    const pack_entry_t *e;
+    int cat, cats = 0;
+
+    cddb_pack_check(pack, FALSE);
+    for (cat = CDDB_CAT_DATA; cat < CDDB_CAT_INVALID; cat++) {
+        e = cddb_pack_find(pack, discid, cat);
+        if (e && e->len) {
+            cats |= BIT(cat);
+        }
+    }
+    return cats;
+}
+
+const char *cddb_pack_get(cddb_pack_t *pack, unsigned int discid,
+                          cddb_cat_t cat, int *len)
+{
+    const pack_entry_t *e;
+
+    cddb_pack_check(pack, FALSE);
+    e = cddb_pack_find(pack, discid, cat);
+    if (!e || !e->len || (e->off + e->len > pack->data.len)) {
+        return NULL;
+    }
+    *len = e->len;
+    return pack->data.addr + e->off;
+}
+
+int cddb_pack_put(cddb_pack_t *pack, unsigned int discid, cddb_cat_t cat,
+                  const char *data, int len)
+{
+    int rv;
+
+    cddb_log_debug("cddb_pack_put()");
+    rv = cddb_pack_append(pack, discid, cat, data, len);
+    cddb_pack_check(pack, TRUE);
+    return rv;
+}
+
+int cddb_pack_add(cddb_pack_t *pack, unsigned int discid, cddb_cat_t cat,
+                  const char *data, int len)
+{
+    cddb_log_debug("cddb_pack_add()");
+    return cddb_pack_append(pack, discid, cat, data, len);
+}
+
+int cddb_pack_remove(cddb_pack_t *pack, unsigned int discid, cddb_cat_t cat)
+{
+    const pack_entry_t *e;
+    int rv = TRUE;
+
+    cddb_log_debug("cddb_pack_remove()");
+    cddb_pack_check(pack, FALSE);
+    e = cddb_pack_find(pack, discid, cat);
+    if (e && e->len) {
+        rv = cddb_pack_append(pack, discid, cat, NULL, 0);
+        cddb_pack_check(pack, TRUE);
+    }
+    return rv;
+}
+
+void cddb_pack_recheck(cddb_pack_t *pack)
+{
+    pack->checked = 0;
+}
+
+int cddb_pack_save_index(cddb_pack_t *pack)
+{
+    pack_index_header_t hdr;
+    pack_entry_t *all;
+    unsigned int i, n = 0;
+    char *tmp;
+    FILE *fp;
+    int len, rv;
+#ifdef HAVE_MKSTEMP
+    int fd;
+#endif
+
+    cddb_log_debug("cddb_pack_save_index()");
+    cddb_pack_check(pack, TRUE);
+    if (!pack->data.addr || pack->broken) {
+        return FALSE;
+    }
+    /* merge the index with the records appended since */
+    all = (pack_entry_t*)malloc((pack->count + pack->tail_count + 1) *
+                                sizeof(pack_entry_t));
+    if (!all) {
+        return FALSE;
+    }
+    for (i = 0; i < pack->count; i++) {
+        if (!cddb_pack_tail_find(pack, pack->entries[i].discid,
+                                 pack->entries[i].cat, FALSE)) {
+            all[n++] = pack->entries[i];
+        }
+    }
+    for (i = 0; i < pack->tail_size; i++) {
+        if (pack->tail[i].discid && pack->tail[i].len) {
+            all[n++] = pack->tail[i];
+        }
+    }
+    qsort(all, n, sizeof(pack_entry_t), cddb_pack_entry_cmp);
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.h.magic, PACK_INDEX_MAGIC, sizeof(hdr.h.magic));
+    hdr.h.order = PACK_ORDER;
+    hdr.count = n;
+    hdr.covered = pack->scanned;
+
+    /* write a temporary file and move it into place, readers never see
+       a partial index */
+    len = strlen(pack->index_fn) + 16;
+    tmp = (char*)malloc(len);
+    fp = NULL;
+    if (tmp) {
+#ifdef HAVE_MKSTEMP
+        snprintf(tmp, len, "%s.XXXXXX", pack->index_fn);
+        fd = mkstemp(tmp);
+        if (fd != -1) {
+            /* mkstemp only allows the owner to read the file */
+            fchmod(fd, 0644);
+            fp = fdopen(fd, "wb");
+            if (!fp) {
+                close(fd);
+                unlink(tmp);
+            }
+        }
+#else
+        snprintf(tmp, len, "%s.%d", pack->index_fn, (int)getpid());
+        fp = fopen(tmp, "wb");
+#endif
+    }
+    if (!fp) {
+        cddb_log_error("cannot write packed cache index '%s'", pack->index_fn);
+        FREE_NOT_NULL(tmp);
+        free(all);
+        return FALSE;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(all, sizeof(pack_entry_t), n, fp);
+    rv = !ferror(fp);
+    rv &= (fclose(fp) == 0);
+    if (rv) {
+        rv = (rename(tmp, pack->index_fn) == 0);
+    }
+    if (!rv) {
+        cddb_log_error("cannot write packed cache index '%s'", pack->index_fn);
+        unlink(tmp);
+    }
+    free(tmp);
+    free(all);
+    /* switch to the new index */
+    cddb_pack_check(pack, TRUE);
+    return rv;
+}
+
+int cddb_pack_convert(cddb_pack_t *pack, const char *dir)
+{
+#ifdef HAVE_DIRENT_H
+    const pack_entry_t *e;
+    struct dirent *d;
+    struct stat st;
+    unsigned int discid;
+    char *fn, *buf;
+    DIR *cd;
+    FILE *fp;
+    int cat, size, count = 0, rv = TRUE;
+
+    cddb_log_debug("cddb_pack_convert()");
+    cddb_pack_check(pack, TRUE);
+    for (cat = CDDB_CAT_DATA; rv && (cat < CDDB_CAT_INVALID); cat++) {
+        fn = cddb_pack_path(dir, CDDB_CATEGORY[cat]);
+        cd = (fn ? opendir(fn) : NULL);
+        FREE_NOT_NULL(fn);
+        if (!cd) {
+            continue;
+        }
+        while (rv && ((d = readdir(cd)) != NULL)) {
+            if (!cddb_index_entry_name(d->d_name, &discid)) {
+                /* not a cache entry */
+                continue;
+            }
+            e = cddb_pack_find(pack, discid, cat);
+            if (e && e->len) {
+                /* converted before */
+                continue;
+            }
+            fn = (char*)malloc(strlen(dir) + 32);
+            fp = NULL;
+            if (fn) {
+                sprintf(fn, "%s/%s/%s", dir, CDDB_CATEGORY[cat], d->d_name);
+                fp = fopen(fn, "rb");
+                free(fn);
+            }
+            if (!fp) {
+                continue;
+            }
+            buf = NULL;
+            size = 0;
+            if ((fstat(fileno(fp), &st) == 0) && (st.st_size > 0) &&
+                (buf = (char*)malloc(st.st_size))) {
+                size = fread(buf, 1, st.st_size, fp);
+            }
+            fclose(fp);
+            if (size > 0) {
+                rv = cddb_pack_append(pack, discid, cat, buf, size);
+                count += rv;
+            }
+            FREE_NOT_NULL(buf);
+        }
+        closedir(cd);
+    }
+    if (!rv || ((count > 0) && !cddb_pack_save_index(pack))) {
+        return -1;
+    }
+    return count;
+#else
+    return -1;
+#endif /* HAVE_DIRENT_H */
+}
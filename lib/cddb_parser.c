@@ -0,0 +1,602 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cddb/cddb_ni.h"
+
+
+/* --- type and structure definitions */
+
+
+#define STATE_START         0
+#define STATE_TRACK_OFFSETS 1
+#define STATE_DISC_LENGTH   2
+#define STATE_DISC_REVISION 3
+#define STATE_DISC_TITLE    4
+#define STATE_DISC_YEAR     5
+#define STATE_DISC_GENRE    6
+#define STATE_DISC_EXT      7
+#define STATE_TRACK_TITLE   8
+#define STATE_TRACK_EXT     9
+#define STATE_PLAY_ORDER    10
+#define STATE_END_DOT       11
+#define STATE_STOP          12
+
+#define MULTI_NONE          0
+#define MULTI_ARTIST        1
+#define MULTI_TITLE         2
+#define MULTI_EXT           3
+
+/* Is the current line of the given kind?  With the built-in scanner
+   the line has already been classified, otherwise it is matched
+   against the regular expression for that kind of line. */
+#ifdef HAVE_REGEX_H
+#define LINE_IS(k) \
+    (p->use_regex ? cddb_regex_record_line(k, line, &f) : (f.kind == (k)))
+#else
+#define LINE_IS(k) (f.kind == (k))
+#endif
+
+
+/**
+ * Actual definition of the parser structure.
+ */
+struct cddb_parser_s
+{
+    cddb_disc_t *disc;          /**< the disc being filled in */
+    int state;                  /**< current state, one of STATE_* */
+    int multi_line;             /**< multi-line field being parsed, one of
+                                     MULTI_* */
+    int track_no;               /**< current track number */
+    int old_no;                 /**< track number of the previous line */
+    int use_regex;              /**< use the regular expression engine
+                                     (see CDDB_F_REGEX_PARSER) */
+    cddb_error_t error;         /**< the error that stopped the parser */
+    char *line;                 /**< buffer for a line that is split over
+                                     several chunks */
+    int len;                    /**< number of bytes in the line buffer */
+    int max;                    /**< maximum line length, longer lines are
+                                     parsed in pieces like they are read
+                                     from the network */
+    cddb_lazy_t *lazy;          /**< if not NULL, the lines being parsed lie
+                                     in this record and the genre and
+                                     extended data are only indexed */
+};
+
+
+/* --- construction / destruction */
+
+
+cddb_parser_t *cddb_parser_new(cddb_disc_t *disc)
+{
+    cddb_parser_t *p;
+
+    p = (cddb_parser_t*)calloc(1, sizeof(cddb_parser_t));
+    if (p) {
+        p->max = DEFAULT_BUF_SIZE - 1;
+        p->line = (char*)malloc(p->max + 1);
+        if (!p->line) {
+            free(p);
+            return NULL;
+        }
+        p->disc = disc;
+        p->state = STATE_START;
+        p->multi_line = MULTI_NONE;
+        p->track_no = 0;
+        p->old_no = -1;
+#ifdef HAVE_REGEX_H
+        p->use_regex = (libcddb_flags() & CDDB_F_REGEX_PARSER);
+#else
+        p->use_regex = FALSE;
+#endif
+        p->error = CDDB_ERR_OK;
+        p->len = 0;
+        p->lazy = NULL;
+    }
+    return p;
+}
+
+void cddb_parser_destroy(cddb_parser_t *p)
+{
+    if (p) {
+        FREE_NOT_NULL(p->line);
+        free(p);
+    }
+}
+
+
+/* --- line handlers --- */
+
+
+/*
+ * The handlers below process a line of a given kind in the state that
+ * expects it.  They return FALSE if the record is invalid.
+ */
+
+static int cddb_parser_track_offsets(cddb_parser_t *p, const cddb_field_t *f,
+                                     char *line, int len)
+{
+    /* expect a list of track frame offsets now */
+    p->state = STATE_TRACK_OFFSETS;
+    return TRUE;
+}
+
+static int cddb_parser_track_offset(cddb_parser_t *p, const cddb_field_t *f,
+                                    char *line, int len)
+{
+    cddb_track_t *track;
+
+    track = cddb_disc_get_track(p->disc, p->track_no);
+    if (!track) {
+        /* no such track present in disc structure yet */
+        track = cddb_track_new();
+        /* XXX: insert at track_no pos?? */
+        cddb_disc_add_track(p->disc, track);
+    }
+    track->frame_offset = f->num;
+    p->track_no++;
+    return TRUE;
+}
+
+static int cddb_parser_disc_length(cddb_parser_t *p, const cddb_field_t *f,
+                                   char *line, int len)
+{
+    p->disc->length = f->num;
+    /* expect disc revision now */
+    p->state = STATE_DISC_REVISION;
+    return TRUE;
+}
+
+static int cddb_parser_disc_revision(cddb_parser_t *p, const cddb_field_t *f,
+                                     char *line, int len)
+{
+    p->disc->revision = f->num;
+    /* expect disc title now */
+    p->state = STATE_DISC_TITLE;
+    return TRUE;
+}
+
+static int cddb_parser_disc_title(cddb_parser_t *p, const cddb_field_t *f,
+                                  char *line, int len)
+{
+    /* XXX: more error detection possible! */
+    if (p->multi_line == MULTI_NONE) {
+        /* start parsing title or artist, delete current
+           track and artist in case this disc structure is
+           being reused from a previous read */
+        cddb_disc_set_artist(p->disc, NULL);
+        cddb_disc_set_title(p->disc, NULL);
+    }
+    if (f->title != NULL) {
+        /* both artist and title of disc are specified */
+        cddb_disc_append_artist_n(p->disc, f->str, f->len);
+        cddb_disc_append_title_n(p->disc, f->title, f->title_len);
+        /* we should only get title continuations now */
+        p->multi_line = MULTI_TITLE;
+    } else {
+        /* only title or artist of disc on this line */
+        if (p->multi_line != MULTI_TITLE) {
+            /* this line is part of the artist name */
+            cddb_disc_append_artist_n(p->disc, f->str, f->len);
+            /* next line might be continuation of artist name */
+            p->multi_line = MULTI_ARTIST;
+        } else {
+            /* this line is part of the title */
+            cddb_disc_append_title_n(p->disc, f->str, f->len);
+        }
+    }
+    return TRUE;
+}
+
+static int cddb_parser_disc_year(cddb_parser_t *p, const cddb_field_t *f,
+                                 char *line, int len)
+{
+    p->disc->year = f->num;
+    /* expect disc genre now */
+    p->state = STATE_DISC_GENRE;
+    return TRUE;
+}
+
+static int cddb_parser_disc_genre(cddb_parser_t *p, const cddb_field_t *f,
+                                  char *line, int len)
+{
+    if (p->lazy) {
+        cddb_disc_set_genre(p->disc, NULL);
+        cddb_lazy_mark(p->lazy, &p->disc->lazy_genre, line, len, TRUE);
+    } else {
+        cddb_disc_set_genre_n(p->disc, f->str, f->len);
+    }
+    /* expect track title now */
+    p->state = STATE_TRACK_TITLE;
+    return TRUE;
+}
+
+static int cddb_parser_track_title(cddb_parser_t *p, const cddb_field_t *f,
+                                   char *line, int len)
+{
+    cddb_track_t *track;
+
+    p->state = STATE_TRACK_TITLE;
+    p->track_no = f->num;
+    track = cddb_disc_get_track(p->disc, p->track_no);
+    if (track == NULL) {
+        p->error = CDDB_ERR_TRACK_NOT_FOUND;
+        p->state = STATE_STOP;
+        return FALSE;
+    }
+    if (p->track_no != p->old_no) {
+        p->old_no = p->track_no;
+        /* reset multi-line flag, expect artist first */
+        p->multi_line = MULTI_ARTIST;
+        /* delete current title and artist in case this
+           track structure is being reused from a previous
+           read */
+        cddb_track_set_artist(track, NULL);
+        cddb_track_set_title(track, NULL);
+    }
+    if (f->title == NULL) {
+        /* only title or artist of track on this line */
+        if (p->multi_line != MULTI_TITLE) {
+            /* this line might be part of the artist,
+               but if we don't encounter a ' / ' it's the title,
+               so we use the title space for now and fix it later
+               if needed (see below) */
+            cddb_track_append_title_n(track, f->str, f->len);
+        } else {
+            /* this line is part of the title */
+            cddb_track_append_title_n(track, f->str, f->len);
+        }
+    } else {
+        /* we might have put the artist in the title space,
+           fix this now (see artist) */
+        track->artist = track->title;
+        track->title = NULL;
+        /* both artist and title of track are specified */
+        cddb_track_append_artist_n(track, f->str, f->len);
+        cddb_track_append_title_n(track, f->title, f->title_len);
+        /* we should only get title continuations now */
+        p->multi_line = MULTI_TITLE;
+    }
+    return TRUE;
+}
+
+static int cddb_parser_disc_ext(cddb_parser_t *p, const cddb_field_t *f,
+                                char *line, int len)
+{
+    p->state = STATE_DISC_EXT;
+    if (p->multi_line == MULTI_NONE) {
+        /* start parsing extended disc data, delete
+           current data in case this disc structure is
+           being reused from a previous read */
+        cddb_disc_set_ext_data(p->disc, NULL);
+        p->multi_line = MULTI_EXT;
+        if (p->lazy) {
+            cddb_lazy_mark(p->lazy, &p->disc->lazy_ext, line, len, TRUE);
+        }
+    } else if (p->lazy) {
+        cddb_lazy_mark(p->lazy, &p->disc->lazy_ext, line, len, FALSE);
+    }
+    if ((f->len > 0) && !p->lazy) {
+        cddb_disc_append_ext_data_n(p->disc, f->str, f->len);
+    }
+    return TRUE;
+}
+
+static int cddb_parser_track_ext(cddb_parser_t *p, const cddb_field_t *f,
+                                 char *line, int len)
+{
+    cddb_track_t *track;
+
+    p->state = STATE_TRACK_EXT;
+    p->track_no = f->num;
+    track = cddb_disc_get_track(p->disc, p->track_no);
+    if (track == NULL) {
+        p->error = CDDB_ERR_TRACK_NOT_FOUND;
+        p->state = STATE_STOP;
+        return FALSE;
+    }
+    if (p->track_no != p->old_no) {
+        p->old_no = p->track_no;
+        /* start parsing extended track data for a new
+           track, delete current data in case this
+           track structure is being reused from a
+           previous read */
+        cddb_track_set_ext_data(track, NULL);
+        if (p->lazy) {
+            cddb_lazy_mark(p->lazy, &track->lazy_ext, line, len, TRUE);
+        }
+    } else if (p->lazy) {
+        cddb_lazy_mark(p->lazy, &track->lazy_ext, line, len, FALSE);
+    }
+    if ((f->len > 0) && !p->lazy) {
+        cddb_track_append_ext_data_n(track, f->str, f->len);
+    }
+    return TRUE;
+}
+
+static int cddb_parser_play_order(cddb_parser_t *p, const cddb_field_t *f,
+                                  char *line, int len)
+{
+    /* expect nothing more */
+    p->state = STATE_END_DOT;
+    return TRUE;
+}
+
+/**
+ * Line handlers indexed by the kind of line, with the state in which
+ * that kind of line is expected.  A line that is expected in the
+ * current state goes straight to its handler.  Only other lines,
+ * which end the current state or are out of order, go through the
+ * state machine in cddb_parser_line().
+ */
+static const struct {
+    int state;
+    int (*handler)(cddb_parser_t *p, const cddb_field_t *f,
+                   char *line, int len);
+} HANDLERS[] = {
+    /* not expected in any state */
+    [LINE_OTHER] = { STATE_STOP, NULL },
+    [LINE_TRACK_FRAME_OFFSETS] = { STATE_START, cddb_parser_track_offsets },
+    [LINE_TRACK_FRAME_OFFSET] = { STATE_TRACK_OFFSETS, cddb_parser_track_offset },
+    [LINE_DISC_LENGTH] = { STATE_DISC_LENGTH, cddb_parser_disc_length },
+    [LINE_DISC_REVISION] = { STATE_DISC_REVISION, cddb_parser_disc_revision },
+    [LINE_DISC_TITLE] = { STATE_DISC_TITLE, cddb_parser_disc_title },
+    [LINE_DISC_YEAR] = { STATE_DISC_YEAR, cddb_parser_disc_year },
+    [LINE_DISC_GENRE] = { STATE_DISC_GENRE, cddb_parser_disc_genre },
+    [LINE_DISC_EXT] = { STATE_DISC_EXT, cddb_parser_disc_ext },
+    [LINE_TRACK_TITLE] = { STATE_TRACK_TITLE, cddb_parser_track_title },
+    [LINE_TRACK_EXT] = { STATE_TRACK_EXT, cddb_parser_track_ext },
+    [LINE_PLAY_ORDER] = { STATE_PLAY_ORDER, cddb_parser_play_order },
+};
+
+/* Handle the current line if it is of the given kind. */
+#define HANDLE(k) \
+    if (LINE_IS(k)) { \
+        return HANDLERS[k].handler(p, &f, line, len); \
+    }
+
+
+/* --- parsing --- */
+
+
+int cddb_parser_line(cddb_parser_t *p, char *line, int len, int eq)
+{
+    cddb_field_t f;
+
+    if (p->state == STATE_STOP) {
+        /* nothing expected after the end of the record */
+        return (p->error == CDDB_ERR_OK);
+    }
+
+    if ((line[0] == CHR_DOT) && (line[1] == CHR_EOS)) {
+        /* end of server response, whatever state we are in; do
+           not read beyond it, the next response might follow */
+        p->state = STATE_STOP;
+        return TRUE;
+    }
+
+    if (!p->use_regex) {
+        cddb_scan_record_line(line, len, eq, &f);
+        if (HANDLERS[f.kind].state == p->state) {
+            /* the line continues the current state */
+            return HANDLERS[f.kind].handler(p, &f, line, len);
+        }
+    }
+
+    switch (p->state) {
+        case STATE_START:
+            cddb_log_debug("...state: START");
+            HANDLE(LINE_TRACK_FRAME_OFFSETS);
+            break;
+        case STATE_TRACK_OFFSETS:
+            cddb_log_debug("...state: TRACK OFFSETS");
+            HANDLE(LINE_TRACK_FRAME_OFFSET);
+            /* expect disc length now */
+            p->state = STATE_DISC_LENGTH;
+        case STATE_DISC_LENGTH:
+            cddb_log_debug("...state: DISC LENGTH");
+            HANDLE(LINE_DISC_LENGTH);
+            break;
+        case STATE_DISC_REVISION:
+            cddb_log_debug("...state: DISC REVISION");
+            HANDLE(LINE_DISC_REVISION);
+            break;
+        case STATE_DISC_TITLE:
+            cddb_log_debug("...state: DISC TITLE");
+            HANDLE(LINE_DISC_TITLE);
+            if (p->multi_line == MULTI_NONE) {
+                /* not yet parsing multi-line DTITLE */
+                /* might be comment line, just skip it */
+                break;
+            }
+            /* if format was not 'artist / title' we assume that
+               the title and artist name are equal (see specs) */
+            if (p->disc->artist != NULL && p->disc->title == NULL) {
+                cddb_disc_set_title(p->disc, p->disc->artist);
+            }
+            p->multi_line = MULTI_NONE;
+            /* fall through to end multi-line disc title */
+        case STATE_DISC_YEAR:
+            cddb_log_debug("...state: DISC YEAR");
+            HANDLE(LINE_DISC_YEAR);
+            /* fall through because disc year is optional */
+        case STATE_DISC_GENRE:
+            cddb_log_debug("...state: DISC GENRE");
+            HANDLE(LINE_DISC_GENRE);
+            /* fall through because disc genre is optional */
+        case STATE_TRACK_TITLE:
+            cddb_log_debug("...state: TRACK TITLE");
+            HANDLE(LINE_TRACK_TITLE);
+            p->multi_line = MULTI_NONE;
+            p->old_no = -1;
+            /* fall through, we might have reached end of track titles */
+        case STATE_DISC_EXT:
+            cddb_log_debug("...state: DISC EXT");
+            HANDLE(LINE_DISC_EXT);
+            p->multi_line = MULTI_NONE;
+            /* fall through, reached end of multi-line extended disc data */
+        case STATE_TRACK_EXT:
+            cddb_log_debug("...state: TRACK EXT");
+            HANDLE(LINE_TRACK_EXT);
+            /* fall through, reached end of extended track data? */
+        case STATE_PLAY_ORDER:
+            cddb_log_debug("...state: PLAY ORDER");
+            HANDLE(LINE_PLAY_ORDER);
+            /* fall through, reached end? */
+        case STATE_END_DOT:
+            cddb_log_debug("...state: STOP");
+            if (*line == CHR_DOT) {
+                /* server response ends with a dot, so end of parsing */
+                p->state = STATE_STOP;
+                break;
+            }
+        default:
+            /* unexpected line */
+            cddb_log_error("unexpected line = '%s'", line);
+    }
+    return TRUE;
+}
+
+/**
+ * Parse the line collected in the line buffer.
+ */
+static int cddb_parser_flush(cddb_parser_t *p)
+{
+    int len;
+
+    /* strip off any line-terminating characters */
+    while ((p->len > 0) && ((p->line[p->len - 1] == CHR_CR) ||
+                            (p->line[p->len - 1] == CHR_LF))) {
+        p->len--;
+    }
+    len = p->len;
+    p->line[len] = CHR_EOS;
+    p->len = 0;
+    cddb_log_debug("...[P] line = '%s'", p->line);
+    return cddb_parser_line(p, p->line, len, -1);
+}
+
+/**
+ * Add input to the line buffer up to the end of the current line.
+ * This handles lines that are split over several chunks and lines
+ * that do not fit in the line buffer.
+ *
+ * @return The number of bytes consumed or -1 if the record is
+ *         invalid.
+ */
+static int cddb_parser_append(cddb_parser_t *p, const char *buf, int len)
+{
+    const char *lf;
+    int n;
+
+    lf = memchr(buf, CHR_LF, len);
+    n = (lf ? lf - buf : len);
+    if (n > p->max - p->len) {
+        /* line too long, parse it in pieces */
+        n = p->max - p->len;
+        lf = NULL;
+    }
+    memcpy(p->line + p->len, buf, n);
+    p->len += n;
+    if (lf) {
+        /* skip the line feed */
+        n++;
+    } else if (p->len < p->max) {
+        /* wait for the rest of the line */
+        return n;
+    }
+    return (cddb_parser_flush(p) ? n : -1);
+}
+
+int cddb_parser_feed(cddb_parser_t *p, const char *buf, int len)
+{
+    cddb_line_ref_t lines[DEFAULT_LINE_TABLE_SIZE], *l;
+    int pos = 0, n, i, used;
+
+    cddb_log_debug("cddb_parser_feed()");
+    while ((pos < len) && (p->state != STATE_STOP)) {
+        n = 0;
+        if (p->len == 0) {
+            /* split as much of the input as possible into lines */
+            n = cddb_scan_lines(buf + pos, len - pos, lines,
+                                DEFAULT_LINE_TABLE_SIZE, &used);
+        }
+        if ((n == 0) || (lines[0].len > p->max)) {
+            /* part of a line, or a line that is too long */
+            n = cddb_parser_append(p, buf + pos, len - pos);
+            if (n < 0) {
+                return -1;
+            }
+            pos += n;
+            continue;
+        }
+        for (i = 0; (i < n) && (p->state != STATE_STOP); i++) {
+            l = lines + i;
+            if (l->len > p->max) {
+                /* parse it in pieces, see above */
+                break;
+            }
+            memcpy(p->line, buf + pos + l->off, l->len);
+            p->line[l->len] = CHR_EOS;
+            cddb_log_debug("...[P] line = '%s'", p->line);
+            if (!cddb_parser_line(p, p->line, l->len, l->eq)) {
+                return -1;
+            }
+        }
+        /* continue after the last line parsed */
+        pos += (i < n) ? lines[i].off : used;
+    }
+    return pos;
+}
+
+int cddb_parser_finish(cddb_parser_t *p)
+{
+    cddb_log_debug("cddb_parser_finish()");
+    if ((p->len > 0) && (p->state != STATE_STOP)) {
+        /* last line was not terminated */
+        if (!cddb_parser_flush(p)) {
+            return FALSE;
+        }
+    }
+    if (p->error != CDDB_ERR_OK) {
+        return FALSE;
+    }
+    /* the end of the input also ends the record */
+    p->state = STATE_STOP;
+    return TRUE;
+}
+
+void cddb_parser_set_lazy(cddb_parser_t *p, cddb_lazy_t *lz)
+{
+    p->lazy = lz;
+}
+
+int cddb_parser_done(const cddb_parser_t *p)
+{
+    return (p->state == STATE_STOP);
+}
+
+cddb_error_t cddb_parser_errno(const cddb_parser_t *p)
+{
+    return p->error;
+}
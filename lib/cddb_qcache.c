@@ -0,0 +1,307 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#include "cddb/cddb_ni.h"
+
+#include <stdlib.h>
+#include <time.h>
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+
+
+/* --- type and structure definitions */
+
+
+/* Marks the end of a hash chain or of the LRU list. */
+#define QC_NONE -1
+
+/**
+ * One remembered query result.
+ */
+typedef struct qcache_entry_s
+{
+    unsigned int discid;        /**< the disc ID */
+    int tracks;                 /**< the number of tracks */
+    cddb_cat_t cat;             /**< category, CDDB_CAT_INVALID if the disc
+                                     was not found */
+    time_t expires;             /**< time at which the result goes stale, or
+                                     0 if it does not */
+    int chain;                  /**< next entry in the same hash bucket, or
+                                     next unused entry */
+    int prev;                   /**< more recently used entry */
+    int next;                   /**< less recently used entry */
+} qcache_entry_t;
+
+/**
+ * Actual definition of the query cache structure.
+ */
+struct cddb_qcache_s
+{
+    qcache_entry_t *entries;    /**< all entries, allocated up front */
+    unsigned int size;          /**< number of entries */
+    int unused;                 /**< first unused entry */
+    int *buckets;               /**< first entry of every hash chain */
+    unsigned int mask;          /**< number of buckets minus one */
+    int head;                   /**< most recently used entry */
+    int tail;                   /**< least recently used entry */
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t lock;       /**< serializes all access */
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+#define QC_LOCK(qc) pthread_mutex_lock(&(qc)->lock)
+#define QC_UNLOCK(qc) pthread_mutex_unlock(&(qc)->lock)
+#else
+#define QC_LOCK(qc)
+#define QC_UNLOCK(qc)
+#endif
+
+
+/* --- private functions --- */
+
+
+/* all track counts of a disc ID share a bucket, see cddb_qcache_forget */
+#define QC_BUCKET(qc, discid) \
+    ((qc)->buckets + ((((discid) * 0x9e3779b1u) >> 16) & (qc)->mask))
+
+/**
+ * Empty the cache.
+ */
+static void cddb_qcache_reset(cddb_qcache_t *qc)
+{
+    unsigned int i;
+
+    for (i = 0; i <= qc->mask; i++) {
+        qc->buckets[i] = QC_NONE;
+    }
+    for (i = 0; i < qc->size; i++) {
+        qc->entries[i].chain = i + 1;
+    }
+    qc->entries[qc->size - 1].chain = QC_NONE;
+    qc->unused = 0;
+    qc->head = qc->tail = QC_NONE;
+}
+
+/**
+ * Take an entry out of the LRU list.
+ */
+static void cddb_qcache_unlink(cddb_qcache_t *qc, int i)
+{
+    qcache_entry_t *e = qc->entries + i;
+
+    if (e->prev == QC_NONE) {
+        qc->head = e->next;
+    } else {
+        qc->entries[e->prev].next = e->next;
+    }
+    if (e->next == QC_NONE) {
+        qc->tail = e->prev;
+    } else {
+        qc->entries[e->next].prev = e->prev;
+    }
+}
+
+/**
+ * Put an entry at the front of the LRU list.
+ */
+static void cddb_qcache_push(cddb_qcache_t *qc, int i)
+{
+    qcache_entry_t *e = qc->entries + i;
+
+    e->prev = QC_NONE;
+    e->next = qc->head;
+    if (qc->head == QC_NONE) {
+        qc->tail = i;
+    } else {
+        qc->entries[qc->head].prev = i;
+    }
+    qc->head = i;
+}
+
+/**
+ * Take an entry out of its hash chain.
+ */
+static void cddb_qcache_unchain(cddb_qcache_t *qc, int i)
+{
+    int *p;
+
+    for (p = QC_BUCKET(qc, qc->entries[i].discid); *p != i;
+         p = &qc->entries[*p].chain) {
+        /* find the link to the entry */
+    }
+    *p = qc->entries[i].chain;
+}
+
+/**
+ * Find the entry of a disc.
+ *
+ * @return The entry index or QC_NONE.
+ */
+static int cddb_qcache_find(cddb_qcache_t *qc, unsigned int discid, int tracks)
+{
+    int i;
+
+    for (i = *QC_BUCKET(qc, discid); i != QC_NONE; i = qc->entries[i].chain) {
+        if ((qc->entries[i].discid == discid) &&
+            (qc->entries[i].tracks == tracks)) {
+            break;
+        }
+    }
+    return i;
+}
+
+/**
+ * Drop an entry and put it on the list of unused entries.
+ */
+static void cddb_qcache_drop(cddb_qcache_t *qc, int i)
+{
+    cddb_qcache_unchain(qc, i);
+    cddb_qcache_unlink(qc, i);
+    qc->entries[i].chain = qc->unused;
+    qc->unused = i;
+}
+
+
+/* --- construction / destruction */
+
+
+cddb_qcache_t *cddb_qcache_new(unsigned int size)
+{
+    cddb_qcache_t *qc;
+    unsigned int n;
+
+    qc = (cddb_qcache_t*)calloc(1, sizeof(cddb_qcache_t));
+    if (!qc || (size == 0)) {
+        FREE_NOT_NULL(qc);
+        return NULL;
+    }
+    /* at least two buckets per entry keeps the chains short */
+    for (n = 2; (n < size * 2) && (n < 0x40000000); n *= 2) {
+        /* next power of two */
+    }
+    qc->entries = (qcache_entry_t*)malloc(size * sizeof(qcache_entry_t));
+    qc->buckets = (int*)malloc(n * sizeof(int));
+    if (!qc->entries || !qc->buckets) {
+        FREE_NOT_NULL(qc->entries);
+        FREE_NOT_NULL(qc->buckets);
+        free(qc);
+        return NULL;
+    }
+    qc->mask = n - 1;
+    qc->size = size;
+    cddb_qcache_reset(qc);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&qc->lock, NULL);
+#endif
+    return qc;
+}
+
+void cddb_qcache_destroy(cddb_qcache_t *qc)
+{
+    if (qc) {
+#ifdef HAVE_PTHREAD
+        pthread_mutex_destroy(&qc->lock);
+#endif
+        free(qc->entries);
+        free(qc->buckets);
+        free(qc);
+    }
+}
+
+
+/* --- lookup and update --- */
+
+
+int cddb_qcache_lookup(cddb_qcache_t *qc, unsigned int discid, int tracks,
+                       cddb_cat_t *cat)
+{
+    qcache_entry_t *e;
+    int i, rv = FALSE;
+
+    QC_LOCK(qc);
+    i = cddb_qcache_find(qc, discid, tracks);
+    if (i != QC_NONE) {
+        e = qc->entries + i;
+        if (e->expires && (e->expires <= time(NULL))) {
+            cddb_qcache_drop(qc, i);
+        } else {
+            *cat = e->cat;
+            if (qc->head != i) {
+                cddb_qcache_unlink(qc, i);
+                cddb_qcache_push(qc, i);
+            }
+            rv = TRUE;
+        }
+    }
+    QC_UNLOCK(qc);
+    return rv;
+}
+
+void cddb_qcache_store(cddb_qcache_t *qc, unsigned int discid, int tracks,
+                       cddb_cat_t cat, int ttl)
+{
+    qcache_entry_t *e;
+    int i, *bucket;
+
+    QC_LOCK(qc);
+    i = cddb_qcache_find(qc, discid, tracks);
+    if (i != QC_NONE) {
+        cddb_qcache_drop(qc, i);
+    } else if (qc->unused == QC_NONE) {
+        /* evict the least recently used result */
+        cddb_qcache_drop(qc, qc->tail);
+    }
+    i = qc->unused;
+    e = qc->entries + i;
+    qc->unused = e->chain;
+    e->discid = discid;
+    e->tracks = tracks;
+    e->cat = cat;
+    e->expires = (ttl > 0 ? time(NULL) + ttl : 0);
+    bucket = QC_BUCKET(qc, discid);
+    e->chain = *bucket;
+    *bucket = i;
+    cddb_qcache_push(qc, i);
+    QC_UNLOCK(qc);
+}
+
+void cddb_qcache_clear(cddb_qcache_t *qc)
+{
+    QC_LOCK(qc);
+    cddb_qcache_reset(qc);
+    QC_UNLOCK(qc);
+}
+
+void cddb_qcache_forget(cddb_qcache_t *qc, unsigned int discid)
+{
+    int i, next;
+
+    QC_LOCK(qc);
+    for (i = *QC_BUCKET(qc, discid); i != QC_NONE; i = next) {
+        next = qc->entries[i].chain;
+        if (qc->entries[i].discid == discid) {
+            cddb_qcache_drop(qc, i);
+        }
+    }
+    QC_UNLOCK(qc);
+}
@@ -40,7 +40,6 @@ regex_t *REGEX_TRACK_EXT = NULL;
 regex_t *REGEX_PLAY_ORDER = NULL;
 regex_t *REGEX_QUERY_MATCH = NULL;
 regex_t *REGEX_SITE = NULL;
-regex_t *REGEX_TEXT_SEARCH = NULL;
 
 
 static int cddb_regex_init_1(regex_t **p, const char *regex)
@@ -86,13 +85,6 @@ void cddb_regex_init()
     /*          <server> <proto> <port> <query-url> <latitude> <longitude> <description> */
     rv = cddb_regex_init_1(&REGEX_SITE,
                            "^([[:graph:]]+)[[:blank:]]([[:alpha:]]+)[[:blank:]]([[:digit:]]+)[[:blank:]]([[:graph:]]+)[[:blank:]]([NS])([0-9.]+)[[:blank:]]([EW])([0-9.]+)[[:blank:]](.*)$");
-
-    /* example: ...<a href="http://www.freedb.org/freedb_search_fmt.php?cat=rock&id=8e0eee0b">Massive Attack / Mezzanine</a>... */
-    /*          ...<a href="http://www.freedb.org/freedb_search_fmt.php?cat=soundtrack&id=b30ed30b"><font size=-1>3</font></a>... */
-    /*          <1:greedy_remains> <2:category> <3:discid> <6:artist> <7:title> <8:artist_title> <10:duplicate_number> */
-    rv = cddb_regex_init_1(&REGEX_TEXT_SEARCH,
-                           "^(.*)/freedb_search_fmt\\.php\\?cat=([[:alpha:]]+)&id=([[:xdigit:]]+)\">"
-                           "((([^<]+) / ([^<]+))|([^<]+)|([^>]*>([[:digit:]]+)<.*))</a>.*$");
 }
 
 static inline void cddb_regfree(regex_t *regex) 
@@ -119,40 +111,45 @@ void cddb_regex_destroy()
     cddb_regfree(REGEX_PLAY_ORDER);
     cddb_regfree(REGEX_QUERY_MATCH);
     cddb_regfree(REGEX_SITE);
-    cddb_regfree(REGEX_TEXT_SEARCH);
+}
+
+/* Copy a (short) numeric match into a caller-supplied buffer, avoids a
+   heap allocation for every number that is parsed. */
+static char *cddb_regex_get_num(const char *s, regmatch_t matches[], int idx,
+                                char *buf, int size)
+{
+    int len;
+
+    len = cddb_regex_len(matches, idx);
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(buf, cddb_regex_ptr(s, matches, idx), len);
+    buf[len] = '\0';
+    return buf;
 }
 
 int cddb_regex_get_int(const char *s, regmatch_t matches[], int idx)
 {
-    char *buf;
-    int i;
+    char buf[32];
 
-    buf = cddb_regex_get_string(s, matches, idx);
-    i = atoi(buf);
-    free(buf);
-    return i;
+    return atoi(cddb_regex_get_num(s, matches, idx, buf, sizeof(buf)));
 }
 
 unsigned long cddb_regex_get_hex(const char *s, regmatch_t matches[], int idx)
 {
-    char *buf, *endp;
+    char buf[32];
     long long h;
 
-    buf = cddb_regex_get_string(s, matches, idx);
-    h = strtoll(buf, &endp, 16);
-    free(buf);
+    h = strtoll(cddb_regex_get_num(s, matches, idx, buf, sizeof(buf)), NULL, 16);
     return (unsigned long)(h & 0xffffffff);
 }
 
 double cddb_regex_get_float(const char *s, regmatch_t matches[], int idx)
 {
-    char *buf;
-    double f;
+    char buf[64];
 
-    buf = cddb_regex_get_string(s, matches, idx);
-    f = atof(buf);
-    free(buf);
-    return f;
+    return atof(cddb_regex_get_num(s, matches, idx, buf, sizeof(buf)));
 }
 
 char *cddb_regex_get_string(const char *s, regmatch_t matches[], int idx)
@@ -170,4 +167,86 @@ char *cddb_regex_get_string(const char *s, regmatch_t matches[], int idx)
 }
 
 
+int cddb_regex_record_line(cddb_line_kind_t kind, const char *line,
+                           cddb_field_t *f)
+{
+    regmatch_t matches[6];
+
+    f->kind = LINE_OTHER;
+    f->title = NULL;
+    f->title_len = 0;
+    switch (kind) {
+    case LINE_TRACK_FRAME_OFFSETS:
+        if (regexec(REGEX_TRACK_FRAME_OFFSETS, line, 0, NULL, 0) != 0) {
+            return FALSE;
+        }
+        break;
+    case LINE_TRACK_FRAME_OFFSET:
+    case LINE_DISC_LENGTH:
+    case LINE_DISC_REVISION:
+    case LINE_DISC_YEAR:
+        if (regexec(kind == LINE_TRACK_FRAME_OFFSET ? REGEX_TRACK_FRAME_OFFSET :
+                    kind == LINE_DISC_LENGTH ? REGEX_DISC_LENGTH :
+                    kind == LINE_DISC_REVISION ? REGEX_DISC_REVISION :
+                    REGEX_DISC_YEAR, line, 2, matches, 0) != 0) {
+            return FALSE;
+        }
+        f->num = cddb_regex_get_int(line, matches, 1);
+        break;
+    case LINE_DISC_TITLE:
+        if (regexec(REGEX_DISC_TITLE, line, 5, matches, 0) != 0) {
+            return FALSE;
+        }
+        if (matches[2].rm_so != -1) {
+            f->str = cddb_regex_ptr(line, matches, 2);
+            f->len = cddb_regex_len(matches, 2);
+            f->title = cddb_regex_ptr(line, matches, 3);
+            f->title_len = cddb_regex_len(matches, 3);
+        } else {
+            f->str = cddb_regex_ptr(line, matches, 4);
+            f->len = cddb_regex_len(matches, 4);
+        }
+        break;
+    case LINE_TRACK_TITLE:
+        if (regexec(REGEX_TRACK_TITLE, line, 6, matches, 0) != 0) {
+            return FALSE;
+        }
+        f->num = cddb_regex_get_int(line, matches, 1);
+        if (matches[3].rm_so != -1) {
+            f->str = cddb_regex_ptr(line, matches, 3);
+            f->len = cddb_regex_len(matches, 3);
+            f->title = cddb_regex_ptr(line, matches, 4);
+            f->title_len = cddb_regex_len(matches, 4);
+        } else {
+            f->str = cddb_regex_ptr(line, matches, 5);
+            f->len = cddb_regex_len(matches, 5);
+        }
+        break;
+    case LINE_TRACK_EXT:
+        if (regexec(REGEX_TRACK_EXT, line, 3, matches, 0) != 0) {
+            return FALSE;
+        }
+        f->num = cddb_regex_get_int(line, matches, 1);
+        f->str = cddb_regex_ptr(line, matches, 2);
+        f->len = cddb_regex_len(matches, 2);
+        break;
+    case LINE_DISC_GENRE:
+    case LINE_DISC_EXT:
+    case LINE_PLAY_ORDER:
+        if (regexec(kind == LINE_DISC_GENRE ? REGEX_DISC_GENRE :
+                    kind == LINE_DISC_EXT ? REGEX_DISC_EXT :
+                    REGEX_PLAY_ORDER, line, 2, matches, 0) != 0) {
+            return FALSE;
+        }
+        f->str = cddb_regex_ptr(line, matches, 1);
+        f->len = cddb_regex_len(matches, 1);
+        break;
+    default:
+        return FALSE;
+    }
+    f->kind = kind;
+    return TRUE;
+}
+
+
 #endif /*HAVE_REGEX_H*/
@@ -0,0 +1,435 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#include "cddb/cddb_ni.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/* --- private helpers --- */
+
+
+#define IS_BLANK(c) (((c) == ' ') || ((c) == '\t'))
+#define IS_DIGIT(c) (((c) >= '0') && ((c) <= '9'))
+#define IS_ALPHA(c) ((((c) >= 'a') && ((c) <= 'z')) || (((c) >= 'A') && ((c) <= 'Z')))
+#define IS_XDIGIT(c) (IS_DIGIT(c) || (((c) >= 'a') && ((c) <= 'f')) || \
+                      (((c) >= 'A') && ((c) <= 'F')))
+
+/* Length of a string literal, without the terminating zero. */
+#define KW_LEN(kw) (sizeof(kw) - 1)
+
+/* Does the string at p start with the keyword kw? */
+#define HAS_KW(p, end, kw) \
+    (((end) - (p) >= KW_LEN(kw)) && (strncmp(p, kw, KW_LEN(kw)) == 0))
+
+static const char *skip_blanks(const char *p, const char *end)
+{
+    while ((p < end) && IS_BLANK(*p)) {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * Parse a run of decimal digits.  Returns a pointer just after the
+ * last digit, or NULL if there is no digit at p.  The value is
+ * converted like atoi() would do it.
+ */
+static const char *scan_number(const char *p, const char *end, int *num)
+{
+    const char *q;
+    char buf[32];
+    int len;
+
+    for (q = p; (q < end) && IS_DIGIT(*q); q++) {
+        /* skip digits */
+    }
+    if (q == p) {
+        return NULL;
+    }
+    len = q - p;
+    if (len >= sizeof(buf)) {
+        len = sizeof(buf) - 1;
+    }
+    memcpy(buf, p, len);
+    buf[len] = CHR_EOS;
+    *num = atoi(buf);
+    return q;
+}
+
+/**
+ * Parse a run of hexadecimal digits, converted like
+ * cddb_regex_get_hex() does it.  Returns a pointer just after the
+ * last digit, or NULL if there is no digit at p.
+ */
+static const char *scan_hex(const char *p, const char *end, unsigned int *num)
+{
+    const char *q;
+    char buf[32];
+    int len;
+
+    for (q = p; (q < end) && IS_XDIGIT(*q); q++) {
+        /* skip digits */
+    }
+    if (q == p) {
+        return NULL;
+    }
+    len = q - p;
+    if (len >= sizeof(buf)) {
+        len = sizeof(buf) - 1;
+    }
+    memcpy(buf, p, len);
+    buf[len] = CHR_EOS;
+    *num = (unsigned int)(strtoll(buf, NULL, 16) & 0xffffffff);
+    return q;
+}
+
+/**
+ * Store the value of a title line.  When the value contains a ' / '
+ * separator, the part before the last one is the artist and the part
+ * after it the title, just like the greedy match of '(.*) / (.*)'.
+ */
+static void scan_title(const char *p, const char *end, cddb_field_t *f)
+{
+    const char *q;
+
+    f->str = p;
+    f->len = end - p;
+    for (q = end - 3; q >= p; q--) {
+        if ((q[0] == ' ') && (q[1] == '/') && (q[2] == ' ')) {
+            f->len = q - p;
+            f->title = q + 3;
+            f->title_len = end - f->title;
+            break;
+        }
+    }
+}
+
+/**
+ * Classify a comment line, p points just after the '#'.
+ */
+static cddb_line_kind_t scan_comment(const char *p, const char *end,
+                                     cddb_field_t *f)
+{
+    p = skip_blanks(p, end);
+    if ((p < end) && IS_DIGIT(*p)) {
+        /* '#<blank>*<digits><blank>*' */
+        p = scan_number(p, end, &f->num);
+        if (skip_blanks(p, end) == end) {
+            return LINE_TRACK_FRAME_OFFSET;
+        }
+    } else if (HAS_KW(p, end, "Track frame offsets:")) {
+        p += KW_LEN("Track frame offsets:");
+        if (skip_blanks(p, end) == end) {
+            return LINE_TRACK_FRAME_OFFSETS;
+        }
+    } else if (HAS_KW(p, end, "Disc length:")) {
+        /* '#<blank>*Disc length:<blank>+<digits>( seconds)*<blank>*' */
+        p += KW_LEN("Disc length:");
+        if ((p < end) && IS_BLANK(*p) &&
+            (p = scan_number(skip_blanks(p, end), end, &f->num))) {
+            while (HAS_KW(p, end, " seconds")) {
+                p += KW_LEN(" seconds");
+            }
+            if (skip_blanks(p, end) == end) {
+                return LINE_DISC_LENGTH;
+            }
+        }
+    } else if (HAS_KW(p, end, "Revision:")) {
+        /* '#<blank>*Revision:<blank>+<digits><blank>*' */
+        p += KW_LEN("Revision:");
+        if ((p < end) && IS_BLANK(*p) &&
+            (p = scan_number(skip_blanks(p, end), end, &f->num)) &&
+            (skip_blanks(p, end) == end)) {
+            return LINE_DISC_REVISION;
+        }
+    }
+    return LINE_OTHER;
+}
+
+/**
+ * Parse the '<digits>=' following a TTITLE or EXTT keyword.  Returns
+ * a pointer to the value or NULL if the line does not match.
+ */
+static const char *scan_track_no(const char *p, const char *end,
+                                 cddb_field_t *f)
+{
+    p = scan_number(p, end, &f->num);
+    if (!p || (p == end) || (*p != '=')) {
+        return NULL;
+    }
+    return p + 1;
+}
+
+/**
+ * Store a plain keyword value.
+ */
+static int scan_value(const char *p, const char *end, cddb_field_t *f)
+{
+    f->str = p;
+    f->len = end - p;
+    return TRUE;
+}
+
+/**
+ * Store a title keyword value, see scan_title().
+ */
+static int scan_value_title(const char *p, const char *end, cddb_field_t *f)
+{
+    scan_title(p, end, f);
+    return TRUE;
+}
+
+/**
+ * Store a year.  An empty year is allowed.
+ */
+static int scan_value_year(const char *p, const char *end, cddb_field_t *f)
+{
+    return ((p == end) || ((p = scan_number(p, end, &f->num)) && (p == end)));
+}
+
+
+/* --- keyword dispatch --- */
+
+
+/* Hash of a record keyword.  The first and fourth characters are
+   enough to tell all keywords apart, and all of them have at least
+   four characters. */
+#define KW_MIN_LEN 4
+#define KW_SLOTS 32
+#define KW_HASH(c0, c3) \
+    ((((unsigned char)(c0)) ^ ((unsigned char)(c3))) & (KW_SLOTS - 1))
+
+/**
+ * A record keyword.
+ */
+typedef struct keyword_s
+{
+    const char *kw;             /**< the keyword */
+    int len;                    /**< length of the keyword */
+    int numbered;               /**< is it followed by a track number? */
+    cddb_line_kind_t kind;      /**< kind of the lines it starts */
+    int (*value)(const char *p, const char *end, cddb_field_t *f);
+                                /**< parser for the value, returns FALSE if
+                                     the value is invalid */
+} keyword_t;
+
+/* All record keywords: keyword, first and fourth character, whether
+   it is followed by a track number, line kind and value parser. */
+#define KEYWORD_LIST(X) \
+    X("DTITLE",    'D', 'T', FALSE, LINE_DISC_TITLE,  scan_value_title) \
+    X("DYEAR",     'D', 'A', FALSE, LINE_DISC_YEAR,   scan_value_year) \
+    X("DGENRE",    'D', 'N', FALSE, LINE_DISC_GENRE,  scan_value) \
+    X("EXTD",      'E', 'D', FALSE, LINE_DISC_EXT,    scan_value) \
+    X("TTITLE",    'T', 'T', TRUE,  LINE_TRACK_TITLE, scan_value_title) \
+    X("EXTT",      'E', 'T', TRUE,  LINE_TRACK_EXT,   scan_value) \
+    X("PLAYORDER", 'P', 'Y', FALSE, LINE_PLAY_ORDER,  scan_value)
+
+#define KEYWORD(kw, c0, c3, numbered, kind, value) \
+    [KW_HASH(c0, c3)] = { kw, KW_LEN(kw), numbered, kind, value },
+
+/**
+ * Perfect hash table of all record keywords.
+ */
+static const keyword_t KEYWORDS[KW_SLOTS] = {
+    KEYWORD_LIST(KEYWORD)
+};
+
+/* Two keywords in the same slot would silently override each other.
+   The slot bits of all keywords only add up to the bits that are set
+   if no two of them are the same, otherwise this array gets a negative
+   size and compiling fails. */
+#define KW_BIT_OR(kw, c0, c3, numbered, kind, value) \
+    | (1ULL << KW_HASH(c0, c3))
+#define KW_BIT_ADD(kw, c0, c3, numbered, kind, value) \
+    + (1ULL << KW_HASH(c0, c3))
+typedef char keyword_hash_is_perfect[
+    ((0 KEYWORD_LIST(KW_BIT_OR)) == (0 KEYWORD_LIST(KW_BIT_ADD))) ? 1 : -1];
+
+
+/* --- public functions --- */
+
+
+cddb_line_kind_t cddb_scan_record_line(const char *line, int len, int eq,
+                                       cddb_field_t *f)
+{
+    const char *end = line + len;
+    const char *p = line;
+    const char *q;
+    const keyword_t *k;
+
+    f->kind = LINE_OTHER;
+    f->num = 0;
+    f->str = NULL;
+    f->len = 0;
+    f->title = NULL;
+    f->title_len = 0;
+
+    if (len == 0) {
+        return f->kind;
+    }
+    if (*p == '#') {
+        f->kind = scan_comment(p + 1, end, f);
+        return f->kind;
+    }
+    if (eq < 0) {
+        q = memchr(line, '=', len);
+        eq = (q ? q - line : len);
+    }
+    if ((eq == len) || (eq < KW_MIN_LEN)) {
+        /* only comments do not have a keyword */
+        return f->kind;
+    }
+    k = KEYWORDS + KW_HASH(p[0], p[3]);
+    if (!k->kw || (strncmp(p, k->kw, k->len) != 0)) {
+        return f->kind;
+    }
+    if (k->numbered) {
+        /* '<keyword><digits>=' */
+        q = scan_track_no(p + k->len, end, f);
+    } else {
+        q = ((eq == k->len) ? line + eq + 1 : NULL);
+    }
+    if (q && k->value(q, end, f)) {
+        f->kind = k->kind;
+    }
+    return f->kind;
+}
+
+int cddb_scan_query_line(const char *line, cddb_query_line_t *q)
+{
+    const char *end = line + strlen(line);
+    const char *p = line;
+    cddb_field_t f;
+
+    /* '<alpha>+<blank><xdigit>+<blank>' */
+    while ((p < end) && IS_ALPHA(*p)) {
+        p++;
+    }
+    if ((p == line) || (p == end) || !IS_BLANK(*p)) {
+        return FALSE;
+    }
+    q->cat = line;
+    q->cat_len = p - line;
+    p = scan_hex(p + 1, end, &q->discid);
+    if (!p || (p == end) || !IS_BLANK(*p)) {
+        return FALSE;
+    }
+    /* the rest is 'artist / title' or only a title */
+    f.title = NULL;
+    scan_title(p + 1, end, &f);
+    if (f.title) {
+        q->artist = f.str;
+        q->artist_len = f.len;
+        q->title = f.title;
+        q->title_len = f.title_len;
+    } else {
+        q->artist = NULL;
+        q->artist_len = 0;
+        q->title = f.str;
+        q->title_len = f.len;
+    }
+    return TRUE;
+}
+
+/* The part of a result link that identifies a search hit. */
+#define SEARCH_LINK "/freedb_search_fmt.php?cat="
+
+/**
+ * Parse the contents of a search hit anchor, from just after the
+ * opening tag up to end, which is the start of the next hit link or
+ * the end of the line.  Returns FALSE if the contents do not match.
+ */
+static int scan_search_text(const char *p, const char *end,
+                            cddb_search_hit_t *hit)
+{
+    const char *lt, *q;
+
+    hit->artist = hit->title = NULL;
+    hit->artist_len = hit->title_len = 0;
+    hit->dup = 0;
+    /* 'artist / title</a>' or 'title</a>' */
+    for (lt = p; (lt < end) && (*lt != '<'); lt++) {
+        /* find end of text */
+    }
+    if ((lt > p) && HAS_KW(lt, end, "</a>")) {
+        hit->title = p;
+        hit->title_len = lt - p;
+        /* both parts must be non-empty */
+        for (q = lt - 4; q > p; q--) {
+            if ((q[0] == ' ') && (q[1] == '/') && (q[2] == ' ')) {
+                hit->artist = p;
+                hit->artist_len = q - p;
+                hit->title = q + 3;
+                hit->title_len = lt - hit->title;
+                return TRUE;
+            }
+        }
+        hit->artist = hit->title;
+        hit->artist_len = hit->title_len;
+        return TRUE;
+    }
+    /* '...>number<...</a>', a duplicate of the previous hit */
+    q = memchr(p, '>', end - p);
+    if (q && (q = scan_number(q + 1, end, &hit->dup)) && (q < end) &&
+        (*q == '<')) {
+        for (; q + KW_LEN("</a>") <= end; q++) {
+            if (HAS_KW(q, end, "</a>")) {
+                hit->title = NULL;
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+int cddb_scan_search_line(const char *line, cddb_search_hit_cb *cb,
+                          void *arg)
+{
+    const char *link, *next, *end, *p;
+    cddb_search_hit_t hit;
+    int count = 0;
+
+    link = strstr(line, SEARCH_LINK);
+    while (link) {
+        next = strstr(link + KW_LEN(SEARCH_LINK), SEARCH_LINK);
+        end = (next ? next : line + strlen(line));
+        /* '<alpha>+&id=<xdigit>+">' */
+        p = link + KW_LEN(SEARCH_LINK);
+        hit.cat = p;
+        while ((p < end) && IS_ALPHA(*p)) {
+            p++;
+        }
+        hit.cat_len = p - hit.cat;
+        if ((hit.cat_len > 0) && HAS_KW(p, end, "&id=") &&
+            (p = scan_hex(p + KW_LEN("&id="), end, &hit.discid)) &&
+            HAS_KW(p, end, "\">") &&
+            scan_search_text(p + KW_LEN("\">"), end, &hit)) {
+            count++;
+            if (!cb(&hit, arg)) {
+                return -1;
+            }
+        }
+        link = next;
+    }
+    return count;
+}
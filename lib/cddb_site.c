@@ -246,7 +246,8 @@ cddb_error_t cddb_site_set_description(cddb_site_t *site, const char *desc)
 int cddb_site_parse(cddb_site_t *site, const char *line)
 {
     regmatch_t matches[10];
-    char *s;
+    const char *s;
+    int len;
     float f;
 
     if (regexec(REGEX_SITE, line, 10, matches, 0) == REG_NOMATCH) {
@@ -254,17 +255,18 @@ int cddb_site_parse(cddb_site_t *site, const char *line)
         return FALSE;
     }
     site->address = cddb_regex_get_string(line, matches, 1);
-    s = cddb_regex_get_string(line, matches, 2);
-    if (strcmp(s, "cddbp") == 0) {
+    s = cddb_regex_ptr(line, matches, 2);
+    len = cddb_regex_len(matches, 2);
+    if (len == 5 && strncmp(s, "cddbp", 5) == 0) {
         site->protocol = PROTO_CDDBP;
-    } else if (strcmp(s, "http") == 0) {
+    } else if (len == 4 && strncmp(s, "http", 4) == 0) {
         site->protocol = PROTO_HTTP;
     } else {
         site->protocol = PROTO_UNKNOWN;
     }
     site->port = cddb_regex_get_int(line, matches, 3);
     site->query_path = cddb_regex_get_string(line, matches, 4);
-    s = cddb_regex_get_string(line, matches, 5);
+    s = cddb_regex_ptr(line, matches, 5);
     f = cddb_regex_get_float(line, matches, 6);
     if (*s == 'N') {
         site->latitude = f;
@@ -273,8 +275,7 @@ int cddb_site_parse(cddb_site_t *site, const char *line)
     } else {
         site->latitude = 0.0;
     }
-    free(s);
-    s = cddb_regex_get_string(line, matches, 7);
+    s = cddb_regex_ptr(line, matches, 7);
     f = cddb_regex_get_float(line, matches, 8);
     if (*s == 'E') {
         site->longitude = f;
@@ -283,7 +284,6 @@ int cddb_site_parse(cddb_site_t *site, const char *line)
     } else {
         site->longitude = 0.0;
     }
-    free(s);
     site->desc = cddb_regex_get_string(line, matches, 9);
     return TRUE;
 }
@@ -32,34 +32,27 @@
 
 /* --- private functions */
 
+
+/* Arena that the strings of a track are allocated from, if any. */
+#define TRACK_ARENA(t) ((t)->disc ? (t)->disc->arena : NULL)
+
 int cddb_track_iconv(iconv_t cd, cddb_track_t *track)
 { 
-    char *result;
-
     if (!cd) {
         return TRUE;            /* no user character set defined */
     }
     if (track->title) {
-        if (cddb_str_iconv(cd, track->title, &result)) {
-            free(track->title);
-            track->title = result;
-        } else {
+        if (!cddb_str_iconv_field(cd, TRACK_ARENA(track), &track->title)) {
             return FALSE;
         }
     }
     if (track->artist) {
-        if (cddb_str_iconv(cd, track->artist, &result)) {
-            free(track->artist);
-            track->artist = result;
-        } else {
+        if (!cddb_str_iconv_field(cd, TRACK_ARENA(track), &track->artist)) {
             return FALSE;
         }
     }
     if (track->ext_data) {
-        if (cddb_str_iconv(cd, track->ext_data, &result)) {
-            free(track->ext_data);
-            track->ext_data = result;
-        } else {
+        if (!cddb_str_iconv_field(cd, TRACK_ARENA(track), &track->ext_data)) {
             return FALSE;
         }
     }
@@ -90,9 +83,9 @@ cddb_track_t *cddb_track_new(void)
 void cddb_track_destroy(cddb_track_t *track)
 {
     if (track) {
-        FREE_NOT_NULL(track->title);
-        FREE_NOT_NULL(track->artist);
-        FREE_NOT_NULL(track->ext_data);
+        cddb_arena_str_free(TRACK_ARENA(track), &track->title);
+        cddb_arena_str_free(TRACK_ARENA(track), &track->artist);
+        cddb_arena_str_free(TRACK_ARENA(track), &track->ext_data);
         free(track);
     }
 }
@@ -102,6 +95,7 @@ cddb_track_t *cddb_track_clone(const cddb_track_t *track)
     cddb_track_t *clone;
 
     cddb_log_debug("cddb_track_clone()");
+    cddb_lazy_track_ext((cddb_track_t*)track);
     clone = cddb_track_new();
     clone->num = track->num;
     clone->frame_offset = track->frame_offset;
@@ -153,10 +147,7 @@ const char *cddb_track_get_title(const cddb_track_t *track)
 void cddb_track_set_title(cddb_track_t *track, const char *title)
 {
     if (track) {
-        FREE_NOT_NULL(track->title);
-        if (title) {
-            track->title = strdup(title);
-        }
+        cddb_arena_str_set(TRACK_ARENA(track), &track->title, title);
     }
 }
 
@@ -218,17 +209,15 @@ void cddb_track_set_length(cddb_track_t *track, int length)
 
 void cddb_track_append_title(cddb_track_t *track, const char *title)
 {
-    int old_len = 0, len;
+    if (track && title) {
+        cddb_track_append_title_n(track, title, strlen(title));
+    }
+}
 
+void cddb_track_append_title_n(cddb_track_t *track, const char *title, int len)
+{
     if (track && title) {
-        /* only append if there is something to append */
-        if (track->title) {
-            old_len = strlen(track->title);
-        }
-        len = strlen(title);
-        track->title = realloc(track->title, old_len+len+1);
-        strcpy(track->title+old_len, title);
-        track->title[old_len+len] = '\0';
+        cddb_arena_str_append(TRACK_ARENA(track), &track->title, title, len);
     }
 }
 
@@ -251,26 +240,21 @@ const char *cddb_track_get_artist(cddb_track_t *track)
 void cddb_track_set_artist(cddb_track_t *track, const char *artist)
 {
     if (track) {
-        FREE_NOT_NULL(track->artist);
-        if (artist) {
-            track->artist = strdup(artist);
-        }
+        cddb_arena_str_set(TRACK_ARENA(track), &track->artist, artist);
     }
 }
 
 void cddb_track_append_artist(cddb_track_t *track, const char *artist)
 {
-    int old_len = 0, len;
+    if (track && artist) {
+        cddb_track_append_artist_n(track, artist, strlen(artist));
+    }
+}
 
+void cddb_track_append_artist_n(cddb_track_t *track, const char *artist, int len)
+{
     if (track && artist) {
-        /* only append if there is something to append */
-        if (track->artist) {
-            old_len = strlen(track->artist);
-        }
-        len = strlen(artist);
-        track->artist = realloc(track->artist, old_len+len+1);
-        strcpy(track->artist+old_len, artist);
-        track->artist[old_len+len] = '\0';
+        cddb_arena_str_append(TRACK_ARENA(track), &track->artist, artist, len);
     }
 }
 
@@ -279,6 +263,7 @@ const char *cddb_track_get_ext_data(cddb_track_t *track)
     const char *ext_data = NULL;
 
     if (track) {
+        cddb_lazy_track_ext(track);
         ext_data = track->ext_data;
     }
     RETURN_STR_OR_EMPTY(ext_data);
@@ -287,26 +272,23 @@ const char *cddb_track_get_ext_data(cddb_track_t *track)
 void cddb_track_set_ext_data(cddb_track_t *track, const char *ext_data)
 {
     if (track) {
-        FREE_NOT_NULL(track->ext_data);
-        if (ext_data) {
-            track->ext_data = strdup(ext_data);
-        }
+        cddb_lazy_drop(track->disc, &track->lazy_ext);
+        cddb_arena_str_set(TRACK_ARENA(track), &track->ext_data, ext_data);
     }
 }
 
 void cddb_track_append_ext_data(cddb_track_t *track, const char *ext_data)
 {
-    int old_len = 0, len;
+    if (track && ext_data) {
+        cddb_track_append_ext_data_n(track, ext_data, strlen(ext_data));
+    }
+}
 
+void cddb_track_append_ext_data_n(cddb_track_t *track, const char *ext_data, int len)
+{
     if (track && ext_data) {
-        /* only append if there is something to append */
-        if (track->ext_data) {
-            old_len = strlen(track->ext_data);
-        }
-        len = strlen(ext_data);
-        track->ext_data = realloc(track->ext_data, old_len+len+1);
-        strcpy(track->ext_data+old_len, ext_data);
-        track->ext_data[old_len+len] = '\0';
+        cddb_lazy_track_ext(track);
+        cddb_arena_str_append(TRACK_ARENA(track), &track->ext_data, ext_data, len);
     }
 }
 
@@ -317,6 +299,7 @@ void cddb_track_append_ext_data(cddb_track_t *track, const char *ext_data)
 void cddb_track_copy(cddb_track_t *dst, cddb_track_t *src)
 {
     cddb_log_debug("cddb_track_copy()");
+    cddb_lazy_track_ext(src);
     if (src->num != -1) {
         dst->num = src->num;
     }
@@ -327,21 +310,20 @@ void cddb_track_copy(cddb_track_t *dst, cddb_track_t *src)
         dst->length = src->length;
     }
     if (src->title != NULL) {
-        FREE_NOT_NULL(dst->title);
-        dst->title = strdup(src->title);
+        cddb_arena_str_set(TRACK_ARENA(dst), &dst->title, src->title);
     }
     if (src->artist) {
-        FREE_NOT_NULL(dst->artist);
-        dst->artist = strdup(src->artist);
+        cddb_arena_str_set(TRACK_ARENA(dst), &dst->artist, src->artist);
     }
     if (src->ext_data != NULL) {
-        FREE_NOT_NULL(dst->ext_data);
-        dst->ext_data = strdup(src->ext_data);
+        cddb_lazy_drop(dst->disc, &dst->lazy_ext);
+        cddb_arena_str_set(TRACK_ARENA(dst), &dst->ext_data, src->ext_data);
     }
 }
 
 void cddb_track_print(cddb_track_t *track)
 {
+    cddb_lazy_track_ext(track);
     printf("    number: %d\n", track->num);
     printf("    frame offset: %d\n", track->frame_offset);
     printf("    length: %d seconds\n", cddb_track_get_length(track));
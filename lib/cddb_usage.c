@@ -0,0 +1,939 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+#include "cddb/cddb_ni.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+#ifdef HAVE_DIRENT_H
+#  include <dirent.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+
+
+/* --- type and structure definitions */
+
+
+/* Marks the end of a hash chain or of the LRU list. */
+#define USAGE_NONE -1
+
+/* Initial number of entries, a power of two. */
+#define USAGE_INITIAL_SIZE 1024
+
+/* Number of bytes of access log lines collected before they are
+   appended to the log file. */
+#define USAGE_LOG_BUF 4096
+
+/* The access log is rewritten when it has more than twice as many
+   lines as there are entries, plus this many. */
+#define USAGE_LOG_SLACK 1024
+
+/* Changes recorded while the table is built in the background. */
+enum { USAGE_TOUCH, USAGE_ADD, USAGE_REMOVE };
+
+/**
+ * One cache entry.  Unused entries have category CDDB_CAT_INVALID.
+ */
+typedef struct usage_entry_s
+{
+    unsigned int discid;        /**< the disc ID */
+    cddb_cat_t cat;             /**< the category */
+    unsigned long size;         /**< size of the entry in bytes */
+    int chain;                  /**< next entry in the same hash bucket, or
+                                     next unused entry */
+    int prev;                   /**< more recently used entry */
+    int next;                   /**< less recently used entry */
+} usage_entry_t;
+
+/**
+ * A cache entry found while scanning the cache directory.
+ */
+typedef struct usage_found_s
+{
+    unsigned int discid;        /**< the disc ID */
+    cddb_cat_t cat;             /**< the category */
+    unsigned long size;         /**< size of the file */
+    time_t used;                /**< last access or modification time */
+} usage_found_t;
+
+/**
+ * A change made to the cache while the table was being built.
+ */
+typedef struct usage_change_s
+{
+    int op;                     /**< USAGE_TOUCH, USAGE_ADD or USAGE_REMOVE */
+    unsigned int discid;        /**< the disc ID */
+    cddb_cat_t cat;             /**< the category */
+    unsigned long size;         /**< size of an added entry */
+} usage_change_t;
+
+/**
+ * Actual definition of the usage table structure.
+ */
+struct cddb_usage_s
+{
+    char *dir;                  /**< the cache directory */
+    usage_entry_t *entries;     /**< all entries */
+    unsigned int size;          /**< number of entries, a power of two */
+    int unused;                 /**< first unused entry */
+    int *buckets;               /**< first entry of every hash chain, one
+                                     bucket per entry */
+    int head;                   /**< most recently used entry */
+    int tail;                   /**< least recently used entry */
+    unsigned int count;         /**< number of entries in use */
+    unsigned long bytes;        /**< total size of the entries in use */
+    char log[USAGE_LOG_BUF];    /**< access log lines not written yet */
+    int log_len;                /**< length of those lines */
+    int scanning;               /**< the table is being built in the
+                                     background, changes are only recorded
+                                     until it is ready */
+    usage_change_t *changes;    /**< changes recorded while scanning */
+    unsigned int change_cnt;    /**< number of recorded changes */
+    unsigned int change_max;    /**< room for recorded changes */
+#ifdef HAVE_PTHREAD
+    pthread_t thread;           /**< thread building the table */
+    pthread_mutex_t lock;       /**< protects the fields below */
+#endif
+    cddb_usage_t *built;        /**< table built in the background, or NULL
+                                     if that failed */
+    int done;                   /**< the background thread has finished */
+    int cancel;                 /**< the background thread should stop */
+};
+
+#ifdef HAVE_PTHREAD
+#define USAGE_LOCK(u) pthread_mutex_lock(&(u)->lock)
+#define USAGE_UNLOCK(u) pthread_mutex_unlock(&(u)->lock)
+#else
+#define USAGE_LOCK(u)
+#define USAGE_UNLOCK(u)
+#endif
+
+
+/* --- private functions --- */
+
+
+#define USAGE_BUCKET(u, discid, cat) \
+    ((u)->buckets + \
+     ((((discid) * 0x9e3779b1u) ^ (unsigned int)(cat)) & ((u)->size - 1)))
+
+/**
+ * Put the entries from first up to the end of the table on the list
+ * of unused entries.
+ */
+static void cddb_usage_free_from(cddb_usage_t *u, unsigned int first)
+{
+    unsigned int i;
+
+    for (i = first; i < u->size; i++) {
+        u->entries[i].cat = CDDB_CAT_INVALID;
+        u->entries[i].chain = (i + 1 < u->size ? (int)i + 1 : u->unused);
+    }
+    if (first < u->size) {
+        u->unused = first;
+    }
+}
+
+/**
+ * Empty the table.
+ */
+static void cddb_usage_reset(cddb_usage_t *u)
+{
+    unsigned int i;
+
+    for (i = 0; i < u->size; i++) {
+        u->buckets[i] = USAGE_NONE;
+    }
+    u->unused = USAGE_NONE;
+    cddb_usage_free_from(u, 0);
+    u->head = u->tail = USAGE_NONE;
+    u->count = 0;
+    u->bytes = 0;
+}
+
+/**
+ * Double the number of entries and rebuild the hash chains.
+ *
+ * @return FALSE if memory allocation failed.
+ */
+static int cddb_usage_grow(cddb_usage_t *u)
+{
+    usage_entry_t *entries, *e;
+    unsigned int old = u->size, i;
+    int *buckets, *b;
+
+    entries = (usage_entry_t*)realloc(u->entries,
+                                      old * 2 * sizeof(usage_entry_t));
+    if (!entries) {
+        return FALSE;
+    }
+    u->entries = entries;
+    buckets = (int*)malloc(old * 2 * sizeof(int));
+    if (!buckets) {
+        return FALSE;
+    }
+    free(u->buckets);
+    u->buckets = buckets;
+    u->size = old * 2;
+    for (i = 0; i < u->size; i++) {
+        u->buckets[i] = USAGE_NONE;
+    }
+    for (i = 0; i < old; i++) {
+        e = u->entries + i;
+        if (e->cat != CDDB_CAT_INVALID) {
+            b = USAGE_BUCKET(u, e->discid, e->cat);
+            e->chain = *b;
+            *b = i;
+        }
+    }
+    cddb_usage_free_from(u, old);
+    return TRUE;
+}
+
+/**
+ * Take an entry out of the LRU list.
+ */
+static void cddb_usage_unlink(cddb_usage_t *u, int i)
+{
+    usage_entry_t *e = u->entries + i;
+
+    if (e->prev == USAGE_NONE) {
+        u->head = e->next;
+    } else {
+        u->entries[e->prev].next = e->next;
+    }
+    if (e->next == USAGE_NONE) {
+        u->tail = e->prev;
+    } else {
+        u->entries[e->next].prev = e->prev;
+    }
+}
+
+/**
+ * Put an entry at the front of the LRU list.
+ */
+static void cddb_usage_push(cddb_usage_t *u, int i)
+{
+    usage_entry_t *e = u->entries + i;
+
+    e->prev = USAGE_NONE;
+    e->next = u->head;
+    if (u->head == USAGE_NONE) {
+        u->tail = i;
+    } else {
+        u->entries[u->head].prev = i;
+    }
+    u->head = i;
+}
+
+/**
+ * Find the entry of a cache entry.
+ *
+ * @return The entry index or USAGE_NONE.
+ */
+static int cddb_usage_find(cddb_usage_t *u, unsigned int discid,
+                           cddb_cat_t cat)
+{
+    int i;
+
+    for (i = *USAGE_BUCKET(u, discid, cat); i != USAGE_NONE;
+         i = u->entries[i].chain) {
+        if ((u->entries[i].discid == discid) && (u->entries[i].cat == cat)) {
+            break;
+        }
+    }
+    return i;
+}
+
+/**
+ * Move a cache entry to the front of the LRU list.  Nothing happens if
+ * the entry is unknown.
+ */
+static void cddb_usage_move(cddb_usage_t *u, unsigned int discid,
+                            cddb_cat_t cat)
+{
+    int i;
+
+    i = cddb_usage_find(u, discid, cat);
+    if ((i != USAGE_NONE) && (u->head != i)) {
+        cddb_usage_unlink(u, i);
+        cddb_usage_push(u, i);
+    }
+}
+
+/**
+ * Add a cache entry at the front of the LRU list, or update its size
+ * and move it there if it is already known.
+ */
+static void cddb_usage_insert(cddb_usage_t *u, unsigned int discid,
+                              cddb_cat_t cat, unsigned long size)
+{
+    usage_entry_t *e;
+    int i, *bucket;
+
+    i = cddb_usage_find(u, discid, cat);
+    if (i != USAGE_NONE) {
+        /* replaced */
+        e = u->entries + i;
+        u->bytes = u->bytes - e->size + size;
+        e->size = size;
+        cddb_usage_move(u, discid, cat);
+        return;
+    }
+    if ((u->unused == USAGE_NONE) && !cddb_usage_grow(u)) {
+        cddb_log_warn("out of memory, cache entry %s/%08x not counted",
+                      CDDB_CATEGORY[cat], discid);
+        return;
+    }
+    i = u->unused;
+    e = u->entries + i;
+    u->unused = e->chain;
+    e->discid = discid;
+    e->cat = cat;
+    e->size = size;
+    bucket = USAGE_BUCKET(u, discid, cat);
+    e->chain = *bucket;
+    *bucket = i;
+    cddb_usage_push(u, i);
+    u->count++;
+    u->bytes += size;
+}
+
+/**
+ * Drop a cache entry from the table.
+ */
+static void cddb_usage_delete(cddb_usage_t *u, unsigned int discid,
+                              cddb_cat_t cat)
+{
+    int i, *p;
+
+    i = cddb_usage_find(u, discid, cat);
+    if (i == USAGE_NONE) {
+        return;
+    }
+    for (p = USAGE_BUCKET(u, discid, cat); *p != i;
+         p = &u->entries[*p].chain) {
+        /* find the link to the entry */
+    }
+    *p = u->entries[i].chain;
+    cddb_usage_unlink(u, i);
+    u->count--;
+    u->bytes -= u->entries[i].size;
+    u->entries[i].cat = CDDB_CAT_INVALID;
+    u->entries[i].chain = u->unused;
+    u->unused = i;
+}
+
+/**
+ * Order cache entries found on disc from least to most recently
+ * used.
+ */
+static int cddb_usage_cmp(const void *a, const void *b)
+{
+    time_t ta = ((const usage_found_t*)a)->used;
+    time_t tb = ((const usage_found_t*)b)->used;
+
+    return (ta < tb ? -1 : (ta > tb ? 1 : 0));
+}
+
+#ifdef HAVE_DIRENT_H
+/**
+ * Add the entries of a category directory to a list of found
+ * entries.
+ *
+ * @return FALSE if memory allocation failed.
+ */
+static int cddb_usage_scan_dir(cddb_usage_t *u, cddb_cat_t cat,
+                               usage_found_t **found, unsigned int *n,
+                               unsigned int *max)
+{
+    DIR *dir;
+    struct dirent *d;
+    struct stat st;
+    usage_found_t *f;
+    unsigned int discid;
+    char *fn;
+    int len, rv = TRUE;
+
+    len = strlen(u->dir) + strlen(CDDB_CATEGORY[cat]) + 11;
+    fn = (char*)malloc(len);
+    if (!fn) {
+        return FALSE;
+    }
+    snprintf(fn, len, "%s/%s", u->dir, CDDB_CATEGORY[cat]);
+    dir = opendir(fn);
+    while (dir && ((d = readdir(dir)) != NULL)) {
+        if (!cddb_index_entry_name(d->d_name, &discid)) {
+            /* not a cache entry */
+            continue;
+        }
+        snprintf(fn, len, "%s/%s/%08x", u->dir, CDDB_CATEGORY[cat], discid);
+        if ((stat(fn, &st) == -1) || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (*n == *max) {
+            *max = (*max ? *max * 2 : USAGE_INITIAL_SIZE);
+            f = (usage_found_t*)realloc(*found, *max * sizeof(usage_found_t));
+            if (!f) {
+                rv = FALSE;
+                break;
+            }
+            *found = f;
+        }
+        f = *found + (*n)++;
+        f->discid = discid;
+        f->cat = cat;
+        f->size = st.st_size;
+        f->used = (st.st_atime > st.st_mtime ? st.st_atime : st.st_mtime);
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    free(fn);
+    return rv;
+}
+#endif /* HAVE_DIRENT_H */
+
+/**
+ * Create the name of a file in the cache directory.
+ *
+ * @return The name, to be freed by the caller, or NULL.
+ */
+static char *cddb_usage_path(const char *dir, const char *name)
+{
+    char *fn;
+    int len;
+
+    len = strlen(dir) + strlen(name) + 2;
+    fn = (char*)malloc(len);
+    if (fn) {
+        snprintf(fn, len, "%s/%s", dir, name);
+    }
+    return fn;
+}
+
+/**
+ * Order cache entries found on disc on category and disc ID.
+ */
+static int cddb_usage_key_cmp(const void *a, const void *b)
+{
+    const usage_found_t *fa = (const usage_found_t*)a;
+    const usage_found_t *fb = (const usage_found_t*)b;
+
+    if (fa->cat != fb->cat) {
+        return (fa->cat < fb->cat ? -1 : 1);
+    }
+    return (fa->discid < fb->discid ? -1 : (fa->discid > fb->discid ? 1 : 0));
+}
+
+/**
+ * Take the times at which cache entries were last read or written
+ * from the access log, where they are later than the times of their
+ * files.
+ *
+ * @return The number of lines in the log.
+ */
+static unsigned long cddb_usage_read_log(const char *dir,
+                                         usage_found_t *found, unsigned int n)
+{
+    usage_found_t key, *f;
+    char line[64], name[32], *fn;
+    unsigned int discid;
+    unsigned long lines = 0;
+    long used;
+    FILE *fp;
+    int cat;
+
+    fn = cddb_usage_path(dir, USAGE_LOG_FILE);
+    fp = (fn ? fopen(fn, "r") : NULL);
+    FREE_NOT_NULL(fn);
+    if (!fp) {
+        return 0;
+    }
+    qsort(found, n, sizeof(usage_found_t), cddb_usage_key_cmp);
+    /* '<discid> <category> <time>' for every read or write */
+    while (fgets(line, sizeof(line), fp)) {
+        lines++;
+        if (sscanf(line, "%x %31s %ld", &discid, name, &used) != 3) {
+            continue;
+        }
+        for (cat = CDDB_CAT_DATA; cat < CDDB_CAT_INVALID; cat++) {
+            if (strcmp(name, CDDB_CATEGORY[cat]) == 0) {
+                break;
+            }
+        }
+        key.discid = discid;
+        key.cat = cat;
+        f = (usage_found_t*)bsearch(&key, found, n, sizeof(usage_found_t),
+                                    cddb_usage_key_cmp);
+        if (f && (used > (long)f->used)) {
+            f->used = (time_t)used;
+        }
+    }
+    fclose(fp);
+    return lines;
+}
+
+/**
+ * Replace the access log with one line for every cache entry, from
+ * least to most recently used.  Lines appended by others while this
+ * is done may get lost, which only makes those entries look older.
+ */
+static void cddb_usage_write_log(const char *dir, const usage_found_t *found,
+                                 unsigned int n)
+{
+    char *fn, *tmp;
+    unsigned int i;
+    FILE *fp = NULL;
+    int len, rv;
+#ifdef HAVE_MKSTEMP
+    int fd;
+#endif
+
+    cddb_log_debug("cddb_usage_write_log()");
+    fn = cddb_usage_path(dir, USAGE_LOG_FILE);
+    if (!fn) {
+        return;
+    }
+    len = strlen(fn) + 16;
+    tmp = (char*)malloc(len);
+    if (tmp) {
+#ifdef HAVE_MKSTEMP
+        snprintf(tmp, len, "%s.XXXXXX", fn);
+        fd = mkstemp(tmp);
+        if (fd != -1) {
+            /* mkstemp only allows the owner to read the file */
+            fchmod(fd, 0644);
+            fp = fdopen(fd, "w");
+            if (!fp) {
+                close(fd);
+                unlink(tmp);
+            }
+        }
+#else
+        snprintf(tmp, len, "%s.%d", fn, (int)getpid());
+        fp = fopen(tmp, "w");
+#endif
+    }
+    if (!fp) {
+        cddb_log_warn("cannot write cache access log '%s'", fn);
+        FREE_NOT_NULL(tmp);
+        free(fn);
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        fprintf(fp, "%08x %s %ld\n", found[i].discid,
+                CDDB_CATEGORY[found[i].cat], (long)found[i].used);
+    }
+    rv = !ferror(fp);
+    rv = (fclose(fp) == 0) && rv && (rename(tmp, fn) == 0);
+    if (!rv) {
+        cddb_log_warn("cannot write cache access log '%s'", fn);
+        unlink(tmp);
+    }
+    free(tmp);
+    free(fn);
+}
+
+/**
+ * Check whether a table that is being built should stop.
+ */
+static int cddb_usage_cancelled(cddb_usage_t *u)
+{
+    int cancel;
+
+    USAGE_LOCK(u);
+    cancel = u->cancel;
+    USAGE_UNLOCK(u);
+    return cancel;
+}
+
+/**
+ * Build a new table from the category directories and the access
+ * log.  Entries are ordered on the last time they were read or
+ * written according to the log, or on the times of their files if
+ * those are later.  The log is rewritten when it has grown much
+ * larger than the table.
+ *
+ * @param u The table the new one is built for.
+ * @return The new table or NULL if memory ran out, the system cannot
+ *         scan directories or building was cancelled.
+ */
+static cddb_usage_t *cddb_usage_build(cddb_usage_t *u)
+{
+#ifdef HAVE_DIRENT_H
+    usage_found_t *found = NULL;
+    cddb_usage_t *t;
+    unsigned int n = 0, max = 0, i;
+    unsigned long lines;
+    int cat, rv = TRUE;
+
+    cddb_log_debug("cddb_usage_build()");
+    for (cat = CDDB_CAT_DATA; rv && (cat < CDDB_CAT_INVALID); cat++) {
+        rv = !cddb_usage_cancelled(u) &&
+            cddb_usage_scan_dir(u, cat, &found, &n, &max);
+    }
+    t = (rv ? cddb_usage_new(u->dir) : NULL);
+    if (t) {
+        lines = cddb_usage_read_log(u->dir, found, n);
+        qsort(found, n, sizeof(usage_found_t), cddb_usage_cmp);
+        if (lines > 2 * (unsigned long)n + USAGE_LOG_SLACK) {
+            cddb_usage_write_log(u->dir, found, n);
+        }
+        /* add the most recently used entries last, they end up in
+           front */
+        for (i = 0; i < n; i++) {
+            cddb_usage_insert(t, found[i].discid, found[i].cat,
+                              found[i].size);
+        }
+        /* adding fails only when memory runs out */
+        if (t->count != n) {
+            cddb_usage_destroy(t);
+            t = NULL;
+        }
+    }
+    FREE_NOT_NULL(found);
+    return t;
+#else
+    return NULL;
+#endif /* HAVE_DIRENT_H */
+}
+
+/**
+ * Replace the contents of a table with those of a newly built one,
+ * which is destroyed.
+ */
+static void cddb_usage_take(cddb_usage_t *u, cddb_usage_t *t)
+{
+    usage_entry_t *entries = u->entries;
+    int *buckets = u->buckets;
+
+    u->entries = t->entries;
+    u->buckets = t->buckets;
+    u->size = t->size;
+    u->unused = t->unused;
+    u->head = t->head;
+    u->tail = t->tail;
+    u->count = t->count;
+    u->bytes = t->bytes;
+    t->entries = entries;
+    t->buckets = buckets;
+    cddb_usage_destroy(t);
+}
+
+#ifdef HAVE_PTHREAD
+/**
+ * Body of the thread that builds a table in the background.
+ */
+static void *cddb_usage_thread(void *arg)
+{
+    cddb_usage_t *u = (cddb_usage_t*)arg;
+    cddb_usage_t *t;
+
+    t = cddb_usage_build(u);
+    USAGE_LOCK(u);
+    u->built = t;
+    u->done = TRUE;
+    USAGE_UNLOCK(u);
+    return NULL;
+}
+#endif /* HAVE_PTHREAD */
+
+/**
+ * Record a change made while the table is being built.  It is applied
+ * when the table is ready.
+ */
+static void cddb_usage_record(cddb_usage_t *u, int op, unsigned int discid,
+                              cddb_cat_t cat, unsigned long size)
+{
+    usage_change_t *ch;
+    unsigned int max;
+
+    if (u->change_cnt == u->change_max) {
+        max = (u->change_max ? u->change_max * 2 : 64);
+        ch = (usage_change_t*)realloc(u->changes,
+                                      max * sizeof(usage_change_t));
+        if (!ch) {
+            cddb_log_warn("out of memory, cache entry %s/%08x not counted",
+                          CDDB_CATEGORY[cat], discid);
+            return;
+        }
+        u->changes = ch;
+        u->change_max = max;
+    }
+    ch = u->changes + u->change_cnt++;
+    ch->op = op;
+    ch->discid = discid;
+    ch->cat = cat;
+    ch->size = size;
+}
+
+/**
+ * Wait for the background thread if wait is TRUE, or see whether it
+ * has finished otherwise.  When it has, its table replaces the
+ * contents of this one and the changes recorded in the meantime are
+ * applied to it.
+ */
+static void cddb_usage_poll(cddb_usage_t *u, int wait)
+{
+#ifdef HAVE_PTHREAD
+    usage_change_t *ch;
+    unsigned int i;
+    int done;
+
+    if (!u->scanning) {
+        return;
+    }
+    USAGE_LOCK(u);
+    done = u->done;
+    USAGE_UNLOCK(u);
+    if (!done && !wait) {
+        return;
+    }
+    pthread_join(u->thread, NULL);
+    u->scanning = FALSE;
+    if (u->built) {
+        cddb_usage_take(u, u->built);
+        u->built = NULL;
+    } else if (!u->cancel) {
+        cddb_log_warn("cannot scan cache directory '%s'", u->dir);
+    }
+    for (i = 0; i < u->change_cnt; i++) {
+        ch = u->changes + i;
+        switch (ch->op) {
+            case USAGE_TOUCH:
+                cddb_usage_move(u, ch->discid, ch->cat);
+                break;
+            case USAGE_ADD:
+                cddb_usage_insert(u, ch->discid, ch->cat, ch->size);
+                break;
+            case USAGE_REMOVE:
+                cddb_usage_delete(u, ch->discid, ch->cat);
+                break;
+        }
+    }
+    FREE_NOT_NULL(u->changes);
+    u->change_cnt = u->change_max = 0;
+#endif /* HAVE_PTHREAD */
+}
+
+/**
+ * Add a line for a cache entry that has been read or written to the
+ * access log.  The lines are collected and appended to the log file
+ * in one go.
+ */
+static void cddb_usage_log(cddb_usage_t *u, unsigned int discid,
+                           cddb_cat_t cat)
+{
+    char line[64];
+    int len;
+
+    len = snprintf(line, sizeof(line), "%08x %s %ld\n", discid,
+                   CDDB_CATEGORY[cat], (long)time(NULL));
+    if (u->log_len + len > USAGE_LOG_BUF) {
+        cddb_usage_flush(u);
+    }
+    memcpy(u->log + u->log_len, line, len);
+    u->log_len += len;
+}
+
+
+/* --- construction / destruction */
+
+
+cddb_usage_t *cddb_usage_new(const char *dir)
+{
+    cddb_usage_t *u;
+
+    u = (cddb_usage_t*)calloc(1, sizeof(cddb_usage_t));
+    if (u) {
+        u->dir = strdup(dir);
+        u->size = USAGE_INITIAL_SIZE;
+        u->entries = (usage_entry_t*)malloc(u->size * sizeof(usage_entry_t));
+        u->buckets = (int*)malloc(u->size * sizeof(int));
+        if (!u->dir || !u->entries || !u->buckets) {
+            FREE_NOT_NULL(u->dir);
+            FREE_NOT_NULL(u->entries);
+            FREE_NOT_NULL(u->buckets);
+            free(u);
+            return NULL;
+        }
+        cddb_usage_reset(u);
+        u->log_len = 0;
+        u->scanning = FALSE;
+        u->changes = NULL;
+        u->change_cnt = u->change_max = 0;
+        u->built = NULL;
+        u->done = FALSE;
+        u->cancel = FALSE;
+#ifdef HAVE_PTHREAD
+        pthread_mutex_init(&u->lock, NULL);
+#endif
+    }
+    return u;
+}
+
+void cddb_usage_destroy(cddb_usage_t *u)
+{
+    if (u) {
+        if (u->scanning) {
+            /* stop building, the result is not needed */
+            USAGE_LOCK(u);
+            u->cancel = TRUE;
+            USAGE_UNLOCK(u);
+            cddb_usage_poll(u, TRUE);
+        }
+        cddb_usage_flush(u);
+#ifdef HAVE_PTHREAD
+        pthread_mutex_destroy(&u->lock);
+#endif
+        FREE_NOT_NULL(u->dir);
+        FREE_NOT_NULL(u->entries);
+        FREE_NOT_NULL(u->buckets);
+        FREE_NOT_NULL(u->changes);
+        free(u);
+    }
+}
+
+
+/* --- lookup and update --- */
+
+
+int cddb_usage_scan(cddb_usage_t *u)
+{
+    cddb_usage_t *t;
+
+    cddb_log_debug("cddb_usage_scan()");
+    cddb_usage_poll(u, TRUE);
+    t = cddb_usage_build(u);
+    if (!t) {
+        return FALSE;
+    }
+    cddb_usage_take(u, t);
+    return TRUE;
+}
+
+int cddb_usage_scan_start(cddb_usage_t *u)
+{
+    cddb_log_debug("cddb_usage_scan_start()");
+#ifdef HAVE_PTHREAD
+    if (u->scanning) {
+        return TRUE;
+    }
+    u->built = NULL;
+    u->done = FALSE;
+    u->cancel = FALSE;
+    if (pthread_create(&u->thread, NULL, cddb_usage_thread, u) == 0) {
+        u->scanning = TRUE;
+        return TRUE;
+    }
+#endif /* HAVE_PTHREAD */
+    return cddb_usage_scan(u);
+}
+
+int cddb_usage_ready(cddb_usage_t *u)
+{
+    cddb_usage_poll(u, FALSE);
+    return !u->scanning;
+}
+
+void cddb_usage_touch(cddb_usage_t *u, unsigned int discid, cddb_cat_t cat)
+{
+    cddb_usage_log(u, discid, cat);
+    if (!cddb_usage_ready(u)) {
+        cddb_usage_record(u, USAGE_TOUCH, discid, cat, 0);
+        return;
+    }
+    cddb_usage_move(u, discid, cat);
+}
+
+void cddb_usage_add(cddb_usage_t *u, unsigned int discid, cddb_cat_t cat,
+                    unsigned long size)
+{
+    cddb_usage_log(u, discid, cat);
+    if (!cddb_usage_ready(u)) {
+        cddb_usage_record(u, USAGE_ADD, discid, cat, size);
+        return;
+    }
+    cddb_usage_insert(u, discid, cat, size);
+}
+
+void cddb_usage_remove(cddb_usage_t *u, unsigned int discid, cddb_cat_t cat)
+{
+    if (!cddb_usage_ready(u)) {
+        cddb_usage_record(u, USAGE_REMOVE, discid, cat, 0);
+        return;
+    }
+    cddb_usage_delete(u, discid, cat);
+}
+
+int cddb_usage_oldest(cddb_usage_t *u, unsigned int *discid, cddb_cat_t *cat)
+{
+    if (!cddb_usage_ready(u) ||
+        (u->tail == USAGE_NONE) || (u->tail == u->head)) {
+        return FALSE;
+    }
+    *discid = u->entries[u->tail].discid;
+    *cat = u->entries[u->tail].cat;
+    return TRUE;
+}
+
+int cddb_usage_over(cddb_usage_t *u, unsigned long max_bytes,
+                    unsigned int max_count)
+{
+    if (!cddb_usage_ready(u)) {
+        /* nothing is known yet */
+        return FALSE;
+    }
+    return ((max_bytes && (u->bytes > max_bytes)) ||
+            (max_count && (u->count > max_count)));
+}
+
+void cddb_usage_flush(cddb_usage_t *u)
+{
+    char *fn;
+    FILE *fp;
+    int rv;
+
+    if (u->log_len == 0) {
+        return;
+    }
+    fn = cddb_usage_path(u->dir, USAGE_LOG_FILE);
+    fp = (fn ? fopen(fn, "a") : NULL);
+    rv = (fp != NULL);
+    if (fp) {
+        rv = (fwrite(u->log, 1, u->log_len, fp) == (size_t)u->log_len);
+        rv = (fclose(fp) == 0) && rv;
+    }
+    if (!rv) {
+        cddb_log_warn("cannot write cache access log '%s'", STR_OR_NULL(fn));
+    }
+    FREE_NOT_NULL(fn);
+    u->log_len = 0;
+}
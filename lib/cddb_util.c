@@ -24,6 +24,9 @@
 #ifdef HAVE_ERRNO_H
 #include <errno.h>
 #endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
@@ -70,6 +73,68 @@ int cddb_str_iconv(iconv_t cd, ICONV_CONST char *in, char **out)
     return TRUE;
 }
 
+int cddb_str_iconv_field(iconv_t cd, cddb_arena_t *a, char **s)
+{
+#ifdef HAVE_ICONV_H
+    ICONV_CONST char *in;
+    size_t inlen, outlen;
+    char *buf, *out;
+
+    if (!a) {
+        if (!cddb_str_iconv(cd, *s, &out)) {
+            return FALSE;
+        }
+        free(*s);
+        *s = out;
+        return TRUE;
+    }
+    /* convert straight into the arena, the result will nearly always
+       fit; if it does not, take the slow path */
+    in = *s;
+    inlen = strlen(in);
+    outlen = inlen * 4;
+    buf = out = cddb_arena_alloc(a, outlen + 1);
+    if (buf && (iconv(cd, &in, &inlen, &out, &outlen) != (size_t)-1)) {
+        *out = '\0';
+        cddb_arena_trim(a, buf, out - buf);
+        cddb_arena_str_free(a, s);
+        *s = buf;
+        return TRUE;
+    }
+    if (buf) {
+        if (errno != E2BIG) {
+            return FALSE;       /* conversion failed */
+        }
+        /* give back the space */
+        cddb_arena_str_free(a, &buf);
+    }
+    /* reset conversion state and start over */
+    iconv(cd, NULL, NULL, NULL, NULL);
+    if (!cddb_str_iconv(cd, *s, &out)) {
+        return FALSE;
+    }
+    cddb_arena_str_set(a, s, out);
+    free(out);
+#endif
+    return TRUE;
+}
+
+void cddb_str_append(char **dst, const char *src, int len)
+{
+    int old_len = 0;
+    char *s;
+
+    if (*dst) {
+        old_len = strlen(*dst);
+    }
+    s = (char*)realloc(*dst, old_len + len + 1);
+    if (s) {
+        memcpy(s + old_len, src, len);
+        s[old_len + len] = '\0';
+        *dst = s;
+    }
+}
+
 /* Base64 decoder ring */
 static char b64_vec[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/=";
 
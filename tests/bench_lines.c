@@ -0,0 +1,179 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+/*
+ * Benchmark of the record line scanners.  All records found in the
+ * directories given on the command line are loaded into one buffer,
+ * which is then split into lines over and over again by every line
+ * scanner the CPU supports.  The line-at-a-time search that the
+ * parser used before the line table was introduced is included as a
+ * reference.
+ */
+
+#include "cddb/cddb_ni.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/time.h>
+
+#define TABLE_SIZE DEFAULT_LINE_TABLE_SIZE
+#define MIN_TIME 0.5            /* seconds per scanner */
+
+static const char *scanners[] = { "scalar", "sse2", "avx2", NULL };
+
+static char *corpus = NULL;
+static int corpus_len = 0;
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Append one file to the corpus. */
+static void load_file(const char *path)
+{
+    FILE *f;
+    long size;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        return;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    corpus = realloc(corpus, corpus_len + size);
+    if (!corpus) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    corpus_len += fread(corpus + corpus_len, 1, size, f);
+    fclose(f);
+}
+
+/* Append all files in a directory and its subdirectories. */
+static void load_dir(const char *dir)
+{
+    DIR *d;
+    struct dirent *e;
+    char path[1024];
+
+    d = opendir(dir);
+    if (!d) {
+        /* not a directory, try it as a file */
+        load_file(dir);
+        return;
+    }
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        load_dir(path);
+    }
+    closedir(d);
+}
+
+/* Split the corpus with the current line scanner. */
+static int split_table(void)
+{
+    cddb_line_ref_t lines[TABLE_SIZE];
+    int pos, n, used, count = 0;
+
+    for (pos = 0; pos < corpus_len; pos += used) {
+        n = cddb_scan_lines(corpus + pos, corpus_len - pos,
+                            lines, TABLE_SIZE, &used);
+        if (n == 0) {
+            /* unterminated last line */
+            break;
+        }
+        count += n;
+    }
+    return count;
+}
+
+/* Split the corpus one line at a time. */
+static int split_memchr(void)
+{
+    const char *p, *end, *lf;
+    int count = 0;
+    volatile const char *eq;
+
+    p = corpus;
+    end = corpus + corpus_len;
+    while ((lf = memchr(p, CHR_LF, end - p)) != NULL) {
+        eq = memchr(p, '=', lf - p);
+        (void)eq;
+        count++;
+        p = lf + 1;
+    }
+    return count;
+}
+
+static void run(const char *name, int (*split)(void))
+{
+    double start, elapsed;
+    int i, lines = 0;
+
+    start = now();
+    i = 0;
+    do {
+        lines = split();
+        i++;
+        elapsed = now() - start;
+    } while (elapsed < MIN_TIME);
+    printf("%-8s %10.1f MB/s %12.0f lines/s\n", name,
+           (double)corpus_len * i / elapsed / (1024 * 1024),
+           (double)lines * i / elapsed);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s DIR...\n", argv[0]);
+        return 1;
+    }
+    for (i = 1; i < argc; i++) {
+        load_dir(argv[i]);
+    }
+    if (corpus_len == 0) {
+        fprintf(stderr, "no records found\n");
+        return 1;
+    }
+    printf("corpus: %d bytes, %d lines\n", corpus_len, split_memchr());
+    run("memchr", split_memchr);
+    for (i = 0; scanners[i]; i++) {
+        if (cddb_scan_lines_use(scanners[i])) {
+            run(scanners[i], split_table);
+        } else {
+            printf("%-8s not supported\n", scanners[i]);
+        }
+    }
+    free(corpus);
+    return 0;
+}
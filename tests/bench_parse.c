@@ -0,0 +1,538 @@
+/*
+    $Id$
+
+    Copyright (C) 2003, 2004, 2005 Kris Verbeeck <airborne@advalvas.be>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+    Boston, MA  02111-1307, USA.
+*/
+
+/*
+ * Benchmark of the CDDB record parser.  All records found in the
+ * directories given on the command line are loaded into memory and
+ * parsed over and over again with the push parser, which is what
+ * cddb_parse_record() and the cache use.  Files that are not CDDB
+ * records, like the expected results in tests/testdata, are skipped.
+ *
+ * Before timing, every record is parsed once with the built-in line
+ * scanner and once with the regular expression parser and both
+ * results are compared.  The program fails if they differ.
+ *
+ * Large synthetic records, 99 tracks with multi-line titles and
+ * extended data, can be added to the corpus for stress testing or
+ * written to a directory for use with the other tests.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <cddb/cddb.h>
+
+#ifndef TRUE
+#  define FALSE 0
+#  define TRUE  1
+#endif
+
+#define DEFAULT_PASSES 200
+#define SYNTH_TRACKS 99
+#define SYNTH_DISCID 0xbe000000
+#define MAX_LINE 256            /* maximum line length in a record */
+
+/**
+ * A record loaded into memory.
+ */
+typedef struct record_s
+{
+    char *name;                 /**< file name or synthetic record name */
+    char *buf;                  /**< contents */
+    int len;                    /**< length of the contents */
+} record_t;
+
+static record_t *records = NULL;
+static int nrecords = 0;
+static int skipped = 0;
+
+
+/* --- allocation counting --- */
+
+
+static long allocs = 0;
+
+#ifdef __GLIBC__
+/* The C library lets a program replace malloc() and friends; these
+   count all calls made by libcddb, including the ones done on its
+   behalf by strdup() and iconv. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    allocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    allocs++;
+    return __libc_realloc(ptr, size);
+}
+#  define HAVE_ALLOC_COUNT 1
+#endif /* __GLIBC__ */
+
+
+/* --- timing --- */
+
+
+static double now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return (x < y) ? -1 : (x > y);
+}
+
+
+/* --- corpus --- */
+
+
+static void add_record(const char *name, char *buf, int len)
+{
+    records = realloc(records, (nrecords + 1) * sizeof(record_t));
+    if (!records) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    records[nrecords].name = strdup(name);
+    records[nrecords].buf = buf;
+    records[nrecords].len = len;
+    nrecords++;
+}
+
+/* Load a file if it is a CDDB record. */
+static void load_file(const char *path)
+{
+    FILE *f;
+    struct stat st;
+    char *buf;
+    int len;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        return;
+    }
+    if ((fstat(fileno(f), &st) == -1) ||
+        !(buf = malloc(st.st_size + 1))) {
+        fclose(f);
+        return;
+    }
+    len = fread(buf, 1, st.st_size, f);
+    fclose(f);
+    buf[len] = '\0';
+    if (strncmp(buf, "# xmcd", 6) != 0) {
+        /* not a CDDB record */
+        free(buf);
+        skipped++;
+        return;
+    }
+    add_record(path, buf, len);
+}
+
+/* Load all records in a directory and its subdirectories. */
+static void load_dir(const char *dir)
+{
+    DIR *d;
+    struct dirent *e;
+    char path[1024];
+
+    d = opendir(dir);
+    if (!d) {
+        /* not a directory, try it as a file */
+        load_file(dir);
+        return;
+    }
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        load_dir(path);
+    }
+    closedir(d);
+}
+
+
+/* --- corpus generator --- */
+
+
+static unsigned int seed = 1;
+
+/* Small deterministic random generator, so that the synthetic corpus
+   is the same on every run and platform. */
+static int rnd(int n)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % n;
+}
+
+/**
+ * Append a multi-line field: the value is split over several lines of
+ * at most MAX_LINE characters, each starting with the keyword.  The
+ * first line starts with the given text.
+ */
+static int put_field(char *buf, const char *kw, int no, int nlines,
+                     const char *first)
+{
+    static const char *words[] = {
+        "lorem", "ipsum", "dolor", "sit", "amet", "consectetur",
+        "adipiscing", "elit", "sed", "do", "eiusmod", "tempor",
+        "incididunt", "ut", "labore", "et", "dolore", "magna", "aliqua"
+    };
+    char key[32];
+    int n = 0, i, len;
+
+    if (no >= 0) {
+        snprintf(key, sizeof(key), "%s%d=", kw, no);
+    } else {
+        snprintf(key, sizeof(key), "%s=", kw);
+    }
+    for (i = 0; i < nlines; i++) {
+        len = sprintf(buf + n, "%s%s", key, (i == 0) ? first : "");
+        do {
+            len += sprintf(buf + n + len, "%s ",
+                           words[rnd(sizeof(words) / sizeof(words[0]))]);
+        } while ((len < MAX_LINE - 16) && (rnd(12) != 0));
+        n += len;
+        buf[n++] = '\n';
+    }
+    return n;
+}
+
+/**
+ * Generate a large record with 99 tracks, multi-line track titles
+ * and several lines of extended data per track.
+ */
+static char *synth_record(int no, int *len)
+{
+    char *buf, first[64];
+    int n = 0, i;
+
+    buf = malloc(SYNTH_TRACKS * 16 * MAX_LINE + 64 * 1024);
+    if (!buf) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    n += sprintf(buf + n, "# xmcd\n#\n# Track frame offsets:\n");
+    for (i = 0; i < SYNTH_TRACKS; i++) {
+        n += sprintf(buf + n, "#\t%d\n", 150 + i * 2000);
+    }
+    n += sprintf(buf + n, "#\n# Disc length: %d seconds\n#\n"
+                 "# Revision: 0\n# Submitted via: bench_parse\n#\n"
+                 "DISCID=%08x\n", (150 + SYNTH_TRACKS * 2000) / 75 + 2,
+                 SYNTH_DISCID + no);
+    snprintf(first, sizeof(first), "Synthetic Artist %d / ", no);
+    n += put_field(buf + n, "DTITLE", -1, 2, first);
+    n += sprintf(buf + n, "DYEAR=%d\nDGENRE=Stress Test\n", 1990 + no % 20);
+    for (i = 0; i < SYNTH_TRACKS; i++) {
+        snprintf(first, sizeof(first), "Track Artist %d / ", i);
+        n += put_field(buf + n, "TTITLE", i, 1 + rnd(3), first);
+    }
+    n += put_field(buf + n, "EXTD", -1, 4 + rnd(8), "");
+    for (i = 0; i < SYNTH_TRACKS; i++) {
+        n += put_field(buf + n, "EXTT", i, 2 + rnd(8), "");
+    }
+    n += sprintf(buf + n, "PLAYORDER=\n");
+    *len = n;
+    return buf;
+}
+
+/* Write a record to the given cache directory. */
+static int write_record(const char *dir, int no, const char *buf, int len)
+{
+    char path[1024];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/misc", dir);
+    mkdir(dir, 0755);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/misc/%08x", dir, SYNTH_DISCID + no);
+    f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return FALSE;
+    }
+    if (fwrite(buf, 1, len, f) != len) {
+        perror(path);
+        fclose(f);
+        return FALSE;
+    }
+    fclose(f);
+    return TRUE;
+}
+
+
+/* --- parsing --- */
+
+
+/**
+ * Parse a record into a new disc.
+ *
+ * @return The disc or NULL if the record is invalid.
+ */
+static cddb_disc_t *parse(const record_t *r, int arena)
+{
+    cddb_disc_t *disc;
+    cddb_parser_t *p;
+    int ok;
+
+    disc = (arena ? cddb_disc_new_arena() : cddb_disc_new());
+    p = cddb_parser_new(disc);
+    ok = (cddb_parser_feed(p, r->buf, r->len) >= 0) &&
+         cddb_parser_finish(p);
+    cddb_parser_destroy(p);
+    if (!ok) {
+        cddb_disc_destroy(disc);
+        return NULL;
+    }
+    return disc;
+}
+
+static unsigned int hash_str(unsigned int h, const char *s)
+{
+    /* FNV-1a, NULL and empty strings differ */
+    if (!s) {
+        return h * 16777619;
+    }
+    do {
+        h = (h ^ (unsigned char)*s) * 16777619;
+    } while (*s++);
+    return h;
+}
+
+/* Hash of all fields of a parsed disc. */
+static unsigned int hash_disc(cddb_disc_t *disc)
+{
+    cddb_track_t *t;
+    unsigned int h = 2166136261u;
+
+    if (!disc) {
+        return 0;
+    }
+    h = (h ^ cddb_disc_get_length(disc)) * 16777619;
+    h = (h ^ cddb_disc_get_revision(disc)) * 16777619;
+    h = (h ^ cddb_disc_get_year(disc)) * 16777619;
+    h = hash_str(h, cddb_disc_get_artist(disc));
+    h = hash_str(h, cddb_disc_get_title(disc));
+    h = hash_str(h, cddb_disc_get_genre(disc));
+    h = hash_str(h, cddb_disc_get_ext_data(disc));
+    for (t = cddb_disc_get_track_first(disc); t;
+         t = cddb_disc_get_track_next(disc)) {
+        h = (h ^ cddb_track_get_frame_offset(t)) * 16777619;
+        h = hash_str(h, cddb_track_get_artist(t));
+        h = hash_str(h, cddb_track_get_title(t));
+        h = hash_str(h, cddb_track_get_ext_data(t));
+    }
+    return h;
+}
+
+/**
+ * Parse every record with both parsers and compare the results.
+ *
+ * @return The number of records that differ.
+ */
+static int check(void)
+{
+    cddb_disc_t *disc;
+    unsigned int h;
+    int i, bad = 0;
+
+    for (i = 0; i < nrecords; i++) {
+        libcddb_reset_flags(CDDB_F_REGEX_PARSER);
+        disc = parse(records + i, FALSE);
+        h = hash_disc(disc);
+        cddb_disc_destroy(disc);
+        libcddb_set_flags(CDDB_F_REGEX_PARSER);
+        disc = parse(records + i, FALSE);
+        if (hash_disc(disc) != h) {
+            fprintf(stderr, "%s: parsers disagree\n", records[i].name);
+            bad++;
+        }
+        cddb_disc_destroy(disc);
+    }
+    libcddb_reset_flags(CDDB_F_REGEX_PARSER);
+    return bad;
+}
+
+static void run(const char *name, int passes, int arena)
+{
+    double *lat, start, t, elapsed;
+    long bytes = 0, a;
+    int i, k, n = 0, invalid = 0;
+
+    lat = malloc(passes * nrecords * sizeof(double));
+    if (!lat) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    a = allocs;
+    start = now();
+    for (k = 0; k < passes; k++) {
+        for (i = 0; i < nrecords; i++) {
+            cddb_disc_t *disc;
+
+            t = now();
+            disc = parse(records + i, arena);
+            cddb_disc_destroy(disc);
+            lat[n++] = now() - t;
+            bytes += records[i].len;
+            invalid += !disc;
+        }
+    }
+    elapsed = now() - start;
+    a = allocs - a;
+    qsort(lat, n, sizeof(double), cmp_double);
+    printf("%-12s %9.0f rec/s %7.1f MB/s", name, n / elapsed,
+           bytes / elapsed / (1024 * 1024));
+#ifdef HAVE_ALLOC_COUNT
+    printf(" %8.1f allocs/rec", (double)a / n);
+#endif
+    printf("   p50 %7.1f us   p99 %7.1f us\n",
+           lat[n / 2] * 1e6, lat[(n * 99) / 100] * 1e6);
+    if (invalid > 0) {
+        printf("%-12s %d of %d parses failed\n", "", invalid, n);
+    }
+    free(lat);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-n PASSES] [-s COUNT] [-w DIR] [DIR|FILE]...\n"
+            "  -n PASSES  number of passes over the corpus (default %d)\n"
+            "  -s COUNT   add COUNT synthetic %d-track records\n"
+            "  -w DIR     write the synthetic records to the cache\n"
+            "             directory DIR and exit\n",
+            prog, DEFAULT_PASSES, SYNTH_TRACKS);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *out = NULL;
+    char *buf, name[32];
+    int passes = DEFAULT_PASSES, synth = 0;
+    int opt, i, len;
+    long bytes = 0;
+
+    while ((opt = getopt(argc, argv, "n:s:w:")) != -1) {
+        switch (opt) {
+        case 'n':
+            passes = atoi(optarg);
+            break;
+        case 's':
+            synth = atoi(optarg);
+            break;
+        case 'w':
+            out = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if ((passes <= 0) || ((optind == argc) && (synth <= 0))) {
+        usage(argv[0]);
+    }
+
+    libcddb_init();
+    /* no log messages about invalid test records */
+    cddb_log_set_level(CDDB_LOG_CRITICAL);
+
+    for (i = 0; i < synth; i++) {
+        buf = synth_record(i, &len);
+        if (out) {
+            if (!write_record(out, i, buf, len)) {
+                return 1;
+            }
+            free(buf);
+        } else {
+            snprintf(name, sizeof(name), "synthetic %d", i);
+            add_record(name, buf, len);
+        }
+    }
+    if (out) {
+        printf("%d records written to %s\n", synth, out);
+        return 0;
+    }
+    for (i = optind; i < argc; i++) {
+        load_dir(argv[i]);
+    }
+    if (nrecords == 0) {
+        fprintf(stderr, "no records found\n");
+        return 1;
+    }
+    for (i = 0; i < nrecords; i++) {
+        bytes += records[i].len;
+    }
+    printf("corpus: %d records, %ld bytes (%d other files skipped)\n",
+           nrecords, bytes, skipped);
+
+    if (check() > 0) {
+        return 1;
+    }
+
+    run("scan", passes, FALSE);
+    run("scan+arena", passes, TRUE);
+    libcddb_set_flags(CDDB_F_REGEX_PARSER);
+    run("regex", passes, FALSE);
+    libcddb_reset_flags(CDDB_F_REGEX_PARSER);
+
+    for (i = 0; i < nrecords; i++) {
+        free(records[i].name);
+        free(records[i].buf);
+    }
+    free(records);
+    libcddb_shutdown();
+    return 0;
+}
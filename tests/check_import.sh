@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+# $Id$
+
+. ./settings.sh
+
+# This script checks importing a database dump into the local cache.
+# A small dump is built from the test cache, imported into a fresh
+# cache directory with both backends and read back from there.
+
+# Create/clear cache
+CACHE="./tmpimport"
+DUMP="./tmpdump.tar"
+rm -rf $CACHE $DUMP > /dev/null 2>&1
+(cd $CDDB_CACHE && tar cf - misc) > $DUMP
+
+IDS='12345674 12345675 12345676 12345677 12345678 12345679 1234567a
+     1234567b 1234567c 1234567d 1234567e 1234567f 12345680 12345681
+     12345682 12345683'
+
+# check_count <rv> <name> <expected>: check a counter of the import report
+check_count()
+{
+    RV=$1
+    NAME=$2
+    EXP_CNT=$3
+    if [ ${RV} -ne 0 ]; then
+        fail 'cddb_import failed'
+        return
+    fi
+    CNT=`sed "/^${NAME}: */!d;s/^${NAME}: *//" $TMP_FILE`
+    if [ ${CNT}x != ${EXP_CNT}x ]; then
+        fail "$CNT records $NAME, $EXP_CNT expected"
+        return
+    fi
+    success
+}
+
+for backend in dir pack ; do
+    rm -rf $CACHE > /dev/null 2>&1
+
+    # the charset test record has no disc data and is rejected
+    start_test 'Check dump import ('${backend}')'
+    $CDDB_IMPORT -b $backend -D $CACHE $DUMP > $TMP_FILE
+    check_count $? added 16
+    PRV_RESULT=${RESULT}
+
+    for id in $IDS ; do
+        start_test 'Check imported read for '${id}' ('${backend}')'
+        if test ${PRV_RESULT} -eq ${FAILURE}; then
+            skip 'import failed'
+        else
+            cddb_query -b $backend -c only -D $CACHE read misc $id
+            check_read $? $id
+        fi
+    done
+
+    start_test 'Check rejected record read ('${backend}')'
+    cddb_query -b $backend -c only -D $CACHE read misc 12340000
+    check_not_found $? 12340000
+
+    # importing again from standard input finds all records cached
+    start_test 'Check second dump import ('${backend}')'
+    $CDDB_IMPORT -b $backend -D $CACHE < $DUMP > $TMP_FILE
+    check_count $? existing 16
+done
+
+# Remove cache and dump
+rm -rf $CACHE $DUMP > /dev/null 2>&1
+
+#
+# Print results and exit accordingly
+#
+finalize
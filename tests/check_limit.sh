@@ -0,0 +1,63 @@
+#!/bin/sh
+#
+# $Id$
+
+. ./settings.sh
+
+# This script checks that a limited local cache removes its least
+# recently used records.  The records of the test cache are given an
+# access time in a known order, then one more record is imported with
+# a limit on the number of records.
+
+# Create/clear cache
+CACHE="./tmplimit"
+DUMP="./tmplimit.tar"
+rm -rf $CACHE $DUMP > /dev/null 2>&1
+mkdir $CACHE
+cp -r $CDDB_CACHE/misc $CACHE/
+rm -f $CACHE/misc/12340000 $CACHE/misc/12345683
+(cd $CDDB_CACHE && tar cf - misc/12345683) > $DUMP
+
+# least recently used first, not in the order of the file names
+OLD='1234567c 12345675 12345681 1234567f 12345677 12345679'
+NEW='12345674 1234567a 12345676 12345682 1234567b 12345678 1234567e
+     12345680 1234567d'
+MIN=10
+for id in $OLD $NEW ; do
+    touch -t 2001010100${MIN} $CACHE/misc/$id
+    MIN=`expr $MIN + 1`
+done
+
+# 15 records cached plus 1 imported, limited to 10
+start_test 'Check import with record limit'
+$CDDB_IMPORT -m 10 -D $CACHE $DUMP > $TMP_FILE
+if [ $? -ne 0 ]; then
+    fail 'cddb_import failed'
+else
+    CNT=`sed '/^removed: */!d;s/^removed: *//' $TMP_FILE`
+    if [ ${CNT}x != 6x ]; then
+        fail "$CNT records removed, 6 expected"
+    else
+        success
+    fi
+fi
+
+for id in $OLD ; do
+    start_test 'Check removed record '${id}
+    cddb_query -c only -D $CACHE read misc $id
+    check_not_found $? $id
+done
+
+for id in $NEW 12345683 ; do
+    start_test 'Check kept record '${id}
+    cddb_query -c only -D $CACHE read misc $id
+    check_read $? $id
+done
+
+# Remove cache and dump
+rm -rf $CACHE $DUMP > /dev/null 2>&1
+
+#
+# Print results and exit accordingly
+#
+finalize
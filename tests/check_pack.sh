@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# $Id$
+
+. ./settings.sh
+
+# This script checks the packed cache backend.  The entries of the
+# test cache are copied into the packed data file of a fresh cache
+# directory.  The record files are then removed, so that they can only
+# be read back through the packed store.
+
+# Create/clear cache
+CACHE="./tmppack"
+rm -rf $CACHE > /dev/null 2>&1
+mkdir $CACHE
+cp -r $CDDB_CACHE/misc $CACHE/
+
+IDS='12345674 12345675 12345676 12345677 12345678 12345679 1234567a
+     1234567b 1234567c 1234567d 1234567e 1234567f 12345680 12345681
+     12345682 12345683'
+
+# convert the record files
+start_test 'Check conversion to packed store'
+$CDDB_IMPORT -C -D $CACHE > $TMP_FILE
+if [ $? -ne 0 ]; then
+    fail 'cddb_import failed'
+else
+    CNT=`sed '/^copied: */!d;s/^copied: *//' $TMP_FILE`
+    if [ ${CNT}x != 17x ]; then
+        fail "$CNT records copied, 17 expected"
+    else
+        success
+    fi
+fi
+PRV_RESULT=${RESULT}
+rm -rf $CACHE/misc
+
+# read every entry from the packed store
+for id in $IDS ; do
+    start_test 'Check packed store read for '${id}
+    if test ${PRV_RESULT} -eq ${FAILURE}; then
+        skip 'conversion failed'
+    else
+        cddb_query -b pack -c only -D $CACHE read misc $id
+        check_read $? $id
+    fi
+done
+
+# the directory backend does not see the packed records
+start_test 'Check directory backend read after conversion'
+cddb_query -b dir -c only -D $CACHE read misc 12345678
+check_not_found $? 12345678
+
+# converting again does not copy anything
+start_test 'Check second conversion'
+cp -r $CDDB_CACHE/misc $CACHE/
+$CDDB_IMPORT -C -D $CACHE > $TMP_FILE
+if [ $? -ne 0 ]; then
+    fail 'cddb_import failed'
+else
+    CNT=`sed '/^copied: */!d;s/^copied: *//' $TMP_FILE`
+    if [ ${CNT}x != 0x ]; then
+        fail "$CNT records copied, none expected"
+    else
+        success
+    fi
+fi
+
+# Remove cache
+rm -rf $CACHE > /dev/null 2>&1
+
+#
+# Print results and exit accordingly
+#
+finalize
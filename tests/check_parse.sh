@@ -6,14 +6,23 @@
 
 # Test parsing of some locally cached entries.  These entries are
 # designed to test the parsing of all supported fields.  Mutli-line
-# fields are also tested in every possible way.
+# fields are also tested in every possible way.  The built-in line
+# scanner, the regular expression parser and lazy decoding are
+# checked.
 
-for id in 12345674 12345675 12345676 12345677 \
-          12345678 12345679 1234567a 1234567b 1234567c 1234567d \
-          1234567e 1234567f 12345680 12345681 12345682 12345683 ; do
-    start_test 'Check parsing for '${id}
-    cddb_query -c only -D $CDDB_CACHE read misc $id
-    check_read $? $id
+for parser in scan regex lazy ; do
+    case $parser in
+        regex) OPT='-r' ;;
+        lazy)  OPT='-L' ;;
+        *)     OPT='' ;;
+    esac
+    for id in 12345674 12345675 12345676 12345677 \
+              12345678 12345679 1234567a 1234567b 1234567c 1234567d \
+              1234567e 1234567f 12345680 12345681 12345682 12345683 ; do
+        start_test 'Check parsing for '${id}' ('${parser}')'
+        cddb_query $OPT -c only -D $CDDB_CACHE read misc $id
+        check_read $? $id
+    done
 done
 
 #